@@ -0,0 +1,346 @@
+#ifdef TRACK_ALLOCATIONS
+#ifdef _WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#endif
+#endif
+
+#include <algorithm>
+#include <new>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "allocation_tracker.hpp"
+#include "foreach.hpp"
+#include "formula.hpp"
+#include "variant.hpp"
+
+namespace allocation_tracker
+{
+
+#ifdef TRACK_ALLOCATIONS
+
+namespace {
+
+#if defined(_MSC_VER)
+#define TRACKER_THREAD_LOCAL __declspec(thread)
+#else
+#define TRACKER_THREAD_LOCAL __thread
+#endif
+
+TRACKER_THREAD_LOCAL const char* current_scope = NULL;
+TRACKER_THREAD_LOCAL bool is_main_thread = false;
+
+//set while a site's location is being recorded, which allocates.
+TRACKER_THREAD_LOCAL bool recording_site = false;
+
+void atomic_add(volatile int& value, int amount)
+{
+#ifdef _WINDOWS
+	InterlockedExchangeAdd(reinterpret_cast<volatile LONG*>(&value), amount);
+#else
+	__sync_fetch_and_add(&value, amount);
+#endif
+}
+
+//counts for the frame in progress, which any thread can add to.
+volatile int frame_allocations = 0, frame_frees = 0, frame_bytes = 0;
+
+const int FrameHistorySize = 100;
+frame_stats frame_history[FrameHistorySize];
+int nframes = 0;
+
+//the frame the sites were last reset on.
+int reset_frame = 0;
+
+//the sites are kept in a fixed size hash table, since we can't allocate
+//while recording an allocation. Only the main thread uses it.
+struct site_record {
+	const char* scope;
+	const game_logic::formula_expression* expression;
+
+	//where the expression is, found when the site is first seen, since
+	//expressions such as those run from the debug console may be freed
+	//before the summary is made.
+	const std::string* location;
+	int allocations, bytes;
+};
+
+const unsigned int SiteTableSize = 4096;
+site_record site_table[SiteTableSize];
+
+//allocations from sites which didn't fit in the table.
+int overflow_allocations = 0, overflow_bytes = 0;
+
+void record_site(size_t size)
+{
+	const std::vector<const game_logic::formula_expression*>& stack = get_expression_call_stack();
+	const game_logic::formula_expression* expression = stack.empty() ? NULL : stack.back();
+
+	const size_t hash = (reinterpret_cast<size_t>(current_scope)*31) ^ (reinterpret_cast<size_t>(expression) >> 3);
+	for(unsigned int n = 0; n != 16; ++n) {
+		site_record& s = site_table[(hash + n)%SiteTableSize];
+		if(s.allocations == 0) {
+			s.scope = current_scope;
+			s.expression = expression;
+			if(expression) {
+				recording_site = true;
+				s.location = new std::string(expression->debug_pinpoint_location());
+				recording_site = false;
+			}
+		} else if(s.scope != current_scope || s.expression != expression) {
+			continue;
+		}
+
+		s.allocations++;
+		s.bytes += size;
+		return;
+	}
+
+	overflow_allocations++;
+	overflow_bytes += size;
+}
+
+void record_allocation(size_t size)
+{
+	atomic_add(frame_allocations, 1);
+	atomic_add(frame_bytes, size);
+	if(is_main_thread && !recording_site) {
+		record_site(size);
+	}
+}
+
+void* allocate(size_t size)
+{
+	void* result = malloc(size ? size : 1);
+	if(result) {
+		record_allocation(size);
+	}
+
+	return result;
+}
+
+void deallocate(void* p)
+{
+	if(p) {
+		atomic_add(frame_frees, 1);
+		free(p);
+	}
+}
+
+bool site_greater(const site& a, const site& b)
+{
+	return a.allocations > b.allocations;
+}
+}
+
+bool enabled()
+{
+	return true;
+}
+
+const char* set_scope(const char* scope)
+{
+	const char* result = current_scope;
+	current_scope = scope;
+	return result;
+}
+
+void end_frame()
+{
+	is_main_thread = true;
+
+	frame_stats& stats = frame_history[nframes%FrameHistorySize];
+	stats.allocations = frame_allocations;
+	stats.frees = frame_frees;
+	stats.bytes = frame_bytes;
+	atomic_add(frame_allocations, -stats.allocations);
+	atomic_add(frame_frees, -stats.frees);
+	atomic_add(frame_bytes, -stats.bytes);
+	++nframes;
+}
+
+summary get_summary(int nsites)
+{
+	summary result;
+	result.nframes = nframes - reset_frame;
+
+	const int nhistory = std::min(nframes, FrameHistorySize);
+	for(int n = 0; n != nhistory; ++n) {
+		const frame_stats& stats = frame_history[n];
+		result.mean.allocations += stats.allocations;
+		result.mean.frees += stats.frees;
+		result.mean.bytes += stats.bytes;
+		result.worst.allocations = std::max(result.worst.allocations, stats.allocations);
+		result.worst.frees = std::max(result.worst.frees, stats.frees);
+		result.worst.bytes = std::max(result.worst.bytes, stats.bytes);
+	}
+
+	if(nhistory) {
+		result.last = frame_history[(nframes - 1)%FrameHistorySize];
+		result.mean.allocations /= nhistory;
+		result.mean.frees /= nhistory;
+		result.mean.bytes /= nhistory;
+	}
+
+	//copy the table first, since making the strings will allocate.
+	std::vector<site_record> records;
+	for(unsigned int n = 0; n != SiteTableSize; ++n) {
+		if(site_table[n].allocations) {
+			records.push_back(site_table[n]);
+		}
+	}
+
+	foreach(const site_record& r, records) {
+		site s;
+		s.scope = r.scope ? r.scope : "(none)";
+		s.expression = r.location ? *r.location : "";
+		s.allocations = r.allocations;
+		s.bytes = r.bytes;
+		result.sites.push_back(s);
+	}
+
+	if(overflow_allocations) {
+		site s;
+		s.scope = "(other sites)";
+		s.allocations = overflow_allocations;
+		s.bytes = overflow_bytes;
+		result.sites.push_back(s);
+	}
+
+	std::sort(result.sites.begin(), result.sites.end(), site_greater);
+	if(int(result.sites.size()) > nsites) {
+		result.sites.resize(nsites);
+	}
+
+	return result;
+}
+
+void reset()
+{
+	for(unsigned int n = 0; n != SiteTableSize; ++n) {
+		site_table[n].allocations = 0;
+		site_table[n].bytes = 0;
+		delete site_table[n].location;
+		site_table[n].location = NULL;
+	}
+
+	overflow_allocations = overflow_bytes = 0;
+	reset_frame = nframes;
+}
+
+#else
+
+bool enabled()
+{
+	return false;
+}
+
+const char* set_scope(const char* scope)
+{
+	return NULL;
+}
+
+void end_frame()
+{
+}
+
+summary get_summary(int nsites)
+{
+	summary result;
+	result.nframes = 0;
+	return result;
+}
+
+void reset()
+{
+}
+
+#endif
+
+std::string get_summary_text(int nsites)
+{
+	if(!enabled()) {
+		return "ALLOCATION TRACKING IS NOT BUILT IN. BUILD WITH TRACK_ALLOCATIONS\n";
+	}
+
+	const summary info = get_summary(nsites);
+
+	std::ostringstream s;
+	char buf[1024];
+	sprintf(buf, "ALLOCATIONS PER FRAME: LAST %d (%d bytes), MEAN %d (%d bytes), WORST %d (%d bytes)\n",
+	        info.last.allocations, info.last.bytes, info.mean.allocations, info.mean.bytes, info.worst.allocations, info.worst.bytes);
+	s << buf;
+
+	foreach(const site& site, info.sites) {
+		sprintf(buf, "  %9d allocs %11d bytes %7.1f/frame  %s %s\n", site.allocations, site.bytes, info.nframes ? double(site.allocations)/info.nframes : 0.0, site.scope.c_str(), site.expression.c_str());
+		s << buf;
+	}
+
+	return s.str();
+}
+
+}
+
+#ifdef TRACK_ALLOCATIONS
+
+#if __cplusplus >= 201103L
+#define THROW_BAD_ALLOC
+#define THROW_NOTHING noexcept
+#else
+#define THROW_BAD_ALLOC throw(std::bad_alloc)
+#define THROW_NOTHING throw()
+#endif
+
+void* operator new(size_t size) THROW_BAD_ALLOC
+{
+	void* result = allocation_tracker::allocate(size);
+	if(!result) {
+		throw std::bad_alloc();
+	}
+
+	return result;
+}
+
+void* operator new[](size_t size) THROW_BAD_ALLOC
+{
+	void* result = allocation_tracker::allocate(size);
+	if(!result) {
+		throw std::bad_alloc();
+	}
+
+	return result;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) THROW_NOTHING
+{
+	return allocation_tracker::allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) THROW_NOTHING
+{
+	return allocation_tracker::allocate(size);
+}
+
+void operator delete(void* p) THROW_NOTHING
+{
+	allocation_tracker::deallocate(p);
+}
+
+void operator delete[](void* p) THROW_NOTHING
+{
+	allocation_tracker::deallocate(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) THROW_NOTHING
+{
+	allocation_tracker::deallocate(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) THROW_NOTHING
+{
+	allocation_tracker::deallocate(p);
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef ALLOCATION_TRACKER_HPP_INCLUDED
+#define ALLOCATION_TRACKER_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+
+//When built with TRACK_ALLOCATIONS, the global operator new and delete are
+//replaced with ones which count every allocation, and on the main thread
+//attribute it to the formula_profiler instrument and FFL expression it was
+//made in. Without it, nothing is counted.
+namespace allocation_tracker
+{
+
+bool enabled();
+
+//sets the scope allocations on this thread are attributed to, returning
+//the previous one. Used by formula_profiler::instrument.
+const char* set_scope(const char* scope);
+
+//should be called at the end of each frame from the main thread. The
+//thread it's called from is taken to be the main thread.
+void end_frame();
+
+struct frame_stats {
+	frame_stats() : allocations(0), frees(0), bytes(0)
+	{}
+	int allocations, frees, bytes;
+};
+
+//somewhere allocations are made: an instrument scope and, if FFL was
+//being evaluated, the innermost FFL expression.
+struct site {
+	std::string scope, expression;
+	int allocations, bytes;
+};
+
+struct summary {
+	//frames since the last reset.
+	int nframes;
+
+	//the last frame, and the mean and worst of the recent frames.
+	frame_stats last, mean, worst;
+
+	//the sites which have allocated the most since the last reset.
+	std::vector<site> sites;
+};
+
+summary get_summary(int nsites);
+std::string get_summary_text(int nsites);
+
+void reset();
+
+}
+
+#endif
@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <map>
+
+#include <boost/weak_ptr.hpp>
+
+#include "alpha_mask.hpp"
+#include "asserts.hpp"
+#include "thread.hpp"
+#include "unit_test.hpp"
+
+namespace {
+//gets 64 bits of a row, starting at bit 'pos', which may be negative.
+//Bits outside of the row are zero.
+uint64_t get_bits(const uint64_t* row, int nwords, int pos)
+{
+	if(pos < 0) {
+		if(pos <= -64) {
+			return 0;
+		}
+
+		return row[0] << -pos;
+	}
+
+	const int index = pos >> 6;
+	const int shift = pos&63;
+	if(index >= nwords) {
+		return 0;
+	}
+
+	uint64_t result = row[index] >> shift;
+	if(shift && index+1 < nwords) {
+		result |= row[index+1] << (64 - shift);
+	}
+
+	return result;
+}
+
+typedef std::multimap<size_t, boost::weak_ptr<const alpha_mask> > mask_cache_map;
+
+threading::mutex& mask_cache_mutex()
+{
+	static threading::mutex* instance = new threading::mutex;
+	return *instance;
+}
+
+mask_cache_map& mask_cache()
+{
+	static mask_cache_map* instance = new mask_cache_map;
+	return *instance;
+}
+}
+
+alpha_mask::alpha_mask(int w, int h)
+  : w_(w), h_(h), words_per_row_((w + 63)/64),
+    rows_(words_per_row_*h), spans_(h*2), hash_(0)
+{
+	ASSERT_GE(w, 0);
+	ASSERT_GE(h, 0);
+}
+
+void alpha_mask::set_opaque(int x, int y)
+{
+	ASSERT_LOG(x >= 0 && y >= 0 && x < w_ && y < h_, "ILLEGAL ALPHA MASK POSITION: " << x << ", " << y << " IN " << w_ << "x" << h_);
+	rows_[y*words_per_row_ + (x >> 6)] |= uint64_t(1) << (x&63);
+}
+
+void alpha_mask::finish()
+{
+	mirrored_rows_.assign(rows_.size(), 0);
+
+	int x1 = w_, y1 = h_, x2 = 0, y2 = 0;
+	hash_ = w_*31 + h_;
+	for(int y = 0; y != h_; ++y) {
+		const uint64_t* row = &rows_[0] + y*words_per_row_;
+		uint64_t* mirrored = &mirrored_rows_[0] + y*words_per_row_;
+
+		int begin = -1, end = 0;
+		for(int x = 0; x != w_; ++x) {
+			if((row[x >> 6] >> (x&63))&1) {
+				const int m = w_ - x - 1;
+				mirrored[m >> 6] |= uint64_t(1) << (m&63);
+				if(begin == -1) {
+					begin = x;
+				}
+
+				end = x + 1;
+			}
+		}
+
+		for(int n = 0; n != words_per_row_; ++n) {
+			hash_ = hash_*1000003 ^ size_t(row[n] ^ (row[n] >> 32));
+		}
+
+		if(begin == -1) {
+			spans_[y*2] = spans_[y*2+1] = 0;
+			continue;
+		}
+
+		spans_[y*2] = begin;
+		spans_[y*2+1] = end;
+
+		x1 = std::min(x1, begin);
+		x2 = std::max(x2, end);
+		y1 = std::min(y1, y);
+		y2 = y + 1;
+	}
+
+	if(x2 > x1) {
+		opaque_area_ = rect(x1, y1, x2 - x1, y2 - y1);
+	} else {
+		opaque_area_ = rect();
+	}
+}
+
+void alpha_mask::extract_row(int y, int begin, int count, bool mirrored, uint64_t* out) const
+{
+	const int nwords = (count + 63)/64;
+	std::fill(out, out + nwords, 0);
+
+	if(y < 0 || y >= h_ || count <= 0) {
+		return;
+	}
+
+	int span_begin = row_begin(y), span_end = row_end(y);
+	if(mirrored) {
+		span_begin = w_ - row_end(y);
+		span_end = w_ - row_begin(y);
+	}
+
+	if(span_begin == span_end || begin >= span_end || begin + count <= span_begin) {
+		return;
+	}
+
+	const uint64_t* row = &(mirrored ? mirrored_rows_ : rows_)[0] + y*words_per_row_;
+	for(int n = 0; n != nwords; ++n) {
+		out[n] = get_bits(row, words_per_row_, begin + n*64);
+	}
+
+	if(count&63) {
+		out[nwords-1] &= (uint64_t(1) << (count&63)) - 1;
+	}
+}
+
+bool alpha_mask::operator==(const alpha_mask& o) const
+{
+	return w_ == o.w_ && h_ == o.h_ && hash_ == o.hash_ && rows_ == o.rows_;
+}
+
+const_alpha_mask_ptr share_alpha_mask(alpha_mask* mask_ptr)
+{
+	const_alpha_mask_ptr mask(mask_ptr);
+
+	threading::lock lck(mask_cache_mutex());
+	mask_cache_map& cache = mask_cache();
+	std::pair<mask_cache_map::iterator, mask_cache_map::iterator> range = cache.equal_range(mask->hash());
+	while(range.first != range.second) {
+		const_alpha_mask_ptr existing = range.first->second.lock();
+		if(!existing) {
+			cache.erase(range.first++);
+			continue;
+		}
+
+		if(*existing == *mask) {
+			return existing;
+		}
+
+		++range.first;
+	}
+
+	cache.insert(std::pair<size_t, boost::weak_ptr<const alpha_mask> >(mask->hash(), mask));
+	return mask;
+}
+
+bool bits_intersect(const uint64_t* a, const uint64_t* b, int nwords)
+{
+	for(int n = 0; n != nwords; ++n) {
+		if(a[n]&b[n]) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+UNIT_TEST(alpha_mask_extract)
+{
+	alpha_mask* mask = new alpha_mask(100, 3);
+	mask->set_opaque(0, 0);
+	mask->set_opaque(63, 1);
+	mask->set_opaque(64, 1);
+	mask->set_opaque(99, 1);
+	mask->finish();
+
+	CHECK_EQ(mask->opaque_area(), rect(0, 0, 100, 2));
+	CHECK_EQ(mask->row_begin(1), 63);
+	CHECK_EQ(mask->row_end(1), 100);
+	CHECK_EQ(mask->row_begin(2), mask->row_end(2));
+
+	uint64_t bits[2];
+	mask->extract_row(1, 60, 8, false, bits);
+	CHECK_EQ(bits[0], 0x18);
+
+	mask->extract_row(1, 0, 100, true, bits);
+	CHECK_EQ(bits[0], (uint64_t(1) << 35) | (uint64_t(1) << 36) | 1);
+	CHECK_EQ(bits[1], 0);
+
+	mask->extract_row(0, -3, 4, false, bits);
+	CHECK_EQ(bits[0], 0x8);
+
+	mask->extract_row(2, 0, 100, false, bits);
+	CHECK_EQ(bits[0], 0);
+
+	alpha_mask* copy = new alpha_mask(*mask);
+	const_alpha_mask_ptr shared = share_alpha_mask(mask);
+	CHECK_EQ(share_alpha_mask(copy).get(), shared.get());
+}
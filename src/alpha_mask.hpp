@@ -0,0 +1,70 @@
+#ifndef ALPHA_MASK_HPP_INCLUDED
+#define ALPHA_MASK_HPP_INCLUDED
+
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "geometry.hpp"
+
+//A bitmap of which pixels in an image are opaque, stored as rows of
+//64-bit words so that collision tests can be done a word at a time.
+//We also store a mirrored copy of every row, so that tests against
+//frames that are facing left don't have to reverse bits.
+class alpha_mask
+{
+public:
+	//create a mask of the given size with every pixel transparent.
+	alpha_mask(int w, int h);
+
+	int width() const { return w_; }
+	int height() const { return h_; }
+
+	void set_opaque(int x, int y);
+
+	//must be called once the mask has been filled in, before it's used.
+	void finish();
+
+	bool is_opaque(int x, int y) const {
+		return (rows_[y*words_per_row_ + (x >> 6)] >> (x&63))&1;
+	}
+
+	//the smallest rectangle containing every opaque pixel. Empty if the
+	//mask has no opaque pixels.
+	const rect& opaque_area() const { return opaque_area_; }
+
+	//the opaque pixels in row y are all in [row_begin(y), row_end(y)).
+	int row_begin(int y) const { return spans_[y*2]; }
+	int row_end(int y) const { return spans_[y*2+1]; }
+
+	//extract the bits for pixels [begin, begin+count) of row y into 'out',
+	//which must have room for (count+63)/64 words. Pixels that are outside
+	//the mask are given as transparent. If mirrored is true the row is read
+	//from right to left, with pixel 0 being the last pixel in the row.
+	void extract_row(int y, int begin, int count, bool mirrored, uint64_t* out) const;
+
+	size_t hash() const { return hash_; }
+	bool operator==(const alpha_mask& o) const;
+	bool operator!=(const alpha_mask& o) const { return !(*this == o); }
+
+private:
+	int w_, h_;
+	int words_per_row_;
+	std::vector<uint64_t> rows_, mirrored_rows_;
+	std::vector<int> spans_;
+	rect opaque_area_;
+	size_t hash_;
+};
+
+typedef boost::shared_ptr<const alpha_mask> const_alpha_mask_ptr;
+
+//returns a mask with the same contents as the one given, which will be
+//shared with any other identical mask that is still in use. Takes
+//ownership of the mask passed in.
+const_alpha_mask_ptr share_alpha_mask(alpha_mask* mask);
+
+//returns true if the two arrays of 'nwords' words have a set bit in common.
+bool bits_intersect(const uint64_t* a, const uint64_t* b, int nwords);
+
+#endif
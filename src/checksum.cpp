@@ -1,5 +1,10 @@
+#include <boost/scoped_ptr.hpp>
+
+#include <algorithm>
+#include <deque>
 #include <iostream>
 #include <map>
+#include <stdlib.h>
 #include <string>
 #include <vector>
 
@@ -10,51 +15,224 @@
 #include "md5.hpp"
 #include "module.hpp"
 #include "json_parser.hpp"
+#include "preferences.hpp"
+#include "thread.hpp"
 #include "unit_test.hpp"
 #include "variant.hpp"
+#include "xxhash64.hpp"
 
 namespace checksum {
 
 namespace {
+//signatures made with a hash other than md5 are prefixed with its name, so
+//old signature files stay valid.
+const std::string Xxh64Prefix = "xxh64:";
+
+std::string hash_contents(const std::string& contents, bool xxh64)
+{
+	return xxh64 ? Xxh64Prefix + xxhash64::sum(contents) : md5::sum(contents);
+}
+
+bool is_xxh64(const std::string& signature)
+{
+	return signature.compare(0, Xxh64Prefix.size(), Xxh64Prefix) == 0;
+}
+
+bool matches_signature(const std::string& contents, const std::string& signature)
+{
+	return hash_contents(contents, is_xxh64(signature)) == signature;
+}
+
+threading::mutex& checksum_mutex()
+{
+	static threading::mutex m;
+	return m;
+}
+
+threading::condition& checksum_condition()
+{
+	static threading::condition c;
+	return c;
+}
+
+//everything below is guarded by checksum_mutex().
+bool running = false, quit = false;
+bool signature_loaded = false;
 bool verified = false;
-std::map<std::string, std::string> hashes;
 std::string whole_game_signature;
-}
 
-manager::manager() {
+//files waiting to be checked, and whether one is being checked now.
+std::deque<std::pair<std::string, std::string> > pending;
+bool checking = false;
+
+//only used by the verification thread.
+std::map<std::string, std::string> hashes;
+
+//files already checked this session, by size and modification time, so
+//files loaded again aren't hashed again.
+struct file_stamp {
+	int64_t size, mod_time;
+};
+
+std::map<std::string, file_stamp> checked_files;
+
+boost::scoped_ptr<threading::thread> verification_thread;
+
+void load_signature()
+{
+	bool ok = false;
+	std::string signature;
 	try {
-		whole_game_signature = md5::sum(sys::read_file("./signature.cfg"));
-		variant v = json::parse_from_file("./signature.cfg");
+		const std::string contents = sys::read_file("./signature.cfg");
+		signature = md5::sum(contents);
 
-		if(!v.is_map()) {
-			verified = false;
-			return;
+		//json::parse may be used from any thread without the preprocessor.
+		variant v = json::parse(contents, json::JSON_NO_PREPROCESSOR);
+
+		if(v.is_map()) {
+			std::vector<std::string> keys = v.get_keys().as_list_string();
+			std::vector<std::string> values = v.get_values().as_list_string();
+			ASSERT_EQ(keys.size(), values.size());
+			for(int n = 0; n != keys.size(); ++n) {
+				hashes[keys[n]] = values[n];
+			}
+
+			ok = true;
 		}
+	} catch(...) {
+		ok = false;
+	}
 
-		std::vector<std::string> keys = v.get_keys().as_list_string();
-		std::vector<std::string> values = v.get_values().as_list_string();
-		ASSERT_EQ(keys.size(), values.size());
-		for(int n = 0; n != keys.size(); ++n) {
-			hashes[keys[n]] = values[n];
+	threading::lock lck(checksum_mutex());
+	whole_game_signature = signature;
+	verified = ok;
+	signature_loaded = true;
+	if(!ok) {
+		pending.clear();
+	}
+	checksum_condition().notify_all();
+}
+
+//returns false if the file doesn't match its signature.
+bool check_file(const std::string& fname, const std::string& contents)
+{
+	const std::map<std::string,std::string>::const_iterator itor = hashes.find(fname);
+	if(itor == hashes.end()) {
+		if(!contents.empty()) {
+			std::cerr << "UNVERIFIED NEW FILE: " << fname << "\n";
+			return false;
 		}
+		return true;
+	}
 
-		verified = true;
-	} catch(...) {
-		verified = false;
+	//stat the file which was read, which for a module isn't fname.
+	const std::string path = module::map_file(fname);
+
+	file_stamp stamp;
+	stamp.size = sys::file_size(path);
+	stamp.mod_time = stamp.size == int64_t(contents.size()) ? sys::file_mod_time(path) : 0;
+
+	std::map<std::string, file_stamp>::const_iterator checked = checked_files.find(fname);
+	if(checked != checked_files.end() && stamp.size == int64_t(contents.size()) && checked->second.size == stamp.size && checked->second.mod_time == stamp.mod_time) {
+		return true;
+	}
+
+	if(!matches_signature(contents, itor->second)) {
+		std::cerr << "UNVERIFIED FILE: " << fname << " (((" << contents << ")))\n";
+		return false;
+	}
+
+	if(stamp.size == int64_t(contents.size())) {
+		checked_files[fname] = stamp;
+	}
+
+	return true;
+}
+
+void verification_loop()
+{
+	load_signature();
+
+	for(;;) {
+		std::pair<std::string, std::string> item;
+		{
+			threading::lock lck(checksum_mutex());
+			checking = false;
+			checksum_condition().notify_all();
+
+			while(pending.empty() && !quit) {
+				checksum_condition().wait(checksum_mutex());
+			}
+
+			if(pending.empty()) {
+				return;
+			}
+
+			item.first.swap(pending.front().first);
+			item.second.swap(pending.front().second);
+			pending.pop_front();
+			checking = true;
+		}
+
+		if(!check_file(item.first, item.second)) {
+			threading::lock lck(checksum_mutex());
+			verified = false;
+
+			//nothing more can change the verdict.
+			pending.clear();
+		}
 	}
 }
 
+//waits until the signature is loaded and the files passed to verify_file
+//so far have been checked. Must be called with checksum_mutex() held.
+void wait_for_verification()
+{
+	while(running && (!signature_loaded || checking || !pending.empty())) {
+		checksum_condition().wait(checksum_mutex());
+	}
+}
+}
+
+manager::manager() {
+	{
+		threading::lock lck(checksum_mutex());
+		running = true;
+		quit = false;
+	}
+
+#if defined(__ANDROID__) && SDL_VERSION_ATLEAST(1, 3, 0)
+	verification_thread.reset(new threading::thread("checksum", verification_loop));
+#else
+	verification_thread.reset(new threading::thread(verification_loop));
+#endif
+}
+
 manager::~manager() {
+	{
+		threading::lock lck(checksum_mutex());
+		quit = true;
+		checksum_condition().notify_all();
+	}
+
+	verification_thread.reset();
+
+	threading::lock lck(checksum_mutex());
+	running = false;
 	std::cerr << "EXITING WITH " << (verified ? "VERIFIED" : "UNVERIFIED") << " SESSION\n";
 }
 
 const std::string& game_signature()
 {
+	threading::lock lck(checksum_mutex());
+	wait_for_verification();
 	return whole_game_signature;
 }
 
 bool is_verified()
 {
+	threading::lock lck(checksum_mutex());
+	wait_for_verification();
 	return verified;
 }
 
@@ -66,8 +244,11 @@ bool both_slashes(char a, char b) {
 
 void verify_file(const std::string& fname_input, const std::string& contents)
 {
-	if(!verified) {
-		return;
+	{
+		threading::lock lck(checksum_mutex());
+		if(!running || quit || (signature_loaded && !verified)) {
+			return;
+		}
 	}
 
 	std::string fname = fname_input;
@@ -77,51 +258,169 @@ void verify_file(const std::string& fname_input, const std::string& contents)
 		return;
 	}
 
-	const std::map<std::string,std::string>::const_iterator itor = hashes.find(fname);
-	if(itor == hashes.end()) {
-		if(!contents.empty()) {
-			std::cerr << "UNVERIFIED NEW FILE: " << fname << "\n";
-			verified = false;
-		}
-		return;
-	}
-
-	verified = md5::sum(contents) == itor->second;
-	if(!verified) {
-		std::cerr << "UNVERIFIED FILE: " << fname << " (((" << contents << ")))\n";
-	}
+	threading::lock lck(checksum_mutex());
+	pending.push_back(std::pair<std::string, std::string>(fname, contents));
+	checksum_condition().notify_all();
 }
 
 }
 
 namespace {
-void get_signatures(const std::string& dir, std::map<std::string, std::string>* results)
+void get_data_files(const std::string& dir, std::vector<std::string>* results)
 {
 	std::vector<std::string> files, dirs;
 	module::get_files_in_dir(dir, &files, &dirs);
 	foreach(const std::string& d, dirs) {
-		get_signatures(dir + "/" + d, results);
+		get_data_files(dir + "/" + d, results);
 	}
 
 	foreach(const std::string& fname, files) {
-		const std::string path = dir + "/" + fname;
-		const std::string contents = sys::read_file(module::map_file(path));
-		ASSERT_LOG(contents != "", "COULD NOT READ " << path);
-		const std::string md5sum = md5::sum(contents);
-		(*results)[path] = md5sum;
+		results->push_back(dir + "/" + fname);
+	}
+}
+
+//what sign_game_data knows about a file, kept between runs so unchanged
+//files needn't be read again.
+struct signed_file {
+	signed_file() : size(-1), mod_time(0)
+	{}
+	int64_t size, mod_time;
+	std::string signature;
+};
+
+struct sign_file_job {
+	const std::vector<std::string>* paths;
+	const std::map<std::string, signed_file>* cache;
+	std::vector<signed_file>* results;
+	std::vector<char>* reused;
+	bool xxh64;
+
+	void operator()(int n) const {
+		const std::string& path = (*paths)[n];
+		const std::string real_path = module::map_file(path);
+
+		signed_file& result = (*results)[n];
+		result.size = sys::file_size(real_path);
+		if(result.size < 0) {
+			return;
+		}
+
+		result.mod_time = sys::file_mod_time(real_path);
+
+		const std::map<std::string, signed_file>::const_iterator itor = cache->find(path);
+		if(itor != cache->end() && itor->second.size == result.size && itor->second.mod_time == result.mod_time && checksum::is_xxh64(itor->second.signature) == xxh64) {
+			result.signature = itor->second.signature;
+			(*reused)[n] = 1;
+			return;
+		}
+
+		const std::string contents = sys::read_file(real_path);
+		if(contents.empty()) {
+			return;
+		}
+
+		result.signature = checksum::hash_contents(contents, xxh64);
+	}
+};
+
+std::map<std::string, signed_file> read_sign_cache(const std::string& fname)
+{
+	std::map<std::string, signed_file> result;
+	if(!sys::file_exists(fname)) {
+		return result;
+	}
+
+	try {
+		const variant v = json::parse(sys::read_file(fname), json::JSON_NO_PREPROCESSOR);
+		foreach(const variant& path, v.get_keys().as_list()) {
+			const variant entry = v[path];
+			signed_file& f = result[path.as_string()];
+			f.size = entry["size"].as_int();
+			f.mod_time = entry["mod_time"].as_int();
+			f.signature = entry["signature"].as_string();
+		}
+	} catch(...) {
+		std::cerr << "COULD NOT READ SIGNATURE CACHE " << fname << ". SIGNING ALL FILES\n";
+		result.clear();
 	}
+
+	return result;
 }
 }
 
+//Writes signature.cfg, the signatures of all the data files, which the
+//game checks the files it loads against. Files are hashed on many threads,
+//and a file whose size and modification time are the same as when it was
+//last signed isn't read again.
+//
+//--hash xxh64 signs with the much faster xxHash instead of md5. Versions of
+//the game from before it was supported will find such signatures don't
+//match.
 COMMAND_LINE_UTILITY(sign_game_data)
 {
-	std::map<std::string,std::string> signatures;
-	get_signatures("data", &signatures);
+	const char* Usage = "usage: sign_game_data [--jobs N] [--hash md5|xxh64] [--cache FILE] [--no-cache]";
+
+	int njobs = threading::num_processors();
+	bool xxh64 = false;
+	std::string cache_file = std::string(preferences::user_data_path()) + "/signature_cache.cfg";
+	for(size_t n = 0; n < args.size(); ++n) {
+		const std::string& arg = args[n];
+		if(arg == "--jobs" && n+1 < args.size()) {
+			njobs = atoi(args[++n].c_str());
+		} else if(arg == "--hash" && n+1 < args.size()) {
+			const std::string& hash = args[++n];
+			ASSERT_LOG(hash == "md5" || hash == "xxh64", "UNKNOWN HASH: " << hash << "\n" << Usage);
+			xxh64 = hash == "xxh64";
+		} else if(arg == "--cache" && n+1 < args.size()) {
+			cache_file = args[++n];
+		} else if(arg == "--no-cache") {
+			cache_file = "";
+		} else {
+			ASSERT_LOG(false, "UNRECOGNIZED ARGUMENT: " << arg << "\n" << Usage);
+		}
+	}
+
+	SDL_Init(SDL_INIT_TIMER);
+	const int start_time = SDL_GetTicks();
+
+	std::vector<std::string> paths;
+	get_data_files("data", &paths);
 
-	std::map<variant,variant> output;
-	for(std::map<std::string,std::string>::const_iterator i = signatures.begin(); i != signatures.end(); ++i) {
-		output[variant(i->first)] = variant(i->second);
+	std::map<std::string, signed_file> cache;
+	if(cache_file.empty() == false) {
+		cache = read_sign_cache(cache_file);
+	}
+
+	std::vector<signed_file> results(paths.size());
+	std::vector<char> reused(paths.size());
+
+	sign_file_job job;
+	job.paths = &paths;
+	job.cache = &cache;
+	job.results = &results;
+	job.reused = &reused;
+	job.xxh64 = xxh64;
+	threading::run_jobs(paths.size(), njobs, job);
+
+	std::map<variant,variant> output, cache_output;
+	int nreused = 0;
+	for(int n = 0; n != paths.size(); ++n) {
+		ASSERT_LOG(results[n].signature.empty() == false, "COULD NOT READ " << paths[n]);
+		output[variant(paths[n])] = variant(results[n].signature);
+
+		std::map<variant,variant> entry;
+		entry[variant("size")] = variant(static_cast<int>(results[n].size));
+		entry[variant("mod_time")] = variant(static_cast<int>(results[n].mod_time));
+		entry[variant("signature")] = variant(results[n].signature);
+		cache_output[variant(paths[n])] = variant(&entry);
+
+		nreused += reused[n];
 	}
 
 	sys::write_file("signature.cfg", variant(&output).write_json());
+	if(cache_file.empty() == false) {
+		sys::write_file(cache_file, variant(&cache_output).write_json(false));
+	}
+
+	std::cerr << "SIGNED " << paths.size() << " FILES WITH " << (xxh64 ? "xxh64" : "md5") << " IN " << (SDL_GetTicks() - start_time) << "ms ON " << njobs << " THREADS, " << nreused << " UNCHANGED SINCE THE LAST SIGNING\n";
 }
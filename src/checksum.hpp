@@ -5,13 +5,17 @@
 
 namespace checksum {
 
+//While a manager exists, the data files the game loads are checked against
+//signature.cfg on a background thread, so loading doesn't wait on hashing.
 struct manager {
 	manager();
 	~manager();
 };
 
+//these wait for the files loaded so far to be checked.
 const std::string& game_signature();
 bool is_verified();
+
 void verify_file(const std::string& fname, const std::string& contents);
 
 }
@@ -1,3 +1,6 @@
+#include <algorithm>
+
+#include "alpha_mask.hpp"
 #include "asserts.hpp"
 #include "collision_utils.hpp"
 #include "foreach.hpp"
@@ -58,7 +61,7 @@ bool point_standable(const level& lvl, const entity& e, int x, int y, collision_
 
 	const point pt(x, y);
 
-	const std::vector<entity_ptr>& chars = lvl.get_solid_chars();
+	const std::vector<entity_ptr>& chars = lvl.get_solid_chars_in_rect(rect(x, y, 1, 1));
 
 	for(std::vector<entity_ptr>::const_iterator i = chars.begin();
 	    i != chars.end(); ++i) {
@@ -120,7 +123,7 @@ bool entity_collides(level& lvl, const entity& e, MOVE_DIRECTION dir, collision_
 		return true;
 	}
 
-	const std::vector<entity_ptr>& solid_chars = lvl.get_solid_chars();
+	const std::vector<entity_ptr>& solid_chars = lvl.get_solid_chars_in_rect(e.solid_rect());
 	for(std::vector<entity_ptr>::const_iterator obj = solid_chars.begin(); obj != solid_chars.end(); ++obj) {
 		if(obj->get() != &e && entity_collides_with_entity(e, **obj, info)) {
 			if(info) {
@@ -310,18 +313,14 @@ bool non_solid_entity_collides_with_level(const level& lvl, const entity& e)
 		return false;
 	}
 
-	const int increment = e.face_right() ? 2 : -2;
-	for(int y = 0; y < f.height(); y += 2) {
-		std::vector<bool>::const_iterator i = f.get_alpha_itor(0, y, e.time_in_frame(), e.face_right());
-		for(int x = 0; x < f.width(); x += 2) {
-			if(i == f.get_alpha_buf().end() || i == f.get_alpha_buf().begin()) {
-				continue;
-			}
-			if(!*i && lvl.solid(e.x() + x, e.y() + y)) {
+	//only look at the part of the frame that has opaque pixels, keeping
+	//to the same grid of every other pixel.
+	const rect opaque = f.opaque_area(e.time_in_frame(), e.face_right());
+	for(int y = opaque.y() + (opaque.y()&1); y < opaque.y2(); y += 2) {
+		for(int x = opaque.x() + (opaque.x()&1); x < opaque.x2(); x += 2) {
+			if(!f.is_alpha(x, y, e.time_in_frame(), e.face_right()) && lvl.solid(e.x() + x, e.y() + y)) {
 				return true;
 			}
-
-			i += increment;
 		}
 	}
 
@@ -420,6 +419,92 @@ bool place_entity_in_level_with_large_displacement(level& lvl, entity& e)
 	return true;
 }
 
+namespace {
+int floor_div(int a, int b)
+{
+	return a >= 0 ? a/b : -((b - a - 1)/b);
+}
+
+//Where the samples taken by a collision test fall in one entity's alpha
+//mask. Sample k of a row is pixel col+k of the (possibly mirrored) row.
+struct mask_samples {
+	const alpha_mask* mask;
+	bool check_alpha;
+	bool mirrored;
+	int col, row;
+};
+
+mask_samples get_mask_samples(const entity& e, bool check_alpha, const rect& area)
+{
+	const frame& f = e.current_frame();
+	mask_samples result;
+	result.mask = f.get_alpha_mask(e.time_in_frame());
+	result.check_alpha = check_alpha;
+	result.mirrored = !e.face_right();
+	result.row = floor_div(area.y() - e.y(), f.scale());
+	if(e.face_right()) {
+		result.col = floor_div(area.x() - e.x(), f.scale());
+	} else {
+		const int col = floor_div(f.width() - 1 - (area.x() - e.x()), f.scale());
+		result.col = f.area().w() - 1 - col;
+	}
+
+	return result;
+}
+
+//Tests for a collision by sampling every 'stride' pixels of 'area', the
+//same as testing is_alpha() on each sample, for frames drawn with a scale
+//equal to the stride. Then each sample falls on its own pixel in each
+//frame's alpha mask, so we can test a whole row of samples at a time by
+//ANDing together the bits from the two masks.
+//
+//Returns false if the area is too large to test this way, otherwise sets
+//'result' to whether the areas collide.
+bool alpha_masks_collide(const mask_samples& a, const mask_samples& b, const rect& area, int stride, bool* result)
+{
+	const int MaxWords = 16;
+	const int ncols = (area.w() + stride - 1)/stride;
+	const int nrows = (area.h() + stride - 1)/stride;
+	const int nwords = (ncols + 63)/64;
+	if(nwords > MaxWords) {
+		return false;
+	}
+
+	*result = false;
+	if(a.check_alpha && !a.mask || b.check_alpha && !b.mask) {
+		//a frame without an image has no opaque pixels.
+		return true;
+	}
+
+	uint64_t all_opaque[MaxWords], bits_a[MaxWords], bits_b[MaxWords];
+	std::fill(all_opaque, all_opaque + nwords, ~uint64_t(0));
+	if(ncols&63) {
+		all_opaque[nwords-1] = (uint64_t(1) << (ncols&63)) - 1;
+	}
+
+	for(int y = 0; y != nrows; ++y) {
+		const uint64_t* row_a = all_opaque;
+		if(a.check_alpha) {
+			a.mask->extract_row(a.row + y, a.col, ncols, a.mirrored, bits_a);
+			row_a = bits_a;
+		}
+
+		const uint64_t* row_b = all_opaque;
+		if(b.check_alpha) {
+			b.mask->extract_row(b.row + y, b.col, ncols, b.mirrored, bits_b);
+			row_b = bits_b;
+		}
+
+		if(bits_intersect(row_a, row_b, nwords)) {
+			*result = true;
+			return true;
+		}
+	}
+
+	return true;
+}
+}
+
 int entity_user_collision(const entity& a, const entity& b, collision_pair* areas_colliding, int buf_size)
 {
 	const frame& fa = a.current_frame();
@@ -450,8 +535,15 @@ int entity_user_collision(const entity& a, const entity& b, collision_pair* area
 				const int Stride = 2;
 				bool found = false;
 				const rect intersection = intersection_rect(rect_a, rect_b);
-				for(int y = intersection.y(); y <= intersection.y2() && !found; y += Stride) {
-					for(int x = intersection.x(); x <= intersection.x2(); x += Stride) {
+
+				//the samples include the right and bottom edges.
+				const rect samples(intersection.x(), intersection.y(), intersection.w() + 1, intersection.h() + 1);
+				const bool tested_masks = fa.scale() == Stride && fb.scale() == Stride &&
+				   alpha_masks_collide(get_mask_samples(a, !area_a.no_alpha_check, samples),
+				                       get_mask_samples(b, !area_b.no_alpha_check, samples),
+				                       samples, Stride, &found);
+				for(int y = samples.y(); y < samples.y2() && !found && !tested_masks; y += Stride) {
+					for(int x = samples.x(); x < samples.x2(); x += Stride) {
 						if((area_a.no_alpha_check || !fa.is_alpha(x - a.x(), y - a.y(), time_a, a.face_right())) &&
 						   (area_b.no_alpha_check || !fb.is_alpha(x - b.x(), y - b.y(), time_b, b.face_right()))) {
 							found = true;
@@ -531,9 +623,28 @@ bool entity_user_collision_specific_areas(const entity& a, const std::string& ar
 	const int time_a = a.time_in_frame();
 	const int time_b = b.time_in_frame();
 
-	const rect intersection = intersection_rect(rect_a, rect_b);
-	for(int y = intersection.y(); y <= intersection.y2(); ++y) {
-		for(int x = intersection.x(); x <= intersection.x2(); ++x) {
+	//only the pixels where both frames are opaque can collide.
+	const rect opaque_a = fa.opaque_area(time_a, a.face_right());
+	const rect opaque_b = fb.opaque_area(time_b, b.face_right());
+	//the samples include the right and bottom edges of the intersection.
+	rect samples = intersection_rect(rect_a, rect_b);
+	samples = rect(samples.x(), samples.y(), samples.w() + 1, samples.h() + 1);
+	samples = intersection_rect(samples, rect(a.x() + opaque_a.x(), a.y() + opaque_a.y(), opaque_a.w(), opaque_a.h()));
+	samples = intersection_rect(samples, rect(b.x() + opaque_b.x(), b.y() + opaque_b.y(), opaque_b.w(), opaque_b.h()));
+	if(samples.w() == 0 || samples.h() == 0) {
+		return false;
+	}
+
+	bool found = false;
+	if(fa.scale() == 1 && fb.scale() == 1 &&
+	   alpha_masks_collide(get_mask_samples(a, true, samples),
+	                       get_mask_samples(b, true, samples),
+	                       samples, 1, &found)) {
+		return found;
+	}
+
+	for(int y = samples.y(); y < samples.y2(); ++y) {
+		for(int x = samples.x(); x < samples.x2(); ++x) {
 			if(!fa.is_alpha(x - a.x(), y - a.y(), time_a, a.face_right()) &&
 			   !fb.is_alpha(x - b.x(), y - b.y(), time_b, b.face_right())) {
 				return true;
@@ -669,7 +780,7 @@ bool is_flightpath_clear(const level& lvl, const entity& e, const rect& area)
 		return false;
 	}
 
-	const std::vector<entity_ptr>& v = lvl.get_solid_chars();
+	const std::vector<entity_ptr>& v = lvl.get_solid_chars_in_rect(area);
 	for(std::vector<entity_ptr>::const_iterator obj = v.begin();
 	    obj != v.end(); ++obj) {
 		if(obj->get() == &e) {
@@ -3,93 +3,185 @@
 
 #include "asserts.hpp"
 #include "colorshift_hash_table.hpp"
+#include "unit_test.hpp"
 
 namespace {
 	const int ArraySizes[] = {7, 17, 37, 79, 163, 331, 673, 1361, 2729, 5471, 10949, 21911, 43853, 87719, 175447, 350899, 701819, 1403641, 2807303, 5614657, 11229331, 22458671, 44917381, 89834777, };  //normally a vector would increase in size by ^2 with each iteration.  However, with our hashing function, this yields perversely bad collisions, because the last byte of each color value is the alpha, and generally is always opaque or transparent (e.g. 0x00 or 0xFF).  Whenever this lines lines up with a power of 2, such as with an arraySize of 256, it would fail like this.  Thus we're using primes, instead.  Our primes are also precalculated because in practice we'll never have many colors.
+	const int NumArraySizes = sizeof(ArraySizes)/sizeof(*ArraySizes);
 }
 
+const uint32_t colorshift_hash_table::empty_color_;
+
 colorshift_hash_table::colorshift_hash_table()
-  :	length_(10),
+  :	array_(ArraySizes[0], pixel_pair(empty_color_, empty_color_)),
+	size_index_(0),
+	ideal_size_(ArraySizes[0] / 2),
 	elements_stored_(0),
-	empty_color_(0x6f6d5100),
-	num_predefined_sizes_(24)
+	has_empty_color_(false),
+	empty_color_result_(0)
 {
-	array_ = new pixel_pair[length_];
-	ideal_size_ = length_ / 2;
-	
-	std::fill(array_, array_ + length_, std::pair<uint32_t, uint32_t> (empty_color_,empty_color_));
 }
 
-colorshift_hash_table::~colorshift_hash_table(){
-	delete [] array_;
+//returns the slot the key is stored in, or the empty slot it would be
+//inserted in if it isn't in the table. Since the table is never more than
+//half full there is always an empty slot to stop at.
+int colorshift_hash_table::find_slot(uint32_t key) const
+{
+	const int length = array_.size();
+	int slot = key%length;
+	while(array_[slot].first != key && array_[slot].first != empty_color_) {
+		if(++slot == length) {
+			slot = 0;
+		}
+	}
+
+	return slot;
 }
 
-void colorshift_hash_table::insert(const pixel_pair& entry){
-	
-	if( elements_stored_ >= ideal_size_){
-		colorshift_hash_table::grow_array();
+void colorshift_hash_table::insert(const pixel_pair& entry)
+{
+	if(entry.first == empty_color_) {
+		has_empty_color_ = true;
+		empty_color_result_ = entry.second;
+		return;
+	}
+
+	if(elements_stored_ >= ideal_size_) {
+		grow_array();
+	}
+
+	pixel_pair& slot = array_[find_slot(entry.first)];
+	if(slot.first == empty_color_) {
+		++elements_stored_;
 	}
-	
-	int desired_element = entry.first%length_;
-	
-	for(int i=0; i <= elements_stored_; ++i){
-		desired_element = (desired_element + 1) % length_; //modulo addition
-		
-		if (array_[desired_element].first != empty_color_){
-			array_[desired_element] = entry;
-			
-			++elements_stored_;
-			return;
+
+	slot = entry;
+}
+
+void colorshift_hash_table::grow_array()
+{
+	ASSERT_LT(size_index_ + 1, NumArraySizes);
+
+	std::vector<pixel_pair> old_array(ArraySizes[++size_index_], pixel_pair(empty_color_, empty_color_));
+	array_.swap(old_array);
+	ideal_size_ = array_.size() / 2;
+
+	for(std::vector<pixel_pair>::const_iterator i = old_array.begin(); i != old_array.end(); ++i) {
+		if(i->first != empty_color_) {
+			array_[find_slot(i->first)] = *i;
 		}
 	}
 }
 
-void colorshift_hash_table::grow_array(){
-	int new_length = 0;
-	pixel_pair* temp_array; //copy of the old array
-	pixel_pair* new_array; //new, bigger array
-	
-	
-	for(int i=0; i < num_predefined_sizes_; ++i){
-		if (length_ <= ArraySizes[i]){
-			new_length = ArraySizes[i+1];
-			break;
+bool colorshift_hash_table::find(uint32_t key, uint32_t* result) const
+{
+	if(key == empty_color_) {
+		if(has_empty_color_ && result) {
+			*result = empty_color_result_;
 		}
+		return has_empty_color_;
 	}
-	ASSERT_NE(new_length,0);
-
-	new_array = new pixel_pair[new_length];
-	std::fill(new_array, new_array + new_length, std::pair<uint32_t, uint32_t> (empty_color_,empty_color_));
-	
-	//set aside address to old array
-	temp_array = &array_[0];
-	array_ = &new_array[0];
-	
-	ideal_size_ = new_length / 2;  //bad code smell:  failure to set this could result in an infinite recursion between this and insert
-	
-	for(int i=0; i<length_ ;++i){
-		colorshift_hash_table::insert(temp_array[i]);
+
+	const pixel_pair& slot = array_[find_slot(key)];
+	if(slot.first == empty_color_) {
+		return false;
 	}
-	delete temp_array;
+
+	if(result) {
+		*result = slot.second;
+	}
+	return true;
+}
+
+uint32_t colorshift_hash_table::operator[](uint32_t key) const
+{
+	uint32_t result = key; //identity operation if the color isn't in the table
+	find(key, &result);
+	return result;
 }
 
+void colorshift_hash_table::map_pixels(uint32_t* pixels, int npixels) const
+{
+	map_pixels(pixels, pixels, npixels);
+}
 
-uint32_t colorshift_hash_table::operator[](uint32_t key) const {
+void colorshift_hash_table::map_pixels(const uint32_t* src, uint32_t* dst, int npixels) const
+{
+	if(npixels <= 0) {
+		return;
+	}
 
-	//If the first+n element isn't what we're looking for, then loop forward until we find an empty slot - because of how these are inserted, this is a faster way of indicating the array doesn't have the desired item than the alternative of looping over the entire array.
-	int desired_element = key%length_;
-	
-	for(int i=0; i <= elements_stored_; ++i){
-		desired_element = (desired_element + 1) % length_; //modulo addition
-		
-		if (array_[desired_element].first == key){  //then we don't have a collision, and can return the color
-			return array_[key%length_].second;
-		} else if (array_[desired_element].first == empty_color_) {   //if we did have a collision, we normally step to the next element, unless the one we're on is empty, which means the color isn't in our array
-			return key; //identity operation
+	//pixel art has long runs of the same color, so remember the last
+	//lookup and only go to the table when the color changes.
+	uint32_t last_key = *src;
+	uint32_t last_value = (*this)[last_key];
+	const uint32_t* end = src + npixels;
+	while(src != end) {
+		if(*src != last_key) {
+			last_key = *src;
+			last_value = (*this)[last_key];
 		}
-	}	
-		//if we manage to step through the entire array without reaching any empty elements, something is wrong and we should probably assert, however
-	return key; //identity operation
+
+		*dst++ = last_value;
+		++src;
+	}
 }
 
+UNIT_TEST(colorshift_hash_table)
+{
+	colorshift_hash_table table;
+	CHECK_EQ(table.empty(), true);
+	CHECK_EQ(table[0xFF00FF00], 0xFF00FF00);
+
+	//insert enough colors to make the table grow several times.
+	for(uint32_t n = 0; n != 1000; ++n) {
+		table.insert(colorshift_hash_table::pixel_pair(n*0x01010101, n));
+	}
+
+	CHECK_EQ(table.size(), 1000);
+	for(uint32_t n = 0; n != 1000; ++n) {
+		CHECK_EQ(table[n*0x01010101], n);
+	}
+
+	//replacing an entry doesn't add a new one.
+	table.insert(colorshift_hash_table::pixel_pair(0x01010101, 5));
+	CHECK_EQ(table.size(), 1000);
+	CHECK_EQ(table[0x01010101], 5);
 
+	//the color used to mark empty slots is still a valid key.
+	CHECK_EQ(table.find(0x6f6d5100), false);
+	CHECK_EQ(table[0x6f6d5100], 0x6f6d5100);
+	table.insert(colorshift_hash_table::pixel_pair(0x6f6d5100, 7));
+	CHECK_EQ(table[0x6f6d5100], 7);
+	CHECK_EQ(table.size(), 1001);
+
+	uint32_t pixels[] = { 0x02020202, 0x02020202, 0xFF00FF00, 0x6f6d5100, 0x02020202 };
+	table.map_pixels(pixels, sizeof(pixels)/sizeof(*pixels));
+	CHECK_EQ(pixels[0], 2);
+	CHECK_EQ(pixels[1], 2);
+	CHECK_EQ(pixels[2], 0xFF00FF00);
+	CHECK_EQ(pixels[3], 7);
+	CHECK_EQ(pixels[4], 2);
+}
+
+BENCHMARK_TAGGED(colorshift_hash_table, "render")
+{
+	//the same data as the pixel_table benchmark, for comparison.
+	const uint32_t PixelsFrom[] = {0xFF00FFFF, 0xFFFFFFFF, 0x9772FF13, 0xFF002145, 0x00FFFFFF, 0x94FF28FF };
+	const uint32_t PixelsTo[] = {0x00FF0000, 0xFF00FFFF, 0xFFFFFFFF, 0x9772FF13, 0xFF002145, 0x00FFFFFF };
+	const int NumColors = sizeof(PixelsFrom)/sizeof(*PixelsFrom);
+
+	std::vector<uint32_t> image(1000000);
+	for(int n = 0; n != image.size(); ++n) {
+		image[n] = PixelsFrom[n%NumColors];
+	}
+
+	colorshift_hash_table table;
+	for(int n = 0; n != NumColors; ++n) {
+		table.insert(colorshift_hash_table::pixel_pair(PixelsFrom[n], PixelsTo[n]));
+	}
+
+	BENCHMARK_LOOP {
+		table.map_pixels(&image[0], image.size());
+	}
+}
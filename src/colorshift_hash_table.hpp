@@ -2,31 +2,42 @@
 #define COLORSHIFT_HASH_TABLE_HPP_INCLUDED
 
 //A quick data structure for doing color shifts of pixel art images.
+//Colors which aren't in the table map to themselves.
 #include <utility>
+#include <vector>
 #include <boost/cstdint.hpp>
 
 
 class colorshift_hash_table {
 public:
 	colorshift_hash_table();
-	~colorshift_hash_table();
 	typedef std::pair<uint32_t, uint32_t> pixel_pair;  //original and result colors
-	void insert(const pixel_pair& entry);  //insert a new entry into the table
+	void insert(const pixel_pair& entry);  //insert a new entry into the table, replacing any existing entry for that color
 	uint32_t operator[](uint32_t key) const;  //look up an item in the table
+	bool find(uint32_t key, uint32_t* result=NULL) const;  //true if the color is in the table
+
+	bool empty() const { return elements_stored_ == 0 && !has_empty_color_; }
+	int size() const { return elements_stored_ + (has_empty_color_ ? 1 : 0); }
+
+	//map a buffer of pixels through the table. This is the tight loop
+	//used for converting whole surfaces.
+	void map_pixels(uint32_t* pixels, int npixels) const;
+	void map_pixels(const uint32_t* src, uint32_t* dst, int npixels) const;
 	
 private:
-	pixel_pair* array_;
-	int length_;  //size of the array
+	int find_slot(uint32_t key) const;
+	void grow_array();
+
+	std::vector<pixel_pair> array_;
+	int size_index_;  //index into the table of array sizes
 	int ideal_size_;  // half the array size.  We want half the array to be empty, to avoid having collisions.
 	int elements_stored_;  //number of actual valid items in the array
-	const int empty_color_;  //when this is the key, this given array slot is 'empty'
 
-	
-	const int num_predefined_sizes_;
-	
-	void grow_array();
-	
-	
+	//when this is the key, this given array slot is 'empty'. If that color
+	//is actually inserted we store it outside of the array.
+	static const uint32_t empty_color_ = 0x6f6d5100;
+	bool has_empty_color_;
+	uint32_t empty_color_result_;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -1,7 +1,16 @@
 //#define ZLIB_CONST
 
+#include <boost/bind.hpp>
+#include <string.h>
+
+#if !defined(_WINDOWS)
+#include <sys/resource.h>
+#endif
+
 #include "asserts.hpp"
 #include "compress.hpp"
+#include "filesystem.hpp"
+#include "foreach.hpp"
 #include "unit_test.hpp"
 #include "zlib.h"
 
@@ -31,30 +40,18 @@ std::vector<char> compress(const std::vector<char>& data, int compression_level)
 
 std::vector<char> decompress(const std::vector<char>& data)
 {
-	const unsigned int MAX_OUTPUT_SIZE = 256*1024*1024;
-
-	unsigned int output_size = data.size()*10;
-	if(output_size > MAX_OUTPUT_SIZE) {
-		output_size = MAX_OUTPUT_SIZE;
+	std::vector<char> output;
+	if(data.empty()) {
+		return output;
 	}
 
-	do {
-		std::vector<char> output(output_size);
-
-		Bytef* dst = reinterpret_cast<Bytef*>(&output[0]);
-		uLongf dst_len = output.size();
-		const Bytef* src = reinterpret_cast<const Bytef*>(&data[0]);
-
-		const int result = uncompress(dst, &dst_len, src, data.size());
-		if(result == Z_OK) {
-			output.resize(dst_len);
-			return output;
-		}
-
-		output_size *= 2;
-	} while(output_size < MAX_OUTPUT_SIZE);
-
-	ASSERT_LOG(false, "COULD NOT DECOMPRESS " << data.size() << " BYTE BUFFER\n");
+	//the output size isn't known, so it's decompressed in pieces rather
+	//than guessing at a buffer big enough for it all.
+	output.reserve(data.size()*4);
+	decompressor d(vector_sink(&output));
+	d.write(&data[0], data.size());
+	d.finish();
+	return output;
 }
 
 std::vector<char> decompress_known_size(const std::vector<char>& data, int size)
@@ -73,6 +70,137 @@ std::vector<char> decompress_known_size(const std::vector<char>& data, int size)
 	return output;
 }
 
+namespace {
+void append_to_string(std::string* out, const char* data, size_t len)
+{
+	out->append(data, len);
+}
+
+void append_to_vector(std::vector<char>* out, const char* data, size_t len)
+{
+	out->insert(out->end(), data, data + len);
+}
+
+void write_to_file(FILE* file, const char* data, size_t len)
+{
+	ASSERT_LOG(fwrite(data, 1, len, file) == len, "ERROR WRITING COMPRESSED DATA TO FILE");
+}
+}
+
+sink string_sink(std::string* out)
+{
+	return boost::bind(append_to_string, out, _1, _2);
+}
+
+sink vector_sink(std::vector<char>* out)
+{
+	return boost::bind(append_to_vector, out, _1, _2);
+}
+
+sink file_sink(FILE* file)
+{
+	return boost::bind(write_to_file, file, _1, _2);
+}
+
+compressor::compressor(sink out, int compression_level)
+  : stream_(new z_stream), out_(out), finished_(false), total_in_(0), total_out_(0)
+{
+	ASSERT_LOG(compression_level >= -1 && compression_level <= 9, "Compression level must be between -1(default) and 9.");
+	memset(stream_.get(), 0, sizeof(z_stream));
+	const int result = deflateInit(stream_.get(), compression_level);
+	ASSERT_EQ(result, Z_OK);
+}
+
+compressor::~compressor()
+{
+	deflateEnd(stream_.get());
+}
+
+void compressor::write(const char* data, size_t len)
+{
+	ASSERT_LOG(!finished_, "DATA WRITTEN TO FINISHED COMPRESSOR");
+	total_in_ += len;
+	stream_->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+	stream_->avail_in = len;
+	deflate_input(Z_NO_FLUSH);
+}
+
+void compressor::finish()
+{
+	if(finished_) {
+		return;
+	}
+
+	stream_->next_in = Z_NULL;
+	stream_->avail_in = 0;
+	deflate_input(Z_FINISH);
+	finished_ = true;
+}
+
+void compressor::deflate_input(int flush)
+{
+	char buf[CHUNK];
+	int result = Z_OK;
+	do {
+		stream_->next_out = reinterpret_cast<Bytef*>(buf);
+		stream_->avail_out = CHUNK;
+		result = deflate(stream_.get(), flush);
+		ASSERT_LOG(result != Z_STREAM_ERROR, "COMPRESSION FAILED");
+
+		const size_t nbytes = CHUNK - stream_->avail_out;
+		if(nbytes) {
+			total_out_ += nbytes;
+			out_(buf, nbytes);
+		}
+	} while(stream_->avail_out == 0 || (flush == Z_FINISH && result != Z_STREAM_END));
+}
+
+decompressor::decompressor(sink out)
+  : stream_(new z_stream), out_(out), finished_(false), total_out_(0)
+{
+	memset(stream_.get(), 0, sizeof(z_stream));
+	const int result = inflateInit(stream_.get());
+	ASSERT_EQ(result, Z_OK);
+}
+
+decompressor::~decompressor()
+{
+	inflateEnd(stream_.get());
+}
+
+void decompressor::write(const char* data, size_t len)
+{
+	ASSERT_LOG(!finished_ || len == 0, "DATA AFTER END OF COMPRESSED STREAM");
+	stream_->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+	stream_->avail_in = len;
+
+	char buf[CHUNK];
+	do {
+		stream_->next_out = reinterpret_cast<Bytef*>(buf);
+		stream_->avail_out = CHUNK;
+		const int result = inflate(stream_.get(), Z_NO_FLUSH);
+		ASSERT_LOG(result != Z_MEM_ERROR, "Decompression out of memory");
+		ASSERT_LOG(result == Z_OK || result == Z_STREAM_END || result == Z_BUF_ERROR, "Compression data corrupt");
+
+		const size_t nbytes = CHUNK - stream_->avail_out;
+		if(nbytes) {
+			total_out_ += nbytes;
+			out_(buf, nbytes);
+		}
+
+		if(result == Z_STREAM_END) {
+			ASSERT_LOG(stream_->avail_in == 0, "DATA AFTER END OF COMPRESSED STREAM");
+			finished_ = true;
+			return;
+		}
+	} while(stream_->avail_out == 0);
+}
+
+void decompressor::finish()
+{
+	ASSERT_LOG(finished_, "COMPRESSED DATA IS TRUNCATED");
+}
+
 }
 
 UNIT_TEST(compression_test)
@@ -89,3 +217,108 @@ UNIT_TEST(compression_test)
 		CHECK_EQ(data[n], uncompressed[n]);
 	}
 }
+
+UNIT_TEST(compression_stream_test)
+{
+	std::vector<char> data(100000);
+	for(size_t n = 0; n != data.size(); ++n) {
+		data[n] = 'A' + rand()%26;
+	}
+
+	std::string compressed;
+	zip::compressor c(zip::string_sink(&compressed));
+	for(size_t n = 0; n < data.size(); n += 999) {
+		c.write(&data[n], std::min<size_t>(999, data.size() - n));
+	}
+	c.finish();
+
+	std::vector<char> uncompressed;
+	zip::decompressor d(zip::vector_sink(&uncompressed));
+	for(size_t n = 0; n < compressed.size(); n += 777) {
+		d.write(&compressed[n], std::min<size_t>(777, compressed.size() - n));
+	}
+	d.finish();
+
+	CHECK_EQ(c.total_in(), data.size());
+	CHECK_EQ(c.total_out(), compressed.size());
+	CHECK(uncompressed == data, "STREAMED DATA DIFFERS");
+	CHECK(zip::decompress(std::vector<char>(compressed.begin(), compressed.end())) == data, "DECOMPRESSED DATA DIFFERS");
+}
+
+namespace {
+void get_files_under_dir(const std::string& dir, std::vector<std::string>* res)
+{
+	std::vector<std::string> files, dirs;
+	sys::get_files_in_dir(dir, &files, &dirs);
+	foreach(const std::string& d, dirs) {
+		get_files_under_dir(dir + "/" + d, res);
+	}
+
+	foreach(const std::string& fname, files) {
+		res->push_back(dir + "/" + fname);
+	}
+}
+
+void count_output(size_t* count, const char* data, size_t len)
+{
+	*count += len;
+}
+}
+
+//compresses all the files in a directory, given as "buffer:<dir>" to
+//compress them in one buffer, the way module packages used to be built,
+//or "stream:<dir>" to stream them through a compressor. Run each in its
+//own process to compare the peak RSS reported.
+BENCHMARK_ARG(compress_module, const std::string& arg)
+{
+	const std::string::size_type colon = arg.find(':');
+	ASSERT_LOG(colon != std::string::npos, "ARGUMENT MUST BE buffer:<dir> OR stream:<dir>");
+	const std::string mode(arg, 0, colon);
+	const std::string dir(arg, colon + 1);
+	ASSERT_LOG(mode == "buffer" || mode == "stream", "UNKNOWN MODE: " << mode);
+
+	std::vector<std::string> files;
+	get_files_under_dir(dir, &files);
+
+	size_t input_size = 0, output_size = 0;
+	BENCHMARK_LOOP {
+		input_size = output_size = 0;
+		if(mode == "buffer") {
+			std::vector<char> data;
+			foreach(const std::string& fname, files) {
+				const std::string contents = sys::read_file(fname);
+				data.insert(data.end(), contents.begin(), contents.end());
+			}
+
+			input_size = data.size();
+			output_size = zip::compress(data).size();
+		} else {
+			zip::compressor c(boost::bind(count_output, &output_size, _1, _2));
+			foreach(const std::string& fname, files) {
+				const std::string contents = sys::read_file(fname);
+				c.write(contents.c_str(), contents.size());
+			}
+
+			c.finish();
+			input_size = c.total_in();
+		}
+	}
+
+	//the benchmark runner calls this many times to time it, so only
+	//report the sizes the first time.
+	static bool reported = false;
+	if(reported) {
+		return;
+	}
+
+	reported = true;
+	std::cerr << "COMPRESSED " << files.size() << " FILES, " << input_size << " BYTES TO " << output_size << " BYTES\n";
+
+#if !defined(_WINDOWS)
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	std::cerr << "PEAK RSS: " << usage.ru_maxrss << "KB\n";
+#endif
+}
+
+BENCHMARK_ARG_CALL_COMMAND_LINE(compress_module);
@@ -2,12 +2,19 @@
 #ifndef COMPRESS_HPP_INCLUDED
 #define COMPRESS_HPP_INCLUDED
 
+#include <cstdio>
+#include <string>
 #include <vector>
 
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+
 #include "base64.hpp"
 #include "formula_callable.hpp"
 #include "variant.hpp"
 
+struct z_stream_s;
+
 namespace zip {
 
 struct CompressionException {
@@ -18,6 +25,64 @@ std::vector<char> compress(const std::vector<char>& data, int compression_level=
 std::vector<char> decompress(const std::vector<char>& data);
 std::vector<char> decompress_known_size(const std::vector<char>& data, int size);
 
+//receives output from a compressor or decompressor as it's produced.
+typedef boost::function<void(const char*, size_t)> sink;
+
+sink string_sink(std::string* out);
+sink vector_sink(std::vector<char>* out);
+sink file_sink(FILE* file);
+
+//Compresses data fed to it in pieces, passing output to the sink as it
+//goes, so neither the input nor the output has to be held all at once.
+class compressor {
+public:
+	explicit compressor(sink out, int compression_level=-1);
+	~compressor();
+
+	void write(const char* data, size_t len);
+
+	//flushes the end of the stream. Must be called once all the data has
+	//been written.
+	void finish();
+
+	size_t total_in() const { return total_in_; }
+	size_t total_out() const { return total_out_; }
+private:
+	compressor(const compressor&);
+	void operator=(const compressor&);
+
+	void deflate_input(int flush);
+
+	boost::scoped_ptr<z_stream_s> stream_;
+	sink out_;
+	bool finished_;
+	size_t total_in_, total_out_;
+};
+
+//Decompresses data fed to it in pieces, passing output to the sink as it
+//goes. Corrupt data causes an assert.
+class decompressor {
+public:
+	explicit decompressor(sink out);
+	~decompressor();
+
+	void write(const char* data, size_t len);
+
+	//asserts that the whole stream has been written.
+	void finish();
+
+	bool finished() const { return finished_; }
+	size_t total_out() const { return total_out_; }
+private:
+	decompressor(const decompressor&);
+	void operator=(const decompressor&);
+
+	boost::scoped_ptr<z_stream_s> stream_;
+	sink out_;
+	bool finished_;
+	size_t total_out_;
+};
+
 class compressed_data : public game_logic::formula_callable {
 	std::vector<char> data_;
 public:
@@ -21,6 +21,9 @@ uint32_t htonl(uint32_t nl)
 
 #include <stdio.h>
 
+#include <algorithm>
+#include <iostream>
+#include <map>
 #include <stack>
 #include <vector>
 
@@ -51,7 +54,10 @@ int32_t highest_confirmed[MAX_PLAYERS];
 //for each player, the highest confirmed cycle of ours that they have
 int32_t remote_highest_confirmed[MAX_PLAYERS];
 
+//checksums of the level state, by level cycle.
 std::map<int, int> our_checksums;
+std::map<int, int> remote_checksums;
+int ndesyncs;
 
 int starting_cycles;
 int nplayers = 1;
@@ -61,6 +67,12 @@ int delay;
 
 int first_invalid_cycle_var = -1;
 
+//the highest cycle of other players' controls the game has used.
+int highest_used_cycle = -1;
+
+bool rollback = false;
+int max_rollback_cycles = 8;
+
 SDLKey sdlk[NUM_CONTROLS] = {
 	SDLK_UP,
 	SDLK_DOWN,
@@ -95,6 +107,109 @@ int32_t our_highest_confirmed() {
 	return res;
 }
 
+//the level cycle which is processed using the controls for 'cycle'.
+int level_cycle_for(int cycle) {
+	return cycle + 1 + starting_cycles + delay;
+}
+
+void invalidate_from(int cycle) {
+	//controls the game hasn't used yet can't have been mispredicted.
+	if(cycle > highest_used_cycle) {
+		return;
+	}
+
+	if(first_invalid_cycle_var == -1 || first_invalid_cycle_var > cycle) {
+		//mark us as invalid back to this point, so game logic
+		//will be recalculated from here.
+		first_invalid_cycle_var = cycle;
+	}
+}
+
+//Controls are sent as runs of the same state, since they mostly stay the
+//same from one cycle to the next. Each run is the state followed by how
+//many cycles it lasts, seven bits at a time with the top bit set on all
+//but the last byte.
+void encode_controls(std::vector<unsigned char>::const_iterator i, std::vector<unsigned char>::const_iterator end, std::vector<char>& v)
+{
+	while(i != end) {
+		const unsigned char state = *i;
+		unsigned int count = 0;
+		while(i != end && *i == state) {
+			++count;
+			++i;
+		}
+
+		v.push_back(state);
+		while(count >= 0x80) {
+			v.push_back(char((count&0x7F) | 0x80));
+			count >>= 7;
+		}
+
+		v.push_back(char(count));
+	}
+}
+
+bool decode_controls(const char* buf, const char* end, int ncycles, std::vector<unsigned char>& result)
+{
+	result.clear();
+	while(buf != end) {
+		const unsigned char state = *buf++;
+		unsigned int count = 0;
+		for(int shift = 0; ; shift += 7) {
+			if(buf == end || shift > 28) {
+				return false;
+			}
+
+			const unsigned char c = *buf++;
+			count |= (c&0x7F) << shift;
+			if((c&0x80) == 0) {
+				break;
+			}
+		}
+
+		if(count == 0 || count > ncycles - result.size()) {
+			return false;
+		}
+
+		result.insert(result.end(), count, state);
+	}
+
+	return int(result.size()) == ncycles;
+}
+
+//compares the checksums we've had from other players with ours, once
+//both are for cycles all of whose controls are confirmed.
+void compare_checksums() {
+	if(first_invalid_cycle_var != -1) {
+		return;
+	}
+
+	//we can compare up to the last cycle we've both confirmed and processed.
+	if(our_checksums.empty()) {
+		return;
+	}
+
+	const int confirmed_cycle = std::min(level_cycle_for(our_highest_confirmed()), our_checksums.rbegin()->first);
+	while(remote_checksums.empty() == false && remote_checksums.begin()->first <= confirmed_cycle) {
+		const int cycle = remote_checksums.begin()->first;
+		const int checksum = remote_checksums.begin()->second;
+		remote_checksums.erase(remote_checksums.begin());
+
+		std::map<int, int>::const_iterator ours = our_checksums.find(cycle);
+		if(ours == our_checksums.end()) {
+			continue;
+		}
+
+		if(ours->second != checksum) {
+			++ndesyncs;
+			std::cerr << "DESYNC: CHECKSUM DID NOT MATCH FOR " << cycle << ": " << checksum << " VS " << ours->second << "\n";
+		}
+
+		//older checksums won't be needed again.
+		our_checksums.erase(our_checksums.begin(), our_checksums.find(cycle));
+	}
+}
+
 CKey& keyboard() {
 	static CKey key;
 	return key;
@@ -157,6 +272,11 @@ void new_level(int level_starting_cycles, int level_nplayers, int level_local_pl
 	foreach(int32_t& highest, remote_highest_confirmed) {
 		highest = 0;
 	}
+
+	our_checksums.clear();
+	remote_checksums.clear();
+	first_invalid_cycle_var = -1;
+	highest_used_cycle = -1;
 }
 
 namespace {
@@ -308,25 +428,28 @@ void get_control_status(int cycle, int player, bool* output)
 	}
 
 	if(player != local_player) {
-		const int breathing_room = highest_confirmed[player] - cycle;
-
-		if(cycle > highest_confirmed[player]) {
+		//in rollback mode we go ahead with predicted controls, as long as
+		//we don't get so far ahead that rolling back would take too long.
+		const int max_ahead = rollback ? max_rollback_cycles : 0;
+		if(cycle > highest_confirmed[player] + max_ahead) {
 			std::cerr << "DELAYING AND WAITING\n";
 			const int max_delay = 1000;
 			const int end_time = SDL_GetTicks() + max_delay;
 
 			const pause_scope pause;
 #if !defined(__native_client__)
-			while(cycle > highest_confirmed[player] && SDL_GetTicks() < end_time) {
+			while(cycle > highest_confirmed[player] + max_ahead && SDL_GetTicks() < end_time) {
 				multiplayer::receive();
 			}
 #endif
 		}
 
-		if(cycle > highest_confirmed[player]) {
+		if(cycle > highest_confirmed[player] + max_ahead) {
 			std::cerr << "ERROR: REMOTE HOST TIMED OUT. GAME ABORTED.\n";
 			throw multiplayer::error();
 		}
+
+		highest_used_cycle = std::max(highest_used_cycle, cycle);
 	}
 
 	ASSERT_INDEX_INTO_VECTOR(cycle, controls[player]);
@@ -343,11 +466,22 @@ void set_delay(int value)
 	delay = value;
 }
 
+void set_rollback(bool value, int max_cycles)
+{
+	rollback = value;
+	max_rollback_cycles = max_cycles;
+}
+
+bool rollback_enabled()
+{
+	return rollback;
+}
+
 void read_control_packet(const char* buf, size_t len)
 {
 	++npackets_received;
 
-	if(len < 13) {
+	if(len < 21) {
 		fprintf(stderr, "ERROR: CONTROL PACKET TOO SHORT: %d\n", (int)len);
 		return;
 	}
@@ -376,18 +510,18 @@ void read_control_packet(const char* buf, size_t len)
 		return;
 	}
 
+	int32_t checksum_cycle;
+	memcpy(&checksum_cycle, buf, 4);
+	checksum_cycle = ntohl(checksum_cycle);
+	buf += 4;
+
 	int32_t checksum;
 	memcpy(&checksum, buf, 4);
 	checksum = ntohl(checksum);
 	buf += 4;
 
-	if(checksum && our_checksums[current_cycle-1]) {
-		if(checksum == our_checksums[current_cycle-1]) {
-			std::cerr << "CHECKSUM MATCH FOR " << current_cycle << ": " << checksum << "\n";
-		} else {
-			std::cerr << "CHECKSUM DID NOT MATCH FOR " << current_cycle << ": " << checksum << " VS " << our_checksums[current_cycle-1] << "\n";
-		}
-
+	if(checksum_cycle >= 0) {
+		remote_checksums[checksum_cycle] = checksum;
 	}
 
 	int32_t highest_cycle;
@@ -404,11 +538,20 @@ void read_control_packet(const char* buf, size_t len)
 	ncycles = ntohl(ncycles);
 	buf += 4;
 
-	if(end_buf - buf != ncycles) {
-		fprintf(stderr, "ERROR: BAD NUMBER OF CYCLES: %d vs %d\n", (int)ncycles, (int)(end_buf - buf));
+	if(ncycles < 0 || ncycles > current_cycle + 1) {
+		fprintf(stderr, "ERROR: BAD NUMBER OF CYCLES: %d\n", (int)ncycles);
+		return;
+	}
+
+	static std::vector<unsigned char> decoded;
+	if(!decode_controls(buf, end_buf, ncycles, decoded)) {
+		fprintf(stderr, "ERROR: BAD CONTROLS IN PACKET FOR %d CYCLES\n", (int)ncycles);
 		return;
 	}
 
+	buf = decoded.empty() ? NULL : reinterpret_cast<const char*>(&decoded[0]);
+	end_buf = buf + decoded.size();
+
 	int start_cycle = 1 + current_cycle - ncycles;
 
 	//if we already have data up to this point, don't reprocess it.
@@ -424,11 +567,7 @@ void read_control_packet(const char* buf, size_t len)
 			if(controls[slot][cycle] != *buf) {
 				fprintf(stderr, "RECEIVED CORRECTION\n");
 				controls[slot][cycle] = *buf;
-				if(first_invalid_cycle_var == -1 || first_invalid_cycle_var > cycle) {
-					//mark us as invalid back to this point, so game logic
-					//will be recalculated from here.
-					first_invalid_cycle_var = cycle;
-				}
+				invalidate_from(cycle);
 			}
 		} else {
 			fprintf(stderr, "RECEIVED FUTURE PACKET!\n");
@@ -444,7 +583,10 @@ void read_control_packet(const char* buf, size_t len)
 	//controls don't change unless we get an explicit signal
 	if(current_cycle < static_cast<int>(controls[slot].size()) - 1) {
 		for(int n = current_cycle + 1; n < controls[slot].size(); ++n) {
-			controls[slot][n] = controls[slot][current_cycle];
+			if(controls[slot][n] != controls[slot][current_cycle]) {
+				controls[slot][n] = controls[slot][current_cycle];
+				invalidate_from(n);
+			}
 		}
 	}
 
@@ -453,6 +595,8 @@ void read_control_packet(const char* buf, size_t len)
 
 	assert(buf == end_buf);
 
+	compare_checksums();
+
 	++ngood_packets;
 }
 
@@ -472,8 +616,20 @@ void write_control_packet(std::vector<char>& v)
 	v.resize(v.size() + 4);
 	memcpy(&v[v.size()-4], &current_cycle_net, 4);
 
-	//write our checksum of game state
-	int32_t checksum = our_checksums[current_cycle-1];
+	//write our checksum of the game state for the latest cycle which only
+	//depends on confirmed controls, so it can be compared with theirs.
+	int32_t checksum_cycle = -1, checksum = 0;
+	std::map<int, int>::const_iterator checksum_itor = our_checksums.upper_bound(level_cycle_for(our_highest_confirmed()));
+	if(first_invalid_cycle_var == -1 && checksum_itor != our_checksums.begin()) {
+		--checksum_itor;
+		checksum_cycle = checksum_itor->first;
+		checksum = checksum_itor->second;
+	}
+
+	int32_t checksum_cycle_net = htonl(checksum_cycle);
+	v.resize(v.size() + 4);
+	memcpy(&v[v.size()-4], &checksum_cycle_net, 4);
+
 	int32_t checksum_net = htonl(checksum);
 	v.resize(v.size() + 4);
 	memcpy(&v[v.size()-4], &checksum_net, 4);
@@ -494,12 +650,18 @@ void write_control_packet(std::vector<char>& v)
 	v.resize(v.size() + 4);
 	memcpy(&v[v.size()-4], &ncycles_to_write_net, 4);
 
-	v.insert(v.end(), controls[local_player].end() - ncycles_to_write, controls[local_player].end());
+	encode_controls(controls[local_player].end() - ncycles_to_write, controls[local_player].end(), v);
 }
 
 int first_invalid_cycle()
 {
-	return first_invalid_cycle_var;
+	if(first_invalid_cycle_var == -1) {
+		return -1;
+	}
+
+	//the level has to go back to the state before the first cycle which
+	//used the invalid controls.
+	return level_cycle_for(first_invalid_cycle_var) - 1;
 }
 
 void mark_valid()
@@ -536,6 +698,11 @@ int last_packet_size()
 	return last_packet_size_;
 }
 
+int num_desyncs()
+{
+	return ndesyncs;
+}
+
 void set_checksum(int cycle, int sum)
 {
 	our_checksums[cycle] = sum;
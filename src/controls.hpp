@@ -52,9 +52,18 @@ void ignore_current_keypresses();
 void get_control_status(int cycle, int player, bool* output);
 void set_delay(int delay);
 
+//In rollback mode other players' controls are predicted, rather than
+//waited for, until we are max_cycles ahead of the last controls they've
+//confirmed. When a prediction turns out to be wrong, first_invalid_cycle()
+//gives the cycle the level must be replayed from.
+void set_rollback(bool value, int max_cycles=8);
+bool rollback_enabled();
+
 void read_control_packet(const char* buf, size_t len);
 void write_control_packet(std::vector<char>& v);
 
+//the level cycle whose state must be restored and replayed from because
+//controls used after it have changed, or -1 if nothing has changed.
 int first_invalid_cycle();
 void mark_valid();
 
@@ -66,7 +75,10 @@ int cycles_behind();
 int their_highest_confirmed();
 int last_packet_size();
 
+//checksums of the level state are exchanged with other players, to detect
+//the game getting out of sync.
 void set_checksum(int cycle, int sum);
+int num_desyncs();
 
 void debug_dump_controls();
 
@@ -3501,6 +3501,8 @@ void custom_object::set_value_by_slot(int slot, const variant& value)
 		for(int n = 0; n != value.num_elements(); ++n) {
 			platform_offsets_.push_back(value[n].as_int());
 		}
+
+		calculate_solid_rect();
 		break;
 	}
 
@@ -3896,6 +3898,7 @@ bool custom_object::handle_event_internal(int event, const formula_callable* con
 
 	swallow_mouse_event_ = false;
 	backup_callable_stack_scope callable_scope(&backup_callable_stack_, context);
+	formula_profiler::event_cost_scope event_cost(type_.get(), event);
 
 	for(int n = 0; n != nhandlers; ++n) {
 		const game_logic::formula* handler = handlers[n];
@@ -3910,8 +3913,10 @@ bool custom_object::handle_event_internal(int event, const formula_callable* con
 		variant var;
 		
 		try {
-			formula_profiler::instrument instrumentation("FFL");
+			formula_profiler::instrument instrumentation("FFL", type_.get(), event);
+			event_cost.begin_phase(formula_profiler::event_cost_scope::FFL);
 			var = handler->execute(*this);
+			event_cost.end_phase();
 		} catch(validation_failure_exception& e) {
 #ifndef DISABLE_FORMULA_PROFILER
 			event_call_stack.pop_back();
@@ -3928,8 +3933,10 @@ bool custom_object::handle_event_internal(int event, const formula_callable* con
 		
 		try {
 			if(execute_commands_now) {
-				formula_profiler::instrument instrumentation("COMMANDS");
+				formula_profiler::instrument instrumentation("COMMANDS", type_.get(), event);
+				event_cost.begin_phase(formula_profiler::event_cost_scope::COMMANDS);
 				result = execute_command(var);
+				event_cost.end_phase();
 			} else {
 				delayed_commands_.push_back(var);
 			}
@@ -4460,6 +4467,20 @@ rect custom_object::platform_rect_at(int xpos) const
 	return rect(area.x(), area.y() + offset, area.w(), area.h());
 }
 
+rect custom_object::platform_rect_bounds() const
+{
+	rect area = platform_rect();
+	if(platform_offsets_.empty() || area.w() == 0) {
+		return area;
+	}
+
+	//platform_rect_at() is the platform rect shifted by an offset between
+	//the smallest and largest platform offsets.
+	const int min_offset = std::min(0, *std::min_element(platform_offsets_.begin(), platform_offsets_.end()));
+	const int max_offset = std::max(0, *std::max_element(platform_offsets_.begin(), platform_offsets_.end()));
+	return rect(area.x(), area.y() + min_offset, area.w(), area.h() + max_offset - min_offset);
+}
+
 int custom_object::platform_slope_at(int xpos) const
 {
 	if(platform_offsets_.size() <= 1) {
@@ -4600,7 +4621,7 @@ void custom_object::add_to_level()
 	standing_on_.reset();
 }
 
-BENCHMARK(custom_object_spike) {
+BENCHMARK_TAGGED(custom_object_spike, "object") {
 	static level* lvl = NULL;
 	if(!lvl) {	
 		lvl = new level("test.cfg");
@@ -4625,8 +4646,8 @@ BENCHMARK_ARG(custom_object_get_attr, const std::string& attr)
 	}
 }
 
-BENCHMARK_ARG_CALL(custom_object_get_attr, easy_lookup, "x");
-BENCHMARK_ARG_CALL(custom_object_get_attr, hard_lookup, "xxxx");
+BENCHMARK_ARG_CALL_TAGGED(custom_object_get_attr, easy_lookup, "object", "x");
+BENCHMARK_ARG_CALL_TAGGED(custom_object_get_attr, hard_lookup, "object", "xxxx");
 
 BENCHMARK_ARG(custom_object_handle_event, const std::string& object_event)
 {
@@ -4644,6 +4665,6 @@ BENCHMARK_ARG(custom_object_handle_event, const std::string& object_event)
 	}
 }
 
-BENCHMARK_ARG_CALL(custom_object_handle_event, ant_non_exist, "ant_black:blahblah");
+BENCHMARK_ARG_CALL_TAGGED(custom_object_handle_event, ant_non_exist, "object", "ant_black:blahblah");
 
 BENCHMARK_ARG_CALL_COMMAND_LINE(custom_object_handle_event);
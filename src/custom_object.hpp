@@ -258,6 +258,7 @@ protected:
 	virtual void add_to_level();
 
 	virtual rect platform_rect_at(int xpos) const;
+	virtual rect platform_rect_bounds() const;
 	virtual int platform_slope_at(int xpos) const;
 
 	virtual bool solid_platform() const;
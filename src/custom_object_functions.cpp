@@ -6,6 +6,7 @@
 #include <time.h>
 
 #include "achievements.hpp"
+#include "allocation_tracker.hpp"
 #include "asserts.hpp"
 #include "blur.hpp"
 #include "clipboard.hpp"
@@ -22,6 +23,7 @@
 #include "formula_callable_definition.hpp"
 #include "formula_function_registry.hpp"
 #include "formula_profiler.hpp"
+#include "frame_timing.hpp"
 #include "i18n.hpp"
 #include "json_parser.hpp"
 #include "level.hpp"
@@ -36,6 +38,7 @@
 #endif
 #include "texture.hpp"
 #include "message_dialog.hpp"
+#include "multiplayer.hpp"
 #include "options_dialog.hpp"
 #include "playable_custom_object.hpp"
 #include "preferences.hpp"
@@ -76,6 +79,23 @@ FUNCTION_DEF(performance, 0, 0, "performance(): returns an object with current p
 	return variant(performance_data::current());
 END_FUNCTION_DEF(performance)
 
+FUNCTION_DEF(network_stats, 0, 0, "network_stats(): returns a list with the round trip time (rtt), jitter and packet loss to each other player in a multiplayer game")
+	formula::fail_if_static_context();
+	std::vector<variant> result;
+	foreach(const multiplayer::peer_stats& peer, multiplayer::get_peer_stats()) {
+		std::map<variant, variant> m;
+		m[variant("slot")] = variant(peer.slot);
+		m[variant("rtt")] = variant(peer.rtt);
+		m[variant("jitter")] = variant(peer.jitter);
+		m[variant("loss")] = variant(peer.loss_percent);
+		m[variant("packets_sent")] = variant(peer.packets_sent);
+		m[variant("packets_received")] = variant(peer.packets_received);
+		result.push_back(variant(&m));
+	}
+
+	return variant(&result);
+END_FUNCTION_DEF(network_stats)
+
 FUNCTION_DEF(get_clipboard_text, 0, 0, "get_clipboard_text(): returns the text currentl in the windowing clipboard")
 	formula::fail_if_static_context();
 	return variant(copy_from_clipboard(false));
@@ -901,6 +921,128 @@ public:
 	}
 };
 
+FUNCTION_DEF(event_costs, 0, 1, "event_costs(int max_rows=20): returns a list of the most expensive object events since event costs were first asked for or reset, giving the object type and event, the number of calls, the self, inclusive, FFL and command times in microseconds and the number of allocations")
+	formula::fail_if_static_context();
+	formula_profiler::enable_event_costs();
+	const int max_rows = args().size() > 0 ? args()[0]->evaluate(variables).as_int() : 20;
+
+	std::vector<variant> result;
+	foreach(const formula_profiler::event_cost& cost, formula_profiler::get_event_costs()) {
+		if(int(result.size()) >= max_rows) {
+			break;
+		}
+
+		std::map<variant, variant> m;
+		m[variant("type")] = variant(cost.type);
+		m[variant("event")] = variant(cost.event);
+		m[variant("calls")] = variant(cost.calls);
+		m[variant("self_us")] = variant(cost.self_us);
+		m[variant("inclusive_us")] = variant(cost.inclusive_us);
+		m[variant("ffl_us")] = variant(cost.ffl_us);
+		m[variant("commands_us")] = variant(cost.commands_us);
+		m[variant("allocations")] = variant(cost.allocations);
+		result.push_back(variant(&m));
+	}
+
+	return variant(&result);
+END_FUNCTION_DEF(event_costs)
+
+FUNCTION_DEF(allocation_stats, 0, 1, "allocation_stats(int nsites=10): returns the number of allocations and bytes allocated in the last frame, and the mean and worst of recent frames, and the sites which have allocated most, with the instrument and FFL expression they were made in. Only available in builds with TRACK_ALLOCATIONS")
+	formula::fail_if_static_context();
+	const int nsites = args().size() > 0 ? args()[0]->evaluate(variables).as_int() : 10;
+	const allocation_tracker::summary summary = allocation_tracker::get_summary(nsites);
+
+	std::map<variant, variant> m;
+	m[variant("enabled")] = variant::from_bool(allocation_tracker::enabled());
+	m[variant("frames")] = variant(summary.nframes);
+
+	const allocation_tracker::frame_stats* frames[] = { &summary.last, &summary.mean, &summary.worst };
+	const char* frame_names[] = { "last", "mean", "worst" };
+	for(int n = 0; n != 3; ++n) {
+		std::map<variant, variant> frame;
+		frame[variant("allocations")] = variant(frames[n]->allocations);
+		frame[variant("frees")] = variant(frames[n]->frees);
+		frame[variant("bytes")] = variant(frames[n]->bytes);
+		m[variant(frame_names[n])] = variant(&frame);
+	}
+
+	std::vector<variant> sites;
+	foreach(const allocation_tracker::site& site, summary.sites) {
+		std::map<variant, variant> s;
+		s[variant("scope")] = variant(site.scope);
+		s[variant("expression")] = variant(site.expression);
+		s[variant("allocations")] = variant(site.allocations);
+		s[variant("bytes")] = variant(site.bytes);
+		sites.push_back(variant(&s));
+	}
+
+	m[variant("sites")] = variant(&sites);
+	return variant(&m);
+END_FUNCTION_DEF(allocation_stats)
+
+class reset_allocation_stats_command : public game_logic::command_callable {
+public:
+	virtual void execute(game_logic::formula_callable& ob) const {
+		allocation_tracker::reset();
+	}
+};
+
+FUNCTION_DEF(reset_allocation_stats, 0, 0, "reset_allocation_stats(): starts counting the allocations of each site given by allocation_stats() from zero")
+	return variant(new reset_allocation_stats_command);
+END_FUNCTION_DEF(reset_allocation_stats)
+
+FUNCTION_DEF(frame_times, 0, 0, "frame_times(): returns the median, 95th and 99th percentile and maximum times in ms taken by the recent frames, and a histogram of the number of frames taking each number of ms, for each of process, draw, flip and the whole frame")
+	formula::fail_if_static_context();
+	std::map<variant, variant> result;
+	for(int n = 0; n <= frame_timing::NUM_PHASES; ++n) {
+		const frame_timing::PHASE phase = static_cast<frame_timing::PHASE>(n);
+		const frame_timing::phase_stats stats = frame_timing::get_phase_stats(phase);
+
+		std::map<variant, variant> m;
+		m[variant("frames")] = variant(stats.nframes);
+		m[variant("median")] = variant(stats.median);
+		m[variant("p95")] = variant(stats.p95);
+		m[variant("p99")] = variant(stats.p99);
+		m[variant("max")] = variant(stats.max);
+
+		std::vector<variant> histogram;
+		foreach(int count, stats.histogram) {
+			histogram.push_back(variant(count));
+		}
+
+		m[variant("histogram")] = variant(&histogram);
+		result[variant(frame_timing::phase_name(phase))] = variant(&m);
+	}
+
+	return variant(&result);
+END_FUNCTION_DEF(frame_times)
+
+class show_event_costs_command : public game_logic::command_callable {
+	bool show_;
+public:
+	explicit show_event_costs_command(bool show) : show_(show)
+	{}
+
+	virtual void execute(game_logic::formula_callable& ob) const {
+		debug_console::show_event_costs(show_);
+	}
+};
+
+FUNCTION_DEF(show_event_costs, 0, 1, "show_event_costs(bool show=true): shows a table of the most expensive object events on screen, updated as the game runs")
+	return variant(new show_event_costs_command(args().size() > 0 ? args()[0]->evaluate(variables).as_bool() : true));
+END_FUNCTION_DEF(show_event_costs)
+
+class reset_event_costs_command : public game_logic::command_callable {
+public:
+	virtual void execute(game_logic::formula_callable& ob) const {
+		formula_profiler::reset_event_costs();
+	}
+};
+
+FUNCTION_DEF(reset_event_costs, 0, 0, "reset_event_costs(): starts counting the costs shown by event_costs() and show_event_costs() from zero")
+	return variant(new reset_event_costs_command);
+END_FUNCTION_DEF(reset_event_costs)
+
 FUNCTION_DEF(solid, 3, 6, "solid(level, int x, int y, (optional)int w=1, (optional) int h=1, (optional) int debug=0) -> boolean: returns true iff the level contains solid space within the given (x,y,w,h) rectangle. If 'debug' is set, then the tested area will be displayed on-screen.")
 	level* lvl = args()[0]->evaluate(variables).convert_to<level>();
 	const int x = args()[1]->evaluate(variables).as_int();
@@ -11,6 +11,7 @@
 #include "custom_object_type.hpp"
 #include "filesystem.hpp"
 #include "formula_constants.hpp"
+#include "frame_timing.hpp"
 #include "json_parser.hpp"
 #include "level.hpp"
 #include "load_level.hpp"
@@ -358,6 +359,7 @@ custom_object_type_ptr custom_object_type::recreate(const std::string& id,
                                              const custom_object_type* old_type)
 {
 	std::cerr << "CREATE OBJ: "<< id << "\n";
+	frame_timing::note_asset_load("object " + id);
 	if(object_file_paths().empty()) {
 		load_file_paths();
 	}
@@ -1078,7 +1080,7 @@ void custom_object_type::load_variations() const
 #include "texture.hpp"
 #include "surface_cache.hpp"
 
-BENCHMARK(custom_object_type_load)
+BENCHMARK_TAGGED(custom_object_type_load, "object")
 {
 	static std::map<std::string,std::string> file_paths;
 	if(file_paths.empty()) {
@@ -1097,7 +1099,7 @@ BENCHMARK(custom_object_type_load)
 }
 
 
-BENCHMARK(custom_object_type_frogatto_load)
+BENCHMARK_TAGGED(custom_object_type_frogatto_load, "object")
 {
 	BENCHMARK_LOOP {
 		custom_object_type::create("frogatto_playable");
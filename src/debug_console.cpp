@@ -16,6 +16,7 @@
 #include "font.hpp"
 #include "formatter.hpp"
 #include "foreach.hpp"
+#include "formula_profiler.hpp"
 #include "debug_console.hpp"
 #include "decimal.hpp"
 #include "foreach.hpp"
@@ -354,6 +355,37 @@ bool console_dialog::on_begin_enter()
 	return false;
 }
 
+namespace {
+bool event_costs_shown = false;
+}
+
+void show_event_costs(bool value)
+{
+	event_costs_shown = value;
+	if(value) {
+		formula_profiler::enable_event_costs();
+	}
+}
+
+void draw_event_costs()
+{
+	if(!event_costs_shown) {
+		return;
+	}
+
+	//rendering the table is slow, so it's only updated twice a second.
+	static graphics::texture table;
+	static int last_update = 0;
+	if(!table.valid() || SDL_GetTicks() - last_update >= 500) {
+		table = font::render_text_uncached(formula_profiler::get_event_cost_table(20), graphics::color_white(), 12);
+		last_update = SDL_GetTicks();
+	}
+
+	const rect area(10, 280, table.width() + 10, table.height() + 10);
+	graphics::draw_rect(area, graphics::color(0, 0, 0, 160));
+	graphics::blit_texture(table, area.x() + 5, area.y() + 5);
+}
+
 void console_dialog::on_enter()
 {
 }
@@ -21,6 +21,11 @@ void add_graph_sample(const std::string& id, decimal value);
 void process_graph();
 void draw_graph();
 
+//shows a table of the most expensive object events, updated as the game
+//runs, for finding which object scripts need optimizing.
+void show_event_costs(bool value);
+void draw_event_costs();
+
 void add_message(const std::string& msg);
 void draw();
 
@@ -169,7 +169,7 @@ UNIT_TEST(decimal_div) {
 	CHECK_EQ(decimal::from_raw_value(DECIMAL(10934540000))/decimal::from_raw_value(DECIMAL(7649440000)), decimal::from_raw_value(DECIMAL(1429456)));
 }
 
-BENCHMARK(decimal_div_bench) {
+BENCHMARK_TAGGED(decimal_div_bench, "formula") {
 	BENCHMARK_LOOP {
 		decimal res(decimal::from_raw_value(DECIMAL(0)));
 		for(int n = 1; n < 1000000; ++n) {
@@ -7,6 +7,7 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/scoped_ptr.hpp>
 
+#include "allocation_tracker.hpp"
 #include "asserts.hpp"
 #include "controls.hpp"
 #include "debug_console.hpp"
@@ -16,12 +17,14 @@
 #include "font.hpp"
 #include "foreach.hpp"
 #include "formula_profiler.hpp"
+#include "frame_timing.hpp"
 #include "globals.h"
 #include "graphical_font.hpp"
 #include "gui_section.hpp"
 #include "i18n.hpp"
 #include "level.hpp"
 #include "message_dialog.hpp"
+#include "multiplayer.hpp"
 #include "player_info.hpp"
 #include "preferences.hpp"
 #include "raster.hpp"
@@ -394,6 +397,7 @@ void render_scene(const level& lvl, screen_position& pos, const entity* focus, b
 #endif
 
 	debug_console::draw_graph();
+	debug_console::draw_event_costs();
 
 	if (!pause_stack) lvl.draw_status();
 
@@ -552,12 +556,38 @@ void draw_fps(const level& lvl, const performance_data& data)
 
 	rect area = font->draw(10, 60, s.str());
 
+	{
+		std::ostringstream s;
+		s << "frame ms";
+		for(int n = 0; n <= frame_timing::NUM_PHASES; ++n) {
+			const frame_timing::PHASE phase = static_cast<frame_timing::PHASE>(n);
+			const frame_timing::phase_stats stats = frame_timing::get_phase_stats(phase);
+			s << "; " << frame_timing::phase_name(phase) << " " << stats.median << "/" << stats.p95 << "/" << stats.p99 << "/" << stats.max;
+		}
+
+		s << " (median/95%/99%/max)";
+		area = font->draw(10, area.y2() + 5, s.str());
+	}
+
+	if(allocation_tracker::enabled()) {
+		const allocation_tracker::summary allocs = allocation_tracker::get_summary(0);
+		std::ostringstream s;
+		s << allocs.last.allocations << " allocs (" << allocs.last.bytes/1024 << "kb) last frame; " << allocs.mean.allocations << " mean; " << allocs.worst.allocations << " worst";
+		area = font->draw(10, area.y2() + 5, s.str());
+	}
+
 	if(controls::num_players() > 1) {
 		//draw networking stats
 		std::ostringstream s;
 		s << controls::packets_received() << " packets received; " << controls::num_errors() << " errors; " << controls::cycles_behind() << " behind; " << controls::their_highest_confirmed() << " remote cycles " << controls::last_packet_size() << " packet";
 
 		area = font->draw(10, area.y2() + 5, s.str());
+
+		foreach(const multiplayer::peer_stats& peer, multiplayer::get_peer_stats()) {
+			std::ostringstream s;
+			s << "player " << peer.slot << ": " << peer.rtt << "ms rtt; " << peer.jitter << "ms jitter; " << peer.loss_percent << "% loss";
+			area = font->draw(10, area.y2() + 5, s.str());
+		}
 	}
 
 	if(!data.profiling_info.empty()) {
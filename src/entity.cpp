@@ -186,6 +186,8 @@ void entity::calculate_solid_rect()
 	} else {
 		platform_rect_ = rect();
 	}
+
+	solid_index_link_.notify(this);
 }
 
 rect entity::body_rect() const
@@ -14,6 +14,7 @@
 #include "geometry.hpp"
 #include "key.hpp"
 #include "light.hpp"
+#include "solid_entity_index.hpp"
 #include "solid_map_fwd.hpp"
 #include "wml_formula_callable.hpp"
 #include "variant.hpp"
@@ -102,6 +103,9 @@ public:
 	const rect& frame_rect() const { return frame_rect_; }
 	rect platform_rect() const { return platform_rect_; }
 	virtual rect platform_rect_at(int xpos) const { return platform_rect(); }
+
+	//the area covered by platform_rect_at() for any position.
+	virtual rect platform_rect_bounds() const { return platform_rect(); }
 	virtual int platform_slope_at(int xpos) const { return 0; }
 	virtual bool solid_platform() const { return false; }
 	rect body_rect() const;
@@ -352,6 +356,11 @@ private:
 	int platform_motion_x_;
 
 	std::string spawned_by_;
+
+	//the solid indexes of any levels we're in, which are told whenever
+	//our solid or platform rect changes.
+	friend class solid_entity_index;
+	solid_entity_index_link solid_index_link_;
 };
 
 bool zorder_compare(const entity_ptr& e1, const entity_ptr& e2);	
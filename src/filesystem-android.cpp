@@ -276,6 +276,11 @@ int64_t file_mod_time(const std::string& fname)
 	return 0;
 }
 
+int64_t file_size(const std::string& fname)
+{
+	return -1;
+}
+
 bool file_exists(const std::string& name)
 {
 	return do_file_exists(find_file(name));
@@ -666,6 +666,15 @@ int64_t file_mod_time(const std::string& fname)
 	return static_cast<int64_t>(buf.st_mtime);
 }
 
+int64_t file_size(const std::string& fname)
+{
+	struct stat buf;
+	if(stat(fname.c_str(), &buf)) {
+		return -1;
+	}
+	return static_cast<int64_t>(buf.st_size);
+}
+
 bool file_exists(const std::string& name)
 {
 	return do_file_exists(find_file(name));
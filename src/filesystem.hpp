@@ -62,6 +62,9 @@ std::string find_file(const std::string& name);
 
 int64_t file_mod_time(const std::string& fname);
 
+//the size of a file in bytes, or -1 if it can't be found.
+int64_t file_size(const std::string& fname);
+
 #if defined(__ANDROID__)
 SDL_RWops* read_sdl_rw_from_asset(const std::string& name);
 void print_assets();
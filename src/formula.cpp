@@ -2231,7 +2231,7 @@ UNIT_TEST(formula_list_comprehension) {
 	CHECK_EQ(formula(variant("[x | x <- [0,1,2,3], x%2 = 1]")).execute(), formula(variant("[1,3]")).execute());
 }
 
-BENCHMARK(formula_list_comprehension_bench) {
+BENCHMARK_TAGGED(formula_list_comprehension_bench, "formula") {
 	formula f(variant("[x*x + 5 | x <- range(input)]"));
 	static map_formula_callable* callable = new map_formula_callable;
 	callable->add("input", variant(1000));
@@ -2240,7 +2240,7 @@ BENCHMARK(formula_list_comprehension_bench) {
 	}
 }
 
-BENCHMARK(formula_map_bench) {
+BENCHMARK_TAGGED(formula_map_bench, "formula") {
 	formula f(variant("map(range(input), value*value + 5)"));
 	static map_formula_callable* callable = new map_formula_callable;
 	callable->add("input", variant(1000));
@@ -2249,7 +2249,7 @@ BENCHMARK(formula_map_bench) {
 	}
 }
 
-BENCHMARK(formula_recurse_sort) {
+BENCHMARK_TAGGED(formula_recurse_sort, "formula") {
 	formula f(variant(
 "def my_qsort(items) if(size(items) <= 1, items,"
 " my_qsort(filter(items, i, i < items[0])) +"
@@ -2273,7 +2273,7 @@ BENCHMARK(formula_recurse_sort) {
 	}
 }
 
-BENCHMARK(formula_recursion) {
+BENCHMARK_TAGGED(formula_recursion, "formula") {
 	formula f(variant(
 "def my_index(ls, item, n)"
 "base ls = []: -1 "
@@ -2293,7 +2293,7 @@ BENCHMARK(formula_recursion) {
 	}
 }
 
-BENCHMARK(formula_if) {
+BENCHMARK_TAGGED(formula_if, "formula") {
 	static map_formula_callable* callable = new map_formula_callable;
 	callable->add("x", variant(1));
 	static formula f(variant("if(x, 1, 0)"));
@@ -2302,7 +2302,7 @@ BENCHMARK(formula_if) {
 	}
 }
 
-BENCHMARK(formula_add) {
+BENCHMARK_TAGGED(formula_add, "formula") {
 	static map_formula_callable* callable = new map_formula_callable;
 	callable->add("x", variant(1));
 	static formula f(variant("x+1"));
@@ -2508,7 +2508,7 @@ UNIT_TEST(where_scope_function) {
 	CHECK(game_logic::formula(variant("'five: ${five}' where five = 5")).execute() == game_logic::formula(variant("'five: 5'")).execute(), "string where test failed");
 }
 
-BENCHMARK(map_function) {
+BENCHMARK_TAGGED(map_function, "formula") {
 	using namespace game_logic;
 
 	static map_formula_callable* callable = NULL;
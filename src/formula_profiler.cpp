@@ -2,7 +2,14 @@
 
 #include <SDL_thread.h>
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <x86intrin.h>
+#endif
+
 #include <assert.h>
+#include <algorithm>
 #include <iostream>
 #include <map>
 #include <string>
@@ -11,69 +18,270 @@
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
-#if !defined( _WINDOWS )
+#if defined(_WINDOWS)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#elif defined(__APPLE__)
+#include <mach/mach_time.h>
 #include <sys/time.h>
 #else
+#include <sys/time.h>
 #include <time.h>
-#endif // defined( _WINDOWS )
+#endif
 
+#include "allocation_tracker.hpp"
 #include "custom_object_type.hpp"
 #include "filesystem.hpp"
 #include "foreach.hpp"
 #include "formatter.hpp"
 #include "formula_profiler.hpp"
 #include "object_events.hpp"
+#include "thread.hpp"
 #include "variant.hpp"
 
+#if defined(_MSC_VER) || (defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)))
+#define PROFILER_USE_TSC
+#endif
+
 namespace formula_profiler
 {
 
 namespace {
 bool profiler_on = false;
+bool tracing_on = false;
+int ninstrumentation_scopes = 0;
+
+//whether instruments have anything to do. This is tested by every
+//instrument, so is kept up to date as a single flag.
+bool instruments_on = false;
+
+void update_instruments_on()
+{
+	instruments_on = profiler_on || tracing_on || ninstrumentation_scopes;
+}
+
+int64_t get_time_ns()
+{
+#if defined(_WINDOWS)
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (count.QuadPart/freq.QuadPart)*1000000000LL + ((count.QuadPart%freq.QuadPart)*1000000000LL)/freq.QuadPart;
+#elif defined(__APPLE__)
+	static mach_timebase_info_data_t timebase;
+	if(timebase.denom == 0) {
+		mach_timebase_info(&timebase);
+	}
+
+	return int64_t(mach_absolute_time()*double(timebase.numer)/timebase.denom);
+#else
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return int64_t(ts.tv_sec)*1000000000LL + ts.tv_nsec;
+#endif
+}
+
+//instruments are timed with the CPU's time stamp counter where there is
+//one, since it's much cheaper to read than the system clock.
+inline int64_t get_ticks()
+{
+#ifdef PROFILER_USE_TSC
+	return __rdtsc();
+#else
+	return get_time_ns();
+#endif
+}
+
+//measures how fast the ticks go against the system clock the first time
+//it's called, which takes 10ms.
+double ticks_per_us()
+{
+	static double result = 0.0;
+	if(result == 0.0) {
+#ifdef PROFILER_USE_TSC
+		const int64_t start_ns = get_time_ns();
+		const int64_t start_ticks = get_ticks();
+		int64_t end_ns;
+		do {
+			end_ns = get_time_ns();
+		} while(end_ns - start_ns < 10000000);
+
+		result = double(get_ticks() - start_ticks)*1000.0/double(end_ns - start_ns);
+#else
+		result = 1000.0;
+#endif
+	}
+
+	return result;
+}
+
+int ticks_to_us(int64_t ticks)
+{
+	return int(ticks/ticks_per_us());
+}
 
 struct InstrumentationRecord {
-	InstrumentationRecord() : time_us(0), nsamples(0)
+	InstrumentationRecord() : ticks(0), nsamples(0)
 	{}
-	int time_us, nsamples;
+	int64_t ticks;
+	int nsamples;
 };
 
 std::map<const char*, InstrumentationRecord> g_instrumentation;
+
+//totals for the current frame, which are zeroed rather than erased at the
+//end of the frame, so they don't allocate once every instrument is in.
+std::map<const char*, InstrumentationRecord> g_frame_instrumentation;
+
+struct trace_event {
+	const char* id;
+	const custom_object_type* type;
+	int event_id;
+	int depth;
+	int64_t start, end;
+};
+
+const unsigned int TraceBufferSize = 1 << 16;
+
+//each thread that records trace events has its own buffer, which only it
+//writes to, so recording an event takes no lock. Once it's full the oldest
+//events are overwritten.
+struct trace_buffer {
+	explicit trace_buffer(Uint32 id) : events(TraceBufferSize), nevents(0), depth(0), thread_id(id)
+	{}
+	std::vector<trace_event> events;
+
+	//how many events have ever been written. The event is written before
+	//this is incremented, with a barrier in between, so a reader on another
+	//thread only sees complete events.
+	volatile unsigned int nevents;
+
+	int depth;
+	Uint32 thread_id;
+};
+
+#if defined(_MSC_VER)
+__declspec(thread) trace_buffer* thread_trace_buffer = NULL;
+#else
+__thread trace_buffer* thread_trace_buffer = NULL;
+#endif
+
+threading::mutex& trace_buffers_mutex()
+{
+	static threading::mutex mutex;
+	return mutex;
 }
 
-instrument::instrument(const char* id) : id_(id)
+//every buffer ever made. They're never freed, so the events of threads
+//which have finished can still be written out.
+std::vector<trace_buffer*> trace_buffers;
+
+int64_t trace_start_ticks = 0;
+
+std::string trace_output_file = "trace.json";
+
+trace_buffer& get_thread_trace_buffer()
 {
-	if(profiler_on) {
-		gettimeofday(&tv_, NULL);
+	if(thread_trace_buffer == NULL) {
+		thread_trace_buffer = new trace_buffer(SDL_ThreadID());
+		threading::lock l(trace_buffers_mutex());
+		trace_buffers.push_back(thread_trace_buffer);
 	}
+
+	return *thread_trace_buffer;
+}
+
+void memory_barrier()
+{
+#ifdef _WINDOWS
+	MemoryBarrier();
+#else
+	__sync_synchronize();
+#endif
+}
+}
+
+instrument::instrument(const char* id) : id_(id), type_(NULL), event_id_(-1), start_(0), traced_(false)
+{
+#ifdef TRACK_ALLOCATIONS
+	previous_allocation_scope_ = allocation_tracker::set_scope(id);
+#endif
+
+	if(instruments_on) {
+		start();
+	}
+}
+
+instrument::instrument(const char* id, const custom_object_type* type, int event_id) : id_(id), type_(type), event_id_(event_id), start_(0), traced_(false)
+{
+#ifdef TRACK_ALLOCATIONS
+	previous_allocation_scope_ = allocation_tracker::set_scope(id);
+#endif
+
+	if(instruments_on) {
+		start();
+	}
+}
+
+void instrument::start()
+{
+	traced_ = tracing_on;
+	if(traced_) {
+		get_thread_trace_buffer().depth++;
+	}
+
+	start_ = get_ticks();
 }
 
 instrument::~instrument()
 {
-	if(profiler_on) {
-		struct timeval end_tv;
-		gettimeofday(&end_tv, NULL);
-		const int time_us = (end_tv.tv_sec - tv_.tv_sec)*1000000 + (end_tv.tv_usec - tv_.tv_usec);
-		InstrumentationRecord& r = g_instrumentation[id_];
-		r.time_us += (end_tv.tv_sec - tv_.tv_sec)*1000000 + (end_tv.tv_usec - tv_.tv_usec);
-		r.nsamples++;
+#ifdef TRACK_ALLOCATIONS
+	allocation_tracker::set_scope(previous_allocation_scope_);
+#endif
+
+	if(start_) {
+		const int64_t end = get_ticks();
+		if(traced_) {
+			trace_buffer& buf = get_thread_trace_buffer();
+			--buf.depth;
+			trace_event& e = buf.events[buf.nevents%TraceBufferSize];
+			e.id = id_;
+			e.type = type_;
+			e.event_id = event_id_;
+			e.depth = buf.depth;
+			e.start = start_;
+			e.end = end;
+			memory_barrier();
+			buf.nevents++;
+		}
+
+		if(profiler_on || ninstrumentation_scopes) {
+			InstrumentationRecord& r = g_instrumentation[id_];
+			r.ticks += end - start_;
+			r.nsamples++;
+
+			InstrumentationRecord& frame = g_frame_instrumentation[id_];
+			frame.ticks += end - start_;
+			frame.nsamples++;
+		}
 	}
 }
 
 void dump_instrumentation()
 {
-	static struct timeval prev_call;
+	static int64_t prev_call;
 	static bool first_call = true;
 
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
+	const int64_t ticks = get_ticks();
 
 	if(!first_call && g_instrumentation.empty() == false) {
-		const int time_us = (tv.tv_sec - prev_call.tv_sec)*1000000 + (tv.tv_usec - prev_call.tv_usec);
+		const int time_us = ticks_to_us(ticks - prev_call);
 		if(time_us) {
 			fprintf(stderr, "FRAME INSTRUMENTATION TOTAL TIME: %dus. INSTRUMENTS: ", time_us);
 			for(std::map<const char*,InstrumentationRecord>::const_iterator i = g_instrumentation.begin(); i != g_instrumentation.end(); ++i) {
-				const int percent = (i->second.time_us*100)/time_us;
-				fprintf(stderr, "%s: %dus (%d%%) in %d calls; ", i->first, i->second.time_us, percent, i->second.nsamples);
+				const int instrument_us = ticks_to_us(i->second.ticks);
+				const int percent = (instrument_us*100)/time_us;
+				fprintf(stderr, "%s: %dus (%d%%) in %d calls; ", i->first, instrument_us, percent, i->second.nsamples);
 			}
 
 			fprintf(stderr, "\n");
@@ -83,7 +291,62 @@ void dump_instrumentation()
 	}
 
 	first_call = false;
-	prev_call = tv;
+	prev_call = ticks;
+}
+
+instrumentation_scope::instrumentation_scope()
+{
+	ticks_per_us();
+	if(ninstrumentation_scopes++ == 0) {
+		g_instrumentation.clear();
+	}
+
+	update_instruments_on();
+}
+
+instrumentation_scope::~instrumentation_scope()
+{
+	--ninstrumentation_scopes;
+	update_instruments_on();
+}
+
+std::vector<instrument_total> get_instrumentation()
+{
+	std::vector<instrument_total> result;
+	for(std::map<const char*,InstrumentationRecord>::const_iterator i = g_instrumentation.begin(); i != g_instrumentation.end(); ++i) {
+		instrument_total total;
+		total.id = i->first;
+		total.time_us = ticks_to_us(i->second.ticks);
+		total.nsamples = i->second.nsamples;
+		result.push_back(total);
+	}
+
+	return result;
+}
+
+std::vector<instrument_total> get_frame_instrumentation()
+{
+	std::vector<instrument_total> result;
+	for(std::map<const char*,InstrumentationRecord>::const_iterator i = g_frame_instrumentation.begin(); i != g_frame_instrumentation.end(); ++i) {
+		if(i->second.nsamples == 0) {
+			continue;
+		}
+
+		instrument_total total;
+		total.id = i->first;
+		total.time_us = ticks_to_us(i->second.ticks);
+		total.nsamples = i->second.nsamples;
+		result.push_back(total);
+	}
+
+	return result;
+}
+
+void clear_frame_instrumentation()
+{
+	for(std::map<const char*,InstrumentationRecord>::iterator i = g_frame_instrumentation.begin(); i != g_frame_instrumentation.end(); ++i) {
+		i->second = InstrumentationRecord();
+	}
 }
 
 event_call_stack_type event_call_stack;
@@ -160,7 +423,9 @@ manager::manager(const char* output_file)
 		main_thread = SDL_GetThreadID(NULL);
 
 		fprintf(stderr, "SETTING UP PROFILING...\n");
+		ticks_per_us();
 		profiler_on = true;
+		update_instruments_on();
 		output_fname = output_file;
 
 #if defined(_WINDOWS) || defined(TARGET_OS_IPHONE)
@@ -285,6 +550,7 @@ void end_profiling()
 		}
 
 		profiler_on = false;
+		update_instruments_on();
 	}
 }
 
@@ -355,6 +621,265 @@ std::string get_profile_summary()
 	return s.str();
 }
 
+void start_tracing()
+{
+	if(tracing_on) {
+		return;
+	}
+
+	ticks_per_us();
+	if(trace_start_ticks == 0) {
+		trace_start_ticks = get_ticks();
+	}
+
+	tracing_on = true;
+	update_instruments_on();
+	std::cerr << "TRACING STARTED\n";
+}
+
+void stop_tracing()
+{
+	if(tracing_on) {
+		tracing_on = false;
+		update_instruments_on();
+		std::cerr << "TRACING STOPPED\n";
+	}
+}
+
+bool tracing()
+{
+	return tracing_on;
+}
+
+namespace {
+void write_json_string(std::ostream& s, const std::string& str)
+{
+	s << '"';
+	foreach(char c, str) {
+		if(c == '"' || c == '\\') {
+			s << '\\' << c;
+		} else if(c >= 0 && c < ' ') {
+			s << ' ';
+		} else {
+			s << c;
+		}
+	}
+	s << '"';
+}
+}
+
+void write_trace(const std::string& fname)
+{
+	const double us_per_tick = 1.0/ticks_per_us();
+
+	std::vector<trace_buffer*> buffers;
+	{
+		threading::lock l(trace_buffers_mutex());
+		buffers = trace_buffers;
+	}
+
+	std::ostringstream s;
+	s.precision(3);
+	s << std::fixed << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+
+	int nevents = 0;
+	bool first = true;
+	foreach(const trace_buffer* buf, buffers) {
+		const unsigned int end = buf->nevents;
+		memory_barrier();
+		const unsigned int begin = end > TraceBufferSize ? end - TraceBufferSize : 0;
+
+		s << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buf->thread_id << ",\"args\":{\"name\":\"thread " << buf->thread_id << "\"}}";
+		first = false;
+
+		for(unsigned int n = begin; n != end; ++n) {
+			const trace_event& e = buf->events[n%TraceBufferSize];
+
+			s << ",\n{\"name\":";
+			write_json_string(s, e.id);
+			s << ",\"cat\":\"frogatto\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buf->thread_id
+			  << ",\"ts\":" << (e.start - trace_start_ticks)*us_per_tick
+			  << ",\"dur\":" << (e.end - e.start)*us_per_tick
+			  << ",\"args\":{\"depth\":" << e.depth;
+			if(e.type) {
+				s << ",\"object\":";
+				write_json_string(s, e.type->id());
+			}
+
+			if(e.event_id >= 0) {
+				s << ",\"event\":";
+				write_json_string(s, get_object_event_str(e.event_id));
+			}
+
+			s << "}}";
+			++nevents;
+		}
+	}
+
+	s << "\n]}\n";
+
+	sys::write_file(fname, s.str());
+	std::cerr << "WROTE " << nevents << " TRACE EVENTS TO " << fname << "\n";
+}
+
+void toggle_tracing()
+{
+	if(tracing_on) {
+		stop_tracing();
+		write_trace(trace_output_file);
+	} else {
+		start_tracing();
+	}
+}
+
+trace_manager::trace_manager(const std::string& output_file) : output_file_(output_file)
+{
+	if(output_file_.empty() == false) {
+		trace_output_file = output_file_;
+		start_tracing();
+	}
+}
+
+trace_manager::~trace_manager()
+{
+	if(output_file_.empty() == false) {
+		stop_tracing();
+		write_trace(output_file_);
+	}
+}
+
+namespace {
+bool event_costs_on = false;
+
+struct event_cost_record {
+	event_cost_record() : calls(0), inclusive(0), self(0), ffl(0), commands(0), allocations(0)
+	{}
+	int calls;
+	int64_t inclusive, self, ffl, commands;
+	int allocations;
+};
+
+//keyed by the type's id and the event. Not by the type's address, since
+//types are freed when they're reloaded and the address may be reused.
+typedef std::map<std::pair<std::string, int>, event_cost_record> event_cost_map;
+
+event_cost_map event_costs;
+
+//the innermost event being accounted for.
+event_cost_scope* current_event_cost_scope = NULL;
+
+bool event_cost_greater(const event_cost& a, const event_cost& b)
+{
+	return a.self_us > b.self_us;
+}
+}
+
+void enable_event_costs()
+{
+	if(!event_costs_on) {
+		ticks_per_us();
+		event_costs_on = true;
+	}
+}
+
+void reset_event_costs()
+{
+	event_costs.clear();
+}
+
+std::vector<event_cost> get_event_costs()
+{
+	std::vector<event_cost> result;
+	for(event_cost_map::const_iterator i = event_costs.begin(); i != event_costs.end(); ++i) {
+		const event_cost_record& r = i->second;
+		event_cost cost;
+		cost.type = i->first.first;
+		cost.event = get_object_event_str(i->first.second);
+		cost.calls = r.calls;
+		cost.inclusive_us = ticks_to_us(r.inclusive);
+		cost.self_us = ticks_to_us(r.self);
+		cost.ffl_us = ticks_to_us(r.ffl);
+		cost.commands_us = ticks_to_us(r.commands);
+		cost.allocations = r.allocations;
+		result.push_back(cost);
+	}
+
+	std::sort(result.begin(), result.end(), event_cost_greater);
+	return result;
+}
+
+std::string get_event_cost_table(int max_rows)
+{
+	const std::vector<event_cost> costs = get_event_costs();
+
+	std::ostringstream s;
+	char buf[256];
+	sprintf(buf, "%-32s %8s %9s %9s %9s %9s %8s", "OBJECT:EVENT", "CALLS", "SELF(ms)", "INCL(ms)", "FFL(ms)", "CMD(ms)", "ALLOCS");
+	s << buf;
+	for(int n = 0; n < int(costs.size()) && n < max_rows; ++n) {
+		const event_cost& c = costs[n];
+		sprintf(buf, "\n%-32s %8d %9.1f %9.1f %9.1f %9.1f %8d", (c.type + ":" + c.event).substr(0, 32).c_str(), c.calls, c.self_us/1000.0, c.inclusive_us/1000.0, c.ffl_us/1000.0, c.commands_us/1000.0, c.allocations);
+		s << buf;
+	}
+
+	return s.str();
+}
+
+event_cost_scope::event_cost_scope(const custom_object_type* type, int event_id)
+  : type_(type), event_id_(event_id), active_(event_costs_on), parent_(NULL),
+    start_(0), children_(0), allocations_(0), phase_(-1), phase_start_(0)
+{
+	phase_ticks_[FFL] = phase_ticks_[COMMANDS] = 0;
+	if(active_) {
+		parent_ = current_event_cost_scope;
+		current_event_cost_scope = this;
+		allocations_ = get_variant_allocations();
+		start_ = get_ticks();
+	}
+}
+
+event_cost_scope::~event_cost_scope()
+{
+	if(!active_) {
+		return;
+	}
+
+	end_phase();
+
+	const int64_t inclusive = get_ticks() - start_;
+
+	event_cost_record& r = event_costs[std::pair<std::string, int>(type_->id(), event_id_)];
+	r.calls++;
+
+	r.inclusive += inclusive;
+	r.self += inclusive - children_;
+	r.ffl += phase_ticks_[FFL];
+	r.commands += phase_ticks_[COMMANDS];
+	r.allocations += get_variant_allocations() - allocations_;
+
+	current_event_cost_scope = parent_;
+	if(parent_) {
+		parent_->children_ += inclusive;
+	}
+}
+
+void event_cost_scope::begin_phase(PHASE phase)
+{
+	if(active_) {
+		end_phase();
+		phase_ = phase;
+		phase_start_ = get_ticks();
+	}
+}
+
+void event_cost_scope::end_phase()
+{
+	if(active_ && phase_ != -1) {
+		phase_ticks_[phase_] += get_ticks() - phase_start_;
+		phase_ = -1;
+	}
+}
+
 }
 
 #endif
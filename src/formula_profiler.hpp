@@ -2,9 +2,12 @@
 #define FORMULA_PROFILER_HPP_INCLUDED
 
 #include <string>
+#include <vector>
 
 #ifdef DISABLE_FORMULA_PROFILER
 
+class custom_object_type;
+
 namespace formula_profiler
 {
 
@@ -14,8 +17,22 @@ class instrument
 {
 public:
 	explicit instrument(const char* id) {}
+	instrument(const char* id, const custom_object_type* type, int event_id) {}
 	~instrument() {}
-}
+};
+
+class instrumentation_scope
+{
+};
+
+struct instrument_total {
+	std::string id;
+	int time_us, nsamples;
+};
+
+inline std::vector<instrument_total> get_instrumentation() { return std::vector<instrument_total>(); }
+inline std::vector<instrument_total> get_frame_instrumentation() { return std::vector<instrument_total>(); }
+inline void clear_frame_instrumentation() {}
 
 //should be called every cycle while the profiler is running.
 void pump();
@@ -33,36 +50,97 @@ class suspend_scope
 
 inline std::string get_profile_summary() { return ""; }
 
+inline void start_tracing() {}
+inline void stop_tracing() {}
+inline bool tracing() { return false; }
+inline void write_trace(const std::string& fname) {}
+inline void toggle_tracing() {}
+
+class trace_manager
+{
+public:
+	explicit trace_manager(const std::string& output_file) {}
+};
+
+struct event_cost {
+	std::string type, event;
+	int calls, inclusive_us, self_us, ffl_us, commands_us, allocations;
+};
+
+inline void enable_event_costs() {}
+inline void reset_event_costs() {}
+inline std::vector<event_cost> get_event_costs() { return std::vector<event_cost>(); }
+inline std::string get_event_cost_table(int max_rows) { return ""; }
+
+class event_cost_scope
+{
+public:
+	enum PHASE { FFL, COMMANDS };
+	event_cost_scope(const custom_object_type* type, int event_id) {}
+	void begin_phase(PHASE phase) {}
+	void end_phase() {}
+};
+
 }
 
 #else
 
+#include <stdint.h>
 #include <vector>
 
-#if defined(_WINDOWS)
-#include "utils.hpp"
-#else
-#include <sys/time.h>
-#endif
-
 class custom_object_type;
 
 namespace formula_profiler
 {
 
-//instruments inside a given scope.
+//instruments inside a given scope. When tracing, the object type and
+//event being handled, if given, are recorded with the trace event.
 class instrument
 {
 public:
 	explicit instrument(const char* id);
+	instrument(const char* id, const custom_object_type* type, int event_id);
 	~instrument();
 private:
+	void start();
+
 	const char* id_;
-	struct timeval tv_;
+	const custom_object_type* type_;
+	int event_id_;
+
+	//0 if the profiler was off when this was made.
+	int64_t start_;
+	bool traced_;
+
+#ifdef TRACK_ALLOCATIONS
+	const char* previous_allocation_scope_;
+#endif
 };
 
 void dump_instrumentation();
 
+//while one of these exists, instruments are timed even if the profiler
+//isn't running. The totals start from zero when the first one is made.
+class instrumentation_scope
+{
+public:
+	instrumentation_scope();
+	~instrumentation_scope();
+};
+
+struct instrument_total {
+	std::string id;
+	int time_us, nsamples;
+};
+
+//the time spent in each instrument since the totals were last cleared.
+std::vector<instrument_total> get_instrumentation();
+
+//the time spent in each instrument since clear_frame_instrumentation()
+//was last called, which should be done at the end of each frame.
+std::vector<instrument_total> get_frame_instrumentation();
+void clear_frame_instrumentation();
+
 //should be called every cycle while the profiler is running.
 void pump();
 
@@ -97,6 +175,81 @@ private:
 
 std::string get_profile_summary();
 
+//Tracing records every instrument, with when it started and finished, how
+//deeply it was nested, and which thread it was on, in a ring buffer per
+//thread holding the most recent events. It can be switched on and off at
+//any time, and costs a test of a flag per instrument while it is off.
+void start_tracing();
+void stop_tracing();
+bool tracing();
+
+//writes the events traced so far in the Chrome trace event format, which
+//can be loaded into chrome://tracing or Perfetto.
+void write_trace(const std::string& fname);
+
+//starts tracing, or stops it and writes the trace to the trace_manager's
+//output file, or trace.json if there is none.
+void toggle_tracing();
+
+//traces from when it's made until it's destroyed, then writes the trace
+//to the output file. Does nothing if the output file is empty.
+class trace_manager
+{
+public:
+	explicit trace_manager(const std::string& output_file);
+	~trace_manager();
+private:
+	std::string output_file_;
+};
+
+//the cost of the handlers of one event for one type of object, since
+//event costs were enabled or last reset. Self time excludes the time
+//spent in events fired from within the handlers, while the other times
+//include it. Allocations are the lists, maps, strings and functions
+//allocated for variants.
+struct event_cost {
+	std::string type, event;
+	int calls, inclusive_us, self_us, ffl_us, commands_us, allocations;
+};
+
+//event costs aren't accounted until they're enabled, after which they're
+//accounted all the time.
+void enable_event_costs();
+void reset_event_costs();
+
+//the costs of every event handled, most self time first.
+std::vector<event_cost> get_event_costs();
+
+//a table of the max_rows most expensive events.
+std::string get_event_cost_table(int max_rows);
+
+//accounts for the cost of handling an event, while it's in scope. The
+//phases divide the time between evaluating FFL and executing commands.
+class event_cost_scope
+{
+public:
+	enum PHASE { FFL, COMMANDS };
+
+	event_cost_scope(const custom_object_type* type, int event_id);
+	~event_cost_scope();
+
+	void begin_phase(PHASE phase);
+	void end_phase();
+private:
+	event_cost_scope(const event_cost_scope&);
+	void operator=(const event_cost_scope&);
+
+	const custom_object_type* type_;
+	int event_id_;
+	bool active_;
+	event_cost_scope* parent_;
+	int64_t start_, children_;
+	int allocations_;
+
+	int phase_;
+	int64_t phase_start_, phase_ticks_[2];
+};
+
 }
 
 #endif
@@ -104,7 +104,7 @@ UNIT_TEST(formula)
 
 }
 
-BENCHMARK(construct_int_variant)
+BENCHMARK_TAGGED(construct_int_variant, "formula")
 {
 	BENCHMARK_LOOP {
 		variant v(0);
@@ -120,14 +120,14 @@ BENCHMARK_ARG(formula, const std::string& fm)
 	}
 }
 
-BENCHMARK_ARG_CALL(formula, integer, "0");
-BENCHMARK_ARG_CALL(formula, where, "x where x = 5");
-BENCHMARK_ARG_CALL(formula, add, "5 + 4");
-BENCHMARK_ARG_CALL(formula, arithmetic, "(5 + 4)*17 + 12*9 - 5/2");
-BENCHMARK_ARG_CALL(formula, read_input, "char");
-BENCHMARK_ARG_CALL(formula, read_input_sub, "char.strength");
-BENCHMARK_ARG_CALL(formula, array, "[4, 5, 8, 12, 17, 0, 19]");
-BENCHMARK_ARG_CALL(formula, array_str, "['stand', 'walk', 'run', 'jump']");
-BENCHMARK_ARG_CALL(formula, string, "'blah'");
-BENCHMARK_ARG_CALL(formula, null_function, "null()");
-BENCHMARK_ARG_CALL(formula, if_function, "if(4 > 5, 7, 8)");
+BENCHMARK_ARG_CALL_TAGGED(formula, integer, "formula", "0");
+BENCHMARK_ARG_CALL_TAGGED(formula, where, "formula", "x where x = 5");
+BENCHMARK_ARG_CALL_TAGGED(formula, add, "formula", "5 + 4");
+BENCHMARK_ARG_CALL_TAGGED(formula, arithmetic, "formula", "(5 + 4)*17 + 12*9 - 5/2");
+BENCHMARK_ARG_CALL_TAGGED(formula, read_input, "formula", "char");
+BENCHMARK_ARG_CALL_TAGGED(formula, read_input_sub, "formula", "char.strength");
+BENCHMARK_ARG_CALL_TAGGED(formula, array, "formula", "[4, 5, 8, 12, 17, 0, 19]");
+BENCHMARK_ARG_CALL_TAGGED(formula, array_str, "formula", "['stand', 'walk', 'run', 'jump']");
+BENCHMARK_ARG_CALL_TAGGED(formula, string, "formula", "'blah'");
+BENCHMARK_ARG_CALL_TAGGED(formula, null_function, "formula", "null()");
+BENCHMARK_ARG_CALL_TAGGED(formula, if_function, "formula", "if(4 > 5, 7, 8)");
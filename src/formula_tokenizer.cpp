@@ -372,7 +372,7 @@ UNIT_TEST(tokenizer_test)
 	}
 }
 
-BENCHMARK(tokenizer_bench)
+BENCHMARK_TAGGED(tokenizer_bench, "formula")
 {
 	const std::string input =
 "	  #function which returns true if the object is in an animation that"
@@ -3,6 +3,7 @@
 
 #include <boost/lexical_cast.hpp>
 
+#include "alpha_mask.hpp"
 #include "asserts.hpp"
 #include "foreach.hpp"
 #include "frame.hpp"
@@ -295,23 +296,24 @@ void frame::build_alpha_from_frame_info()
 		return;
 	}
 
-	alpha_.resize(nframes_*img_rect_.w()*img_rect_.h(), true);
+	alpha_masks_.clear();
 	for(int n = 0; n < nframes_; ++n) {
 		const rect& area = frames_[n].area;
-		int dst_index = frames_[n].y_adjust*img_rect_.w()*nframes_ + n*img_rect_.w() + frames_[n].x_adjust;
+		alpha_mask* mask = new alpha_mask(img_rect_.w(), img_rect_.h());
 		for(int y = 0; y != area.h(); ++y) {
-			ASSERT_INDEX_INTO_VECTOR(dst_index, alpha_);
-			std::vector<bool>::iterator dst = alpha_.begin() + dst_index;
-
 			ASSERT_LT(area.x(), texture_.width());
 			ASSERT_LE(area.x() + area.w(), texture_.width());
 			ASSERT_LT(area.y() + y, texture_.height());
 			std::vector<bool>::const_iterator src = texture_.get_alpha_row(area.x(), area.y() + y);
-
-			std::copy(src, src + area.w(), dst);
-			
-			dst_index += img_rect_.w()*nframes_;
+			for(int x = 0; x != area.w(); ++x, ++src) {
+				if(!*src) {
+					mask->set_opaque(frames_[n].x_adjust + x, frames_[n].y_adjust + y);
+				}
+			}
 		}
+
+		mask->finish();
+		alpha_masks_.push_back(share_alpha_mask(mask));
 	}
 }
 
@@ -322,7 +324,7 @@ void frame::build_alpha()
 		return;
 	}
 
-	alpha_.resize(nframes_*img_rect_.w()*img_rect_.h(), true);
+	alpha_masks_.clear();
 
 	for(int n = 0; n < nframes_; ++n) {
 		const int current_col = (nframes_per_row_ > 0) ? (n% nframes_per_row_) : n;
@@ -336,16 +338,19 @@ void frame::build_alpha()
 			throw error();
 		}
 
+		alpha_mask* mask = new alpha_mask(img_rect_.w(), img_rect_.h());
 		for(int y = 0; y != img_rect_.h(); ++y) {
-			const int dst_index = y*img_rect_.w()*nframes_ + n*img_rect_.w();
-			ASSERT_INDEX_INTO_VECTOR(dst_index, alpha_);
-
-			std::vector<bool>::iterator dst = alpha_.begin() + dst_index;
-
 			std::vector<bool>::const_iterator src = texture_.get_alpha_row(xbase, ybase + y);
-			std::copy(src, src + img_rect_.w(), dst);
+			for(int x = 0; x != img_rect_.w(); ++x, ++src) {
+				if(!*src) {
+					mask->set_opaque(x, y);
+				}
+			}
 		}
 
+		mask->finish();
+		alpha_masks_.push_back(share_alpha_mask(mask));
+
 		//now calculate if the actual frame we should be using for drawing
 		//is smaller than the outer rectangle, so we can save on drawing space
 		frame_info& f = frames_[n];
@@ -354,68 +359,17 @@ void frame::build_alpha()
 		if(no_remove_alpha_borders_) {
 			continue;
 		}
-		
-		int top;
-		for(top = 0; top != img_rect_.h(); ++top) {
-			const std::vector<bool>::const_iterator a = texture_.get_alpha_row(xbase, ybase + top);
-			if(std::find(a, a + img_rect_.w(), false) != a + img_rect_.w()) {
-				break;
-			}
-		}
-
-		int bot;
-		for(bot = img_rect_.h(); bot > 0; --bot) {
-			const std::vector<bool>::const_iterator a = texture_.get_alpha_row(xbase, ybase + bot-1);
-			if(std::find(a, a + img_rect_.w(), false) != a + img_rect_.w()) {
-				break;
-			}
-		}
-
-		int left;
-		for(left = 0; left < img_rect_.w(); ++left) {
-			std::vector<bool>::const_iterator a = texture_.get_alpha_row(xbase + left, ybase);
-
-			bool has_opaque = false;
-			for(int n = 0; n != img_rect_.h(); ++n) {
-				if(!*a) {
-					has_opaque = true;
-				}
-				if(n+1 != img_rect_.h()) {
-					a += texture_.width();
-				}
-			}
-
-			if(has_opaque) {
-				break;
-			}
-		}
-
-		int right;
-		for(right = img_rect_.w(); right > 0; --right) {
-			std::vector<bool>::const_iterator a = texture_.get_alpha_row(xbase + right-1, ybase);
-
-			bool has_opaque = false;
-			for(int n = 0; n != img_rect_.h(); ++n) {
-				if(!*a) {
-					has_opaque = true;
-				}
-
-				if(n+1 != img_rect_.h()) {
-					a += texture_.width();
-				}
-			}
-
-			if(has_opaque) {
-				break;
-			}
-		}
-
-		if(right < left) {
-			right = left;
-		}
 
-		if(bot < top) {
-			bot = top;
+		//the mask already knows the bounds of the opaque pixels. A frame
+		//with no opaque pixels gets trimmed down to nothing.
+		const rect& opaque = alpha_masks_.back()->opaque_area();
+		int left = img_rect_.w(), right = img_rect_.w();
+		int top = img_rect_.h(), bot = img_rect_.h();
+		if(opaque.w() > 0) {
+			left = opaque.x();
+			right = opaque.x2();
+			top = opaque.y();
+			bot = opaque.y2();
 		}
 
 		f.x_adjust = left;
@@ -430,18 +384,8 @@ void frame::build_alpha()
 
 bool frame::is_alpha(int x, int y, int time, bool face_right) const
 {
-	std::vector<bool>::const_iterator itor = get_alpha_itor(x, y, time, face_right);
-	if(itor == alpha_.end()) {
+	if(alpha_masks_.empty()) {
 		return true;
-	} else {
-		return *itor;
-	}
-}
-
-std::vector<bool>::const_iterator frame::get_alpha_itor(int x, int y, int time, bool face_right) const
-{
-	if(alpha_.empty()) {
-		return alpha_.end();
 	}
 
 	if(face_right == false) {
@@ -449,18 +393,31 @@ std::vector<bool>::const_iterator frame::get_alpha_itor(int x, int y, int time,
 	}
 
 	if(x < 0 || y < 0 || x >= width() || y >= height()) {
-		return alpha_.end();
+		return true;
 	}
 
-	x /= scale_;
-	y /= scale_;
+	return !alpha_masks_[frame_number(time)]->is_opaque(x/scale_, y/scale_);
+}
+
+const alpha_mask* frame::get_alpha_mask(int time) const
+{
+	if(alpha_masks_.empty()) {
+		return NULL;
+	}
+
+	return alpha_masks_[frame_number(time)].get();
+}
+
+rect frame::opaque_area(int time, bool face_right) const
+{
+	const alpha_mask* mask = get_alpha_mask(time);
+	if(!mask || mask->opaque_area().w() == 0) {
+		return rect();
+	}
 
-	const int nframe = frame_number(time);
-	x += nframe*img_rect_.w();
-	
-	const int index = y*img_rect_.w()*nframes_ + x;
-	ASSERT_INDEX_INTO_VECTOR(index, alpha_);
-	return alpha_.begin() + index;
+	const rect& area = mask->opaque_area();
+	const int x = face_right ? area.x()*scale_ : width() - area.x2()*scale_;
+	return rect(x, area.y()*scale_, area.w()*scale_, area.h()*scale_);
 }
 
 void frame::draw_into_blit_queue(graphics::blit_queue& blit, int x, int y, bool face_right, bool upside_down, int time) const
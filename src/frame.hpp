@@ -6,6 +6,7 @@
 #include <string>
 #include <vector>
 
+#include "alpha_mask.hpp"
 #include "geometry.hpp"
 #include "solid_map_fwd.hpp"
 #include "texture.hpp"
@@ -46,9 +47,13 @@ public:
 	void play_sound(const void* object=NULL) const;
 	bool is_alpha(int x, int y, int time, bool face_right) const;
 
-	//Low level interface to alpha information.
-	std::vector<bool>::const_iterator get_alpha_itor(int x, int y, int time, bool face_right) const;
-	const std::vector<bool>& get_alpha_buf() const { return alpha_; }
+	//Low level interface to alpha information. The mask is in unscaled
+	//image pixels, and is NULL if the frame has no image.
+	const alpha_mask* get_alpha_mask(int time) const;
+
+	//the area of the frame which has opaque pixels, in the same
+	//coordinates as is_alpha(). Empty if there are none.
+	rect opaque_area(int time, bool face_right) const;
 
 	void draw_into_blit_queue(graphics::blit_queue& blit, int x, int y, bool face_right=true, bool upside_down=false, int time=0) const;
 	void draw(int x, int y, bool face_right=true, bool upside_down=false, int time=0, GLfloat rotate=0) const;
@@ -84,6 +89,7 @@ public:
 	int velocity_y() const { return velocity_y_; }
 	int width() const { return img_rect_.w()*scale_; }
 	int height() const { return img_rect_.h()*scale_; }
+	int scale() const { return scale_; }
 	int duration() const;
 	bool hit(int time_in_frame) const;
 	const graphics::texture& img() const { return texture_; }
@@ -163,7 +169,10 @@ private:
 
 	void build_alpha_from_frame_info();
 	void build_alpha();
-	std::vector<bool> alpha_;
+
+	//one mask for each frame in the animation. Identical frames share
+	//their mask.
+	std::vector<const_alpha_mask_ptr> alpha_masks_;
 
 	bool no_remove_alpha_borders_;
 
@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <time.h>
+
+#include "allocation_tracker.hpp"
+#include "filesystem.hpp"
+#include "foreach.hpp"
+#include "formatter.hpp"
+#include "formula_profiler.hpp"
+#include "frame_timing.hpp"
+#include "level.hpp"
+#include "preferences.hpp"
+#include "thread.hpp"
+#include "variant.hpp"
+
+namespace frame_timing
+{
+
+namespace {
+const int HistorySize = 1000;
+const int HistogramSize = 101;
+
+//don't fill the disk if something goes badly wrong.
+const int MaxHitchReports = 50;
+
+struct frame_record {
+	frame_record() {
+		std::fill(phases, phases + NUM_PHASES, 0);
+	}
+
+	int phases[NUM_PHASES];
+};
+
+frame_record history[HistorySize];
+int nframes = 0;
+
+frame_record current_frame;
+
+threading::mutex& asset_loads_mutex()
+{
+	static threading::mutex m;
+	return m;
+}
+
+std::vector<std::string> asset_loads;
+
+int nhitch_reports = 0;
+
+int frame_time(const frame_record& frame)
+{
+	int result = 0;
+	for(int n = 0; n != NUM_PHASES; ++n) {
+		result += frame.phases[n];
+	}
+
+	return result;
+}
+
+void write_hitch_report(const level& lvl, const frame_record& frame, const std::vector<std::string>& assets)
+{
+	std::map<variant, variant> report;
+	report[variant("level")] = variant(lvl.id());
+	report[variant("cycle")] = variant(lvl.cycle());
+	report[variant("frame_ms")] = variant(frame_time(frame));
+	for(int n = 0; n != NUM_PHASES; ++n) {
+		report[variant(std::string(phase_name(static_cast<PHASE>(n))) + "_ms")] = variant(frame.phases[n]);
+	}
+
+	report[variant("active_objects")] = variant(lvl.num_active_chars());
+
+	//timing every instrument is too costly to leave on in case of a
+	//hitch, so their times are only included if they were being timed
+	//anyway, by the profiler or a benchmark.
+	std::vector<variant> instruments;
+	foreach(const formula_profiler::instrument_total& instrument, formula_profiler::get_frame_instrumentation()) {
+		std::map<variant, variant> m;
+		m[variant("id")] = variant(instrument.id);
+		m[variant("time_us")] = variant(instrument.time_us);
+		m[variant("calls")] = variant(instrument.nsamples);
+		instruments.push_back(variant(&m));
+	}
+
+	if(instruments.empty() == false) {
+		report[variant("instruments")] = variant(&instruments);
+	}
+
+	if(allocation_tracker::enabled()) {
+		const allocation_tracker::summary allocs = allocation_tracker::get_summary(0);
+		std::map<variant, variant> m;
+		m[variant("allocations")] = variant(allocs.last.allocations);
+		m[variant("frees")] = variant(allocs.last.frees);
+		m[variant("bytes")] = variant(allocs.last.bytes);
+		report[variant("allocations")] = variant(&m);
+	}
+
+	std::vector<variant> assets_list;
+	foreach(const std::string& asset, assets) {
+		assets_list.push_back(variant(asset));
+	}
+
+	report[variant("asset_loads")] = variant(&assets_list);
+
+	char time_buf[64];
+	const time_t now = time(NULL);
+	strftime(time_buf, sizeof(time_buf), "%Y%m%d-%H%M%S", localtime(&now));
+
+	const std::string fname = formatter() << sys::get_dir(std::string(preferences::user_data_path()) + "/hitches") << "/hitch-" << time_buf << "-" << lvl.cycle() << ".json";
+	sys::write_file(fname, variant(&report).write_json());
+	std::cerr << "FRAME TOOK " << frame_time(frame) << "ms. WROTE HITCH REPORT TO " << fname << "\n";
+}
+}
+
+const char* phase_name(PHASE phase)
+{
+	static const char* names[] = { "process", "draw", "flip", "frame" };
+	return names[phase];
+}
+
+void add_phase_time(PHASE phase, int ms)
+{
+	current_frame.phases[phase] += ms;
+}
+
+void note_asset_load(const std::string& description)
+{
+	if(preferences::hitch_threshold_millis() <= 0) {
+		return;
+	}
+
+	threading::lock lck(asset_loads_mutex());
+	asset_loads.push_back(description);
+}
+
+void end_frame(const level& lvl)
+{
+	const int threshold = preferences::hitch_threshold_millis();
+
+	std::vector<std::string> assets;
+	{
+		threading::lock lck(asset_loads_mutex());
+		assets.swap(asset_loads);
+	}
+
+	if(threshold > 0 && frame_time(current_frame) > threshold && nhitch_reports < MaxHitchReports) {
+		++nhitch_reports;
+		write_hitch_report(lvl, current_frame, assets);
+	}
+
+	history[nframes%HistorySize] = current_frame;
+	++nframes;
+	current_frame = frame_record();
+	formula_profiler::clear_frame_instrumentation();
+}
+
+phase_stats get_phase_stats(PHASE phase)
+{
+	std::vector<int> times;
+	for(int n = 0; n != std::min(nframes, HistorySize); ++n) {
+		times.push_back(phase == NUM_PHASES ? frame_time(history[n]) : history[n].phases[phase]);
+	}
+
+	phase_stats result;
+	result.nframes = times.size();
+	result.median = result.p95 = result.p99 = result.max = 0;
+	result.histogram.resize(HistogramSize);
+	if(times.empty()) {
+		return result;
+	}
+
+	foreach(int t, times) {
+		result.histogram[std::min(std::max(t, 0), HistogramSize - 1)]++;
+	}
+
+	std::sort(times.begin(), times.end());
+	result.median = times[times.size()/2];
+	result.p95 = times[(times.size()*95)/100];
+	result.p99 = times[(times.size()*99)/100];
+	result.max = times.back();
+	return result;
+}
+
+}
@@ -0,0 +1,42 @@
+#ifndef FRAME_TIMING_HPP_INCLUDED
+#define FRAME_TIMING_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+
+class level;
+
+//Keeps the time taken by each phase of the recent frames, and writes a
+//report of what happened in any frame which takes too long, since such
+//hitches are rarely reproducible.
+namespace frame_timing
+{
+
+enum PHASE { PROCESS, DRAW, FLIP, NUM_PHASES };
+
+const char* phase_name(PHASE phase);
+
+void add_phase_time(PHASE phase, int ms);
+
+//notes that an asset was loaded in the current frame. May be called from
+//any thread.
+void note_asset_load(const std::string& description);
+
+//should be called at the end of every frame. If the frame took longer
+//than preferences::hitch_threshold_millis(), a report is written.
+void end_frame(const level& lvl);
+
+//how long a phase, or the whole frame if phase is NUM_PHASES, took over
+//the recent frames. histogram[n] is the number of frames which took n ms,
+//with the last bucket also counting all longer frames.
+struct phase_stats {
+	int nframes;
+	int median, p95, p99, max;
+	std::vector<int> histogram;
+};
+
+phase_stats get_phase_stats(PHASE phase);
+
+}
+
+#endif
@@ -9,13 +9,18 @@
 namespace {
 	typedef std::map<std::string, const_framed_gui_element_ptr> cache_map;
 	cache_map cache;
+
+	//elements are only made when they're first used, so their textures
+	//aren't all loaded at startup.
+	std::map<std::string, variant> element_nodes;
 }
 
 void framed_gui_element::init(variant node)
 {
 	foreach(variant obj, node["framed_gui_element"].as_list()) {
 		const std::string& id = obj["id"].as_string();
-		cache[id].reset(new framed_gui_element(obj));
+		element_nodes[id] = obj;
+		cache.erase(id);
 	}
 }
 
@@ -23,8 +28,15 @@ const_framed_gui_element_ptr framed_gui_element::get(const std::string& key)
 {
 	cache_map::const_iterator itor = cache.find(key);
 	if(itor == cache.end()) {
-		assert(false); //TODO: replace with an exception.
-		return const_framed_gui_element_ptr();
+		std::map<std::string, variant>::const_iterator node_itor = element_nodes.find(key);
+		if(node_itor == element_nodes.end()) {
+			assert(false); //TODO: replace with an exception.
+			return const_framed_gui_element_ptr();
+		}
+
+		const_framed_gui_element_ptr& result = cache[key];
+		result.reset(new framed_gui_element(node_itor->second));
+		return result;
 	}
 	
 	return itor->second;
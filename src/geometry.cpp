@@ -350,7 +350,7 @@ UNIT_TEST(rect_intersect)
 	CHECK_EQ(r3, intersection_rect(r2, r1));
 }
 
-BENCHMARK(benchmark_rect_str)
+BENCHMARK_TAGGED(benchmark_rect_str, "render")
 {
 	static const std::string str = "45,89,100, 120";
 	BENCHMARK_LOOP {
@@ -672,7 +672,7 @@ variant gui_algorithm::get_value_by_slot(int slot) const
 
 #include "level.hpp"
 
-BENCHMARK(gui_algorithm_bench)
+BENCHMARK_TAGGED(gui_algorithm_bench, "render")
 {
 	static boost::intrusive_ptr<level> lvl;
 	if(!lvl) {
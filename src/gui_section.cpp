@@ -10,13 +10,18 @@
 namespace {
 typedef std::map<std::string, const_gui_section_ptr> cache_map;
 cache_map cache;
+
+//sections are only made when they're first used, so the textures of ones
+//not needed for the title screen aren't loaded at startup.
+std::map<std::string, variant> section_nodes;
 }
 
 void gui_section::init(variant node)
 {
 	foreach(const variant& section_node, node["section"].as_list()) {
 		const std::string& id = section_node["id"].as_string();
-		cache[id].reset(new gui_section(section_node));
+		section_nodes[id] = section_node;
+		cache.erase(id);
 	}
 }
 
@@ -35,8 +40,15 @@ const_gui_section_ptr gui_section::get(const std::string& key)
 {
 	cache_map::const_iterator itor = cache.find(key);
 	if(itor == cache.end()) {
-		ASSERT_LOG(false, "GUI section " << key << " not found in cache");
-		return const_gui_section_ptr();
+		std::map<std::string, variant>::const_iterator node_itor = section_nodes.find(key);
+		if(node_itor == section_nodes.end()) {
+			ASSERT_LOG(false, "GUI section " << key << " not found in cache");
+			return const_gui_section_ptr();
+		}
+
+		const_gui_section_ptr& result = cache[key];
+		result.reset(new gui_section(node_itor->second));
+		return result;
 	}
 
 	return itor->second;
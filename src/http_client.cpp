@@ -140,6 +140,23 @@ void http_client::handle_send(connection_ptr conn, const boost::system::error_co
 	}
 }
 
+namespace {
+//finds whichever of the two header terminators comes first, since the
+//body may contain the other one.
+const char* find_end_headers(const std::string& response, int* term_len)
+{
+	const char* end_headers = strstr(response.c_str(), "\n\n");
+	const char* end_headers_crlf = strstr(response.c_str(), "\r\n\r\n");
+	if(end_headers_crlf && (end_headers == NULL || end_headers_crlf < end_headers)) {
+		*term_len = 4;
+		return end_headers_crlf;
+	}
+
+	*term_len = 2;
+	return end_headers;
+}
+}
+
 void http_client::handle_receive(connection_ptr conn, const boost::system::error_code& e, size_t nbytes)
 {
 	if(e) {
@@ -168,11 +185,7 @@ void http_client::handle_receive(connection_ptr conn, const boost::system::error
 	conn->response.insert(conn->response.end(), &conn->buf[0], &conn->buf[0] + nbytes);
 	if(conn->expected_len == -1) {
 		int header_term_len = 2;
-		const char* end_headers = strstr(conn->response.c_str(), "\n\n");
-		if(!end_headers) {
-			end_headers = strstr(conn->response.c_str(), "\r\n\r\n");
-			header_term_len = 4;
-		}
+		const char* end_headers = find_end_headers(conn->response, &header_term_len);
 		if(end_headers) {
 			const char* content_length = strstr(conn->response.c_str(), "Content-Length:");
 			if(!content_length) {
@@ -196,16 +209,13 @@ void http_client::handle_receive(connection_ptr conn, const boost::system::error
 	if(conn->expected_len != -1 && conn->response.size() >= conn->expected_len) {
 		ASSERT_LOG(conn->expected_len == conn->response.size(), "UNEXPECTED RESPONSE SIZE " << conn->expected_len << " VS " << conn->response << " " << conn->response.size());
 
-		//We have the full response now -- handle it.
-		const char* end_headers = strstr(conn->response.c_str(), "\n\n");
+		//We have the full response now -- handle it. The body may be binary,
+		//so it's taken by length rather than as a C string.
 		int header_term_len = 2;
-		if(!end_headers) {
-			header_term_len = 4;
-			end_headers = strstr(conn->response.c_str(), "\r\n\r\n");
-		}
+		const char* end_headers = find_end_headers(conn->response, &header_term_len);
 		ASSERT_LOG(end_headers, "COULD NOT FIND END OF HEADERS IN MESSAGE: " << conn->response);
 		--in_flight_;
-		conn->handler(std::string(end_headers+header_term_len));
+		conn->handler(std::string(end_headers+header_term_len, conn->response.c_str() + conn->response.size()));
 	} else {
 		if(conn->expected_len != -1 && conn->progress_handler) {
 			conn->progress_handler(conn->response.size(), conn->expected_len, true);
@@ -3,6 +3,7 @@
 #include <boost/bind.hpp>
 #include <deque>
 #include <iostream>
+#include <string.h>
 
 #if !defined(_WINDOWS)
 #include <sys/time.h>
@@ -15,280 +16,643 @@
 #include "json_parser.hpp"
 #include "http_server.hpp"
 #include "string_utils.hpp"
+#include "thread.hpp"
 #include "utils.hpp"
 #include "unit_test.hpp"
 #include "variant.hpp"
+#include "variant_utils.hpp"
 
 using boost::asio::ip::tcp;
 
 namespace http {
 
-web_server::web_server(boost::asio::io_service& io_service, int port)
-  : acceptor_(io_service, tcp::endpoint(tcp::v4(), port))
+namespace {
+//how long a persistent connection may sit idle between requests.
+const int KeepAliveTimeoutSeconds = 30;
+
+//requests with headers larger than this are rejected.
+const size_t MaxHeaderSize = 64*1024;
+
+const size_t ReceiveSize = 16*1024;
+
+boost::int64_t get_microseconds()
 {
-	start_accept();
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return boost::int64_t(tv.tv_sec)*1000000 + tv.tv_usec;
 }
 
-void web_server::start_accept()
+//finds the blank line ending the headers in [begin, end). Returns the
+//offset of the first byte after it, or 0 if it's not there yet.
+size_t find_end_of_headers(const char* buf, size_t begin, size_t end)
 {
-	socket_ptr socket(new tcp::socket(acceptor_.get_io_service()));
-	acceptor_.async_accept(*socket, boost::bind(&web_server::handle_accept, this, socket, boost::asio::placeholders::error));
+	for(size_t n = begin; n < end; ++n) {
+		if(buf[n] != '\n') {
+			continue;
+		}
+
+		if(n+1 < end && buf[n+1] == '\n') {
+			return n+2;
+		}
+
+		if(n+2 < end && buf[n+1] == '\r' && buf[n+2] == '\n') {
+			return n+3;
+		}
+	}
 
+	return 0;
 }
 
-namespace {
-int nconnections = 0;
+//A view of one line of the headers, without the line ending.
+struct header_line {
+	const char* begin;
+	const char* end;
+};
+
+bool next_line(const char*& pos, const char* end, header_line* line)
+{
+	if(pos == end) {
+		return false;
+	}
+
+	const char* eol = std::find(pos, end, '\n');
+	line->begin = pos;
+	line->end = eol;
+	if(line->end != line->begin && line->end[-1] == '\r') {
+		--line->end;
+	}
+
+	pos = eol == end ? end : eol+1;
+	return true;
 }
 
-void web_server::handle_accept(socket_ptr socket, const boost::system::error_code& error)
+void parse_args(const char* begin_args, const char* end_url, std::map<std::string, std::string>& args)
+{
+	while(begin_args != end_url) {
+		const char* eq = std::find(begin_args, end_url, '=');
+		if(eq == end_url) {
+			break;
+		}
+
+		const char* amp = std::find(eq, end_url, '&');
+		args[std::string(begin_args, eq)] = std::string(eq+1, amp);
+
+		begin_args = amp;
+		if(begin_args == end_url) {
+			break;
+		}
+
+		++begin_args;
+	}
+}
+
+std::string lower_case(std::string s)
+{
+	std::transform(s.begin(), s.end(), s.begin(), tolower);
+	return s;
+}
+}
+
+web_server::server_stats::server_stats()
+  : connections_accepted(0), connections_open(0),
+    requests(0), reused_connection_requests(0),
+    bytes_received(0), bytes_sent(0),
+    handler_time(0), response_time(0),
+    max_handler_time(0), max_response_time(0)
+{}
+
+web_server::connection::connection(boost::asio::io_service& io_service)
+  : socket(new tcp::socket(io_service)), conn_strand(io_service), timer(io_service),
+    nbuf(0), header_scan(0), header_len(0), content_length(0), request_len(0), nrequests(0),
+    busy(false), keep_alive(false), chunked(false), http_1_1(false),
+    response_done(false), closed(false), request_start(0), response_queued(false)
+{}
+
+web_server::web_server(boost::asio::io_service& io_service, int port, strand* handler_strand)
+  : io_service_(io_service), acceptor_(io_service, tcp::endpoint(tcp::v4(), port)),
+    own_handler_strand_(handler_strand ? NULL : new strand(io_service)),
+    handler_strand_(handler_strand ? *handler_strand : *own_handler_strand_),
+    date_time_(0)
+{
+	start_accept();
+}
+
+web_server::~web_server()
+{
+}
+
+void web_server::start_accept()
+{
+	connection_ptr conn(new connection(io_service_));
+	acceptor_.async_accept(*conn->socket, boost::bind(&web_server::handle_accept, this, conn, boost::asio::placeholders::error));
+}
+
+void web_server::handle_accept(connection_ptr conn, const boost::system::error_code& error)
 {
 	if(error) {
 		std::cerr << "ERROR IN ACCEPT\n";
 		return;
 	}
 
-	start_receive(socket);
+	{
+		threading::lock lck(mutex_);
+		connections_[conn->socket] = conn;
+		++stats_.connections_accepted;
+		++stats_.connections_open;
+	}
+
+	conn->conn_strand.dispatch(boost::bind(&web_server::start_receive, this, conn));
 	start_accept();
 }
 
-void web_server::start_receive(socket_ptr socket, receive_buf_ptr recv_buf)
+void web_server::start_receive(connection_ptr conn)
 {
-	if(!recv_buf) {
-		recv_buf.reset(new receive_buf);
+	if(conn->buf.size() - conn->nbuf < ReceiveSize/4) {
+		conn->buf.resize(std::max(conn->buf.size()*2, conn->nbuf + ReceiveSize));
+	}
+
+	if(!conn->busy) {
+		conn->timer.expires_from_now(boost::posix_time::seconds(KeepAliveTimeoutSeconds));
+		conn->timer.async_wait(conn->conn_strand.wrap(boost::bind(&web_server::handle_timeout, this, conn, boost::asio::placeholders::error)));
 	}
 
-	buffer_ptr buf(new boost::array<char, 64*1024>);
-	socket->async_read_some(boost::asio::buffer(*buf), boost::bind(&web_server::handle_receive, this, socket, buf, _1, _2, recv_buf));
+	conn->socket->async_read_some(boost::asio::buffer(&conn->buf[conn->nbuf], conn->buf.size() - conn->nbuf),
+	                              conn->conn_strand.wrap(boost::bind(&web_server::handle_receive, this, conn, _1, _2)));
 }
 
-void web_server::handle_receive(socket_ptr socket, buffer_ptr buf, 
-	const boost::system::error_code& e, 
-	size_t nbytes, 
-	receive_buf_ptr recv_buf)
+void web_server::handle_receive(connection_ptr conn, const boost::system::error_code& e, size_t nbytes)
 {
+	if(conn->closed) {
+		return;
+	}
+
 	if(e) {
-		//TODO: handle error
-		std::cerr << "SOCKET ERROR: " << e.message() << "\n";
-		disconnect(socket);
+		if(e != boost::asio::error::eof) {
+			std::cerr << "SOCKET ERROR: " << e.message() << "\n";
+		}
+
+		close_connection(conn, true);
 		return;
 	}
 
-	handle_incoming_data(socket, &(*buf)[0], &(*buf)[0] + nbytes, recv_buf);
+	conn->nbuf += nbytes;
+	{
+		threading::lock lck(mutex_);
+		stats_.bytes_received += nbytes;
+	}
+
+	process_buffer(conn);
 }
 
-void web_server::handle_incoming_data(socket_ptr socket, const char* i1, const char* i2, receive_buf_ptr recv_buf)
+void web_server::handle_timeout(connection_ptr conn, const boost::system::error_code& e)
 {
-	recv_buf->msg += std::string(i1, i2);
+	if(e == boost::asio::error::operation_aborted || conn->closed || conn->busy) {
+		return;
+	}
+
+	if(conn->timer.expires_at() <= boost::asio::deadline_timer::traits_type::now()) {
+		close_connection(conn, true);
+	}
+}
+
+void web_server::process_buffer(connection_ptr conn)
+{
+	if(conn->busy || conn->closed) {
+		return;
+	}
+
+	if(conn->header_len == 0) {
+		const char* buf = conn->nbuf ? &conn->buf[0] : "";
+		const size_t header_len = find_end_of_headers(buf, conn->header_scan, conn->nbuf);
+		if(header_len == 0) {
+			if(conn->nbuf > MaxHeaderSize) {
+				std::cerr << "REQUEST HEADERS TOO LARGE\n";
+				close_connection(conn, true);
+				return;
+			}
+
+			//the next read might complete a line ending which started in
+			//this data, so rescan the last couple of bytes.
+			conn->header_scan = conn->nbuf > 2 ? conn->nbuf - 2 : 0;
+			start_receive(conn);
+			return;
+		}
+
+		if(!parse_headers(conn, header_len)) {
+			close_connection(conn, true);
+			return;
+		}
+	}
 
-	if(recv_buf->wanted > 0 && recv_buf->msg.size() < recv_buf->wanted) {
-		start_receive(socket, recv_buf);
+	if(conn->nbuf < conn->header_len + conn->content_length) {
+		//wait for the rest of the body.
+		start_receive(conn);
 		return;
 	}
 
-	timeval before, after;
-	gettimeofday(&before, NULL);
-	handle_message(socket, recv_buf);
-	gettimeofday(&after, NULL);
+	conn->busy = true;
+	conn->chunked = false;
+	conn->response_done = false;
+	conn->response_queued = false;
+	conn->request_start = get_microseconds();
+	conn->timer.cancel();
 
-	const int ms = (after.tv_sec - before.tv_sec)*1000 + (after.tv_usec - before.tv_usec)/1000;
-	std::cerr << "handle_incoming_data time: " << ms << "ms\n";
+	handler_strand_.post(boost::bind(&web_server::handle_message, this, conn));
 }
 
-namespace {
-struct Request {
-	std::string path;
-	std::map<std::string, std::string> args;
-};
+bool web_server::parse_headers(connection_ptr conn, size_t header_len)
+{
+	const char* pos = &conn->buf[0];
+	const char* headers_end = pos + header_len;
 
-Request parse_request(const std::string& str) {
-	std::string::const_iterator end_path = std::find(str.begin(), str.end(), '?');
-	Request request;
-	request.path.assign(str.begin(), end_path);
+	header_line request_line;
+	next_line(pos, headers_end, &request_line);
 
-	std::cerr << "PATH: '" << request.path << "'\n";
+	const char* method_end = std::find(request_line.begin, request_line.end, ' ');
+	const char* url_begin = method_end == request_line.end ? method_end : method_end+1;
+	const char* url_end = std::find(url_begin, request_line.end, ' ');
+	const char* version = url_end == request_line.end ? url_end : url_end+1;
 
-	if(end_path != str.end()) {
-		++end_path;
+	conn->method.assign(request_line.begin, method_end);
+	if(conn->method != "GET" && conn->method != "POST") {
+		return false;
+	}
 
-		std::vector<std::string> args = util::split(std::string(end_path, str.end()), '&');
-		foreach(const std::string& a, args) {
-			std::string::const_iterator equal_itor = std::find(a.begin(), a.end(), '=');
-			if(equal_itor != a.end()) {
-				const std::string name(a.begin(), equal_itor);
-				const std::string value(equal_itor+1, a.end());
-				request.args[name] = value;
-			}
+	conn->url.assign(url_begin, url_end);
+	conn->http_1_1 = std::string(version, request_line.end) == "HTTP/1.1";
+
+	conn->env.clear();
+	header_line line;
+	while(next_line(pos, headers_end, &line) && line.begin != line.end) {
+		const char* colon = std::find(line.begin, line.end, ':');
+		if(colon == line.end) {
+			continue;
 		}
+
+		const char* value = colon+1;
+		while(value != line.end && *value == ' ') {
+			++value;
+		}
+
+		conn->env[lower_case(std::string(line.begin, colon))] = std::string(value, line.end);
 	}
 
-	return request;
+	conn->content_length = 0;
+	environment::const_iterator content_length = conn->env.find("content-length");
+	if(content_length != conn->env.end()) {
+		const int len = atoi(content_length->second.c_str());
+		if(len < 0) {
+			return false;
+		}
+
+		conn->content_length = len;
+	}
+
+	environment::const_iterator connection_header = conn->env.find("connection");
+	const std::string connection_type = connection_header == conn->env.end() ? "" : lower_case(connection_header->second);
+	if(conn->http_1_1) {
+		conn->keep_alive = connection_type.find("close") == std::string::npos;
+	} else {
+		conn->keep_alive = connection_type.find("keep-alive") != std::string::npos;
+	}
+
+	conn->header_len = header_len;
+	return true;
 }
 
-std::map<std::string, std::string> parse_env(const std::string& str)
+void web_server::handle_message(connection_ptr conn)
 {
-	std::map<std::string, std::string> env;
-	std::vector<std::string> lines = util::split(str, '\n');
-	foreach(const std::string& line, lines) {
-		if(line.empty()) {
-			break;
+	{
+		threading::lock lck(mutex_);
+		++stats_.requests;
+		if(conn->nrequests++ > 0) {
+			++stats_.reused_connection_requests;
 		}
+	}
 
-		std::string::const_iterator colon = std::find(line.begin(), line.end(), ':');
-		if(colon == line.end() || colon+1 == line.end()) {
-			continue;
+	//keep our own reference to the socket, since the handler might
+	//disconnect it.
+	const socket_ptr socket = conn->socket;
+
+	if(conn->method == "POST") {
+		const char* body_begin = &conn->buf[0] + conn->header_len;
+		const std::string body(body_begin, body_begin + conn->content_length);
+		if(!handle_post_body(socket, body, conn->env)) {
+			variant doc;
+
+			try {
+				doc = json::parse(body, json::JSON_NO_PREPROCESSOR);
+			} catch(...) {
+				std::cerr << "ERROR PARSING JSON\n";
+			}
+
+			if(doc.is_null()) {
+				disconnect(socket);
+				return;
+			}
+
+			handle_post(socket, doc, conn->env);
+		}
+	} else {
+		const char* url = conn->url.c_str();
+		const char* url_end = url + conn->url.size();
+		const char* begin_args = std::find(url, url_end, '?');
+		std::map<std::string, std::string> args;
+		const std::string url_base(url, begin_args);
+		if(begin_args != url_end) {
+			parse_args(begin_args+1, url_end, args);
 		}
 
-		std::string key(line.begin(), colon);
-		const std::string value(colon+2, line.end());
+		if(url_base == "/http_stats") {
+			send_msg(socket, "text/json", get_stats_variant().write_json(), "");
+		} else {
+			handle_get(socket, url_base, args);
+		}
+	}
 
-		std::transform(key.begin(), key.end(), key.begin(), tolower);
-		env[key] = value;
+	const int handler_time = int(get_microseconds() - conn->request_start);
+	threading::lock lck(mutex_);
+	stats_.handler_time += handler_time;
+	stats_.max_handler_time = std::max(stats_.max_handler_time, handler_time);
+}
+
+web_server::connection_ptr web_server::get_connection(socket_ptr socket) const
+{
+	threading::lock lck(mutex_);
+	std::map<socket_ptr, connection_ptr>::const_iterator i = connections_.find(socket);
+	if(i == connections_.end()) {
+		return connection_ptr();
 	}
 
-	return env;
+	return i->second;
 }
 
+const std::string& web_server::http_date()
+{
+	const time_t now = time(NULL);
+	if(now != date_time_) {
+		date_time_ = now;
+		date_ = get_http_datetime();
+	}
+
+	return date_;
+}
+
+void web_server::post_write(connection_ptr conn, const std::string& data, bool last)
+{
+	const boost::shared_ptr<std::string> buf(new std::string(data));
+	conn->conn_strand.post(boost::bind(&web_server::queue_write, this, conn, buf, last));
 }
 
-void web_server::handle_message(socket_ptr socket, receive_buf_ptr recv_buf)
+void web_server::queue_write(connection_ptr conn, boost::shared_ptr<std::string> data, bool last)
 {
-	const std::string& msg = recv_buf->msg;
-	if(msg.size() < 16) {
-		std::cerr << "CLOSESOCKB\n";
-		disconnect(socket);
+	if(conn->closed) {
 		return;
 	}
 
-	if(std::equal(msg.begin(), msg.begin()+5, "POST ")) {
-
-		environment env = parse_env(msg);
-		const int content_length = atoi(env["content-length"].c_str());
+	if(last) {
+		conn->response_queued = true;
+	}
 
-		const char* payload = NULL;
-		const char* payload1 = strstr(msg.c_str(), "\n\n");
-		const char* payload2 = strstr(msg.c_str(), "\r\n\r\n");
-		if(payload1) {
-			payload1 += 2;
-			payload = payload1;
+	if(data->empty()) {
+		if(last && conn->write_queue.empty()) {
+			finish_response(conn);
 		}
 
-		if(payload2 && (!payload1 || payload2 < payload1)) {
-			payload2 += 4;
-			payload = payload2;
-		}
+		return;
+	}
 
-		const int payload_len = payload ? (msg.c_str() + msg.size() - payload) : 0;
+	conn->write_queue.push_back(data);
+	if(conn->write_queue.size() == 1) {
+		boost::asio::async_write(*conn->socket, boost::asio::buffer(*conn->write_queue.front()),
+		                         conn->conn_strand.wrap(boost::bind(&web_server::handle_write, this, conn, _1, _2)));
+	}
+}
 
-		if(!payload || payload_len < content_length) {
-			if(payload_len) {
-				recv_buf->wanted = msg.size() + (content_length - payload_len);
-			}
-			start_receive(socket, recv_buf);
-			return;
-		}
+void web_server::handle_write(connection_ptr conn, const boost::system::error_code& e, size_t nbytes)
+{
+	if(conn->closed) {
+		return;
+	}
 
-		variant doc;
+	if(e) {
+		std::cerr << "ERROR SENDING DATA: " << e.message() << "\n";
+		close_connection(conn, true);
+		return;
+	}
 
-		try {
-			doc = json::parse(std::string(payload), json::JSON_NO_PREPROCESSOR);
-		} catch(...) {
-			std::cerr << "ERROR PARSING JSON\n";
-		}
+	{
+		threading::lock lck(mutex_);
+		stats_.bytes_sent += nbytes;
+	}
 
-		if(!doc.is_null()) {
-			handle_post(socket, doc, env);
-			return;
-		}
-	} else if(std::equal(msg.begin(), msg.begin()+4, "GET ")) {
-		std::string::const_iterator begin_url = msg.begin() + 4;
-		std::string::const_iterator end_url = std::find(begin_url, msg.end(), ' ');
-		std::string::const_iterator begin_args = std::find(begin_url, end_url, '?');
-		std::map<std::string, std::string> args;
-		std::string url_base(begin_url, begin_args);
-		if(begin_args != end_url) {
-			begin_args++;
-			while(begin_args != end_url) {
-				std::string::const_iterator eq = std::find(begin_args, end_url, '=');
-				if(eq == end_url) {
-					break;
-				}
-
-				std::string::const_iterator amp = std::find(eq, end_url, '&');
-				std::string name(begin_args, eq);
-				std::string value(eq+1, amp);
-				args[name] = value;
-
-				begin_args = amp;
-				if(begin_args == end_url) {
-					break;
-				}
-
-				++begin_args;
-			}
-		}
+	conn->write_queue.pop_front();
+	if(conn->write_queue.empty() == false) {
+		boost::asio::async_write(*conn->socket, boost::asio::buffer(*conn->write_queue.front()),
+		                         conn->conn_strand.wrap(boost::bind(&web_server::handle_write, this, conn, _1, _2)));
+	} else if(conn->response_queued) {
+		finish_response(conn);
+	}
+}
 
-		handle_get(socket, url_base, args);
+void web_server::finish_response(connection_ptr conn)
+{
+	const int response_time = int(get_microseconds() - conn->request_start);
+	{
+		threading::lock lck(mutex_);
+		stats_.response_time += response_time;
+		stats_.max_response_time = std::max(stats_.max_response_time, response_time);
+	}
 
+	if(!conn->keep_alive) {
+		close_connection(conn, true);
 		return;
 	}
 
-	disconnect(socket);
+	//the handler may still be looking at the request, so let it know we're
+	//done before going on to the next one.
+	handler_strand_.post(boost::bind(&web_server::handle_finished_request, this, conn));
+}
+
+void web_server::handle_finished_request(connection_ptr conn)
+{
+	handle_response_sent(conn->socket);
+	conn->conn_strand.post(boost::bind(&web_server::start_next_request, this, conn));
 }
 
-void web_server::handle_send(socket_ptr socket, const boost::system::error_code& e, size_t nbytes, size_t max_bytes, boost::shared_ptr<std::string> buf)
+void web_server::start_next_request(connection_ptr conn)
 {
-	if(nbytes == max_bytes || e) {
-		disconnect(socket);
+	if(conn->closed) {
+		return;
 	}
+
+	//drop the request we just answered. Any data after it is the start of
+	//the next, pipelined, request.
+	conn->request_len = conn->header_len + conn->content_length;
+	std::copy(conn->buf.begin() + conn->request_len, conn->buf.begin() + conn->nbuf, conn->buf.begin());
+	conn->nbuf -= conn->request_len;
+	conn->request_len = conn->header_len = conn->content_length = 0;
+	conn->header_scan = 0;
+	conn->busy = false;
+
+	process_buffer(conn);
 }
 
-void web_server::disconnect_socket(socket_ptr socket)
+void web_server::close_connection(connection_ptr conn, bool notify)
 {
-	socket->close();
-	--nconnections;
+	if(conn->closed) {
+		return;
+	}
+
+	conn->closed = true;
+	conn->timer.cancel();
+
+	boost::system::error_code e;
+	conn->socket->close(e);
+
+	{
+		threading::lock lck(mutex_);
+		connections_.erase(conn->socket);
+		--stats_.connections_open;
+	}
+
+	if(notify) {
+		handler_strand_.post(boost::bind(&web_server::disconnect, this, conn->socket));
+	}
 }
 
 void web_server::disconnect(socket_ptr socket)
 {
-	disconnect_socket(socket);
+	connection_ptr conn = get_connection(socket);
+	if(conn) {
+		conn->conn_strand.post(boost::bind(&web_server::close_connection, this, conn, false));
+	}
 }
 
 void web_server::send_msg(socket_ptr socket, const std::string& type, const std::string& msg, const std::string& header_parms)
 {
-    std::stringstream buf;
+	connection_ptr conn = get_connection(socket);
+	if(!conn || conn->response_done) {
+		return;
+	}
+
+	std::stringstream buf;
 	buf <<
 		"HTTP/1.1 200 OK\r\n"
-		"Date: " << get_http_datetime() << "\r\n"
-		"Connection: close\r\n"
+		"Date: " << http_date() << "\r\n"
+		"Connection: " << (conn->keep_alive ? "keep-alive" : "close") << "\r\n"
 		"Server: Wizard/1.0\r\n"
 		"Accept-Ranges: bytes\r\n"
 		"Access-Control-Allow-Origin: *\r\n"
 		"Content-Type: " << type << "\r\n"
 		"Content-Length: " << std::dec << (int)msg.size() << "\r\n"
-		"Last-Modified: " << get_http_datetime() << "\r\n" <<
-        (header_parms.empty() ? "" : header_parms + "\r\n")
-        << "\r\n";
-
-	boost::shared_ptr<std::string> str(new std::string(buf.str()));
-	*str += msg;
+		"Last-Modified: " << http_date() << "\r\n" <<
+		(header_parms.empty() ? "" : header_parms + "\r\n")
+		<< "\r\n";
 
-	boost::asio::async_write(*socket, boost::asio::buffer(*str),
-	                         boost::bind(&web_server::handle_send, this, socket, _1, _2, str->size(), str));
+	conn->response_done = true;
+	post_write(conn, buf.str() + msg, true);
 }
 
 void web_server::send_404(socket_ptr socket)
 {
+	connection_ptr conn = get_connection(socket);
+	if(!conn || conn->response_done) {
+		return;
+	}
+
 	std::stringstream buf;
-	buf << 
+	buf <<
 		"HTTP/1.1 404 NOT FOUND\r\n"
-		"Date: " << get_http_datetime() << "\r\n"
-		"Connection: close\r\n"
+		"Date: " << http_date() << "\r\n"
+		"Connection: " << (conn->keep_alive ? "keep-alive" : "close") << "\r\n"
 		"Server: Wizard/1.0\r\n"
 		"Accept-Ranges: none\r\n"
+		"Content-Length: 0\r\n"
 		"\r\n";
-	boost::shared_ptr<std::string> str(new std::string(buf.str()));
-	boost::asio::async_write(*socket, boost::asio::buffer(*str),
-                boost::bind(&web_server::handle_send, this, socket, _1, _2, str->size(), str));
+
+	conn->response_done = true;
+	post_write(conn, buf.str(), true);
+}
+
+void web_server::begin_chunked_msg(socket_ptr socket, const std::string& type, const std::string& header_parms)
+{
+	connection_ptr conn = get_connection(socket);
+	if(!conn || conn->response_done || conn->chunked) {
+		return;
+	}
+
+	//HTTP/1.0 clients don't understand chunks, so we just send them the
+	//data and close the connection to mark the end of it.
+	conn->chunked = true;
+	if(!conn->http_1_1) {
+		conn->keep_alive = false;
+	}
+
+	std::stringstream buf;
+	buf <<
+		"HTTP/1.1 200 OK\r\n"
+		"Date: " << http_date() << "\r\n"
+		"Connection: " << (conn->keep_alive ? "keep-alive" : "close") << "\r\n"
+		"Server: Wizard/1.0\r\n"
+		"Access-Control-Allow-Origin: *\r\n"
+		"Content-Type: " << type << "\r\n" <<
+		(conn->http_1_1 ? "Transfer-Encoding: chunked\r\n" : "") <<
+		(header_parms.empty() ? "" : header_parms + "\r\n")
+		<< "\r\n";
+
+	post_write(conn, buf.str(), false);
+}
+
+void web_server::send_chunk(socket_ptr socket, const std::string& data)
+{
+	connection_ptr conn = get_connection(socket);
+	if(!conn || !conn->chunked || conn->response_done || data.empty()) {
+		return;
+	}
+
+	if(!conn->http_1_1) {
+		post_write(conn, data, false);
+		return;
+	}
+
+	std::ostringstream chunk;
+	chunk << std::hex << data.size() << "\r\n" << data << "\r\n";
+	post_write(conn, chunk.str(), false);
+}
+
+void web_server::end_chunked_msg(socket_ptr socket)
+{
+	connection_ptr conn = get_connection(socket);
+	if(!conn || !conn->chunked || conn->response_done) {
+		return;
+	}
+
+	conn->response_done = true;
+	post_write(conn, conn->http_1_1 ? "0\r\n\r\n" : "", true);
+}
+
+web_server::server_stats web_server::stats() const
+{
+	threading::lock lck(mutex_);
+	return stats_;
+}
+
+variant web_server::get_stats_variant() const
+{
+	const server_stats s = stats();
+	variant_builder res;
+	res.add("connections_accepted", s.connections_accepted);
+	res.add("connections_open", s.connections_open);
+	res.add("requests", s.requests);
+	res.add("reused_connection_requests", s.reused_connection_requests);
+	res.add("kbytes_received", int(s.bytes_received/1024));
+	res.add("kbytes_sent", int(s.bytes_sent/1024));
+	res.add("handler_time_ms", int(s.handler_time/1000));
+	res.add("max_handler_time_us", s.max_handler_time);
+	res.add("response_time_ms", int(s.response_time/1000));
+	res.add("max_response_time_us", s.max_response_time);
+	return res.build();
 }
 
 }
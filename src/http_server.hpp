@@ -3,53 +3,169 @@
 
 #include <boost/array.hpp>
 #include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <ctime>
+#include <deque>
 #include <map>
+#include <vector>
+
+#include "thread.hpp"
+#include "variant.hpp"
 
 namespace http {
 
 typedef std::map<std::string, std::string> environment;
 
+//A web server which may be run by several threads calling run() on the
+//io_service. Each connection reads and writes on its own strand, while
+//handle_get(), handle_post(), handle_response_sent() and disconnect() are
+//all called on a single handler strand, so handlers don't need to lock
+//anything they share. A derived class which touches the same state from
+//a timer should wrap the timer's handler with handler_strand().
 class web_server
 {
 public:
 	typedef boost::shared_ptr<boost::asio::ip::tcp::socket> socket_ptr;
-	typedef boost::shared_ptr<boost::array<char, 64*1024> > buffer_ptr;
-
-	explicit web_server(boost::asio::io_service& io_service, int port=23456);
-	virtual ~web_server()
-	{}
-
-	static void disconnect_socket(socket_ptr socket);
+	typedef boost::asio::io_service::strand strand;
 
-protected:
-	void start_accept();
-	void handle_accept(socket_ptr socket, const boost::system::error_code& error);
+	//if handler_strand is NULL, the server makes its own.
+	explicit web_server(boost::asio::io_service& io_service, int port=23456, strand* handler_strand=NULL);
+	virtual ~web_server();
 
+	//Send the response to the request the socket is waiting on. Once the
+	//response is written, a persistent connection goes on to handle the
+	//next request, otherwise the socket is closed. These must be called
+	//on the handler strand.
 	void send_msg(socket_ptr socket, const std::string& type, const std::string& msg, const std::string& header_parms);
 	void send_404(socket_ptr socket);
 
-	void handle_send(socket_ptr socket, const boost::system::error_code& e, size_t nbytes, size_t max_bytes, boost::shared_ptr<std::string> buf);
+	//Send a response in pieces, using chunked transfer encoding.
+	void begin_chunked_msg(socket_ptr socket, const std::string& type, const std::string& header_parms);
+	void send_chunk(socket_ptr socket, const std::string& data);
+	void end_chunked_msg(socket_ptr socket);
+
+	struct server_stats {
+		server_stats();
+		int connections_accepted, connections_open;
+		int requests, reused_connection_requests;
+		boost::int64_t bytes_received, bytes_sent;
+
+		//time spent in handle_get()/handle_post(), and time from a request
+		//arriving to its response being written, in microseconds.
+		boost::int64_t handler_time, response_time;
+		int max_handler_time, max_response_time;
+	};
 
+	server_stats stats() const;
+	variant get_stats_variant() const;
+
+	strand& handler_strand() { return handler_strand_; }
+
+protected:
+	//closes the socket. Also called when the connection is closed for any
+	//other reason, so derived classes can forget about the socket.
 	virtual void disconnect(socket_ptr socket);
 
+	//called with the body of a POST before it's parsed as JSON. If it
+	//returns true the request has been dealt with, otherwise the body is
+	//parsed and passed to handle_post().
+	virtual bool handle_post_body(socket_ptr socket, const std::string& body, const environment& env) { return false; }
+
 	virtual void handle_post(socket_ptr socket, variant doc, const environment& env) = 0;
 	virtual void handle_get(socket_ptr socket, const std::string& url, const std::map<std::string, std::string>& args) = 0;
 
+	//called when a response has been written and the socket is free to
+	//handle another request.
+	virtual void handle_response_sent(socket_ptr socket) {}
+
 private:
-	struct receive_buf {
-		receive_buf() : wanted(0) {}
-		std::string msg;
-		size_t wanted;
+	web_server(const web_server&);
+	void operator=(const web_server&);
+
+	//A connection's socket, timer, buffer and write queue are only used on
+	//its strand. While it's busy with a request, the request fields are
+	//handed over to the handler strand until the response has been sent.
+	struct connection {
+		explicit connection(boost::asio::io_service& io_service);
+
+		socket_ptr socket;
+		strand conn_strand;
+		boost::asio::deadline_timer timer;
+
+		//data received, of which the first nbuf bytes are valid.
+		std::vector<char> buf;
+		size_t nbuf;
+
+		//how far through the buffer we've looked for the end of the
+		//headers. Once the headers are all here they're parsed into
+		//the fields below, and header_len is set.
+		size_t header_scan;
+		size_t header_len, content_length, request_len;
+		std::string method, url;
+		environment env;
+
+		int nrequests;
+		bool busy, keep_alive, chunked, http_1_1, response_done, closed;
+		boost::int64_t request_start;
+
+		//set on the connection's strand once the last of the response
+		//has been queued for writing.
+		bool response_queued;
+
+		std::deque<boost::shared_ptr<std::string> > write_queue;
 	};
-	typedef boost::shared_ptr<receive_buf> receive_buf_ptr;
 
-	void start_receive(socket_ptr socket, receive_buf_ptr buf=receive_buf_ptr());
-	void handle_receive(socket_ptr socket, buffer_ptr buf, const boost::system::error_code& e, size_t nbytes, receive_buf_ptr recv_buf);
-	void handle_incoming_data(socket_ptr socket, const char* i1, const char* i2, receive_buf_ptr recv_buf);
+	typedef boost::shared_ptr<connection> connection_ptr;
 
-	void handle_message(socket_ptr socket, receive_buf_ptr recv_buf);
+	void start_accept();
+	void handle_accept(connection_ptr conn, const boost::system::error_code& error);
+
+	void start_receive(connection_ptr conn);
+	void handle_receive(connection_ptr conn, const boost::system::error_code& e, size_t nbytes);
+	void handle_timeout(connection_ptr conn, const boost::system::error_code& e);
+
+	//handles the next request in the connection's buffer if it's complete,
+	//otherwise reads more data.
+	void process_buffer(connection_ptr conn);
+	bool parse_headers(connection_ptr conn, size_t header_len);
+
+	//called on the handler strand.
+	void handle_message(connection_ptr conn);
+	void handle_finished_request(connection_ptr conn);
+
+	connection_ptr get_connection(socket_ptr socket) const;
+
+	//the current date, formatted for a header. It's only formatted again
+	//once a second. Called on the handler strand.
+	const std::string& http_date();
 
+	//posts data to be written on the connection's strand. 'last' marks the
+	//end of the response.
+	void post_write(connection_ptr conn, const std::string& data, bool last);
+	void queue_write(connection_ptr conn, boost::shared_ptr<std::string> data, bool last);
+	void handle_write(connection_ptr conn, const boost::system::error_code& e, size_t nbytes);
+	void finish_response(connection_ptr conn);
+	void start_next_request(connection_ptr conn);
+
+	//closes the connection, on its strand. If 'notify' is set, disconnect()
+	//is called on the handler strand to tell derived classes.
+	void close_connection(connection_ptr conn, bool notify);
+
+	boost::asio::io_service& io_service_;
 	boost::asio::ip::tcp::acceptor acceptor_;
+
+	boost::scoped_ptr<strand> own_handler_strand_;
+	strand& handler_strand_;
+
+	time_t date_time_;
+	std::string date_;
+
+	//guards connections_ and stats_.
+	threading::mutex mutex_;
+	std::map<socket_ptr, connection_ptr> connections_;
+	server_stats stats_;
 };
 
 }
@@ -10,6 +10,7 @@
 #include "md5.hpp"
 #include "module.hpp"
 #include "preprocessor.hpp"
+#include "thread.hpp"
 #include "unit_test.hpp"
 #include "variant_utils.hpp"
 
@@ -189,8 +190,22 @@ struct JsonObject {
 	}
 };
 
+//files are parsed on many threads by parse_files_parallel and by
+//utilities, so the registry is locked.
+threading::mutex& filename_registry_mutex()
+{
+	static threading::mutex m;
+	return m;
+}
+
 std::set<std::string> filename_registry;
 
+const std::string* register_filename(const std::string& fname)
+{
+	threading::lock lck(filename_registry_mutex());
+	return &*filename_registry.insert(fname).first;
+}
+
 variant parse_internal(const std::string& doc, const std::string& fname,
                        JSON_PARSE_OPTIONS options,
 					   std::map<std::string, json_macro_ptr>* macros,
@@ -203,13 +218,10 @@ variant parse_internal(const std::string& doc, const std::string& fname,
 
 	bool use_preprocessor = options&JSON_USE_PREPROCESSOR;
 
-	std::set<std::string>::const_iterator filename_itor = filename_registry.insert(fname).first;
-
-
-	const std::string* filename = &*filename_itor;
+	const std::string* filename = register_filename(fname);
 
 	variant::debug_info debug_info;
-	debug_info.filename = &*filename_itor;
+	debug_info.filename = filename;
 	debug_info.line = 1;
 	debug_info.column = 1;
 
@@ -484,12 +496,22 @@ variant parse(const std::string& doc, JSON_PARSE_OPTIONS options)
 	return parse_internal(doc, "", options, NULL, NULL);
 }
 
-variant parse_from_file(const std::string& fname, JSON_PARSE_OPTIONS options)
+std::string read_file_to_parse(const std::string& fname)
 {
-	try {
-		std::string data = get_file_contents(fname);
-		checksum::verify_file(fname, data);
+	std::string data = get_file_contents(fname);
+	checksum::verify_file(fname, data);
+	return data;
+}
+
+bool needs_preprocessor(const std::string& doc)
+{
+	//the preprocessor only acts on strings beginning with '@'.
+	return std::find(doc.begin(), doc.end(), '@') != doc.end();
+}
 
+variant parse_file_contents(const std::string& fname, const std::string& data, JSON_PARSE_OPTIONS options)
+{
+	try {
 		if(data.empty()) {
 			throw parse_error(formatter() << "Could not find file " << fname);
 		}
@@ -503,6 +525,66 @@ variant parse_from_file(const std::string& fname, JSON_PARSE_OPTIONS options)
 	}
 }
 
+variant parse_from_file(const std::string& fname, JSON_PARSE_OPTIONS options)
+{
+	return parse_file_contents(fname, read_file_to_parse(fname), options);
+}
+
+namespace {
+struct parse_file_job {
+	const std::vector<std::string>* fnames;
+	std::vector<std::string>* contents;
+	std::vector<variant>* results;
+	std::vector<char>* parsed;
+	std::vector<int>* parse_times;
+
+	void operator()(int n) const {
+		const int start = SDL_GetTicks();
+		(*contents)[n] = read_file_to_parse((*fnames)[n]);
+		if(needs_preprocessor((*contents)[n]) == false) {
+			try {
+				(*results)[n] = parse_file_contents((*fnames)[n], (*contents)[n]);
+				(*parsed)[n] = 1;
+			} catch(parse_error&) {
+				//leave it to be parsed again on the main thread, so the
+				//error is reported there.
+			}
+		}
+		(*parse_times)[n] = SDL_GetTicks() - start;
+	}
+};
+}
+
+std::vector<variant> parse_files_parallel(const std::vector<std::string>& fnames, int njobs, std::vector<int>* parse_times)
+{
+	std::vector<std::string> contents(fnames.size());
+	std::vector<variant> results(fnames.size());
+	std::vector<char> parsed(fnames.size());
+	std::vector<int> times(fnames.size());
+
+	parse_file_job job;
+	job.fnames = &fnames;
+	job.contents = &contents;
+	job.results = &results;
+	job.parsed = &parsed;
+	job.parse_times = &times;
+	threading::run_jobs(fnames.size(), njobs, job);
+
+	for(int n = 0; n != fnames.size(); ++n) {
+		if(!parsed[n]) {
+			const int start = SDL_GetTicks();
+			results[n] = parse_file_contents(fnames[n], contents[n]);
+			times[n] += SDL_GetTicks() - start;
+		}
+	}
+
+	if(parse_times) {
+		parse_times->swap(times);
+	}
+
+	return results;
+}
+
 bool file_exists_and_is_valid(const std::string& fname)
 {
 	try {
@@ -2,6 +2,7 @@
 #define JSON_PARSER_HPP_INCLUDED
 
 #include <string>
+#include <vector>
 
 #include "variant.hpp"
 
@@ -14,6 +15,17 @@ variant parse(const std::string& doc, JSON_PARSE_OPTIONS options=JSON_USE_PREPRO
 variant parse_from_file(const std::string& fname, JSON_PARSE_OPTIONS options=JSON_USE_PREPROCESSOR);
 bool file_exists_and_is_valid(const std::string& fname);
 
+//parse_from_file in two steps: reading the file, which may be done on any
+//thread, and parsing it. The preprocessor can run FFL, so documents are
+//only parsed off the main thread if needs_preprocessor() is false.
+std::string read_file_to_parse(const std::string& fname);
+bool needs_preprocessor(const std::string& doc);
+variant parse_file_contents(const std::string& fname, const std::string& data, JSON_PARSE_OPTIONS options=JSON_USE_PREPROCESSOR);
+
+//parses the files on up to njobs threads, leaving those which need the
+//preprocessor to be parsed on this thread afterwards.
+std::vector<variant> parse_files_parallel(const std::vector<std::string>& fnames, int njobs, std::vector<int>* parse_times=NULL);
+
 struct parse_error {
 	explicit parse_error(const std::string& msg);
 	parse_error(const std::string& msg, const std::string& filename, int line, int col);
@@ -550,7 +550,7 @@ void level::load_character(variant c)
 		chars_by_label_[chars_.back()->label()] = chars_.back();
 	}
 
-	solid_chars_.clear();
+	solid_index_.invalidate();
 }
 
 void level::finish_loading()
@@ -706,6 +706,7 @@ void level::finish_loading()
 		}
 
 		chars_.erase(std::remove(chars_.begin(), chars_.end(), entity_ptr()), chars_.end());
+		solid_index_.invalidate();
 	}
 
 	//iterate over all our objects and let them do any final loading actions.
@@ -2143,26 +2144,48 @@ void level::calculate_lighting(int x, int y, int w, int h) const
 		return;
 	}
 
-	//find all the lights in the level
-	static std::vector<const light*> lights;
-	lights.clear();
+	//gather the lights that are on screen into a single batch.
+	const unsigned char color[] = { (unsigned char)dark_color_.r(), (unsigned char)dark_color_.g(), (unsigned char)dark_color_.b(), (unsigned char)dark_color_.a() };
+	const rect screen_area(x, y, w, h);
+	static light_batch batch;
+	batch.clear();
 	foreach(const entity_ptr& c, active_chars_) {
 		foreach(const light_ptr& lt, c->lights()) {
-			lights.push_back(lt.get());
+			if(lt->on_screen(screen_area)) {
+				lt->add_to_batch(batch, color);
+			}
 		}
 	}
 
-	{
+	//the light map only depends on the lights, the dark color, and the
+	//transform, so if none of those changed and nothing else has drawn to
+	//the frame buffer, the light map from last frame can be used again.
+	GLfloat transform[16];
+#if defined(USE_GLES2)
+	std::copy((const GLfloat*)(&gles2::get_mvp_matrix().x.x), (const GLfloat*)(&gles2::get_mvp_matrix().x.x) + 16, transform);
+#else
+	glGetFloatv(GL_MODELVIEW_MATRIX, transform);
+#endif
+
+	static light_batch last_batch;
+	static GLfloat last_transform[16];
+	static unsigned char last_color[4];
+	static int last_generation = -1;
+	if(last_generation != texture_frame_buffer::generation() ||
+	   batch != last_batch ||
+	   !std::equal(transform, transform + 16, last_transform) ||
+	   !std::equal(color, color + 4, last_color)) {
 		glBlendFunc(GL_ONE, GL_ONE);
-		rect screen_area(x, y, w, h);
 		const texture_frame_buffer::render_scope scope;
 
 		glClearColor(dark_color_.r()/255.0, dark_color_.g()/255.0, dark_color_.b()/255.0, dark_color_.a()/255.0);
 		glClear(GL_COLOR_BUFFER_BIT);
-		const unsigned char color[] = { (unsigned char)dark_color_.r(), (unsigned char)dark_color_.g(), (unsigned char)dark_color_.b(), (unsigned char)dark_color_.a() };
-		foreach(const light* lt, lights) {
-			lt->draw(screen_area, color);
-		}
+		batch.draw();
+
+		last_batch.swap(batch);
+		std::copy(transform, transform + 16, last_transform);
+		std::copy(color, color + 4, last_color);
+		last_generation = texture_frame_buffer::generation();
 	}
 
 	//now blit the light buffer onto the screen
@@ -2405,7 +2428,11 @@ void level::set_active_chars()
 		}
 	}
 
+	const int nchars = chars_.size();
 	chars_.erase(std::remove(chars_.begin(), chars_.end(), entity_ptr()), chars_.end());
+	if(chars_.size() != nchars) {
+		solid_index_.invalidate();
+	}
 
 	std::sort(active_chars_.begin(), active_chars_.end());
 	active_chars_.erase(std::unique(active_chars_.begin(), active_chars_.end()), active_chars_.end());
@@ -2428,8 +2455,15 @@ void level::do_processing()
 	}
 
 	const int ticks = SDL_GetTicks();
-	set_active_chars();
-	detect_user_collisions(*this);
+	{
+		formula_profiler::instrument instrumentation("SET_ACTIVE_CHARS");
+		set_active_chars();
+	}
+
+	{
+		formula_profiler::instrument instrumentation("COLLISIONS");
+		detect_user_collisions(*this);
+	}
 
 	
 /*
@@ -2478,10 +2512,9 @@ void level::do_processing()
 	}
 
 	if(water_) {
+		formula_profiler::instrument instrumentation("WATER");
 		water_->process(*this);
 	}
-
-	solid_chars_.clear();
 }
 
 void level::erase_char(entity_ptr c)
@@ -2497,7 +2530,7 @@ void level::erase_char(entity_ptr c)
 		group.erase(std::remove(group.begin(), group.end(), c), group.end());
 	}
 
-	solid_chars_.clear();
+	solid_index_.remove(c.get());
 }
 
 bool level::is_solid(const level_solid_map& map, const entity& e, const std::vector<point>& points, const surface_info** surf_info) const
@@ -3139,6 +3172,7 @@ void level::remove_character(entity_ptr e)
 		chars_by_label_.erase(e->label());
 	}
 	chars_.erase(std::remove(chars_.begin(), chars_.end(), e), chars_.end());
+	solid_index_.remove(e.get());
 }
 
 std::vector<entity_ptr> level::get_characters_in_rect(const rect& r, int screen_xpos, int screen_ypos) const
@@ -3307,6 +3341,7 @@ void level::add_multi_player(entity_ptr p)
 	p->get_player_info()->set_player_slot(players_.size());
 	players_.push_back(p);
 	chars_.push_back(p);
+	solid_index_.add(p);
 	if(p->label().empty() == false) {
 		chars_by_label_[p->label()] = p;
 	}
@@ -3352,14 +3387,11 @@ void level::add_player(entity_ptr p)
 	}
 
 	chars_.erase(std::remove(chars_.begin(), chars_.end(), entity_ptr()), chars_.end());
+	solid_index_.invalidate();
 }
 
 void level::add_character(entity_ptr p)
 {
-	if(solid_chars_.empty() == false && p->solid()) {
-		solid_chars_.push_back(p);
-	}
-
 	ASSERT_LOG(p->label().empty() == false, "Entity has no label");
 
 	if(p->label().empty() == false) {
@@ -3379,6 +3411,7 @@ void level::add_character(entity_ptr p)
 		add_player(p);
 	} else {
 		chars_.push_back(p);
+		solid_index_.add(p);
 	}
 
 	p->add_to_level();
@@ -3910,15 +3943,30 @@ void level::get_all_labels(std::vector<std::string>& labels) const
 
 const std::vector<entity_ptr>& level::get_solid_chars() const
 {
-	if(solid_chars_.empty()) {
-		foreach(const entity_ptr& e, chars_) {
-			if(e->solid() || e->platform()) {
-				solid_chars_.push_back(e);
-			}
-		}
+	if(!solid_index_.valid()) {
+		solid_index_.rebuild(chars_);
 	}
 
-	return solid_chars_;
+	return solid_index_.solid_chars();
+}
+
+namespace {
+//with fewer characters than this, searching the grid costs more than
+//just looking at every solid character.
+const int MinCharsForSolidIndex = 32;
+}
+
+const std::vector<entity_ptr>& level::get_solid_chars_in_rect(const rect& area) const
+{
+	if(chars_.size() < MinCharsForSolidIndex) {
+		return get_solid_chars();
+	}
+
+	if(!solid_index_.valid()) {
+		solid_index_.rebuild(chars_);
+	}
+
+	return solid_index_.query(area);
 }
 
 void level::begin_movement_script(const std::string& key, entity& e)
@@ -3958,16 +4006,32 @@ bool level::can_interact(const rect& body) const
 
 void level::replay_from_cycle(int ncycle)
 {
-		/*
-	const int cycles_ago = cycle_ - ncycle;
-	if(cycles_ago <= 0) {
+	const int cycle_to_play_until = cycle_;
+	if(ncycle >= cycle_to_play_until) {
 		return;
 	}
 
-	int index = static_cast<int>(backups_.size()) - cycles_ago;
-	ASSERT_GE(index, 0);
+	int index = static_cast<int>(backups_.size()) - 1;
+	while(index >= 0 && backups_[index]->cycle > ncycle) {
+		--index;
+	}
+
+	if(index < 0 || backups_[index]->cycle != ncycle) {
+		std::cerr << "CANNOT REPLAY FROM CYCLE " << ncycle << ": NO BACKUP OF IT\n";
+		return;
+	}
+
+	const int start_time = SDL_GetTicks();
+	disable_flashes_scope flashes_disabled_scope;
+
+	//the later backups are thrown away, and the objects in them will never
+	//be used, so break any circular references they hold.
+	for(int n = index + 1; n < backups_.size(); ++n) {
+		foreach(const entity_ptr& e, backups_[n]->chars) {
+			e->cleanup_references();
+		}
+	}
 
-	const int cycle_to_play_until = cycle_;
 	restore_from_backup(*backups_[index]);
 	ASSERT_EQ(cycle_, ncycle);
 	backups_.erase(backups_.begin() + index, backups_.end());
@@ -3975,7 +4039,11 @@ void level::replay_from_cycle(int ncycle)
 		backup();
 		do_processing();
 	}
-	*/
+
+	const int time_taken = SDL_GetTicks() - start_time;
+	if(time_taken >= preferences::frame_time_millis()) {
+		std::cerr << "SLOW ROLLBACK: REPLAYED " << (cycle_to_play_until - ncycle) << " CYCLES IN " << time_taken << "ms\n";
+	}
 }
 
 void level::backup()
@@ -4084,7 +4152,7 @@ void level::restore_from_backup(backup_snapshot& snapshot)
 	last_touched_player_ = snapshot.last_touched_player;
 	active_chars_.clear();
 
-	solid_chars_.clear();
+	solid_index_.invalidate();
 
 	chars_by_label_.clear();
 	foreach(const entity_ptr& e, chars_) {
@@ -4549,18 +4617,38 @@ UTILITY(compile_levels)
 	return;
 #endif
 
+	int njobs = threading::num_processors();
+	for(size_t n = 0; n < args.size(); ++n) {
+		if(args[n] == "--jobs" && n+1 < args.size()) {
+			njobs = std::max(1, atoi(args[++n].c_str()));
+		} else {
+			ASSERT_LOG(false, "UNRECOGNIZED ARGUMENT: " << args[n] << "\nusage: compile_levels [--jobs N]");
+		}
+	}
+
 	preferences::compiling_tiles = true;
 
 	std::cerr << "COMPILING LEVELS...\n";
 
+	const int start_time = SDL_GetTicks();
+
 	std::vector<std::string> files;
 	module::get_files_in_dir(preferences::level_path(), &files);
 
+	//parsing can be done on many threads, but levels can only be
+	//constructed on one.
+	std::vector<int> parse_times;
+	const std::vector<variant> nodes = load_level_wml_parallel(files, njobs, &parse_times);
+
+	const int parse_time = SDL_GetTicks() - start_time;
+
 	variant_builder index_node;
 
-	foreach(const std::string& file, files) {
+	for(int n = 0; n != files.size(); ++n) {
+		const std::string& file = files[n];
 		std::cerr << "LOADING LEVEL '" << file << "'\n";
-		boost::intrusive_ptr<level> lvl(new level(file));
+		const int compile_start = SDL_GetTicks();
+		boost::intrusive_ptr<level> lvl(new level(file, nodes[n]));
 		lvl->finish_loading();
 		lvl->record_zorders();
 		module::write_file("data/compiled/level/" + file, lvl->write().write_json(true));
@@ -4570,14 +4658,31 @@ UTILITY(compile_levels)
 		level_summary.add("title", lvl->title());
 		level_summary.add("music", lvl->music());
 		index_node.add("level", level_summary.build());
+
+		//a line of JSON for each level, so whatever is running us can
+		//show progress.
+		variant_builder progress;
+		progress.add("level", file);
+		progress.add("done", n + 1);
+		progress.add("total", static_cast<int>(files.size()));
+		progress.add("parse_ms", parse_times[n]);
+		progress.add("compile_ms", static_cast<int>(SDL_GetTicks() - compile_start));
+		std::cout << progress.build().write_json(false) << std::endl;
 	}
 
 	module::write_file("data/compiled/level_index.cfg", index_node.build().write_json(true));
 
 	level_object::write_compiled();
+
+	variant_builder summary;
+	summary.add("levels", static_cast<int>(files.size()));
+	summary.add("jobs", njobs);
+	summary.add("parse_ms", parse_time);
+	summary.add("total_ms", static_cast<int>(SDL_GetTicks() - start_time));
+	std::cout << summary.build().write_json(false) << std::endl;
 }
 
-BENCHMARK(level_solid)
+BENCHMARK_TAGGED(level_solid, "level")
 {
 	//benchmark which tells us how long level::solid takes.
 	static level* lvl = new level("stairway-to-heaven.cfg");
@@ -4586,14 +4691,14 @@ BENCHMARK(level_solid)
 	}
 }
 
-BENCHMARK(load_nene)
+BENCHMARK_TAGGED(load_nene, "level")
 {
 	BENCHMARK_LOOP {
 		level lvl("to-nenes-house.cfg");
 	}
 }
 
-BENCHMARK(load_all_levels)
+BENCHMARK_TAGGED(load_all_levels, "level")
 {
 	std::vector<std::string> files;
 	module::get_files_in_dir(preferences::level_path(), &files);
@@ -4604,7 +4709,7 @@ BENCHMARK(load_all_levels)
 	}
 }
 
-BENCHMARK(load_and_save_all_levels)
+BENCHMARK_TAGGED(load_and_save_all_levels, "level")
 {
 	BENCHMARK_LOOP {
 		std::vector<std::string> files;
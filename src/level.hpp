@@ -27,6 +27,7 @@
 #include "level_solid_map.hpp"
 #include "movement_script.hpp"
 #include "raster.hpp"
+#include "solid_entity_index.hpp"
 #include "speech_dialog.hpp"
 #include "tile_map.hpp"
 #include "variant.hpp"
@@ -268,7 +269,11 @@ public:
 	const std::vector<entity_ptr>& get_active_chars() const { return active_chars_; }
 	const std::vector<entity_ptr>& get_chars() const { return chars_; }
 	const std::vector<entity_ptr>& get_solid_chars() const;
-	void swap_chars(std::vector<entity_ptr>& v) { chars_.swap(v); solid_chars_.clear(); }
+
+	//the solid and platform characters which may be solid or a platform
+	//in 'area'. Only valid until the next call.
+	const std::vector<entity_ptr>& get_solid_chars_in_rect(const rect& area) const;
+	void swap_chars(std::vector<entity_ptr>& v) { chars_.swap(v); solid_index_.invalidate(); }
 	int num_active_chars() const { return active_chars_.size(); }
 
 	void begin_movement_script(const std::string& name, entity& e);
@@ -280,6 +285,9 @@ public:
 	bool can_interact(const rect& body) const;
 
 	int earliest_backup_cycle() const;
+
+	//restores the backup of the given cycle and processes the level up to
+	//the current cycle again, because the controls used have changed.
 	void replay_from_cycle(int ncycle);
 	void backup();
 	void reverse_one_cycle();
@@ -510,7 +518,7 @@ private:
 	std::vector<entity_ptr> chars_;
 	std::vector<entity_ptr> active_chars_;
 	std::vector<entity_ptr> new_chars_;
-	mutable std::vector<entity_ptr> solid_chars_;
+	mutable solid_entity_index solid_index_;
 
 	std::vector<entity_ptr> chars_immune_from_time_freeze_;
 
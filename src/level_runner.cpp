@@ -9,6 +9,7 @@
 #include "background_task_pool.hpp"
 #include "base64.hpp"
 #include "collision_utils.hpp"
+#include "allocation_tracker.hpp"
 #include "controls.hpp"
 #include "custom_object.hpp"
 #include "custom_object_functions.hpp"
@@ -22,6 +23,7 @@
 #include "foreach.hpp"
 #include "formatter.hpp"
 #include "formula_profiler.hpp"
+#include "frame_timing.hpp"
 #include "formula_callable.hpp"
 #include "http_client.hpp"
 #if defined(TARGET_OS_HARMATTAN) || defined(TARGET_BLACKBERRY) || defined(__ANDROID__)
@@ -43,6 +45,7 @@
 #include "raster.hpp"
 #include "settings_dialog.hpp"
 #include "sound.hpp"
+#include "startup_timeline.hpp"
 #include "stats.hpp"
 #include "surface_cache.hpp"
 #include "utils.hpp"
@@ -1263,6 +1266,8 @@ bool level_runner::play_cycle()
 				} else if(key == SDLK_p && mod & KMOD_ALT) {
 					preferences::set_use_pretty_scaling(!preferences::use_pretty_scaling());
 					graphics::texture::clear_textures();
+				} else if(key == SDLK_t && mod & KMOD_ALT) {
+					formula_profiler::toggle_tracing();
 				} else if(key == SDLK_f && mod & KMOD_CTRL) {
 					preferences::set_fullscreen(!preferences::fullscreen());
 					graphics::set_video_mode(graphics::screen_width(), graphics::screen_height());
@@ -1338,6 +1343,7 @@ bool level_runner::play_cycle()
 
 			const int process_time = SDL_GetTicks() - start_process;
 			next_process_ += process_time;
+			frame_timing::add_phase_time(frame_timing::PROCESS, process_time);
 			current_perf.process = process_time;
 		} else {
 			pause_time_ += preferences::frame_time_millis();
@@ -1445,6 +1451,7 @@ bool level_runner::play_cycle()
 
 		const int draw_time = SDL_GetTicks() - start_draw;
 		next_draw_ += draw_time;
+		frame_timing::add_phase_time(frame_timing::DRAW, draw_time);
 		current_perf.draw = draw_time;
 
 		const int start_flip = SDL_GetTicks();
@@ -1453,10 +1460,17 @@ bool level_runner::play_cycle()
 #if defined(__ANDROID__)
 			graphics::reset_opengl_state();
 #endif
+
+			if(startup_timeline::first_frame_drawn() && preferences::startup_budget_millis() > 0) {
+				//with --time-startup, we only wanted to see how long it
+				//took to get here.
+				quit_ = true;
+			}
 		}
 
 		const int flip_time = SDL_GetTicks() - start_flip;
 		next_flip_ += flip_time;
+		frame_timing::add_phase_time(frame_timing::FLIP, flip_time);
 		current_perf.flip = flip_time;
 		++next_fps_;
 		nskip_draw_ = 0;
@@ -1493,6 +1507,8 @@ bool level_runner::play_cycle()
 	}
 
 	formula_profiler::pump();
+	allocation_tracker::end_frame();
+	frame_timing::end_frame(*lvl_);
 
 	const int raw_wait_time = desired_end_time - SDL_GetTicks();
 	const int wait_time = std::max<int>(1, desired_end_time - SDL_GetTicks());
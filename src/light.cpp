@@ -4,6 +4,7 @@
 #include "formatter.hpp"
 #include "light.hpp"
 #include "raster.hpp"
+#include "unit_test.hpp"
 #include "variant_utils.hpp"
 
 light_ptr light::create_light(const custom_object& obj, variant node)
@@ -47,104 +48,136 @@ void circle_light::process()
 	center_ = object().midpoint();
 }
 
+namespace {
+	int fade_length = 64;
+
+	const int NumCircleAngles = 32;
+	float circle_x[NumCircleAngles], circle_y[NumCircleAngles];
+
+	void init_circle_angles()
+	{
+		static bool init = false;
+		if(init) {
+			return;
+		}
+
+		init = true;
+		for(int n = 0; n != NumCircleAngles; ++n) {
+			const float angle = n*0.2f;
+			circle_x[n] = cos(angle);
+			circle_y[n] = sin(angle);
+		}
+	}
+
+	bool circle_on_screen(const point& center, int radius, const rect& screen_area)
+	{
+		const int extent = radius + fade_length;
+		return rects_intersect(screen_area, rect(center.x - extent, center.y - extent, extent*2, extent*2));
+	}
+
+	void add_circle_to_batch(light_batch& batch, const point& center, int radius, const unsigned char* color)
+	{
+		init_circle_angles();
+
+		const unsigned char solid[] = { color[0], color[1], color[2], 255 };
+		const unsigned char faded[] = { color[0], color[1], color[2], 0 };
+
+		const float x = center.x;
+		const float y = center.y;
+		const float outer_radius = radius + fade_length;
+
+		for(int n = 0; n != NumCircleAngles; ++n) {
+			const int next = (n+1)%NumCircleAngles;
+			const float x1 = x + radius*circle_x[n];
+			const float y1 = y + radius*circle_y[n];
+			const float x2 = x + radius*circle_x[next];
+			const float y2 = y + radius*circle_y[next];
+			const float outer_x1 = x + outer_radius*circle_x[n];
+			const float outer_y1 = y + outer_radius*circle_y[n];
+			const float outer_x2 = x + outer_radius*circle_x[next];
+			const float outer_y2 = y + outer_radius*circle_y[next];
+
+			//the solid center of the light.
+			batch.add_triangle(x, y, x1, y1, x2, y2, solid, solid, solid);
+
+			//the ring around it that fades out.
+			batch.add_triangle(x1, y1, outer_x1, outer_y1, x2, y2, solid, faded, solid);
+			batch.add_triangle(outer_x1, outer_y1, outer_x2, outer_y2, x2, y2, faded, faded, solid);
+		}
+	}
+}
+
 bool circle_light::on_screen(const rect& screen_area) const
 {
-	return true;
+	return circle_on_screen(center_, radius_, screen_area);
 }
 
-namespace {
-	int fade_length = 64;
+void circle_light::add_to_batch(light_batch& batch, const unsigned char* color) const
+{
+	add_circle_to_batch(batch, center_, radius_, color);
 }
 
-void circle_light::draw(const rect& screen_area, const unsigned char* color) const
+void light::draw(const rect& screen_area, const unsigned char* color) const
 {
-	static std::vector<float> x_angles;
-	static std::vector<float> y_angles;
-
-	if(x_angles.empty()) {
-		for(float angle = 0.0f; angle < 3.1459f*2.0f; angle += 0.2f) {
-			x_angles.push_back(cos(angle));
-			y_angles.push_back(sin(angle));
-		}
-	}
+	light_batch batch;
+	add_to_batch(batch, color);
+	batch.draw();
+}
 
-	static std::vector<GLfloat> varray;
+void light_batch::clear()
+{
+	varray_.clear();
+	carray_.clear();
+}
 
-	const int x = center_.x;
-	const int y = center_.y;
+void light_batch::add_vertex(float x, float y, const unsigned char* color)
+{
+	varray_.push_back(x);
+	varray_.push_back(y);
+	carray_.insert(carray_.end(), color, color + 4);
+}
 
-	varray.clear();
-	varray.push_back(x);
-	varray.push_back(y);
-	for(int n = 0; n != x_angles.size(); ++n) {
-		const float xpos = x + radius_*x_angles[n];
-		const float ypos = y + radius_*y_angles[n];
-		varray.push_back(xpos);
-		varray.push_back(ypos);
-	}
+void light_batch::add_triangle(float x1, float y1, float x2, float y2, float x3, float y3,
+                               const unsigned char* c1, const unsigned char* c2, const unsigned char* c3)
+{
+	add_vertex(x1, y1, c1);
+	add_vertex(x2, y2, c2);
+	add_vertex(x3, y3, c3);
+}
 
-	//repeat the first coordinate to complete the circle
-	varray.push_back(varray[2]);
-	varray.push_back(varray[3]);
+bool light_batch::operator==(const light_batch& o) const
+{
+	return varray_ == o.varray_ && carray_ == o.carray_;
+}
 
-	glColor4ub(color[0], color[1], color[2], 255);
+void light_batch::swap(light_batch& o)
+{
+	varray_.swap(o.varray_);
+	carray_.swap(o.carray_);
+}
 
-#if defined(USE_GLES2)
-	gles2::manager gles2_manager(gles2::get_simple_shader());
-	gles2::active_shader()->shader()->vertex_array(2, GL_FLOAT, 0, 0, &varray.front());
-#else
-	glDisable(GL_TEXTURE_2D);
-	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-	glVertexPointer(2, GL_FLOAT, 0, &varray.front());
-#endif
-	glDrawArrays(GL_TRIANGLE_FAN, 0, varray.size()/2);
-
-	varray.clear();
-	for(int n = 0; n != x_angles.size(); ++n) {
-		const float xpos = x + radius_*x_angles[n];
-		const float ypos = y + radius_*y_angles[n];
-		const float xpos2 = x + (radius_+fade_length)*x_angles[n];
-		const float ypos2 = y + (radius_+fade_length)*y_angles[n];
-		varray.push_back(xpos);
-		varray.push_back(ypos);
-		varray.push_back(xpos2);
-		varray.push_back(ypos2);
+void light_batch::draw() const
+{
+	if(varray_.empty()) {
+		return;
 	}
 
-	varray.push_back(varray[0]);
-	varray.push_back(varray[1]);
-	varray.push_back(varray[2]);
-	varray.push_back(varray[3]);
-
-	//the color array always just alternates between full-alpha and no-alpha,
-	//always white. So just expand it until it's as big as needed.
-	static std::vector<GLbyte> carray;
-	carray.clear();
-	while(carray.size() < (x_angles.size()+1)*8) {
-		carray.push_back(color[0]);
-		carray.push_back(color[1]);
-		carray.push_back(color[2]);
-		carray.push_back(255);
-		carray.push_back(color[0]);
-		carray.push_back(color[1]);
-		carray.push_back(color[2]);
-		carray.push_back(0);
-	}
 #if defined(USE_GLES2)
 	{
 		gles2::manager gles2_manager(gles2::get_simple_col_shader());
-		// May need to use a frgament shader implementing phong shading here.
-		gles2::active_shader()->shader()->vertex_array(2, GL_FLOAT, 0, 0, &varray.front());
-		gles2::active_shader()->shader()->color_array(4, GL_UNSIGNED_BYTE, GL_TRUE, 0, &carray.front());
-		glDrawArrays(GL_TRIANGLE_STRIP, 0, varray.size()/2);
+		gles2::active_shader()->shader()->vertex_array(2, GL_FLOAT, 0, 0, &varray_.front());
+		gles2::active_shader()->shader()->color_array(4, GL_UNSIGNED_BYTE, GL_TRUE, 0, &carray_.front());
+		glDrawArrays(GL_TRIANGLES, 0, varray_.size()/2);
 	}
 #else
+	glDisable(GL_TEXTURE_2D);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 	glEnableClientState(GL_COLOR_ARRAY);
 	glShadeModel(GL_SMOOTH);
 
-	glVertexPointer(2, GL_FLOAT, 0, &varray.front());
-	glColorPointer(4, GL_UNSIGNED_BYTE, 0, &carray.front());
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, varray.size()/2);
+	glVertexPointer(2, GL_FLOAT, 0, &varray_.front());
+	glColorPointer(4, GL_UNSIGNED_BYTE, 0, &carray_.front());
+	glDrawArrays(GL_TRIANGLES, 0, varray_.size()/2);
 
 	glDisableClientState(GL_COLOR_ARRAY);
 	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
@@ -155,6 +188,29 @@ void circle_light::draw(const rect& screen_area, const unsigned char* color) con
 	glColor4ub(255, 255, 255, 255);
 }
 
+BENCHMARK_TAGGED(light_batch, "render")
+{
+	//build the light map for a dark level with a lot of torches, around
+	//half of which are off screen.
+	std::vector<std::pair<point, int> > lights;
+	for(int n = 0; n != 64; ++n) {
+		lights.push_back(std::pair<point, int>(point((n%16)*150, (n/16)*400), 40 + (n%3)*20));
+	}
+
+	const rect screen_area(0, 0, 1024, 768);
+	const unsigned char color[] = { 0, 0, 0, 255 };
+
+	light_batch batch;
+	BENCHMARK_LOOP {
+		batch.clear();
+		for(std::vector<std::pair<point, int> >::const_iterator i = lights.begin(); i != lights.end(); ++i) {
+			if(circle_on_screen(i->first, i->second, screen_area)) {
+				add_circle_to_batch(batch, i->first, i->second, color);
+			}
+		}
+	}
+}
+
 light_fade_length_setter::light_fade_length_setter(int value)
   : old_value_(fade_length)
 {
@@ -7,12 +7,38 @@
 
 #include <boost/intrusive_ptr.hpp>
 
+#include <vector>
+
 class custom_object;
 class light;
 
 typedef boost::intrusive_ptr<light> light_ptr;
 typedef boost::intrusive_ptr<const light> const_light_ptr;
 
+//Accumulates the triangles of many lights so the whole light map can be
+//drawn with one call. Doesn't touch OpenGL until draw() is called, so
+//building a batch can be done and measured without video.
+class light_batch
+{
+public:
+	void clear();
+	bool empty() const { return varray_.empty(); }
+	int num_vertexes() const { return varray_.size()/2; }
+
+	void add_triangle(float x1, float y1, float x2, float y2, float x3, float y3,
+	                  const unsigned char* c1, const unsigned char* c2, const unsigned char* c3);
+	void draw() const;
+
+	bool operator==(const light_batch& o) const;
+	bool operator!=(const light_batch& o) const { return !(*this == o); }
+	void swap(light_batch& o);
+private:
+	void add_vertex(float x, float y, const unsigned char* color);
+
+	std::vector<float> varray_;
+	std::vector<unsigned char> carray_;
+};
+
 class light : public game_logic::formula_callable
 {
 public:
@@ -24,7 +50,8 @@ public:
 	virtual ~light();
 	virtual void process() = 0;
 	virtual bool on_screen(const rect& screen_area) const = 0;
-	virtual void draw(const rect& screen_area, const unsigned char* color) const = 0;
+	virtual void add_to_batch(light_batch& batch, const unsigned char* color) const = 0;
+	void draw(const rect& screen_area, const unsigned char* color) const;
 protected:
 	const custom_object& object() const { return obj_; }
 private:
@@ -40,7 +67,7 @@ public:
 	variant write() const;
 	void process();
 	bool on_screen(const rect& screen_area) const;
-	void draw(const rect& screen_area, const unsigned char* color) const;
+	void add_to_batch(light_batch& batch, const unsigned char* color) const;
 private:
 	point center_;
 	int radius_;
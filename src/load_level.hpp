@@ -24,6 +24,11 @@ void preload_level_wml(const std::string& lvl);
 variant load_level_wml(const std::string& lvl);
 variant load_level_wml_nowait(const std::string& lvl);
 
+//parses the WML of many levels on up to njobs threads, for utilities which
+//process many levels. If parse_times is given, it's filled with how long
+//each level took to parse, in milliseconds.
+std::vector<variant> load_level_wml_parallel(const std::vector<std::string>& lvls, int njobs, std::vector<int>* parse_times=NULL);
+
 void preload_level(const std::string& lvl);
 level* load_level(const std::string& lvl);
 
@@ -2,6 +2,7 @@
 #include "concurrent_cache.hpp"
 #include "filesystem.hpp"
 #include "foreach.hpp"
+#include "formula_profiler.hpp"
 #include "json_parser.hpp"
 #include "level.hpp"
 #include "load_level.hpp"
@@ -54,15 +55,38 @@ variant load_level_wml(const std::string& lvl)
 	return load_level_wml_nowait(lvl);
 }
 
-variant load_level_wml_nowait(const std::string& lvl)
+namespace {
+std::string level_file_path(const std::string& lvl)
 {
 	if(lvl == "autosave.cfg") {
-		return json::parse_from_file(preferences::auto_save_file_path());
+		return preferences::auto_save_file_path();
 	} else if(lvl.size() >= 7 && lvl.substr(0,4) == "save" && lvl.substr(lvl.size()-4) == ".cfg") {
 		preferences::set_save_slot(lvl);
-		return json::parse_from_file(preferences::save_file_path());
+		return preferences::save_file_path();
+	}
+	return loadlevel::get_level_path(lvl);
+}
+}
+
+variant load_level_wml_nowait(const std::string& lvl)
+{
+	formula_profiler::instrument instrumentation("LOAD_LEVEL_WML");
+	return json::parse_from_file(level_file_path(lvl));
+}
+
+std::vector<variant> load_level_wml_parallel(const std::vector<std::string>& lvls, int njobs, std::vector<int>* parse_times)
+{
+	//find the paths first, so the threads only read and parse.
+	if(get_level_paths().empty()) {
+		loadlevel::load_level_paths();
+	}
+
+	std::vector<std::string> paths;
+	foreach(const std::string& lvl, lvls) {
+		paths.push_back(level_file_path(lvl));
 	}
-	return json::parse_from_file(loadlevel::get_level_path(lvl));
+
+	return json::parse_files_parallel(paths, njobs, parse_times);
 }
 
 load_level_manager::load_level_manager()
@@ -79,6 +103,7 @@ void preload_level(const std::string& lvl)
 
 level* load_level(const std::string& lvl)
 {
+	formula_profiler::instrument instrumentation("LOAD_LEVEL");
 	level* res = new level(lvl);
 	res->finish_loading();
 	return res;
@@ -52,6 +52,7 @@
 #include "preprocessor.hpp"
 #include "raster.hpp"
 #include "sound.hpp"
+#include "startup_timeline.hpp"
 #include "stats.hpp"
 #include "string_utils.hpp"
 #include "surface_cache.hpp"
@@ -78,8 +79,28 @@
 window_manager wm;
 #endif
 
+#if defined(USE_OSMESA)
+#include <GL/osmesa.h>
+#endif
+
 namespace {
 
+#if defined(USE_OSMESA)
+//makes an OSMesa context, drawing into memory, current, for when there's
+//no GPU or display.
+bool create_software_gl_context(int width, int height)
+{
+	static std::vector<GLubyte> buffer;
+	OSMesaContext ctx = OSMesaCreateContextExt(OSMESA_RGBA, 24, 8, 0, NULL);
+	if(ctx == NULL) {
+		return false;
+	}
+
+	buffer.resize(width*height*4);
+	return OSMesaMakeCurrent(ctx, &buffer[0], GL_UNSIGNED_BYTE, width, height) == GL_TRUE;
+}
+#endif
+
 bool show_title_screen(std::string& level_cfg)
 {
 	//currently the titlescreen is disabled.
@@ -106,6 +127,8 @@ void print_help(const std::string& argv0)
 "      --relay                  use the server as a relay in multiplayer rather\n" <<
 "                                 than trying to initiate direct connections\n" <<
 "      --[no-]resizable         allows/disallows to resize the game window\n" <<
+"      --rollback               in multiplayer, predict other players' controls\n" <<
+"                                 and roll back on mistakes, rather than waiting\n" <<
 "      --scale                  enables an experimental pixel art interpolation\n" <<
 "                                 algorithm for scaling the game graphics (some\n" <<
 "                                 issues with this still have to be solved)\n" <<
@@ -140,10 +163,40 @@ void print_help(const std::string& argv0)
 "                                 hacking on the engine to optimize the speed\n" <<
 "                                 of these\n" <<
 "      --benchmarks=NAME        runs a single named benchmark code\n" <<
+"      --benchmark-tags=TAGS    runs the benchmarks with any of the given\n" <<
+"                                 comma separated tags, e.g. formula,render\n" <<
+"      --benchmark-json=FILE    writes the benchmark results to FILE as JSON\n" <<
+"      --benchmark-baseline=FILE compares the benchmark results with those\n" <<
+"                                 written to FILE by an earlier run, and\n" <<
+"                                 fails if any have slowed down\n" <<
+"      --benchmark-threshold=N  how many percent slower a benchmark can be\n" <<
+"                                 than the baseline before it fails (10)\n" <<
+"      --benchmark-level=LEVEL  runs LEVEL without a window, and reports how\n" <<
+"                                 fast it ran, the time spent in each phase\n" <<
+"                                 of processing, and a checksum of the final\n" <<
+"                                 state. Takes the arguments following it:\n" <<
+"                                 --cycles N, --input FILE and\n" <<
+"                                 --expect-checksum N\n" <<
 "      --[no-]compiled          enable or disable precompiled game data\n" <<
 "      --edit                   starts the game in edit mode.\n" <<
 //"      --profile                FIXME\n" <<
 //"      --profile=FILE           FIXME\n" <<
+"      --trace=FILE             records a trace of where the time goes in\n" <<
+"                                 each frame, and writes it to FILE on exit,\n" <<
+"                                 to load into chrome://tracing or Perfetto.\n" <<
+"                                 Tracing can also be toggled in game with\n" <<
+"                                 alt+t, which writes the trace when stopped\n" <<
+"      --hitch-threshold=MS     writes a report of what happened in any frame\n" <<
+"                                 taking longer than MS (100) to the hitches\n" <<
+"                                 dir in the user data dir. 0 turns it off\n" <<
+"      --time-startup[=MS]      exits once the first frame is drawn, writing\n" <<
+"                                 how long each phase of starting took as\n" <<
+"                                 JSON, and fails if it took longer than MS\n" <<
+"                                 (3000). Use with --no-tests\n" <<
+"      --software-gl            draws with OSMesa without opening a window,\n" <<
+"                                 for running utilities such as render_level\n" <<
+"                                 on machines without a GPU. Needs a build\n" <<
+"                                 with USE_OSMESA\n" <<
 "      --show-hitboxes          turns on the display of object hitboxes\n" <<
 "      --show-controls          turns on the display of iPhone control hitboxes\n" <<
 "      --simipad                changes various options to emulate an iPad\n" <<
@@ -156,7 +209,9 @@ void print_help(const std::string& argv0)
 "      --no-tests               skips the execution of unit tests on startup\n"
 "      --utility=NAME           runs the specified UTILITY( NAME ) code block,\n" <<
 "                                 such as compile_levels or compile_objects,\n" <<
-"                                 with the specified arguments\n"
+"                                 with the specified arguments. The level and\n" <<
+"                                 object compilers and render_level take\n" <<
+"                                 --jobs N, the number of threads to use\n"
 	;
 }
 
@@ -221,6 +276,8 @@ extern "C" int main(int argcount, char** argvec)
 	std::cerr.sync_with_stdio(true);
 	#endif
 
+	startup_timeline::begin_phase("modules");
+
 	std::cerr << "Frogatto engine version " << preferences::version() << "\n";
 	LOG( "After print engine version" );
 
@@ -233,12 +290,14 @@ extern "C" int main(int argcount, char** argvec)
 	bool unit_tests_only = false, skip_tests = false;
 	bool run_benchmarks = false;
 	std::vector<std::string> benchmarks_list;
+	test::benchmark_options benchmark_options;
 	std::string utility_program;
 	std::vector<std::string> util_args;
 	std::string server = "wesnoth.org";
 
 	const char* profile_output = NULL;
 	std::string profile_output_buf;
+	std::string trace_output;
 
 #if defined(__ANDROID__)
 	monstartup("libapplication.so");
@@ -307,6 +366,7 @@ extern "C" int main(int argcount, char** argvec)
 		}
 	}
 
+	startup_timeline::begin_phase("preferences");
 	preferences::load_preferences();
 	LOG( "After load_preferences()" );
 
@@ -328,6 +388,8 @@ extern "C" int main(int argcount, char** argvec)
 		} else if(arg_name == "--profile" || arg == "--profile") {
 			profile_output_buf = arg_value;
 			profile_output = profile_output_buf.c_str();
+		} else if(arg_name == "--trace") {
+			trace_output = arg_value;
 		} else if(arg_name == "--utility") {
 			utility_program = arg_value;
 			for(++n; n < argc; ++n) {
@@ -335,12 +397,31 @@ extern "C" int main(int argcount, char** argvec)
 				util_args.push_back(arg);
 			}
 
+			break;
+		} else if(arg_name == "--benchmark-level") {
+			utility_program = "benchmark_level";
+			util_args.push_back(arg_value);
+			for(++n; n < argc; ++n) {
+				util_args.push_back(argv[n]);
+			}
+
 			break;
 		} else if(arg == "--benchmarks") {
 			run_benchmarks = true;
 		} else if(arg_name == "--benchmarks") {
 			run_benchmarks = true;
 			benchmarks_list = util::split(arg_value);
+		} else if(arg_name == "--benchmark-tags") {
+			run_benchmarks = true;
+			benchmark_options.tags = util::split(arg_value);
+		} else if(arg_name == "--benchmark-json") {
+			run_benchmarks = true;
+			benchmark_options.output_file = arg_value;
+		} else if(arg_name == "--benchmark-baseline") {
+			run_benchmarks = true;
+			benchmark_options.baseline_file = arg_value;
+		} else if(arg_name == "--benchmark-threshold") {
+			benchmark_options.regression_threshold = atoi(arg_value.c_str());
 		} else if(arg == "--tests") {
 			unit_tests_only = true;
 		} else if(arg == "--no-tests") {
@@ -381,11 +462,13 @@ extern "C" int main(int argcount, char** argvec)
 		}
 	}
 
+	startup_timeline::begin_phase("checksum");
 	checksum::manager checksum_manager;
 #ifndef NO_EDITOR
 	sys::filesystem_manager fs_manager;
 #endif // NO_EDITOR
 
+	startup_timeline::begin_phase("data_paths");
 	preferences::expand_data_paths();
 
 	background_task_pool::manager bg_task_pool_manager;
@@ -417,6 +500,19 @@ extern "C" int main(int argcount, char** argvec)
 
 	LOG( "Start of main" );
 	
+	startup_timeline::begin_phase("sdl_init");
+
+	if(preferences::software_gl()) {
+#if defined(USE_OSMESA)
+		//there's no display to open a window on, so SDL just gets a surface
+		//in memory, and OSMesa does the drawing.
+		SDL_putenv(const_cast<char*>("SDL_VIDEODRIVER=dummy"));
+#else
+		std::cerr << "--software-gl NEEDS A BUILD WITH USE_OSMESA\n";
+		return -1;
+#endif
+	}
+
 #if !defined(__native_client__)
 	Uint32 sdl_init_flags = SDL_INIT_VIDEO | SDL_INIT_JOYSTICK;
 #if defined(_WINDOWS) || defined(TARGET_OS_IPHONE)
@@ -452,6 +548,8 @@ extern "C" int main(int argcount, char** argvec)
 		orig_level_cfg = level_cfg;
 	}
 
+	startup_timeline::begin_phase("video_mode");
+
 #if defined(USE_GLES2)
 	wm.create_window(preferences::actual_screen_width(),
 		preferences::actual_screen_height(),
@@ -569,6 +667,15 @@ extern "C" int main(int argcount, char** argvec)
 		return -1;
     }
 #else
+#if defined(USE_OSMESA)
+	if(preferences::software_gl()) {
+		if(SDL_SetVideoMode(preferences::actual_screen_width(),preferences::actual_screen_height(),0,0) == NULL ||
+		   !create_software_gl_context(preferences::actual_screen_width(),preferences::actual_screen_height())) {
+			std::cerr << "could not create software GL context\n";
+			return -1;
+		}
+	} else
+#endif
 	if (SDL_SetVideoMode(preferences::actual_screen_width(),preferences::actual_screen_height(),0,SDL_OPENGL|(preferences::resizable() ? SDL_RESIZABLE : 0)|(preferences::fullscreen() ? SDL_FULLSCREEN : 0)) == NULL) {
 		std::cerr << "could not set video mode\n";
 		return -1;
@@ -601,6 +708,8 @@ extern "C" int main(int argcount, char** argvec)
 
 //	srand(time(NULL));
 
+	startup_timeline::begin_phase("gl_setup");
+
 	const stats::manager stats_manager;
 #ifndef NO_EDITOR
 	const external_text_editor::manager editor_manager;
@@ -668,6 +777,8 @@ extern "C" int main(int argcount, char** argvec)
 
 	const load_level_manager load_manager;
 
+	startup_timeline::begin_phase("fonts_sound_joystick");
+
 	{ //manager scope
 	const font::manager font_manager;
 	const sound::manager sound_manager;
@@ -692,24 +803,28 @@ extern "C" int main(int argcount, char** argvec)
 	variant preloads;
 	loading_screen loader;
 	try {
-		sound::init_music(json::parse_from_file(module::map_file("data/music.cfg")));
-
+		startup_timeline::begin_phase("graphical_fonts");
 		std::string filename = "data/fonts." + i18n::get_locale() + ".cfg";
 		if (!sys::file_exists(filename))
 			filename = "data/fonts.cfg";
 		graphical_font::init(json::parse_from_file(module::map_file(filename)));
 
+		startup_timeline::begin_phase("custom_objects");
 		preloads = json::parse_from_file(module::map_file("data/preload.cfg"));
 		int preload_items = preloads["preload"].num_elements();
 		loader.set_number_of_items(preload_items+7); // 7 is the number of items that will be loaded below
 		custom_object::init();
 		loader.draw_and_increment(_("Initializing custom object functions"));
+		startup_timeline::begin_phase("custom_object_functions");
 		init_custom_object_functions(json::parse_from_file(module::map_file("data/functions.cfg")));
 		loader.draw_and_increment(_("Initializing textures"));
+		startup_timeline::begin_phase("preload_textures");
 		loader.load(preloads);
 		loader.draw_and_increment(_("Initializing tiles"));
+		startup_timeline::begin_phase("tiles");
 		tile_map::init(json::parse_from_file(module::map_file("data/tiles.cfg")));
 		loader.draw_and_increment(_("Initializing GUI"));
+		startup_timeline::begin_phase("gui");
 
 		variant gui_node = json::parse_from_file(module::map_file(preferences::load_compiled() ? "data/compiled/gui.cfg" : "data/gui.cfg"));
 		gui_section::init(gui_node);
@@ -727,6 +842,7 @@ extern "C" int main(int argcount, char** argvec)
 	}
 #endif
 
+	startup_timeline::begin_phase("unit_tests");
 	if(!skip_tests && !test::run_tests()) {
 		return -1;
 	}
@@ -739,6 +855,7 @@ extern "C" int main(int argcount, char** argvec)
 	CGLSetParameter(CGLGetCurrentContext(), kCGLCPSwapInterval, &swapInterval);
 #endif
 
+	startup_timeline::begin_phase("finish_loading");
 	loader.finish_loading();
 	//look to see if we got any quit events while loading.
 	{
@@ -751,6 +868,7 @@ extern "C" int main(int argcount, char** argvec)
 	}
 
 	formula_profiler::manager profiler(profile_output);
+	formula_profiler::trace_manager tracer(trace_output);
 
 #ifdef USE_GLES2
 	texture_frame_buffer::init(preferences::actual_screen_width(), preferences::actual_screen_height());
@@ -759,12 +877,8 @@ extern "C" int main(int argcount, char** argvec)
 #endif
 
 	if(run_benchmarks) {
-		if(benchmarks_list.empty() == false) {
-			test::run_benchmarks(&benchmarks_list);
-		} else {
-			test::run_benchmarks();
-		}
-		return 0;
+		const bool passed = test::run_benchmarks(benchmarks_list.empty() ? NULL : &benchmarks_list, &benchmark_options);
+		return passed ? 0 : -1;
 	} else if(utility_program.empty() == false) {
 		test::run_utility(utility_program, util_args);
 		return 0;
@@ -774,6 +888,7 @@ extern "C" int main(int argcount, char** argvec)
 	bool of_initialized = false;
 
 	while(!quit && !show_title_screen(level_cfg)) {
+		startup_timeline::begin_phase("load_level");
 		boost::intrusive_ptr<level> lvl(load_level(level_cfg));
 		
 #if TARGET_OS_IPHONE || TARGET_IPHONE_SIMULATOR
@@ -826,6 +941,7 @@ extern "C" int main(int argcount, char** argvec)
 		set_scene_title(lvl->title());
 
 		try {
+			startup_timeline::begin_phase("first_frame");
 			quit = level_runner(lvl, level_cfg, orig_level_cfg).play_level();
 			level_cfg = orig_level_cfg;
 		} catch(multiplayer_exception&) {
@@ -851,5 +967,11 @@ extern "C" int main(int argcount, char** argvec)
 #if !defined(TARGET_OS_HARMATTAN) && !defined(TARGET_TEGRA) && !defined(TARGET_BLACKBERRY) && !defined(__ANDROID__) && !defined(USE_GLES2)
 	std::cerr << gluErrorString(glGetError()) << "\n";
 #endif
+
+	if(preferences::startup_budget_millis() > 0) {
+		std::cout << startup_timeline::get_report() << "\n";
+		return startup_timeline::within_budget() ? 0 : -1;
+	}
+
 	return 0;
 }
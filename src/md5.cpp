@@ -29,12 +29,22 @@ namespace md5 {
 
 std::string sum(const std::string& data)
 {
-	std::string result = MD5().calc(data);
+	//hash the string where it is, rather than copying it, since data
+	//files are large enough for the copies to cost about as much as
+	//the hashing.
+	MD5Context ctx;
+	MD5Init(&ctx);
+	if(data.empty() == false) {
+		MD5Update(&ctx, reinterpret_cast<unsigned char*>(const_cast<char*>(data.data())), data.size());
+	}
+
+	uint8_t digest[16];
+	MD5Final(digest, &ctx);
+
 	std::string output;
-	for(std::string::const_iterator i = result.begin(); i != result.end(); ++i) {
+	for(int n = 0; n != 16; ++n) {
 		char buf[64];
-		const unsigned char c = *i;
-		sprintf(buf, "%02x", c);
+		sprintf(buf, "%02x", digest[n]);
 		output += buf;
 	}
 
@@ -275,6 +285,11 @@ void MD5Transform(uint32_t buf[4], uint32_t in[16])
 }
 }
 
+UNIT_TEST(md5_sum) {
+	CHECK_EQ(md5::sum(""), "d41d8cd98f00b204e9800998ecf8427e");
+	CHECK_EQ(md5::sum("message digest"), "f96b697d7cb7938d525a2f31aaf161d0");
+}
+
 UNIT_TEST(md5_test1) {
 	std::string md5sum = MD5::calc("");
 	// We need to construct the result here using the array overload constructor due to the embedded null's
@@ -359,45 +359,85 @@ bool is_valid_module_id(const std::string& id)
 }
 
 #if !defined(NO_TCP) || !defined(NO_MODULES)
+std::string compress_chunk(const std::string& contents)
+{
+	std::string chunk;
+	zip::compressor c(zip::string_sink(&chunk));
+	c.write(contents.c_str(), contents.size());
+	c.finish();
+	return chunk;
+}
+
+namespace {
+//appends decompressed data, refusing to go beyond the size the manifest
+//gives so a bad chunk can't use up memory.
+void append_chunk_data(std::string* contents, size_t size, const char* data, size_t len)
+{
+	ASSERT_LOG(contents->size() + len <= size, "CHUNK IS BIGGER THAN EXPECTED");
+	contents->append(data, len);
+}
+}
+
+bool decompress_chunk(const std::string& chunk, const std::string& md5, int size, std::string* contents)
+{
+	contents->clear();
+	if(size < 0) {
+		return false;
+	}
+
+	contents->reserve(size);
+
+	const assert_recover_scope recovery;
+	try {
+		zip::decompressor d(boost::bind(append_chunk_data, contents, size, _1, _2));
+		d.write(chunk.c_str(), chunk.size());
+		d.finish();
+	} catch(validation_failure_exception&) {
+		return false;
+	}
+
+	return contents->size() == size && md5::sum(*contents) == md5;
+}
+
+bool is_valid_chunk_id(const std::string& id)
+{
+	return id.size() == 32 && id.find_first_not_of("0123456789abcdefABCDEF") == std::string::npos;
+}
+
 variant build_package(const std::string& id)
 {
-	std::vector<char> data;
 	std::vector<std::string> files;
 	const std::string path = "modules/" + id;
 	ASSERT_LOG(sys::file_exists(path), "COULD NOT FIND PATH: " << path);
 	get_files_in_module(path, files);
-	std::map<variant, variant> file_attr;
+	std::map<variant, variant> file_attr, chunks;
+	int uncompressed_size = 0, compressed_size = 0;
 	foreach(const std::string& file, files) {
 		std::cerr << "processing " << file << "...\n";
 		std::string fname(file.begin() + path.size() + 1, file.end());
 		std::map<variant, variant> attr;
 
 		const std::string contents = sys::read_file(file);
+		const variant md5(md5::sum(contents));
 
-		attr[variant("begin")] = variant(data.size());
 		attr[variant("size")] = variant(contents.size());
-		attr[variant("md5")] = variant(md5::sum(contents));
-
-		data.insert(data.end(), contents.begin(), contents.end());
-
+		attr[variant("md5")] = md5;
 		file_attr[variant(fname)] = variant(&attr);
+
+		if(chunks.count(md5) == 0) {
+			const std::string chunk = compress_chunk(contents);
+			chunks[md5] = variant(base64::b64encode(chunk));
+			uncompressed_size += contents.size();
+			compressed_size += chunk.size();
+		}
 	}
 
+	std::cerr << "COMPRESSED " << uncompressed_size << " TO " << compressed_size << " IN " << chunks.size() << " CHUNKS\n";
+
 	const std::string module_cfg_file = path + "/module.cfg";
 	variant module_cfg = json::parse(sys::read_file(module_cfg_file));
 	ASSERT_LOG(module_cfg["version"].is_list(), "IN " << module_cfg_file << " THERE MUST BE A VERSION NUMBER GIVEN AS A LIST OF INTEGERS");
 
-	//this verifies that compression/decompression works but is slow.
-	ASSERT_LOG(zip::decompress_known_size(base64::b64decode(base64::b64encode(zip::compress(data))), data.size()) == data, "COMPRESS/DECOMPRESS BROKEN");
-
-	std::cerr << "compressing data: " << data.size() << "...\n";
-	const int uncompressed_size = data.size();
-	data = zip::compress(data);
-	std::cerr << "COMPRESSED " << uncompressed_size << " TO " << data.size() << "\n";
-	data = base64::b64encode(data);
-
-	const std::string data_str(data.begin(), data.end());
-
 	std::map<variant, variant> data_attr;
 	data_attr[variant("id")] = variant(id);
 	data_attr[variant("version")] = module_cfg["version"];
@@ -406,7 +446,7 @@ variant build_package(const std::string& id)
 	data_attr[variant("description")] = module_cfg["description"];
 	data_attr[variant("dependencies")] = module_cfg["dependencies"];
 	data_attr[variant("manifest")] = variant(&file_attr);
-	data_attr[variant("data")] = variant(data_str);
+	data_attr[variant("chunks")] = variant(&chunks);
 	data_attr[variant("data_size")] = variant(uncompressed_size);
 
 	if(module_cfg.has_key("icon")) {
@@ -525,6 +565,42 @@ bool is_module_path_valid(const std::string& str)
 
 	return str.empty() == false && isalnum(str[0]) && std::count_if(str.begin(), str.end(), valid_path_chars) == str.size();
 }
+
+//installs a package from before packages were chunked, which has all the
+//files concatenated in one blob.
+void install_legacy_package(const std::string& module_id, variant module_data)
+{
+	std::vector<char> data_buf;
+	{
+		const std::string data_str = module_data["data"].as_string();
+		data_buf.insert(data_buf.begin(), data_str.begin(), data_str.end());
+	}
+	const int data_size = module_data["data_size"].as_int();
+	std::cerr << "DATA: " << module_data["data"].as_string().size() << " " << data_size << "\n";
+
+	std::vector<char> data = zip::decompress_known_size(base64::b64decode(data_buf), data_size);
+
+	variant manifest = module_data["manifest"];
+	foreach(variant path, manifest.get_keys().as_list()) {
+		const std::string path_str = path.as_string();
+		ASSERT_LOG(is_module_path_valid(path_str), "INVALID PATH IN MODULE: " << path_str);
+	}
+
+	foreach(variant path, manifest.get_keys().as_list()) {
+		variant info = manifest[path];
+		const std::string path_str = preferences::dlc_path() + "/" + module_id + "/" + path.as_string();
+		const int begin = info["begin"].as_int();
+		const int end = begin + info["size"].as_int();
+		ASSERT_LOG(begin >= 0 && end >= 0 && begin <= data.size() && end <= data.size(), "INVALID PATH INDEXES FOR " << path_str << ": " << begin << "," << end << " / " << data.size());
+
+		std::cerr << "CREATING FILE AT " << path_str << "\n";
+		sys::write_file(path_str, std::string(data.begin() + begin, data.begin() + end));
+	}
+}
+
+//chunks are requested in batches, which are kept to around this size.
+const int MaxChunksPerRequest = 64;
+const int MaxChunkRequestSize = 4*1024*1024;
 }
 
 client::client() : operation_(client::OPERATION_NONE),
@@ -613,6 +689,11 @@ variant client::get_value(const std::string& key) const
 
 void client::on_response(std::string response)
 {
+	if(operation_ == OPERATION_GET_CHUNKS) {
+		on_chunks(response);
+		return;
+	}
+
 	try {
 		std::cerr << "GOT RESPONSE: " << response << "\n";
 		variant doc = json::parse(response, json::JSON_NO_PREPROCESSOR);
@@ -623,32 +704,13 @@ void client::on_response(std::string response)
 			ASSERT_LOG(doc["status"].as_string() == "ok", "COULD NOT DOWNLOAD MODULE: " << doc["message"]);
 
 			variant module_data = doc["module"];
-
-			std::vector<char> data_buf;
-			{
-				const std::string data_str = module_data["data"].as_string();
-				data_buf.insert(data_buf.begin(), data_str.begin(), data_str.end());
-			}
-			const int data_size = module_data["data_size"].as_int();
-			std::cerr << "DATA: " << module_data["data"].as_string().size() << " " << data_size << "\n";
-
-			std::vector<char> data = zip::decompress_known_size(base64::b64decode(data_buf), data_size);
-
-			variant manifest = module_data["manifest"];
-			foreach(variant path, manifest.get_keys().as_list()) {
-				const std::string path_str = path.as_string();
-				ASSERT_LOG(is_module_path_valid(path_str), "INVALID PATH IN MODULE: " << path_str);
-			}
-
-			foreach(variant path, manifest.get_keys().as_list()) {
-				variant info = manifest[path];
-				const std::string path_str = preferences::dlc_path() + "/" + module_id_ + "/" + path.as_string();
-				const int begin = info["begin"].as_int();
-				const int end = begin + info["size"].as_int();
-				ASSERT_LOG(begin >= 0 && end >= 0 && begin <= data.size() && end <= data.size(), "INVALID PATH INDEXES FOR " << path_str << ": " << begin << "," << end << " / " << data.size());
-
-				std::cerr << "CREATING FILE AT " << path_str << "\n";
-				sys::write_file(path_str, std::string(data.begin() + begin, data.begin() + end));
+			if(module_data.has_key("data")) {
+				install_legacy_package(module_id_, module_data);
+			} else {
+				start_install(module_data);
+				if(request_chunks()) {
+					return;
+				}
 			}
 
 		} else if(operation_ == OPERATION_GET_STATUS) {
@@ -702,6 +764,134 @@ void client::on_response(std::string response)
 	operation_ = OPERATION_NONE;
 }
 
+void client::start_install(variant module_data)
+{
+	chunks_.clear();
+	chunks_needed_.clear();
+	chunks_requested_.clear();
+
+	variant manifest = module_data["manifest"];
+	foreach(variant path, manifest.get_keys().as_list()) {
+		const std::string path_str = path.as_string();
+		ASSERT_LOG(is_module_path_valid(path_str), "INVALID PATH IN MODULE: " << path_str);
+	}
+
+	int nfiles = 0;
+	foreach(variant path, manifest.get_keys().as_list()) {
+		variant info = manifest[path];
+		const std::string md5 = info["md5"].as_string();
+		const int size = info["size"].as_int();
+		ASSERT_LOG(is_valid_chunk_id(md5), "INVALID MD5 IN MODULE: " << md5);
+
+		const std::string path_str = preferences::dlc_path() + "/" + module_id_ + "/" + path.as_string();
+		if(sys::file_exists(path_str)) {
+			const std::string contents = sys::read_file(path_str);
+			if(contents.size() == size && md5::sum(contents) == md5) {
+				continue;
+			}
+		}
+
+		chunk_info& chunk = chunks_[md5];
+		if(chunk.paths.empty()) {
+			chunk.size = size;
+			chunks_needed_.push_back(md5);
+		}
+
+		chunk.paths.push_back(path_str);
+		++nfiles;
+	}
+
+	std::cerr << "MODULE " << module_id_ << " NEEDS " << nfiles << " FILES IN " << chunks_.size() << " CHUNKS\n";
+	data_["chunks_remaining"] = variant(static_cast<int>(chunks_.size()));
+}
+
+bool client::request_chunks()
+{
+	chunks_requested_.clear();
+	if(chunks_needed_.empty()) {
+		return false;
+	}
+
+	std::string ids;
+	int size = 0;
+	while(!chunks_needed_.empty() && chunks_requested_.size() < MaxChunksPerRequest && size < MaxChunkRequestSize) {
+		const std::string& id = chunks_needed_.front();
+		size += chunks_[id].size;
+		if(!ids.empty()) {
+			ids += ",";
+		}
+
+		ids += id;
+		chunks_requested_.push_back(id);
+		chunks_needed_.pop_front();
+	}
+
+	operation_ = OPERATION_GET_CHUNKS;
+	client_->send_request("GET /download_chunks?chunks=" + ids, "",
+	                      boost::bind(&client::on_response, this, _1),
+	                      boost::bind(&client::on_error, this, _1),
+	                      boost::bind(&client::on_progress, this, _1, _2, _3));
+	return true;
+}
+
+void client::on_chunks(const std::string& response)
+{
+	//the response is a sequence of chunks, each preceded by a line
+	//giving its id and size.
+	std::string error;
+	size_t pos = 0;
+	while(pos < response.size()) {
+		const size_t end_line = response.find('\n', pos);
+		const size_t space = response.find(' ', pos);
+		if(end_line == std::string::npos || space == std::string::npos || space > end_line) {
+			error = "Could not parse chunks";
+			break;
+		}
+
+		const std::string id(response.begin() + pos, response.begin() + space);
+		const size_t len = strtoul(response.c_str() + space + 1, NULL, 10);
+		pos = end_line + 1;
+
+		std::map<std::string, chunk_info>::iterator i = chunks_.find(id);
+		if(len > response.size() - pos || i == chunks_.end()) {
+			error = "Could not parse chunks";
+			break;
+		}
+
+		std::string contents;
+		if(!decompress_chunk(response.substr(pos, len), id, i->second.size, &contents)) {
+			error = "Corrupt chunk " + id;
+			break;
+		}
+
+		foreach(const std::string& path, i->second.paths) {
+			std::cerr << "CREATING FILE AT " << path << "\n";
+			sys::write_file(path, contents);
+		}
+
+		chunks_.erase(i);
+		pos += len;
+	}
+
+	foreach(const std::string& id, chunks_requested_) {
+		if(error.empty() && chunks_.count(id)) {
+			error = "Server did not send chunk " + id;
+		}
+	}
+
+	if(!error.empty()) {
+		std::cerr << "ERROR INSTALLING MODULE: " << error << "\n";
+		data_["error"] = variant(error);
+		operation_ = OPERATION_NONE;
+		return;
+	}
+
+	data_["chunks_remaining"] = variant(static_cast<int>(chunks_.size()));
+	if(!request_chunks()) {
+		operation_ = OPERATION_NONE;
+	}
+}
+
 void client::on_error(std::string response)
 {
 	data_["error"] = variant(response);
@@ -741,51 +931,18 @@ COMMAND_LINE_UTILITY(install_module)
 		}
 	}
 
-	bool done = false;
-
-	std::string response;
-
-	http_client client(server, port);
-	client.send_request("GET /download_module?module_id=" + module_id, "", 
-	                    boost::bind(finish_upload, _1, &done, &response),
-	                    boost::bind(error_upload, _1, &done),
-	                    boost::bind(upload_progress, _1, _2, _3));
-
-	while(!done) {
-		client.process();
-	}
-
-	variant doc = json::parse(response, json::JSON_NO_PREPROCESSOR);
-	ASSERT_LOG(doc["status"].as_string() == "ok", "COULD NOT DOWNLOAD MODULE: " << doc["message"]);
-
-	variant module_data = doc["module"];
+	ASSERT_LOG(module_id.empty() == false, "MUST SPECIFY MODULE ID");
 
-	std::vector<char> data_buf;
-	{
-		const std::string data_str = module_data["data"].as_string();
-		data_buf.insert(data_buf.begin(), data_str.begin(), data_str.end());
+	client cl(server, port);
+	while(cl.process()) {
 	}
-	const int data_size = module_data["data_size"].as_int();
-	std::cerr << "DATA: " << module_data["data"].as_string().size() << " " << data_size << "\n";
-
-	std::vector<char> data = zip::decompress_known_size(base64::b64decode(data_buf), data_size);
 
-	variant manifest = module_data["manifest"];
-	foreach(variant path, manifest.get_keys().as_list()) {
-		const std::string path_str = path.as_string();
-		ASSERT_LOG(is_module_path_valid(path_str), "INVALID PATH IN MODULE: " << path_str);
+	cl.install_module(module_id);
+	while(cl.process()) {
 	}
 
-	foreach(variant path, manifest.get_keys().as_list()) {
-		variant info = manifest[path];
-		const std::string path_str = preferences::dlc_path() + "/" + module_id + "/" + path.as_string();
-		const int begin = info["begin"].as_int();
-		const int end = begin + info["size"].as_int();
-		ASSERT_LOG(begin >= 0 && end >= 0 && begin <= data.size() && end <= data.size(), "INVALID PATH INDEXES FOR " << path_str << ": " << begin << "," << end << " / " << data.size());
-
-		std::cerr << "CREATING FILE AT " << path_str << "\n";
-		sys::write_file(path_str, std::string(data.begin() + begin, data.begin() + end));
-	}
+	const variant error = cl.get_value("error");
+	ASSERT_LOG(error.is_null(), "COULD NOT INSTALL MODULE: " << error.write_json());
 }
 
 COMMAND_LINE_UTILITY(publish_module_stats)
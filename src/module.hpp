@@ -3,6 +3,8 @@
 
 #include <boost/scoped_ptr.hpp>
 
+#include <deque>
+
 #include "filesystem.hpp"
 #include "formula_callable.hpp"
 #include "variant.hpp"
@@ -57,8 +59,20 @@ void get_module_list(std::vector<std::string>& dirs);
 void load_module_from_file(const std::string& modname, modules* mod_);
 void write_file(const std::string& mod_path, const std::string& data);
 
+//A package holds a module's manifest, mapping each file to its size and
+//md5, and its chunks: the compressed contents of each file, keyed by md5,
+//so a file which is in several places or several versions of a module is
+//only stored and downloaded once.
 variant build_package(const std::string& id);
 
+std::string compress_chunk(const std::string& contents);
+
+//decompresses a chunk, checking it against the size and md5 from the
+//manifest. Returns false if it doesn't match.
+bool decompress_chunk(const std::string& chunk, const std::string& md5, int size, std::string* contents);
+
+bool is_valid_chunk_id(const std::string& id);
+
 bool uninstall_downloaded_module(const std::string& id);
 
 class client : public game_logic::formula_callable
@@ -72,7 +86,7 @@ public:
 	bool process();
 	variant get_value(const std::string& key) const;
 private:
-	enum OPERATION_TYPE { OPERATION_NONE, OPERATION_INSTALL, OPERATION_GET_STATUS, OPERATION_GET_ICONS, OPERATION_RATE };
+	enum OPERATION_TYPE { OPERATION_NONE, OPERATION_INSTALL, OPERATION_GET_CHUNKS, OPERATION_GET_STATUS, OPERATION_GET_ICONS, OPERATION_RATE };
 	OPERATION_TYPE operation_;
 	std::string module_id_;
 	boost::scoped_ptr<class http_client> client_;
@@ -83,6 +97,25 @@ private:
 	void on_response(std::string response);
 	void on_error(std::string response);
 	void on_progress(int sent, int total, bool uploaded);
+
+	//Installs a module by downloading the chunks for files which aren't
+	//already installed, in batches, writing each file as soon as its chunk
+	//arrives. An interrupted install picks up where it left off, since
+	//the files already written are up to date.
+	void start_install(variant module_data);
+
+	//requests the next batch of chunks. Returns false if there are none.
+	bool request_chunks();
+	void on_chunks(const std::string& response);
+
+	struct chunk_info {
+		int size;
+		std::vector<std::string> paths;
+	};
+
+	std::map<std::string, chunk_info> chunks_;
+	std::deque<std::string> chunks_needed_;
+	std::vector<std::string> chunks_requested_;
 };
 
 }
@@ -15,6 +15,7 @@
 #include "formatter.hpp"
 #include "json_parser.hpp"
 #include "md5.hpp"
+#include "module.hpp"
 #include "module_web_server.hpp"
 #include "string_utils.hpp"
 #include "utils.hpp"
@@ -69,6 +70,11 @@ void module_web_server::handle_post(socket_ptr socket, variant doc, const http::
 				prev_versions.push_back(current_data);
 			}
 
+			//chunks are stored once, under their md5, and the module keeps
+			//just the manifest.
+			store_chunks(module_node);
+			module_node.remove_attr_mutation(variant("chunks"));
+
 			const std::string module_path = data_path_ + module_id + ".cfg";
 			const std::string module_path_tmp = module_path + ".tmp";
 			const std::string contents = module_node.write_json();
@@ -169,6 +175,21 @@ void module_web_server::handle_get(socket_ptr socket, const std::string& url, co
 			} else {
 				response[variant("message")] = variant("No such module");
 			}
+		} else if(url == "/download_chunks" && args.count("chunks")) {
+			//chunks are sent raw, each after a line with its id and size.
+			std::string data;
+			foreach(const std::string& id, util::split(args.find("chunks")->second, ',')) {
+				ASSERT_LOG(module::is_valid_chunk_id(id), "ILLEGAL CHUNK ID: " << id);
+				const std::string path = chunk_path(id);
+				ASSERT_LOG(sys::file_exists(path), "UNKNOWN CHUNK: " << id);
+
+				const std::string chunk = sys::read_file(path);
+				data += formatter() << id << " " << chunk.size() << "\n";
+				data += chunk;
+			}
+
+			send_msg(socket, "application/octet-stream", data, "");
+			return;
 		} else if(url == "/get_summary") {
 			response[variant("status")] = variant("ok");
 			response[variant("summary")] = data_;
@@ -183,6 +204,48 @@ void module_web_server::handle_get(socket_ptr socket, const std::string& url, co
 	send_msg(socket, "text/json", variant(&response).write_json(), "");
 }
 
+void module_web_server::store_chunks(variant module_node)
+{
+	std::map<std::string, int> sizes;
+	variant manifest = module_node["manifest"];
+	foreach(variant path, manifest.get_keys().as_list()) {
+		variant info = manifest[path];
+		sizes[info["md5"].as_string()] = info["size"].as_int();
+	}
+
+	variant chunks = module_node["chunks"];
+	ASSERT_LOG(chunks.is_map(), "MODULE HAS NO CHUNKS");
+	foreach(variant key, chunks.get_keys().as_list()) {
+		const std::string id = key.as_string();
+		ASSERT_LOG(module::is_valid_chunk_id(id), "ILLEGAL CHUNK ID: " << id);
+		std::map<std::string, int>::const_iterator size = sizes.find(id);
+		ASSERT_LOG(size != sizes.end(), "CHUNK NOT IN MANIFEST: " << id);
+
+		const std::string path = chunk_path(id);
+		if(sys::file_exists(path)) {
+			continue;
+		}
+
+		const std::string chunk = base64::b64decode(chunks[key].as_string());
+		std::string contents;
+		ASSERT_LOG(module::decompress_chunk(chunk, id, size->second, &contents), "CHUNK DOES NOT MATCH ITS MD5: " << id);
+
+		const std::string tmp_path = path + ".tmp";
+		sys::write_file(tmp_path, chunk);
+		const int rename_result = rename(tmp_path.c_str(), path.c_str());
+		ASSERT_LOG(rename_result == 0, "FAILED TO RENAME FILE: " << errno);
+	}
+
+	for(std::map<std::string, int>::const_iterator i = sizes.begin(); i != sizes.end(); ++i) {
+		ASSERT_LOG(module::is_valid_chunk_id(i->first) && sys::file_exists(chunk_path(i->first)), "MISSING CHUNK: " << i->first);
+	}
+}
+
+std::string module_web_server::chunk_path(const std::string& id) const
+{
+	return data_path_ + ".chunks/" + id;
+}
+
 std::string module_web_server::data_file_path() const
 {
 	return data_path_ + "/module-data.json";
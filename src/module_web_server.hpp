@@ -24,6 +24,10 @@ private:
 	boost::asio::deadline_timer timer_;
 	int nheartbeat_;
 
+	//checks the chunks uploaded with a module and writes any new ones.
+	void store_chunks(variant module_node);
+	std::string chunk_path(const std::string& id) const;
+
 	std::string data_file_path() const;
 	void write_data();
 	variant data_;
@@ -3,25 +3,39 @@
 #include <Windows.h>
 #endif
 
+#include <deque>
 #include <sstream>
 #include <string>
 
 #include <boost/cstdint.hpp>
+#include <errno.h>
 #include <numeric>
 #include <stdio.h>
+#include <stdlib.h>
+
+#if !defined(_WINDOWS)
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 #include <boost/asio.hpp>
 #include <boost/regex.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include "asserts.hpp"
 #include "controls.hpp"
+#include "foreach.hpp"
 #include "formatter.hpp"
 #include "level.hpp"
 #include "multiplayer.hpp"
 #include "preferences.hpp"
 #include "random.hpp"
 #include "regex_utils.hpp"
+#include "spsc_queue.hpp"
+#include "thread.hpp"
 #include "unit_test.hpp"
 
 using boost::asio::ip::tcp;
@@ -40,6 +54,374 @@ std::vector<boost::shared_ptr<udp::endpoint> > udp_endpoint_peers;
 int32_t id;
 int player_slot;
 
+int simulated_latency, simulated_loss;
+
+//Control packets are sent and received by a thread of their own, which
+//passes them to and from the game through these queues. The game thread
+//is the only one to push onto outgoing_packets and pop from
+//incoming_packets. Packets which don't fit are dropped, like any other
+//lost packet.
+const size_t PacketQueueSize = 256;
+spsc_queue<std::vector<char> > outgoing_packets(PacketQueueSize), incoming_packets(PacketQueueSize);
+
+boost::scoped_ptr<threading::thread> network_thread;
+
+//guards network_thread_exiting and current_peer_stats.
+threading::mutex network_mutex;
+bool network_thread_exiting;
+
+//On the wire a control packet is 'C', our ID and slot, then a sequence
+//number and the time it was sent, for measuring loss and latency. Then
+//the time the last packet we received from the peer was sent, and how
+//long ago we received it, so they can work out the round trip time.
+//The rest of the packet is what controls::write_control_packet() made.
+const size_t ControlHeaderSize = 22;
+
+void write_int32(char* buf, int32_t value)
+{
+	value = htonl(value);
+	memcpy(buf, &value, 4);
+}
+
+int32_t read_int32(const char* buf)
+{
+	int32_t value;
+	memcpy(&value, buf, 4);
+	return ntohl(value);
+}
+
+//how many packets loss is measured over.
+const int LossWindow = 100;
+
+//what the network thread knows about each peer.
+struct peer_state {
+	peer_state() : next_seq(0), their_sent_at(-1), received_at(0),
+	  window_start(-1), highest_seq(-1), nreceived(0), last_rtt(-1),
+	  srtt(0.0), jitter(0.0)
+	{}
+
+	int32_t next_seq;
+
+	//when the latest packet from them was sent, by their clock, and when
+	//we got it, by ours.
+	int32_t their_sent_at, received_at;
+
+	//the first sequence number of the current loss window, and the
+	//packets of it we've had.
+	int32_t window_start, highest_seq;
+	int nreceived;
+
+	int last_rtt;
+	double srtt, jitter;
+};
+
+std::vector<peer_state> peers;
+std::vector<peer_stats> current_peer_stats;
+
+struct delayed_packet {
+	int send_at;
+	int peer;
+	std::vector<char> data;
+};
+
+std::deque<delayed_packet> delayed_packets;
+
+//a packet ready to go to a peer.
+struct outgoing_packet {
+	int peer;
+	std::vector<char> data;
+};
+
+void make_control_packet(int peer, const std::vector<char>& payload, int ticks, std::vector<char>& packet)
+{
+	peer_state& state = peers[peer];
+	packet.resize(ControlHeaderSize + payload.size());
+	packet[0] = 'C';
+	memcpy(&packet[1], &id, 4);
+	packet[5] = player_slot;
+	write_int32(&packet[6], state.next_seq++);
+	write_int32(&packet[10], ticks);
+	write_int32(&packet[14], state.their_sent_at);
+	write_int32(&packet[18], ticks - state.received_at);
+	std::copy(payload.begin(), payload.end(), packet.begin() + ControlHeaderSize);
+
+	threading::lock lck(network_mutex);
+	current_peer_stats[peer].packets_sent++;
+}
+
+void update_peer_stats(int peer, int32_t seq, int32_t sent_at, int32_t echo_time, int32_t echo_hold, int ticks)
+{
+	peer_state& state = peers[peer];
+	if(seq > state.highest_seq) {
+		state.their_sent_at = sent_at;
+		state.received_at = ticks;
+		state.highest_seq = seq;
+	}
+
+	if(state.window_start == -1) {
+		state.window_start = seq;
+	}
+
+	if(seq >= state.window_start) {
+		++state.nreceived;
+	}
+
+	threading::lock lck(network_mutex);
+	peer_stats& stats = current_peer_stats[peer];
+	stats.packets_received++;
+
+	const int expected = state.highest_seq - state.window_start + 1;
+	if(expected >= LossWindow) {
+		stats.loss_percent = std::max(0, 100 - (state.nreceived*100)/expected);
+		state.window_start = state.highest_seq + 1;
+		state.nreceived = 0;
+	}
+
+	if(echo_time < 0) {
+		return;
+	}
+
+	//a smoothed round trip time, and its mean variation, as RTP does it.
+	const int rtt = ticks - echo_time - echo_hold;
+	if(rtt < 0) {
+		return;
+	}
+
+	if(state.last_rtt < 0) {
+		state.srtt = rtt;
+	} else {
+		state.srtt += (rtt - state.srtt)/8.0;
+		state.jitter += (abs(rtt - state.last_rtt) - state.jitter)/16.0;
+	}
+
+	state.last_rtt = rtt;
+	stats.rtt = int(state.srtt + 0.5);
+	stats.jitter = int(state.jitter + 0.5);
+}
+
+void handle_datagram(const char* buf, size_t len, int ticks, std::vector<char>& payload)
+{
+	if(len == 0 || buf[0] != 'C') {
+		return;
+	}
+
+	if(len < ControlHeaderSize) {
+		fprintf(stderr, "UDP PACKET TOO SHORT: %d\n", (int)len);
+		return;
+	}
+
+	const int slot = buf[5];
+	if(slot < 0 || slot >= int(peers.size()) || slot == player_slot) {
+		fprintf(stderr, "UDP PACKET FROM BAD SLOT: %d\n", slot);
+		return;
+	}
+
+	update_peer_stats(slot, read_int32(buf + 6), read_int32(buf + 10), read_int32(buf + 14), read_int32(buf + 18), ticks);
+
+	payload.assign(buf + ControlHeaderSize, buf + len);
+	if(!incoming_packets.push(payload)) {
+		fprintf(stderr, "INCOMING PACKET QUEUE FULL. DROPPING PACKET\n");
+	}
+}
+
+//how many packets are sent or received with one system call.
+const int BatchSize = 32;
+const size_t MaxPacketSize = 4096;
+
+void send_packets(const std::vector<outgoing_packet>& packets)
+{
+#if defined(__linux__)
+	const int fd = udp_socket->native_handle();
+	for(size_t begin = 0; begin < packets.size(); begin += BatchSize) {
+		mmsghdr msgs[BatchSize];
+		iovec iovs[BatchSize];
+		const size_t n = std::min<size_t>(BatchSize, packets.size() - begin);
+		memset(msgs, 0, sizeof(msgs));
+		for(size_t i = 0; i != n; ++i) {
+			const outgoing_packet& packet = packets[begin + i];
+			iovs[i].iov_base = const_cast<char*>(&packet.data[0]);
+			iovs[i].iov_len = packet.data.size();
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = udp_endpoint_peers[packet.peer]->data();
+			msgs[i].msg_hdr.msg_namelen = udp_endpoint_peers[packet.peer]->size();
+		}
+
+		if(sendmmsg(fd, msgs, n, 0) < 0) {
+			fprintf(stderr, "ERROR SENDING UDP PACKETS: %d\n", errno);
+		}
+	}
+#else
+	foreach(const outgoing_packet& packet, packets) {
+		boost::system::error_code error;
+		udp_socket->send_to(boost::asio::buffer(packet.data), *udp_endpoint_peers[packet.peer], 0, error);
+	}
+#endif
+}
+
+void receive_packets(std::vector<char>& payload)
+{
+#if defined(__linux__)
+	static std::vector<char> bufs(BatchSize*MaxPacketSize);
+	const int fd = udp_socket->native_handle();
+	for(;;) {
+		mmsghdr msgs[BatchSize];
+		iovec iovs[BatchSize];
+		memset(msgs, 0, sizeof(msgs));
+		for(int i = 0; i != BatchSize; ++i) {
+			iovs[i].iov_base = &bufs[i*MaxPacketSize];
+			iovs[i].iov_len = MaxPacketSize;
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		const int n = recvmmsg(fd, msgs, BatchSize, MSG_DONTWAIT, NULL);
+		if(n <= 0) {
+			return;
+		}
+
+		const int ticks = SDL_GetTicks();
+		for(int i = 0; i != n; ++i) {
+			handle_datagram(&bufs[i*MaxPacketSize], msgs[i].msg_len, ticks, payload);
+		}
+
+		if(n < BatchSize) {
+			return;
+		}
+	}
+#else
+	boost::array<char, MaxPacketSize> buf;
+	for(;;) {
+		boost::system::error_code error;
+		const size_t len = udp_socket->receive(boost::asio::buffer(buf), 0, error);
+		if(error) {
+			return;
+		}
+
+		handle_datagram(&buf[0], len, SDL_GetTicks(), payload);
+	}
+#endif
+}
+
+//waits up to a millisecond for a packet to arrive. Packets the game has
+//queued in the meantime go out the next time round, so they're at most
+//a millisecond late.
+void wait_for_packets()
+{
+	const udp::socket::native_handle_type fd = udp_socket->native_handle();
+	fd_set read_fds;
+	FD_ZERO(&read_fds);
+	FD_SET(fd, &read_fds);
+	timeval timeout;
+	timeout.tv_sec = 0;
+	timeout.tv_usec = 1000;
+	select(fd + 1, &read_fds, NULL, NULL, &timeout);
+}
+
+void run_network_thread()
+{
+	std::vector<char> payload, received_payload;
+	std::vector<outgoing_packet> packets;
+	for(;;) {
+		{
+			threading::lock lck(network_mutex);
+			if(network_thread_exiting) {
+				break;
+			}
+		}
+
+		const int ticks = SDL_GetTicks();
+		packets.clear();
+		while(outgoing_packets.pop(payload)) {
+			for(int n = 0; n != int(peers.size()); ++n) {
+				if(n == player_slot) {
+					continue;
+				}
+
+				outgoing_packet packet;
+				packet.peer = n;
+				make_control_packet(n, payload, ticks, packet.data);
+
+				if(simulated_loss > 0 && rand()%100 < simulated_loss) {
+					continue;
+				}
+
+				if(simulated_latency > 0) {
+					delayed_packet delayed;
+					delayed.send_at = ticks + simulated_latency;
+					delayed.peer = n;
+					delayed.data.swap(packet.data);
+					delayed_packets.push_back(delayed);
+					continue;
+				}
+
+				packets.push_back(packet);
+			}
+		}
+
+		while(!delayed_packets.empty() && delayed_packets.front().send_at <= ticks) {
+			outgoing_packet packet;
+			packet.peer = delayed_packets.front().peer;
+			packet.data.swap(delayed_packets.front().data);
+			packets.push_back(packet);
+			delayed_packets.pop_front();
+		}
+
+		if(!packets.empty()) {
+			send_packets(packets);
+		}
+
+		wait_for_packets();
+		receive_packets(received_payload);
+	}
+}
+
+void start_network_thread()
+{
+	if(network_thread) {
+		return;
+	}
+
+	peers.assign(udp_endpoint_peers.size(), peer_state());
+	current_peer_stats.assign(udp_endpoint_peers.size(), peer_stats());
+	for(int n = 0; n != int(current_peer_stats.size()); ++n) {
+		current_peer_stats[n].slot = n;
+	}
+
+	udp_socket->non_blocking(true);
+	network_thread_exiting = false;
+
+#if defined(__ANDROID__) && SDL_VERSION_ATLEAST(1, 3, 0)
+	network_thread.reset(new threading::thread("network", run_network_thread));
+#else
+	network_thread.reset(new threading::thread(run_network_thread));
+#endif
+}
+
+void stop_network_thread()
+{
+	if(!network_thread) {
+		return;
+	}
+
+	{
+		threading::lock lck(network_mutex);
+		network_thread_exiting = true;
+	}
+
+	network_thread.reset();
+
+	std::vector<char> packet;
+	while(outgoing_packets.pop(packet)) {
+	}
+
+	while(incoming_packets.pop(packet)) {
+	}
+
+	delayed_packets.clear();
+	udp_socket->non_blocking(false);
+}
+
 bool udp_packet_waiting()
 {
 	if(!udp_socket) {
@@ -76,6 +458,7 @@ manager::manager(bool activate)
 }
 
 manager::~manager() {
+	stop_network_thread();
 	udp_endpoint.reset();
 	tcp_socket.reset();
 	udp_socket.reset();
@@ -173,6 +556,9 @@ void sync_start_time(const level& lvl, boost::function<bool()> idle_fn)
 		return;
 	}
 
+	//the handshake uses the socket directly.
+	stop_network_thread();
+
 	//find our host and port number within our NAT and tell the server
 	//about it, so if two servers from behind the same NAT connect to
 	//the server, it can tell them how to connect directly to each other.
@@ -343,6 +729,7 @@ void sync_start_time(const level& lvl, boost::function<bool()> idle_fn)
 	}
 
 	controls::set_delay(3);
+	controls::set_rollback(preferences::rollback_netcode());
 
 	std::cerr << "HANDSHAKING...\n";
 
@@ -503,18 +890,13 @@ void send_and_receive()
 		return;
 	}
 
-	//send our ID followed by the send packet.
-	std::vector<char> send_buf(5);
-	send_buf[0] = 'C';
-	memcpy(&send_buf[1], &id, 4);
-	controls::write_control_packet(send_buf);
-
-	for(int n = 0; n != udp_endpoint_peers.size(); ++n) {
-		if(n == player_slot) {
-			continue;
-		}
+	start_network_thread();
 
-		udp_socket->send_to(boost::asio::buffer(send_buf), *udp_endpoint_peers[n]);
+	static std::vector<char> send_buf;
+	send_buf.clear();
+	controls::write_control_packet(send_buf);
+	if(!outgoing_packets.push(send_buf)) {
+		fprintf(stderr, "OUTGOING PACKET QUEUE FULL. DROPPING PACKET\n");
 	}
 
 	receive();
@@ -522,21 +904,62 @@ void send_and_receive()
 
 void receive()
 {
-	while(udp_packet_waiting()) {
-		udp::endpoint sender_endpoint;
-		boost::array<char, 4096> udp_msg;
-		size_t len = udp_socket->receive(boost::asio::buffer(udp_msg));
-		if(len == 0 || udp_msg[0] != 'C') {
-			continue;
+	if(!udp_socket) {
+		return;
+	}
+
+	start_network_thread();
+
+	static std::vector<char> packet;
+	while(incoming_packets.pop(packet)) {
+		if(!packet.empty()) {
+			controls::read_control_packet(&packet[0], packet.size());
 		}
+	}
+}
 
-		if(len < 5) {
-			fprintf(stderr, "UDP PACKET TOO SHORT: %d\n", (int)len);
-			continue;
+peer_stats::peer_stats()
+  : slot(0), rtt(-1), jitter(0), packets_sent(0), packets_received(0), loss_percent(0)
+{}
+
+std::vector<peer_stats> get_peer_stats()
+{
+	std::vector<peer_stats> result;
+
+	threading::lock lck(network_mutex);
+	foreach(const peer_stats& stats, current_peer_stats) {
+		if(stats.slot != player_slot) {
+			result.push_back(stats);
 		}
+	}
+
+	return result;
+}
+
+void setup_loopback_game(int slot, int port, int peer_port)
+{
+	stop_network_thread();
+
+	boost::asio::io_service& io_service = *asio_service;
+	udp_socket.reset(new udp::socket(io_service, udp::endpoint(udp::v4(), port)));
 
-		controls::read_control_packet(&udp_msg[5], len - 5);
+	udp_endpoint_peers.clear();
+	for(int n = 0; n != 2; ++n) {
+		if(n == slot) {
+			udp_endpoint_peers.push_back(boost::shared_ptr<udp::endpoint>());
+		} else {
+			udp_endpoint_peers.push_back(boost::shared_ptr<udp::endpoint>(new udp::endpoint(boost::asio::ip::address_v4::loopback(), peer_port)));
+		}
 	}
+
+	player_slot = slot;
+	id = slot;
+}
+
+void set_simulated_conditions(int latency_ms, int loss_percent)
+{
+	simulated_latency = latency_ms;
+	simulated_loss = loss_percent;
 }
 
 }
@@ -601,3 +1024,255 @@ UTILITY(hole_punch_test) {
 
 	io_service.run();
 }
+
+namespace {
+//a tiny deterministic game, standing in for a level, which the rollback
+//test plays with controls sent between two processes.
+struct test_game_state {
+	int cycle;
+	int pos[2], vel[2];
+};
+
+int test_game_checksum(const test_game_state& state)
+{
+	return state.cycle + state.pos[0]*31 + state.pos[1]*37 + state.vel[0]*41 + state.vel[1]*43;
+}
+
+void process_test_game(test_game_state& state)
+{
+	++state.cycle;
+	for(int n = 0; n != 2; ++n) {
+		bool status[controls::NUM_CONTROLS];
+		std::fill(status, status + controls::NUM_CONTROLS, false);
+		controls::get_control_status(state.cycle, n, status);
+
+		if(status[controls::CONTROL_LEFT]) {
+			state.vel[n] -= 2;
+		}
+
+		if(status[controls::CONTROL_RIGHT]) {
+			state.vel[n] += 2;
+		}
+
+		if(status[controls::CONTROL_JUMP]) {
+			state.vel[n] = -state.vel[n];
+		}
+
+		state.vel[n] = (state.vel[n]*7)/8;
+		state.pos[n] += state.vel[n];
+	}
+
+	//the players bounce off each other, so each depends on the other's
+	//controls.
+	if(std::abs(state.pos[0] - state.pos[1]) < 10) {
+		std::swap(state.vel[0], state.vel[1]);
+	}
+
+	controls::set_checksum(state.cycle, test_game_checksum(state));
+}
+
+//the controls a player holds on a frame, changing every few frames.
+unsigned char test_game_controls(int slot, int frame)
+{
+	unsigned int seed = (slot + 1)*7919 + (frame/6)*104729;
+	seed = seed*1103515245 + 12345;
+	const int bits = (seed >> 16)%8;
+	unsigned char result = 0;
+	if(bits&1) {
+		result |= 1 << controls::CONTROL_LEFT;
+	}
+
+	if(bits&2) {
+		result |= 1 << controls::CONTROL_RIGHT;
+	}
+
+	if(bits == 7) {
+		result |= 1 << controls::CONTROL_JUMP;
+	}
+
+	return result;
+}
+
+struct rollback_test_args {
+	int ncycles, latency, loss, delay, max_rollback;
+	bool rollback;
+};
+
+//plays the test game as one player, returning the final state's checksum.
+int run_rollback_test_player(int slot, int port, int peer_port, const rollback_test_args& args)
+{
+	SDL_Init(SDL_INIT_TIMER);
+	preferences::parse_arg("--no-iphone-controls");
+
+	multiplayer::manager mgr(true);
+	multiplayer::setup_loopback_game(slot, port, peer_port);
+	multiplayer::set_simulated_conditions(args.latency, args.loss);
+
+	controls::new_level(0, 2, slot);
+	controls::set_delay(args.delay);
+	controls::set_rollback(args.rollback, args.max_rollback);
+
+	test_game_state state;
+	memset(&state, 0, sizeof(state));
+	state.pos[1] = 100;
+
+	std::deque<test_game_state> backups;
+	int nrollbacks = 0, nreplayed = 0, max_replay_time = 0;
+
+	const int FrameTime = 20;
+	const int start_time = SDL_GetTicks();
+
+	//after the last cycle, keep exchanging controls for a while so the
+	//other player can confirm everything.
+	const int EndTime = 2000;
+	int end_time = -1;
+
+	while(end_time == -1 || SDL_GetTicks() < end_time) {
+		const int invalid_cycle = controls::first_invalid_cycle();
+		if(invalid_cycle >= 0) {
+			const int replay_start = SDL_GetTicks();
+			const int play_until = state.cycle;
+			while(backups.empty() == false && backups.back().cycle > invalid_cycle) {
+				backups.pop_back();
+			}
+
+			ASSERT_LOG(backups.empty() == false && backups.back().cycle == invalid_cycle, "NO BACKUP TO ROLL BACK TO AT " << invalid_cycle);
+			state = backups.back();
+			backups.pop_back();
+			while(state.cycle < play_until) {
+				backups.push_back(state);
+				process_test_game(state);
+			}
+
+			controls::mark_valid();
+			++nrollbacks;
+			nreplayed += play_until - invalid_cycle;
+			max_replay_time = std::max<int>(max_replay_time, SDL_GetTicks() - replay_start);
+		}
+
+		if(state.cycle < args.ncycles) {
+			backups.push_back(state);
+			while(backups.size() > 250) {
+				backups.pop_front();
+			}
+
+			{
+				const controls::local_controls_lock lock(test_game_controls(slot, state.cycle));
+				controls::read_local_controls();
+			}
+
+			multiplayer::send_and_receive();
+			process_test_game(state);
+
+			if(state.cycle == args.ncycles) {
+				end_time = SDL_GetTicks() + EndTime;
+			}
+		} else {
+			multiplayer::send_and_receive();
+		}
+
+		const int next_frame = start_time + (state.cycle + 1)*FrameTime;
+		const int ticks = SDL_GetTicks();
+		SDL_Delay(next_frame > ticks ? std::min(next_frame - ticks, FrameTime) : 1);
+	}
+
+	foreach(const multiplayer::peer_stats& peer, multiplayer::get_peer_stats()) {
+		std::cerr << "PLAYER " << slot << ": PEER " << peer.slot << " RTT " << peer.rtt << "ms, JITTER " << peer.jitter << "ms, LOSS " << peer.loss_percent << "%, " << peer.packets_sent << " PACKETS SENT, " << peer.packets_received << " RECEIVED\n";
+	}
+
+	const int checksum = test_game_checksum(state);
+	std::cerr << "PLAYER " << slot << ": " << state.cycle << " CYCLES, " << nrollbacks << " ROLLBACKS REPLAYING " << nreplayed << " CYCLES (MAX " << max_replay_time << "ms), " << controls::num_desyncs() << " DESYNCS, FINAL CHECKSUM " << checksum << "\n";
+	ASSERT_LOG(controls::num_desyncs() == 0, "PLAYER " << slot << " DETECTED A DESYNC");
+	return checksum;
+}
+}
+
+//Plays a small game between two processes over loopback UDP, with
+//simulated latency and packet loss, and checks they end up in the same
+//state. Without --slot it runs both players itself.
+COMMAND_LINE_UTILITY(rollback_test)
+{
+	rollback_test_args test_args;
+	test_args.ncycles = 500;
+	test_args.latency = 60;
+	test_args.loss = 10;
+	test_args.delay = 1;
+	test_args.max_rollback = 8;
+	test_args.rollback = true;
+
+	int slot = -1;
+	int port = 17100;
+
+	std::deque<std::string> arguments(args.begin(), args.end());
+	while(!arguments.empty()) {
+		const std::string arg = arguments.front();
+		arguments.pop_front();
+		if(arg == "--lockstep") {
+			test_args.rollback = false;
+			continue;
+		}
+
+		ASSERT_LOG(arguments.empty() == false, "NEED ARGUMENT AFTER " << arg);
+		const int value = atoi(arguments.front().c_str());
+		arguments.pop_front();
+		if(arg == "--cycles") {
+			test_args.ncycles = value;
+		} else if(arg == "--latency") {
+			test_args.latency = value;
+		} else if(arg == "--loss") {
+			test_args.loss = value;
+		} else if(arg == "--delay") {
+			test_args.delay = value;
+		} else if(arg == "--max-rollback") {
+			test_args.max_rollback = value;
+		} else if(arg == "--slot") {
+			slot = value;
+		} else if(arg == "--port") {
+			port = value;
+		} else {
+			ASSERT_LOG(false, "UNRECOGNIZED ARGUMENT: " << arg);
+		}
+	}
+
+	if(slot != -1) {
+		ASSERT_LOG(slot == 0 || slot == 1, "SLOT MUST BE 0 OR 1");
+		run_rollback_test_player(slot, port + slot, port + 1 - slot, test_args);
+		return;
+	}
+
+#if defined(_WINDOWS)
+	ASSERT_LOG(false, "RUN ONE PROCESS WITH --slot 0 AND ANOTHER WITH --slot 1");
+#else
+	int pipes[2][2];
+	pid_t pids[2];
+	for(int n = 0; n != 2; ++n) {
+		ASSERT_LOG(pipe(pipes[n]) == 0, "COULD NOT CREATE PIPE");
+		pids[n] = fork();
+		ASSERT_LOG(pids[n] >= 0, "COULD NOT FORK");
+		if(pids[n] == 0) {
+			close(pipes[n][0]);
+			srand(n + 1);
+			const int checksum = run_rollback_test_player(n, port + n, port + 1 - n, test_args);
+			ASSERT_LOG(write(pipes[n][1], &checksum, sizeof(checksum)) == sizeof(checksum), "COULD NOT WRITE RESULT");
+			_exit(0);
+		}
+
+		close(pipes[n][1]);
+	}
+
+	int checksums[2];
+	bool ok = true;
+	for(int n = 0; n != 2; ++n) {
+		ok = read(pipes[n][0], &checksums[n], sizeof(checksums[n])) == sizeof(checksums[n]) && ok;
+		close(pipes[n][0]);
+
+		int status = 0;
+		waitpid(pids[n], &status, 0);
+		ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && ok;
+	}
+
+	ASSERT_LOG(ok, "ROLLBACK TEST PLAYER FAILED");
+	ASSERT_LOG(checksums[0] == checksums[1], "ROLLBACK TEST PLAYERS ENDED OUT OF SYNC: " << checksums[0] << " VS " << checksums[1]);
+	std::cerr << "ROLLBACK TEST PASSED\n";
+#endif
+}
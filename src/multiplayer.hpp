@@ -1,6 +1,9 @@
 #ifndef MULTIPLAYER_HPP_INCLUDED
 #define MULTIPLAYER_HPP_INCLUDED
 
+#include <string>
+#include <vector>
+
 #include <boost/function.hpp>
 
 class level;
@@ -12,9 +15,38 @@ void setup_networked_game(const std::string& server);
 
 void sync_start_time(const level& lvl, boost::function<bool()> idle_fn);
 
+//queues our controls to be sent, and passes controls which have arrived
+//to the controls module. Packets are sent and received on a thread of
+//their own, started the first time these are called.
 void send_and_receive();
 void receive();
 
+struct peer_stats {
+	peer_stats();
+	int slot;
+
+	//the smoothed round trip time to the peer, and its mean variation, in
+	//milliseconds. rtt is -1 until it's been measured.
+	int rtt, jitter;
+
+	int packets_sent, packets_received;
+
+	//the percentage of their packets which didn't arrive, over the last
+	//hundred or so.
+	int loss_percent;
+};
+
+//stats for each of the other players in the game.
+std::vector<peer_stats> get_peer_stats();
+
+//sets up a two player game with another process on this machine, without
+//a server.
+void setup_loopback_game(int slot, int port, int peer_port);
+
+//delays and drops packets we send, to test how games cope with a bad
+//connection. Must be called before the game starts.
+void set_simulated_conditions(int latency_ms, int loss_percent);
+
 struct manager {
 	manager(bool activate);
 	~manager();
@@ -141,6 +141,17 @@ namespace preferences {
 		bool level_path_set_ = false;
 		
 		bool relay_through_server_ = false;
+
+		bool rollback_netcode_ = false;
+
+		int hitch_threshold_millis_ = 100;
+
+		bool software_gl_ = false;
+
+		//how long the game should take to get to the title screen, with
+		//--time-startup, on the machines we test on.
+		const int DefaultStartupBudgetMillis = 3000;
+		int startup_budget_millis_ = 0;
 		
 		std::string control_scheme_ = "iphone_2d";
 		
@@ -878,6 +889,16 @@ namespace preferences {
 			password_ = arg_value;
 		} else if(s == "--relay") {
 			relay_through_server_ = true;
+		} else if(s == "--rollback") {
+			rollback_netcode_ = true;
+		} else if(arg_name == "--hitch-threshold" && !arg_value.empty()) {
+			hitch_threshold_millis_ = boost::lexical_cast<int, std::string>(arg_value);
+		} else if(s == "--time-startup") {
+			startup_budget_millis_ = DefaultStartupBudgetMillis;
+		} else if(arg_name == "--time-startup" && !arg_value.empty()) {
+			startup_budget_millis_ = boost::lexical_cast<int, std::string>(arg_value);
+		} else if(s == "--software-gl") {
+			software_gl_ = true;
 		} else if(s == "--failing-tests") {
 			run_failing_unit_tests_ = true;
 		} else if(s == "--serialize-bad-objects") {
@@ -934,6 +955,22 @@ namespace preferences {
 	void set_relay_through_server(bool value) {
 		relay_through_server_ = value;
 	}
+
+	bool rollback_netcode() {
+		return rollback_netcode_;
+	}
+
+	int hitch_threshold_millis() {
+		return hitch_threshold_millis_;
+	}
+
+	bool software_gl() {
+		return software_gl_;
+	}
+
+	int startup_budget_millis() {
+		return startup_budget_millis_;
+	}
 	
 	bool run_failing_unit_tests() {
 		return run_failing_unit_tests_;
@@ -133,6 +133,23 @@ void set_bequ( bool value );
 	bool relay_through_server();
 	void set_relay_through_server(bool value);
 
+	//in multiplayer, predict the other players' controls and roll back
+	//when a prediction is wrong, rather than waiting for them.
+	bool rollback_netcode();
+
+	//frames taking longer than this, 100ms by default, have a report of
+	//what happened in them written to the hitches directory. 0 turns this
+	//off.
+	int hitch_threshold_millis();
+
+	//draw with OSMesa, without a window, for running utilities on machines
+	//without a GPU or display. Only works in builds with USE_OSMESA.
+	bool software_gl();
+
+	//with --time-startup, the game exits once the first frame is drawn,
+	//failing if it took longer than this. 0 otherwise.
+	int startup_budget_millis();
+
 	variant external_code_editor();
 
 	bool run_failing_unit_tests();
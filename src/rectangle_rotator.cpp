@@ -104,7 +104,7 @@ point rotate_point_around_origin(int x1, int y1, float alpha){
 }*/
 
 
-BENCHMARK(rect_rotation) {
+BENCHMARK_TAGGED(rect_rotation, "render") {
 	rect r(10, 10, 20, 30);
 	GLshort output[8];
 	BENCHMARK_LOOP {
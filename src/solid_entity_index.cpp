@@ -0,0 +1,250 @@
+#include <algorithm>
+
+#include "asserts.hpp"
+#include "entity.hpp"
+#include "foreach.hpp"
+#include "solid_entity_index.hpp"
+
+namespace {
+const int CellSize = 128;
+
+int cell_coord(int n)
+{
+	return n >= 0 ? n/CellSize : -((CellSize - n - 1)/CellSize);
+}
+
+//the area in which the entity might be solid or a platform.
+rect entity_solid_area(const entity& e)
+{
+	if(!e.solid() && !e.platform()) {
+		return rect();
+	}
+
+	rect result = e.solid_rect();
+	const rect platform = e.platform_rect_bounds();
+	if(platform.w() > 0 && platform.h() > 0) {
+		if(result.w() == 0 || result.h() == 0) {
+			result = platform;
+		} else {
+			const int x = std::min(result.x(), platform.x());
+			const int y = std::min(result.y(), platform.y());
+			result = rect(x, y, std::max(result.x2(), platform.x2()) - x,
+			                    std::max(result.y2(), platform.y2()) - y);
+		}
+	}
+
+	return result;
+}
+}
+
+void solid_entity_index_link::notify(entity* e) const
+{
+	foreach(solid_entity_index* index, indexes_) {
+		index->update(e);
+	}
+}
+
+solid_entity_index::solid_entity_index()
+  : next_order_(0), valid_(false), solid_chars_valid_(false), query_id_(0)
+{
+}
+
+solid_entity_index::~solid_entity_index()
+{
+	unlink_all();
+}
+
+solid_entity_index::solid_entity_index(const solid_entity_index& o)
+  : next_order_(0), valid_(false), solid_chars_valid_(false), query_id_(0)
+{
+}
+
+solid_entity_index& solid_entity_index::operator=(const solid_entity_index& o)
+{
+	invalidate();
+	return *this;
+}
+
+void solid_entity_index::invalidate()
+{
+	unlink_all();
+	entries_.clear();
+	cells_.clear();
+	solid_chars_.clear();
+	solid_chars_valid_ = false;
+	next_order_ = 0;
+	valid_ = false;
+}
+
+void solid_entity_index::rebuild(const std::vector<entity_ptr>& chars)
+{
+	invalidate();
+	valid_ = true;
+	foreach(const entity_ptr& e, chars) {
+		add(e);
+	}
+}
+
+void solid_entity_index::add(const entity_ptr& e)
+{
+	if(!valid_ || entries_.count(e.get())) {
+		return;
+	}
+
+	entry& item = entries_[e.get()];
+	item.e = e;
+	item.order = next_order_++;
+	item.query_id = 0;
+	insert_into_cells(item);
+	e->solid_index_link_.indexes_.push_back(this);
+	solid_chars_valid_ = false;
+}
+
+void solid_entity_index::remove(entity* e)
+{
+	entry_map::iterator i = entries_.find(e);
+	if(i == entries_.end()) {
+		return;
+	}
+
+	remove_from_cells(i->second);
+	std::vector<solid_entity_index*>& links = e->solid_index_link_.indexes_;
+	links.erase(std::remove(links.begin(), links.end(), this), links.end());
+	entries_.erase(i);
+	solid_chars_valid_ = false;
+}
+
+void solid_entity_index::update(entity* e)
+{
+	entry_map::iterator i = entries_.find(e);
+	if(i == entries_.end()) {
+		return;
+	}
+
+	entry& item = i->second;
+	const bool was_solid = item.x2 >= item.x1;
+	const rect area = entity_solid_area(*e);
+	if(area.w() > 0 && area.h() > 0 &&
+	   cell_coord(area.x()) == item.x1 && cell_coord(area.y()) == item.y1 &&
+	   cell_coord(area.x2() - 1) == item.x2 && cell_coord(area.y2() - 1) == item.y2) {
+		//still in the same cells.
+		return;
+	}
+
+	remove_from_cells(item);
+	insert_into_cells(item);
+	if(was_solid != (item.x2 >= item.x1)) {
+		solid_chars_valid_ = false;
+	}
+}
+
+const std::vector<entity_ptr>& solid_entity_index::solid_chars() const
+{
+	if(!solid_chars_valid_) {
+		std::vector<const entry*> items;
+		for(entry_map::const_iterator i = entries_.begin(); i != entries_.end(); ++i) {
+			if(i->second.x2 >= i->second.x1) {
+				items.push_back(&i->second);
+			}
+		}
+
+		std::sort(items.begin(), items.end(), compare_entry_order);
+
+		solid_chars_.clear();
+		foreach(const entry* item, items) {
+			solid_chars_.push_back(item->e);
+		}
+
+		solid_chars_valid_ = true;
+	}
+
+	return solid_chars_;
+}
+
+const std::vector<entity_ptr>& solid_entity_index::query(const rect& area) const
+{
+	query_result_.clear();
+	if(area.w() <= 0 || area.h() <= 0) {
+		return query_result_;
+	}
+
+	++query_id_;
+	query_entries_.clear();
+
+	const int x1 = cell_coord(area.x()), x2 = cell_coord(area.x2() - 1);
+	const int y1 = cell_coord(area.y()), y2 = cell_coord(area.y2() - 1);
+	for(int y = y1; y <= y2; ++y) {
+		for(int x = x1; x <= x2; ++x) {
+			cell_map::const_iterator cell = cells_.find(std::pair<int, int>(x, y));
+			if(cell == cells_.end()) {
+				continue;
+			}
+
+			foreach(const entry* item, cell->second) {
+				if(item->query_id != query_id_) {
+					item->query_id = query_id_;
+					query_entries_.push_back(item);
+				}
+			}
+		}
+	}
+
+	std::sort(query_entries_.begin(), query_entries_.end(), compare_entry_order);
+	foreach(const entry* item, query_entries_) {
+		query_result_.push_back(item->e);
+	}
+
+	return query_result_;
+}
+
+bool solid_entity_index::compare_entry_order(const entry* a, const entry* b)
+{
+	return a->order < b->order;
+}
+
+void solid_entity_index::insert_into_cells(entry& item)
+{
+	const rect area = entity_solid_area(*item.e);
+	if(area.w() <= 0 || area.h() <= 0) {
+		item.x1 = item.y1 = 0;
+		item.x2 = item.y2 = -1;
+		return;
+	}
+
+	item.x1 = cell_coord(area.x());
+	item.y1 = cell_coord(area.y());
+	item.x2 = cell_coord(area.x2() - 1);
+	item.y2 = cell_coord(area.y2() - 1);
+	for(int y = item.y1; y <= item.y2; ++y) {
+		for(int x = item.x1; x <= item.x2; ++x) {
+			cells_[std::pair<int, int>(x, y)].push_back(&item);
+		}
+	}
+}
+
+void solid_entity_index::remove_from_cells(entry& item)
+{
+	for(int y = item.y1; y <= item.y2; ++y) {
+		for(int x = item.x1; x <= item.x2; ++x) {
+			cell_map::iterator cell = cells_.find(std::pair<int, int>(x, y));
+			ASSERT_LOG(cell != cells_.end(), "SOLID ENTITY INDEX CELL MISSING: " << x << ", " << y);
+
+			std::vector<entry*>& items = cell->second;
+			items.erase(std::remove(items.begin(), items.end(), &item), items.end());
+			if(items.empty()) {
+				cells_.erase(cell);
+			}
+		}
+	}
+
+	item.x1 = item.y1 = 0;
+	item.x2 = item.y2 = -1;
+}
+
+void solid_entity_index::unlink_all()
+{
+	for(entry_map::iterator i = entries_.begin(); i != entries_.end(); ++i) {
+		std::vector<solid_entity_index*>& links = i->second.e->solid_index_link_.indexes_;
+		links.erase(std::remove(links.begin(), links.end(), this), links.end());
+	}
+}
@@ -0,0 +1,95 @@
+#ifndef SOLID_ENTITY_INDEX_HPP_INCLUDED
+#define SOLID_ENTITY_INDEX_HPP_INCLUDED
+
+#include <utility>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+
+#include "entity_fwd.hpp"
+#include "geometry.hpp"
+
+class solid_entity_index;
+
+//The indexes an entity is in, which it tells when its solid or platform
+//area changes. A copy of an entity isn't in any index.
+class solid_entity_index_link
+{
+public:
+	solid_entity_index_link() {}
+	solid_entity_index_link(const solid_entity_index_link&) {}
+	solid_entity_index_link& operator=(const solid_entity_index_link&) { return *this; }
+
+	void notify(entity* e) const;
+private:
+	friend class solid_entity_index;
+	std::vector<solid_entity_index*> indexes_;
+};
+
+//An index of the entities in a level which are solid or act as platforms,
+//bucketed into a grid by the area they take up. It's kept up to date as
+//entities move, so collision tests only need to look at nearby entities.
+class solid_entity_index
+{
+public:
+	solid_entity_index();
+	~solid_entity_index();
+
+	//a copy of an index is empty, and needs to be rebuilt.
+	solid_entity_index(const solid_entity_index& o);
+	solid_entity_index& operator=(const solid_entity_index& o);
+
+	//an invalid index ignores changes until it is rebuilt.
+	bool valid() const { return valid_; }
+	void invalidate();
+	void rebuild(const std::vector<entity_ptr>& chars);
+
+	void add(const entity_ptr& e);
+	void remove(entity* e);
+
+	//called when an entity's solid or platform area changes.
+	void update(entity* e);
+
+	//all the entities which are solid or act as a platform, in the order
+	//they were added.
+	const std::vector<entity_ptr>& solid_chars() const;
+
+	//the entities which are solid or a platform in 'area', as well as
+	//some which are only nearby, in the same order as solid_chars().
+	//The result is only valid until the next query.
+	const std::vector<entity_ptr>& query(const rect& area) const;
+
+private:
+	struct entry {
+		entity_ptr e;
+		int order;
+
+		//the range of cells the entity is in. Empty if x2 < x1.
+		int x1, y1, x2, y2;
+		mutable int query_id;
+	};
+
+	static bool compare_entry_order(const entry* a, const entry* b);
+
+	void insert_into_cells(entry& item);
+	void remove_from_cells(entry& item);
+	void unlink_all();
+
+	typedef boost::unordered_map<const entity*, entry> entry_map;
+	entry_map entries_;
+
+	typedef boost::unordered_map<std::pair<int, int>, std::vector<entry*> > cell_map;
+	cell_map cells_;
+
+	int next_order_;
+	bool valid_;
+
+	mutable std::vector<entity_ptr> solid_chars_;
+	mutable bool solid_chars_valid_;
+
+	mutable int query_id_;
+	mutable std::vector<const entry*> query_entries_;
+	mutable std::vector<entity_ptr> query_result_;
+};
+
+#endif
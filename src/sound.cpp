@@ -6,6 +6,7 @@
 #include <boost/shared_ptr.hpp>
 
 #include "foreach.hpp"
+#include "json_parser.hpp"
 #include "module.hpp"
 #include "preferences.hpp"
 #include "thread.hpp"
@@ -29,7 +30,27 @@ struct MusicInfo {
 	float volume;
 };
 
-std::map<std::string, MusicInfo> music_index;
+//music.cfg is only read when music is first played, so reading it isn't
+//part of starting the game. It must first be called on the main thread,
+//not from on_music_finished.
+std::map<std::string, MusicInfo>& music_index()
+{
+	static std::map<std::string, MusicInfo> index;
+	static bool loaded = false;
+	if(!loaded) {
+		loaded = true;
+		const std::string fname = module::map_file("data/music.cfg");
+		if(sys::file_exists(fname)) {
+			variant node = json::parse_from_file(fname);
+			foreach(variant music_node, node["music"].as_list()) {
+				const std::string name = music_node["name"].as_string();
+				index[name].volume = music_node["volume"].as_decimal(decimal(1.0)).as_float();
+			}
+		}
+	}
+
+	return index;
+}
 
 float sfx_volume = 1.0;
 float user_music_volume = 1.0;
@@ -382,14 +403,6 @@ manager::~manager()
 #endif
 }
 
-void init_music(variant node)
-{
-	foreach(variant music_node, node["music"].as_list()) {
-		const std::string name = music_node["name"].as_string();
-		music_index[name].volume = music_node["volume"].as_decimal(decimal(1.0)).as_float();
-	}
-}
-
 bool ok() { return sound_ok; }
 bool muted() { return mute_; }
 
@@ -703,7 +716,7 @@ void play_music(const std::string& file)
 		return;
 	}
 
-	track_music_volume = music_index[file].volume;
+	track_music_volume = music_index()[file].volume;
 	update_music_volume();
 
 	Mix_FadeInMusic(current_mix_music, -1, 500);
@@ -721,7 +734,7 @@ void play_music(const std::string& file)
 	
 	current_music_name() = file;
 	if (!sys::file_exists(path)) return;
-	track_music_volume = music_index[file].volume;
+	track_music_volume = music_index()[file].volume;
 	update_music_volume();
 	iphone_play_music((path).c_str(), -1);
 	iphone_fade_in_music(350);
@@ -735,6 +748,10 @@ void play_music_interrupt(const std::string& file)
 		return;
 	}
 
+	//the music that was playing is restarted by on_music_finished, on the
+	//audio thread, so make sure music.cfg has been read here.
+	music_index();
+
 	if(next_music().empty() == false) {
 		current_music_name() = next_music();
 		next_music().clear();
@@ -12,8 +12,6 @@ struct manager {
 	~manager();
 };
 
-void init_music(variant node);
-
 bool ok();
 bool muted();
 void mute(bool flag);
@@ -0,0 +1,81 @@
+#ifndef SPSC_QUEUE_HPP_INCLUDED
+#define SPSC_QUEUE_HPP_INCLUDED
+
+#ifdef _WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+//A fixed size queue which one thread pushes onto and one other thread pops
+//from, without either of them taking a lock. Items live in slots which are
+//reused, so a queue of vectors stops allocating once it has warmed up.
+template<typename T>
+class spsc_queue
+{
+public:
+	explicit spsc_queue(size_t capacity) : items_(capacity + 1), head_(0), tail_(0)
+	{}
+
+	//called by the producer. Returns false, leaving the queue unchanged, if
+	//the queue is full.
+	bool push(const T& item) {
+		const size_t tail = tail_;
+		const size_t next = (tail + 1)%items_.size();
+		if(next == load(head_)) {
+			return false;
+		}
+
+		items_[tail] = item;
+		store(tail_, next);
+		return true;
+	}
+
+	//called by the consumer. The front item is swapped into 'item', so
+	//the slot keeps the storage 'item' had.
+	bool pop(T& item) {
+		const size_t head = head_;
+		if(head == load(tail_)) {
+			return false;
+		}
+
+		std::swap(item, items_[head]);
+		store(head_, (head + 1)%items_.size());
+		return true;
+	}
+
+private:
+	spsc_queue(const spsc_queue&);
+	void operator=(const spsc_queue&);
+
+	static void barrier() {
+#ifdef _WINDOWS
+		MemoryBarrier();
+#else
+		__sync_synchronize();
+#endif
+	}
+
+	//reading the other thread's index has to happen before we touch the
+	//slots, and our writes to the slots have to be visible before it sees
+	//our index move.
+	static size_t load(const volatile size_t& index) {
+		const size_t result = index;
+		barrier();
+		return result;
+	}
+
+	static void store(volatile size_t& index, size_t value) {
+		barrier();
+		index = value;
+	}
+
+	std::vector<T> items_;
+
+	//head_ is only written by the consumer, tail_ by the producer.
+	volatile size_t head_, tail_;
+};
+
+#endif
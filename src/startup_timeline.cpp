@@ -0,0 +1,96 @@
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include "foreach.hpp"
+#include "preferences.hpp"
+#include "startup_timeline.hpp"
+#include "unit_test.hpp"
+#include "variant.hpp"
+
+namespace startup_timeline
+{
+
+namespace {
+struct phase {
+	const char* name;
+	int64_t start_ns, end_ns;
+};
+
+std::vector<phase> phases;
+int64_t start_ns = -1;
+int64_t first_frame_ns = -1;
+
+int to_millis(int64_t ns)
+{
+	return static_cast<int>(ns/1000000);
+}
+
+void end_phase(int64_t now)
+{
+	if(!phases.empty() && phases.back().end_ns < 0) {
+		phases.back().end_ns = now;
+	}
+}
+}
+
+void begin_phase(const char* name)
+{
+	if(first_frame_ns >= 0) {
+		return;
+	}
+
+	const int64_t now = test::get_time_ns();
+	if(start_ns < 0) {
+		start_ns = now;
+	}
+
+	end_phase(now);
+
+	phase p = { name, now, -1 };
+	phases.push_back(p);
+}
+
+bool first_frame_drawn()
+{
+	if(first_frame_ns >= 0 || start_ns < 0) {
+		return false;
+	}
+
+	first_frame_ns = test::get_time_ns();
+	end_phase(first_frame_ns);
+
+	std::cerr << "STARTUP TOOK " << time_to_first_frame() << "ms TO THE FIRST FRAME\n";
+	return true;
+}
+
+int time_to_first_frame()
+{
+	return first_frame_ns < 0 ? -1 : to_millis(first_frame_ns - start_ns);
+}
+
+bool within_budget()
+{
+	return time_to_first_frame() >= 0 && time_to_first_frame() <= preferences::startup_budget_millis();
+}
+
+std::string get_report()
+{
+	std::vector<variant> phase_list;
+	foreach(const phase& p, phases) {
+		std::map<variant, variant> m;
+		m[variant("name")] = variant(p.name);
+		m[variant("start_ms")] = variant(to_millis(p.start_ns - start_ns));
+		m[variant("ms")] = variant(p.end_ns < 0 ? -1 : to_millis(p.end_ns - p.start_ns));
+		phase_list.push_back(variant(&m));
+	}
+
+	std::map<variant, variant> report;
+	report[variant("phases")] = variant(&phase_list);
+	report[variant("first_frame_ms")] = variant(time_to_first_frame());
+	report[variant("budget_ms")] = variant(preferences::startup_budget_millis());
+	report[variant("within_budget")] = variant::from_bool(within_budget());
+	return variant(&report).write_json();
+}
+
+}
@@ -0,0 +1,31 @@
+#ifndef STARTUP_TIMELINE_HPP_INCLUDED
+#define STARTUP_TIMELINE_HPP_INCLUDED
+
+#include <string>
+
+//Records how long each phase of starting the game takes, up to the first
+//frame being drawn, so the time to start can be kept within a budget.
+namespace startup_timeline
+{
+
+//ends the current phase, if there is one, and begins a new one. The first
+//call is taken as the start of the program.
+void begin_phase(const char* name);
+
+//should be called whenever a frame has been drawn. The first time, ends the
+//last phase and returns true.
+bool first_frame_drawn();
+
+//the milliseconds from the start to the first frame, or -1 if there hasn't
+//been one yet.
+int time_to_first_frame();
+
+//the phases with how long each took, the time to the first frame, and
+//whether that was within preferences::startup_budget_millis(), as JSON.
+std::string get_report();
+
+bool within_budget();
+
+}
+
+#endif
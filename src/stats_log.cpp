@@ -0,0 +1,378 @@
+#include <algorithm>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+
+#include <boost/bind.hpp>
+#include <zlib.h>
+
+#if !defined(_WINDOWS)
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include "asserts.hpp"
+#include "filesystem.hpp"
+#include "foreach.hpp"
+#include "formatter.hpp"
+#include "stats_log.hpp"
+#include "utils.hpp"
+
+namespace {
+const char LogHeader[] = "STATLOG1";
+const size_t LogHeaderSize = 8;
+
+//records bigger than this are taken to be corrupt.
+const size_t MaxRecordSize = 256*1024*1024;
+
+//how many snapshots to keep around, as backups.
+const int KeptSnapshots = 5;
+
+int get_milliseconds()
+{
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return int(tv.tv_sec*1000 + tv.tv_usec/1000);
+}
+
+void write_uint32(std::string& buf, unsigned int n)
+{
+	for(int i = 0; i != 4; ++i) {
+		buf.push_back(char((n >> (i*8))&0xFF));
+	}
+}
+
+unsigned int read_uint32(const unsigned char* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (unsigned int)(p[3] << 24);
+}
+
+unsigned int checksum(const std::string& data)
+{
+	return crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(data.c_str()), data.size());
+}
+
+bool sync_file(FILE* f)
+{
+	if(fflush(f) != 0) {
+		return false;
+	}
+
+#if !defined(_WINDOWS)
+	fsync(fileno(f));
+#endif
+	return true;
+}
+
+//parses names like <base><n><suffix>, returning -1 if it doesn't match.
+int parse_seq(const std::string& fname, const std::string& base, const std::string& suffix)
+{
+	if(fname.size() <= base.size() + suffix.size() ||
+	   fname.compare(0, base.size(), base) != 0 ||
+	   fname.compare(fname.size() - suffix.size(), suffix.size(), suffix) != 0) {
+		return -1;
+	}
+
+	const std::string num(fname.begin() + base.size(), fname.end() - suffix.size());
+	if(num.find_first_not_of("0123456789") != std::string::npos) {
+		return -1;
+	}
+
+	return atoi(num.c_str());
+}
+
+//reads the documents in a log, stopping at the end or at the first
+//record which is incomplete, as happens if the server died writing it.
+int replay_log(const std::string& fname, boost::function<void(const std::string&)> replay)
+{
+	FILE* f = fopen(fname.c_str(), "rb");
+	if(!f) {
+		std::cerr << "COULD NOT OPEN STATS LOG " << fname << "\n";
+		return 0;
+	}
+
+	char header[LogHeaderSize];
+	if(fread(header, 1, LogHeaderSize, f) != LogHeaderSize || memcmp(header, LogHeader, LogHeaderSize) != 0) {
+		std::cerr << "STATS LOG " << fname << " HAS NO HEADER\n";
+		fclose(f);
+		return 0;
+	}
+
+	int nrecords = 0;
+	std::string doc;
+	for(;;) {
+		unsigned char record_header[8];
+		const size_t nread = fread(record_header, 1, sizeof(record_header), f);
+		if(nread == 0) {
+			break;
+		}
+
+		const size_t len = read_uint32(record_header);
+		if(nread != sizeof(record_header) || len > MaxRecordSize) {
+			std::cerr << "STATS LOG " << fname << " IS TRUNCATED AFTER " << nrecords << " RECORDS\n";
+			break;
+		}
+
+		doc.resize(len);
+		if((len && fread(&doc[0], 1, len, f) != len) || checksum(doc) != read_uint32(record_header + 4)) {
+			std::cerr << "STATS LOG " << fname << " IS TRUNCATED AFTER " << nrecords << " RECORDS\n";
+			break;
+		}
+
+		replay(doc);
+		++nrecords;
+	}
+
+	fclose(f);
+	return nrecords;
+}
+}
+
+stats_log::stats_log(const std::string& prefix)
+  : prefix_(prefix), log_(NULL), seq_(0), bytes_since_snapshot_(0), exiting_(false)
+{
+}
+
+stats_log::~stats_log()
+{
+	if(thread_) {
+		{
+			threading::lock lck(mutex_);
+			exiting_ = true;
+			cond_.notify_one();
+		}
+
+		thread_.reset();
+	}
+
+	if(log_) {
+		fclose(log_);
+	}
+}
+
+bool stats_log::recover(boost::function<void(const std::string&)> read_snapshot,
+                        boost::function<void(const std::string&)> replay)
+{
+	ASSERT_LOG(!thread_, "STATS LOG RECOVERED AFTER BEING STARTED");
+
+	std::vector<int> snapshots, logs;
+	find_files(&snapshots, &logs);
+
+	int first_log = 0;
+	if(!snapshots.empty()) {
+		first_log = snapshots.back();
+
+		const int start_time = get_milliseconds();
+		std::cerr << "READING STATS FROM " << snapshot_file(first_log) << "\n";
+		read_snapshot(sys::read_file(snapshot_file(first_log)));
+		std::cerr << "READ STATS SNAPSHOT IN " << (get_milliseconds() - start_time) << "ms\n";
+	}
+
+	foreach(int seq, logs) {
+		if(seq >= first_log) {
+			const int start_time = get_milliseconds();
+			const int nrecords = replay_log(log_file(seq), replay);
+			std::cerr << "REPLAYED " << nrecords << " STATS RECORDS FROM " << log_file(seq) << " IN " << (get_milliseconds() - start_time) << "ms\n";
+		}
+	}
+
+	return !snapshots.empty() || !logs.empty();
+}
+
+void stats_log::start()
+{
+	ASSERT_LOG(!thread_, "STATS LOG STARTED TWICE");
+
+	//always begin a new log, rather than adding to one which might end
+	//with an incomplete record.
+	std::vector<int> snapshots, logs;
+	find_files(&snapshots, &logs);
+	int seq = 0;
+	if(!snapshots.empty()) {
+		seq = std::max(seq, snapshots.back() + 1);
+	}
+
+	if(!logs.empty()) {
+		seq = std::max(seq, logs.back() + 1);
+	}
+
+	open_log(seq);
+	ASSERT_LOG(log_, "COULD NOT OPEN STATS LOG " << log_file(seq));
+
+#if defined(__ANDROID__) && SDL_VERSION_ATLEAST(1, 3, 0)
+	thread_.reset(new threading::thread("stats-log", boost::bind(&stats_log::run, this)));
+#else
+	thread_.reset(new threading::thread(boost::bind(&stats_log::run, this)));
+#endif
+}
+
+void stats_log::append(const std::string& doc)
+{
+	bytes_since_snapshot_ += doc.size();
+
+	threading::lock lck(mutex_);
+	queue_.push_back(item());
+	queue_.back().is_snapshot = false;
+	queue_.back().data = doc;
+	queue_.back().serialize_time_ms = 0;
+	cond_.notify_one();
+}
+
+void stats_log::write_snapshot(const std::string& data, int serialize_time_ms)
+{
+	bytes_since_snapshot_ = 0;
+
+	threading::lock lck(mutex_);
+	queue_.push_back(item());
+	queue_.back().is_snapshot = true;
+	queue_.back().data = data;
+	queue_.back().serialize_time_ms = serialize_time_ms;
+	cond_.notify_one();
+}
+
+void stats_log::run()
+{
+	for(;;) {
+		std::deque<item> items;
+
+		{
+			threading::lock lck(mutex_);
+			while(queue_.empty() && !exiting_) {
+				cond_.wait(mutex_);
+			}
+
+			if(queue_.empty()) {
+				return;
+			}
+
+			items.swap(queue_);
+		}
+
+		//write everything that's waiting together, so it only has to be
+		//synced once.
+		std::string buf;
+		foreach(const item& i, items) {
+			if(i.is_snapshot) {
+				flush_log(buf);
+				save_snapshot(i);
+			} else {
+				write_uint32(buf, i.data.size());
+				write_uint32(buf, checksum(i.data));
+				buf += i.data;
+			}
+		}
+
+		flush_log(buf);
+	}
+}
+
+void stats_log::open_log(int seq)
+{
+	if(log_) {
+		fclose(log_);
+	}
+
+	seq_ = seq;
+	log_ = fopen(log_file(seq).c_str(), "wb");
+	if(!log_) {
+		std::cerr << "COULD NOT OPEN STATS LOG " << log_file(seq) << "\n";
+		return;
+	}
+
+	fwrite(LogHeader, 1, LogHeaderSize, log_);
+	sync_file(log_);
+}
+
+void stats_log::flush_log(std::string& buf)
+{
+	if(buf.empty()) {
+		return;
+	}
+
+	if(!log_ || fwrite(buf.c_str(), 1, buf.size(), log_) != buf.size() || !sync_file(log_)) {
+		std::cerr << "ERROR WRITING " << buf.size() << " BYTES TO STATS LOG " << log_file(seq_) << "\n";
+	}
+
+	buf.clear();
+}
+
+void stats_log::save_snapshot(const item& snapshot)
+{
+	const int start_time = get_milliseconds();
+	const int seq = seq_ + 1;
+	const std::string fname = snapshot_file(seq);
+	const std::string tmp_fname = fname + ".tmp";
+
+	FILE* f = fopen(tmp_fname.c_str(), "wb");
+	const bool written = f && fwrite(snapshot.data.c_str(), 1, snapshot.data.size(), f) == snapshot.data.size() && sync_file(f);
+	if(f) {
+		fclose(f);
+	}
+
+	if(!written) {
+		std::cerr << "ERROR WRITING STATS SNAPSHOT " << tmp_fname << "\n";
+		sys::remove_file(tmp_fname);
+		return;
+	}
+
+	//the snapshot only replaces the logs once it's complete.
+	sys::move_file(tmp_fname, fname);
+	open_log(seq);
+	remove_old_files();
+
+	std::cerr << "WROTE STATS SNAPSHOT " << fname << ": " << snapshot.data.size() << " BYTES, SERIALIZED IN "
+	          << snapshot.serialize_time_ms << "ms, WRITTEN IN " << (get_milliseconds() - start_time) << "ms\n";
+}
+
+void stats_log::remove_old_files()
+{
+	std::vector<int> snapshots, logs;
+	find_files(&snapshots, &logs);
+
+	foreach(int seq, logs) {
+		if(seq < seq_) {
+			sys::remove_file(log_file(seq));
+		}
+	}
+
+	for(int n = 0; n < int(snapshots.size()) - KeptSnapshots; ++n) {
+		sys::remove_file(snapshot_file(snapshots[n]));
+	}
+}
+
+std::string stats_log::snapshot_file(int seq) const
+{
+	return formatter() << prefix_ << "-snapshot-" << seq << ".json";
+}
+
+std::string stats_log::log_file(int seq) const
+{
+	return formatter() << prefix_ << "-log-" << seq << ".bin";
+}
+
+void stats_log::find_files(std::vector<int>* snapshots, std::vector<int>* logs) const
+{
+	std::string dir = ".", base = prefix_;
+	const std::string::size_type slash = prefix_.rfind('/');
+	if(slash != std::string::npos) {
+		dir = std::string(prefix_.begin(), prefix_.begin() + slash);
+		base = std::string(prefix_.begin() + slash + 1, prefix_.end());
+	}
+
+	std::vector<std::string> files;
+	sys::get_files_in_dir(dir, &files);
+	foreach(const std::string& fname, files) {
+		int seq = parse_seq(fname, base + "-snapshot-", ".json");
+		if(seq >= 0) {
+			snapshots->push_back(seq);
+		}
+
+		seq = parse_seq(fname, base + "-log-", ".bin");
+		if(seq >= 0) {
+			logs->push_back(seq);
+		}
+	}
+
+	std::sort(snapshots->begin(), snapshots->end());
+	std::sort(logs->begin(), logs->end());
+}
@@ -0,0 +1,85 @@
+#ifndef STATS_LOG_HPP_INCLUDED
+#define STATS_LOG_HPP_INCLUDED
+
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include "thread.hpp"
+
+//Stores the stats server's data. Every stats document is appended to a
+//binary log as it arrives, and every so often a snapshot of all the stats
+//is written and a new log begun. Snapshot n holds everything in the logs
+//before log n, so at startup the latest snapshot is loaded and the logs
+//from it on are replayed.
+//
+//Files are written by a thread of their own. It writes all the records
+//waiting for it together, syncing them to disk once for the whole group.
+class stats_log
+{
+public:
+	//files are named <prefix>-snapshot-<n>.json and <prefix>-log-<n>.bin.
+	explicit stats_log(const std::string& prefix);
+
+	//waits for everything to be written.
+	~stats_log();
+
+	//loads the latest snapshot, passing it to 'read_snapshot', and passes
+	//each document logged since to 'replay', in order. Returns false if
+	//there wasn't anything to recover. Must be called before start().
+	bool recover(boost::function<void(const std::string&)> read_snapshot,
+	             boost::function<void(const std::string&)> replay);
+
+	//begins a new log and starts the writer thread.
+	void start();
+
+	void append(const std::string& doc);
+
+	//writes a snapshot, which must include every document appended so far.
+	//'serialize_time_ms' is how long it took to make, for reporting.
+	void write_snapshot(const std::string& data, int serialize_time_ms);
+
+	//the size of the documents appended since the last snapshot.
+	size_t bytes_since_snapshot() const { return bytes_since_snapshot_; }
+
+private:
+	stats_log(const stats_log&);
+	void operator=(const stats_log&);
+
+	struct item {
+		bool is_snapshot;
+		std::string data;
+		int serialize_time_ms;
+	};
+
+	void run();
+	void open_log(int seq);
+	void flush_log(std::string& buf);
+	void save_snapshot(const item& snapshot);
+	void remove_old_files();
+
+	std::string snapshot_file(int seq) const;
+	std::string log_file(int seq) const;
+	void find_files(std::vector<int>* snapshots, std::vector<int>* logs) const;
+
+	const std::string prefix_;
+
+	//used by the writer thread, once started.
+	FILE* log_;
+	int seq_;
+
+	size_t bytes_since_snapshot_;
+
+	threading::mutex mutex_;
+	threading::condition cond_;
+	std::deque<item> queue_;
+	bool exiting_;
+
+	boost::scoped_ptr<threading::thread> thread_;
+};
+
+#endif
@@ -1,16 +1,83 @@
+#include <iostream>
 #include <map>
 #include <vector>
 
+#include <boost/bind.hpp>
+
 #include "asserts.hpp"
 #include "foreach.hpp"
 #include "formula.hpp"
 #include "formula_callable.hpp"
+#include "json_parser.hpp"
 #include "stats_server.hpp"
 
 namespace {
 
 using namespace game_logic;
 
+//Callables which table formulas are evaluated with. They're reused for
+//every sample, rather than allocated for each one.
+class sample_callable : public formula_callable {
+	variant sample_;
+	const formula_callable* context_;
+
+	variant get_value(const std::string& key) const {
+		const variant var = sample_[variant(key)];
+		if(var.is_null()) {
+			return context_->query_value(key);
+		}
+
+		return var;
+	}
+public:
+	sample_callable() : context_(NULL)
+	{}
+
+	void set(const variant& sample, const formula_callable& context) {
+		sample_ = sample;
+		context_ = &context;
+	}
+};
+
+class table_callables
+{
+public:
+	table_callables() : sample_(new sample_callable) {
+		reset_value_callable();
+	}
+
+	const formula_callable& key_callable(const variant& msg, const formula_callable& context_callable) {
+		if(sample_->refcount() > 1) {
+			//a formula kept hold of the last one, so don't change it.
+			sample_.reset(new sample_callable);
+		}
+
+		sample_->set(msg, context_callable);
+		return *sample_;
+	}
+
+	const formula_callable& value_callable(const variant& msg, const variant& current_value) {
+		if(value_->refcount() > 1) {
+			reset_value_callable();
+		}
+
+		*value_slot_ = current_value;
+		*sample_slot_ = msg;
+		return *value_;
+	}
+private:
+	void reset_value_callable() {
+		value_.reset(new map_formula_callable);
+		value_slot_ = &value_->add_direct_access("value");
+		sample_slot_ = &value_->add_direct_access("sample");
+	}
+
+	boost::intrusive_ptr<sample_callable> sample_;
+	boost::intrusive_ptr<map_formula_callable> value_;
+	variant* value_slot_;
+	variant* sample_slot_;
+};
+
 class table_info
 {
 public:
@@ -19,8 +86,8 @@ public:
 	bool is_global() const { return is_global_; }
 
 	variant init_value() const { return init_value_; }
-	variant calculate_key(const variant& msg, const formula_callable& context_callable) const;
-	variant calculate_value(const variant& msg, const variant& current_value) const;
+	variant calculate_key(const variant& msg, const formula_callable& context_callable, table_callables& callables) const;
+	variant calculate_value(const variant& msg, const variant& current_value, table_callables& callables) const;
 private:
 	std::string name_;
 	bool is_global_;
@@ -39,40 +106,19 @@ table_info::table_info(const variant& v)
 {
 }
 
-namespace {
-class variant_callable : public formula_callable {
-	variant var_;
-	variant get_value(const std::string& key) const {
-		return var_[variant(key)];
-	}
-public:
-	explicit variant_callable(const variant& v) : var_(v)
-	{}
-};
-
-}
-
-variant table_info::calculate_key(const variant& msg, const formula_callable& context_callable) const
+variant table_info::calculate_key(const variant& msg, const formula_callable& context_callable, table_callables& callables) const
 {
 	if(key_) {
-		variant_callable* v = new variant_callable(msg);
-		variant holder(v);
-		formula_callable_with_backup* callable = new formula_callable_with_backup(*v, context_callable);
-		variant callable_holder(callable);
-		return key_->execute(*callable);
+		return key_->execute(callables.key_callable(msg, context_callable));
 	} else {
 		return variant();
 	}
 }
 
-variant table_info::calculate_value(const variant& msg, const variant& current_value) const
+variant table_info::calculate_value(const variant& msg, const variant& current_value, table_callables& callables) const
 {
 	if(value_) {
-		map_formula_callable* callable = new map_formula_callable;
-		const variant scope(callable);
-		callable->add("value", current_value);
-		callable->add("sample", msg);
-		return value_->execute(*callable);
+		return value_->execute(callables.value_callable(msg, current_value));
 	} else {
 		if(current_value.is_int() || current_value.is_null()) {
 			return variant(current_value.as_int()+1);
@@ -321,6 +367,11 @@ void process_stats(const variant& doc)
 		return;
 	}
 
+	static const msg_type_info NoTables;
+	static table_callables callables;
+
+	const std::map<std::string, std::map<std::string, msg_type_info> >::const_iterator module_types = message_type_index.find(module_str);
+
 	try {
 	for(int n = 0; n != levels.num_elements(); ++n) {
 		variant lvl = levels[n];
@@ -332,6 +383,11 @@ void process_stats(const variant& doc)
 
 		context_callable->add("level", level_id_v);
 
+		type_data_map* level_data[2];
+		for(int i = 0; i != 2; ++i) {
+			level_data[i] = &data_store[i]->level_to_data[level_id.as_string()];
+		}
+
 		variant stats = lvl["stats"];
 		for(int m = 0; m != stats.num_elements(); ++m) {
 			variant msg = stats[m];
@@ -345,7 +401,13 @@ void process_stats(const variant& doc)
 			}
 			
 			const std::string& type_str = type.as_string();
-			const msg_type_info& msg_info = message_type_index[module_str][type_str];
+			const msg_type_info* msg_info = &NoTables;
+			if(module_types != message_type_index.end()) {
+				std::map<std::string, msg_type_info>::const_iterator info = module_types->second.find(type_str);
+				if(info != module_types->second.end()) {
+					msg_info = &info->second;
+				}
+			}
 
 			table_set* all_ts[4];
 
@@ -355,18 +417,17 @@ void process_stats(const variant& doc)
 				global_ts[i] = &data_store[i]->global_data[type_str];
 				global_ts[i]->total_count++;
 
-				type_data_map& data_map = data_store[i]->level_to_data[level_id.as_string()];
-				level_ts[i] = &data_map[type_str];
+				level_ts[i] = &(*level_data[i])[type_str];
 				level_ts[i]->total_count++;
 			}
 
-			foreach(const table_info& info, msg_info.tables) {
-				variant key = info.calculate_key(msg, *context_callable);
+			foreach(const table_info& info, msg_info->tables) {
+				variant key = info.calculate_key(msg, *context_callable, callables);
 				for(int i = (info.is_global() ? 0 : 2); i != 4; ++i) {
 					table_set* ts = all_ts[i];
 					table& tb = ts->tables[info.name()];
 					variant& val = tb[key];
-					val = info.calculate_value(msg, val);
+					val = info.calculate_value(msg, val, callables);
 				}
 			}
 		}
@@ -388,3 +449,81 @@ variant get_stats(const std::string& version, const std::string& module, const s
 	type_data_map& data = lvl.empty() ? ver_data.global_data : ver_data.level_to_data[lvl];
 	return output_type_data_map(data);
 }
+
+stats_worker::stats_worker(size_t max_queue_size)
+  : max_queue_size_(max_queue_size), exiting_(false)
+{
+	stats_.tasks_run = stats_.tasks_dropped = stats_.tasks_queued = 0;
+	stats_.queue_size = 0;
+
+#if defined(__ANDROID__) && SDL_VERSION_ATLEAST(1, 3, 0)
+	thread_.reset(new threading::thread("stats-worker", boost::bind(&stats_worker::run, this)));
+#else
+	thread_.reset(new threading::thread(boost::bind(&stats_worker::run, this)));
+#endif
+}
+
+stats_worker::~stats_worker()
+{
+	{
+		threading::lock lck(mutex_);
+		exiting_ = true;
+		cond_.notify_one();
+	}
+
+	thread_.reset();
+}
+
+bool stats_worker::queue(boost::function<void()> task, size_t size)
+{
+	threading::lock lck(mutex_);
+	if(size > 0 && stats_.queue_size + size > max_queue_size_) {
+		++stats_.tasks_dropped;
+		return false;
+	}
+
+	queue_.push_back(std::pair<boost::function<void()>, size_t>(task, size));
+	stats_.queue_size += size;
+	++stats_.tasks_queued;
+	cond_.notify_one();
+	return true;
+}
+
+stats_worker::queue_stats stats_worker::get_queue_stats() const
+{
+	threading::lock lck(mutex_);
+	return stats_;
+}
+
+void stats_worker::run()
+{
+	for(;;) {
+		boost::function<void()> task;
+
+		{
+			threading::lock lck(mutex_);
+			while(queue_.empty() && !exiting_) {
+				cond_.wait(mutex_);
+			}
+
+			if(queue_.empty()) {
+				return;
+			}
+
+			task.swap(queue_.front().first);
+			stats_.queue_size -= queue_.front().second;
+			queue_.pop_front();
+		}
+
+		try {
+			task();
+		} catch(validation_failure_exception& e) {
+			std::cerr << "ERROR PROCESSING STATS: " << e.msg << "\n";
+		} catch(json::parse_error& e) {
+			std::cerr << "ERROR PARSING STATS: " << e.error_message() << "\n";
+		}
+
+		threading::lock lck(mutex_);
+		++stats_.tasks_run;
+	}
+}
@@ -1,6 +1,13 @@
 #ifndef STATS_HPP_INCLUDED
 #define STATS_HPP_INCLUDED
 
+#include <deque>
+#include <utility>
+
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include "thread.hpp"
 #include "variant.hpp"
 
 void init_tables(const variant& doc);
@@ -16,4 +23,44 @@ void process_stats(const variant& doc);
 
 variant get_stats(const std::string& version, const std::string& module, const std::string& module_version, const std::string& lvl);
 
+//A thread which stats are processed on, so that handling requests isn't held
+//up by them. Formulas and variants aren't thread safe, so while the worker
+//is running, the functions above must only be called by tasks queued to it.
+class stats_worker
+{
+public:
+	//max_queue_size limits the total size of the tasks waiting to be run.
+	explicit stats_worker(size_t max_queue_size);
+
+	//waits for the tasks which have already been queued to finish.
+	~stats_worker();
+
+	//queues a task. Tasks with a size are dropped if there isn't room for
+	//them in the queue, in which case false is returned.
+	bool queue(boost::function<void()> task, size_t size=0);
+
+	struct queue_stats {
+		int tasks_run, tasks_dropped, tasks_queued;
+		size_t queue_size;
+	};
+
+	queue_stats get_queue_stats() const;
+
+private:
+	stats_worker(const stats_worker&);
+	void operator=(const stats_worker&);
+
+	void run();
+
+	const size_t max_queue_size_;
+
+	threading::mutex mutex_;
+	threading::condition cond_;
+	std::deque<std::pair<boost::function<void()>, size_t> > queue_;
+	queue_stats stats_;
+	bool exiting_;
+
+	boost::scoped_ptr<threading::thread> thread_;
+};
+
 #endif
@@ -3,16 +3,39 @@
 #include <string>
 #include <vector>
 
+#include <boost/bind.hpp>
+
 #include "asserts.hpp"
 #include "filesystem.hpp"
 #include "json_parser.hpp"
+#include "stats_log.hpp"
 #include "stats_server.hpp"
 #include "stats_web_server.hpp"
 #include "unit_test.hpp"
 
+namespace {
+void read_snapshot(const std::string& data)
+{
+	read_stats(json::parse(data, json::JSON_NO_PREPROCESSOR));
+}
+
+void replay_stats(const std::string& doc)
+{
+	const assert_recover_scope recovery_scope;
+	try {
+		process_stats(json::parse(doc, json::JSON_NO_PREPROCESSOR));
+	} catch(validation_failure_exception&) {
+	} catch(json::parse_error&) {
+		std::cerr << "ERROR PARSING LOGGED STATS\n";
+	}
+}
+}
+
 COMMAND_LINE_UTILITY(stats_server)
 {
+	//stats from before there was a stats log.
 	std::string fname = "stats-1.json";
+	bool explicit_file = false;
 	int port = 5000;
 
 	std::deque<std::string> arguments(args.begin(), args.end());
@@ -38,6 +61,7 @@ COMMAND_LINE_UTILITY(stats_server)
 
 			fname = arguments.front();
 			arguments.pop_front();
+			explicit_file = true;
 
 			if(!sys::file_exists(fname)) {
 				std::cerr << "COULD NOT OPEN " << fname << "\n";
@@ -55,17 +79,26 @@ COMMAND_LINE_UTILITY(stats_server)
 		init_tables(json::parse_from_file("data/stats-server.json"));
 	}
 
-	if(sys::file_exists(fname)) {
+	stats_log log("stats");
+	const bool recovered = !explicit_file && log.recover(read_snapshot, replay_stats);
+
+	if(!recovered && sys::file_exists(fname)) {
 		std::cerr << "READING STATS FROM " << fname << "\n";
 		read_stats(json::parse_from_file(fname));
 		std::cerr << "FINISHED READING STATS FROM " << fname << "\n";
 	}
 
+	log.start();
+	if(explicit_file) {
+		//the file given replaces whatever is in the logs.
+		log.write_snapshot(write_stats().write_json(), 0);
+	}
+
 	//Make it so asserts don't make the server die, they throw an
 	//exception instead.
 	const assert_recover_scope recovery_scope;
 
 	boost::asio::io_service io_service;
-	web_server ws(io_service, port);
+	web_server ws(io_service, log, port);
 	io_service.run();
 }
@@ -21,43 +21,85 @@
 
 std::string global_debug_str;
 
-web_server::web_server(boost::asio::io_service& io_service, int port)
-	: http::web_server(io_service, port), timer_(io_service), nheartbeat_(0)
+namespace {
+//stats waiting to be processed may take up this much memory before any
+//more are dropped.
+const size_t MaxQueuedStatsSize = 256*1024*1024;
+
+//once this much has been logged, a snapshot is written so that the log
+//doesn't take too long to replay.
+const size_t MaxLogSize = 64*1024*1024;
+}
+
+web_server::web_server(boost::asio::io_service& io_service, stats_log& log, int port)
+	: http::web_server(io_service, port), log_(log), timer_(io_service), nheartbeat_(0), tasks_dropped_(0),
+	  worker_(MaxQueuedStatsSize)
 {
 	heartbeat();
 }
 
+bool web_server::handle_post_body(socket_ptr socket, const std::string& body, const http::environment& env)
+{
+	if(!worker_.queue(boost::bind(&web_server::process_post, this, socket, body), body.size())) {
+		disconnect(socket);
+	}
+
+	return true;
+}
+
 void web_server::handle_post(socket_ptr socket, variant doc, const http::environment& env)
 {
+	//all posts are handled by handle_post_body().
+	disconnect(socket);
+}
+
+void web_server::process_post(socket_ptr socket, const std::string& body)
+{
+	variant doc;
+	try {
+		doc = json::parse(body, json::JSON_NO_PREPROCESSOR);
+	} catch(json::parse_error&) {
+		std::cerr << "ERROR PARSING JSON\n";
+	}
+
 	static const variant TypeVariant("type");
-	const std::string& type = doc[TypeVariant].as_string();
+	const std::string type = doc.is_map() && doc[TypeVariant].is_string() ? doc[TypeVariant].as_string() : "";
 	if(type == "stats") {
+		log_.append(body);
 		process_stats(doc);
+		if(log_.bytes_since_snapshot() > MaxLogSize) {
+			write_snapshot();
+		}
 	} else if(type == "upload_table_definitions") {
 		//TODO: add authentication to get info about the user
 		//and make sure they have permission to update this module.
-		const std::string& module = doc[variant("module")].as_string();
-		init_tables_for_module(module, doc[variant("definition")]);
-
 		try {
-			send_msg(socket, "text/json", "{ \"status\": \"ok\" }", "");
+			const std::string& module = doc[variant("module")].as_string();
+			init_tables_for_module(module, doc[variant("definition")]);
+
+			respond(socket, "{ \"status\": \"ok\" }");
 			sys::write_file("stats-definitions.json", get_tables_definition().write_json());
 		} catch(validation_failure_exception& e) {
 			std::map<variant,variant> msg;
 			msg[variant("status")] = variant("error");
 			msg[variant("message")] = variant(e.msg);
-			send_msg(socket, "text/json", variant(&msg).write_json(), "");
+			respond(socket, variant(&msg).write_json());
 		}
 
 		return;
 	}
-	disconnect(socket);
-}
 
+	respond(socket, "");
+}
 
 void web_server::handle_get(socket_ptr socket, 
 	const std::string& url, 
 	const std::map<std::string, std::string>& args)
+{
+	worker_.queue(boost::bind(&web_server::process_get, this, socket, args));
+}
+
+void web_server::process_get(socket_ptr socket, const std::map<std::string, std::string>& args)
 {
 	std::map<std::string, std::string>::const_iterator it = args.find("type");
 	if(it != args.end() && it->second == "status") {
@@ -72,7 +114,7 @@ void web_server::handle_get(socket_ptr socket,
 			m[variant(i->first)] = variant(msg);
 		}
 
-		send_msg(socket, "text/json", variant(&m).write_json(), "");
+		respond(socket, variant(&m).write_json());
 		return;
 	}
 
@@ -80,37 +122,48 @@ void web_server::handle_get(socket_ptr socket,
 		args.count("module") ? args.find("module")->second : "",
 		args.count("module_version") ? args.find("module_version")->second : "",
 		args.count("level") ? args.find("level")->second : "");
-	send_msg(socket, "text/json", value.write_json(), "");
+	respond(socket, value.write_json());
+}
+
+void web_server::respond(socket_ptr socket, const std::string& msg)
+{
+	handler_strand().post(boost::bind(&web_server::send_response, this, socket, msg));
+}
+
+void web_server::send_response(socket_ptr socket, const std::string& msg)
+{
+	if(msg.empty()) {
+		disconnect(socket);
+	} else {
+		send_msg(socket, "text/json", msg, "");
+	}
 }
 
 void web_server::heartbeat()
 {
 	if(++nheartbeat_%3600 == 0) {
-		std::cerr << "WRITING DATA...\n";
-		timeval start_time, end_time;
-		gettimeofday(&start_time, NULL);
-		variant v = write_stats();
-		std::string data = v.write_json(true);
-
-		if(sys::file_exists("stats-5.json")) {
-			sys::remove_file("stats-5.json");
-		}
+		worker_.queue(boost::bind(&web_server::write_snapshot, this));
+	}
 
-		for(int n = 4; n >= 1; --n) {
-			if(sys::file_exists(formatter() << "stats-" << n << ".json")) {
-				sys::move_file(formatter() << "stats-" << n << ".json",
-				               formatter() << "stats-" << (n+1) << ".json");
-			}
+	if(nheartbeat_%60 == 0) {
+		const stats_worker::queue_stats stats = worker_.get_queue_stats();
+		if(stats.tasks_dropped != tasks_dropped_) {
+			std::cerr << "STATS QUEUE FULL: DROPPED " << (stats.tasks_dropped - tasks_dropped_) << " REQUESTS. " << stats.queue_size << " BYTES WAITING\n";
+			tasks_dropped_ = stats.tasks_dropped;
 		}
-
-		sys::write_file("stats-1.json", data);
-
-		gettimeofday(&end_time, NULL);
-
-		const int time_us = (end_time.tv_sec - start_time.tv_sec)*1000000 + (end_time.tv_usec - start_time.tv_usec);
-		std::cerr << "WROTE STATS IN " << time_us << "us\n";
 	}
 
 	timer_.expires_from_now(boost::posix_time::seconds(1));
-	timer_.async_wait(boost::bind(&web_server::heartbeat, this));
+	timer_.async_wait(handler_strand().wrap(boost::bind(&web_server::heartbeat, this)));
+}
+
+void web_server::write_snapshot()
+{
+	timeval start_time, end_time;
+	gettimeofday(&start_time, NULL);
+	const std::string data = write_stats().write_json();
+	gettimeofday(&end_time, NULL);
+
+	const int time_ms = (end_time.tv_sec - start_time.tv_sec)*1000 + (end_time.tv_usec - start_time.tv_usec)/1000;
+	log_.write_snapshot(data, time_ms);
 }
@@ -5,19 +5,37 @@
 #include <boost/asio.hpp>
 
 #include "http_server.hpp"
+#include "stats_log.hpp"
+#include "stats_server.hpp"
 
 class web_server : public http::web_server
 {
 public:
-	explicit web_server(boost::asio::io_service& io_service, int port=23456);
+	//every stats document received is appended to 'log'.
+	web_server(boost::asio::io_service& io_service, stats_log& log, int port=23456);
 private:
 	void heartbeat();
 
+	virtual bool handle_post_body(socket_ptr socket, const std::string& body, const http::environment& env);
 	virtual void handle_post(socket_ptr socket, variant doc, const http::environment& env);
 	virtual void handle_get(socket_ptr socket, const std::string& url, const std::map<std::string, std::string>& args);
 
+	//these are run on the stats worker.
+	void process_post(socket_ptr socket, const std::string& body);
+	void process_get(socket_ptr socket, const std::map<std::string, std::string>& args);
+	void write_snapshot();
+
+	//sends a response from the stats worker. An empty message disconnects
+	//the socket instead.
+	void respond(socket_ptr socket, const std::string& msg);
+	void send_response(socket_ptr socket, const std::string& msg);
+
+	stats_log& log_;
 	boost::asio::deadline_timer timer_;
 	int nheartbeat_;
+	int tasks_dropped_;
+
+	stats_worker worker_;
 };
 
 #endif
@@ -14,6 +14,7 @@
 #include "concurrent_cache.hpp"
 #include "filesystem.hpp"
 #include "foreach.hpp"
+#include "frame_timing.hpp"
 #include "module.hpp"
 #include "preferences.hpp"
 #include "surface_cache.hpp"
@@ -116,6 +117,7 @@ surface get_no_cache(const std::string& key, std::string* full_filename)
 	}
 #endif // ANDROID
 	//std::cerr << "loading image '" << fname << "'\n";
+	frame_timing::note_asset_load("image " + key);
 	if(surf.get() == false || surf->w == 0) {
 		if(key != "") {
 			std::cerr << "failed to load image '" << key << "'\n";
@@ -1,8 +1,10 @@
 #include <iostream>
 #include <map>
+#include <set>
 #include "graphics.hpp"
 
 #include "asserts.hpp"
+#include "colorshift_hash_table.hpp"
 #include "concurrent_cache.hpp"
 #include "filesystem.hpp"
 #include "foreach.hpp"
@@ -14,6 +16,7 @@
 #include "surface.hpp"
 #include "surface_cache.hpp"
 #include "surface_formula.hpp"
+#include "thread.hpp"
 #include "unit_test.hpp"
 
 using namespace graphics;
@@ -31,32 +34,37 @@ cache_map& cache() {
 
 class rgba_function : public function_expression {
 public:
-	explicit rgba_function(surface surf, const args_list& args)
-	  : function_expression("rgba", args, 4), surf_(surf) {
+	explicit rgba_function(const SDL_PixelFormat& format, const args_list& args)
+	  : function_expression("rgba", args, 4), format_(format) {
+		//surface formulas only run on 32 bit surfaces, which have no
+		//palette, so don't keep a pointer into the surface's format.
+		format_.palette = NULL;
 	}
 
 private:
 	variant execute(const formula_callable& variables) const {
-		return variant(SDL_MapRGBA(surf_->format,
+		return variant(SDL_MapRGBA(const_cast<SDL_PixelFormat*>(&format_),
 		   Uint8(args()[0]->evaluate(variables).as_int()),
 		   Uint8(args()[1]->evaluate(variables).as_int()),
 		   Uint8(args()[2]->evaluate(variables).as_int()),
 		   Uint8(args()[3]->evaluate(variables).as_int())));
 	}
-	surface surf_;
+	SDL_PixelFormat format_;
 };
 
+//compiled formulas are shared by every surface with the same pixel format,
+//so they keep a copy of the format rather than any surface.
 class surface_formula_symbol_table : public function_symbol_table
 {
 public:
-	explicit surface_formula_symbol_table(surface surf) : surf_(surf)
+	explicit surface_formula_symbol_table(const SDL_PixelFormat& format) : format_(format)
 	{}
 	expression_ptr create_function(
 	                  const std::string& fn,
 	                  const std::vector<expression_ptr>& args,
 					  const formula_callable_definition* callable_def) const;
 private:
-	surface surf_;
+	SDL_PixelFormat format_;
 };
 
 expression_ptr surface_formula_symbol_table::create_function(
@@ -65,7 +73,7 @@ expression_ptr surface_formula_symbol_table::create_function(
 						   const formula_callable_definition* callable_def) const
 {
 	if(fn == "rgba") {
-		return expression_ptr(new rgba_function(surf_, args));
+		return expression_ptr(new rgba_function(format_, args));
 	} else {
 		return function_symbol_table::create_function(fn, args, callable_def);
 	}
@@ -97,13 +105,72 @@ private:
 	Uint8 r, g, b, a;
 };
 
+//the compiled formula for an algorithm along with the table of every color
+//it has been applied to so far. These are shared by all surfaces that use
+//the same algorithm and pixel format, so the formula only ever runs once
+//per distinct color.
+struct algorithm_table {
+	threading::mutex mutex;
+	formula_ptr f;
+	colorshift_hash_table colors;
+};
+
+struct format_masks {
+	explicit format_masks(const SDL_PixelFormat& format)
+	  : r(format.Rmask), g(format.Gmask), b(format.Bmask), a(format.Amask)
+	{}
+
+	bool operator<(const format_masks& o) const {
+		if(r != o.r) { return r < o.r; }
+		if(g != o.g) { return g < o.g; }
+		if(b != o.b) { return b < o.b; }
+		return a < o.a;
+	}
+
+	Uint32 r, g, b, a;
+};
+
+typedef std::map<std::pair<std::string, format_masks>, boost::shared_ptr<algorithm_table> > algorithm_table_map;
+
+algorithm_table& get_algorithm_table(const std::string& algo, const SDL_PixelFormat& format)
+{
+	static threading::mutex map_mutex;
+	static algorithm_table_map tables;
+
+	threading::lock lck(map_mutex);
+	boost::shared_ptr<algorithm_table>& table = tables[std::make_pair(algo, format_masks(format))];
+	if(!table) {
+		table.reset(new algorithm_table);
+	}
+
+	return *table;
+}
+
 void run_formula(surface surf, const std::string& algo)
 {
 	const hi_res_timer timer("run_formula");
 
-	const int ticks = SDL_GetTicks();
-	surface_formula_symbol_table table(surf);
-	game_logic::formula f(variant(algo), &table);
+	algorithm_table& table = get_algorithm_table(algo, *surf->format);
+
+	//the formula runs FFL, so it's compiled and run without the lock held.
+	formula_ptr f;
+	{
+		threading::lock lck(table.mutex);
+		f = table.f;
+	}
+
+	if(!f) {
+		surface_formula_symbol_table symbols(*surf->format);
+		f.reset(new game_logic::formula(variant(algo), &symbols));
+
+		threading::lock lck(table.mutex);
+		if(table.f) {
+			f = table.f;
+		} else {
+			table.f = f;
+		}
+	}
+
 	bool locked = false;
 	if(SDL_MUSTLOCK(surf.get())) {
 		const int res = SDL_LockSurface(surf.get());
@@ -112,29 +179,47 @@ void run_formula(surface surf, const std::string& algo)
 		}
 	}
 
-	std::map<Uint32, Uint32> pixel_map;
-
 	Uint32* pixels = reinterpret_cast<Uint32*>(surf->pixels);
 	Uint32* end_pixels = pixels + surf->w*surf->h;
 
 	Uint32 AlphaPixel = SDL_MapRGBA(surf->format, 0x6f, 0x6d, 0x51, 0x0);
 
-	int skip = 0;
-	while(pixels != end_pixels) {
-		if(((*pixels)&(~surf->format->Amask)) == AlphaPixel) {
-			++pixels;
-			continue;
+	//find any colors we haven't seen before. Transparent pixels are never
+	//added, so mapping leaves them alone.
+	std::set<Uint32> new_colors;
+	{
+		threading::lock lck(table.mutex);
+		bool have_last = false;
+		Uint32 last = 0;
+		for(const Uint32* p = pixels; p != end_pixels; ++p) {
+			if(have_last && *p == last) {
+				continue;
+			}
+
+			have_last = true;
+			last = *p;
+
+			if(((*p)&(~surf->format->Amask)) == AlphaPixel || table.colors.find(*p)) {
+				continue;
+			}
+
+			new_colors.insert(*p);
 		}
-		std::map<Uint32, Uint32>::const_iterator itor = pixel_map.find(*pixels);
-		if(itor == pixel_map.end()) {
-			pixel_callable p(surf, *pixels);
-			Uint32 result = f.execute(p).as_int();
-			pixel_map[*pixels] = result;
-			*pixels = result;
-		} else {
-			*pixels = itor->second;
+	}
+
+	std::vector<colorshift_hash_table::pixel_pair> new_entries;
+	foreach(Uint32 color, new_colors) {
+		pixel_callable callable(surf, color);
+		new_entries.push_back(colorshift_hash_table::pixel_pair(color, f->execute(callable).as_int()));
+	}
+
+	{
+		threading::lock lck(table.mutex);
+		foreach(const colorshift_hash_table::pixel_pair& entry, new_entries) {
+			table.colors.insert(entry);
 		}
-		++pixels;
+
+		table.colors.map_pixels(pixels, end_pixels - pixels);
 	}
 
 	if(locked) {
@@ -258,7 +343,7 @@ GLuint get_gl_shader(const std::vector<std::string>& vertex_shader_file,
 #endif
 }
 
-BENCHMARK(surface_formula)
+BENCHMARK_TAGGED(surface_formula, "render")
 {
 	surface s(graphics::surface_cache::get("characters/frogatto-spritesheet1.png"));
 	assert(s.get());
@@ -272,7 +357,7 @@ BENCHMARK(surface_formula)
 	}
 }
 
-BENCHMARK(pixel_table)
+BENCHMARK_TAGGED(pixel_table, "render")
 {
 	//This is some hard coded test data. It gives the set of pixels in
 	//the input image, and the pixels we want to map to.
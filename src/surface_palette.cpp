@@ -2,6 +2,7 @@
 #include <vector>
 
 #include "asserts.hpp"
+#include "colorshift_hash_table.hpp"
 #include "surface_cache.hpp"
 #include "surface_palette.hpp"
 
@@ -12,7 +13,7 @@ namespace {
 
 struct palette_definition {
 	std::string name;
-	std::map<uint32_t, uint32_t> mapping;
+	colorshift_hash_table mapping;
 };
 
 std::vector<palette_definition> palettes;
@@ -33,7 +34,9 @@ void load_palette_def(const std::string& id)
 
 	const uint32_t* pixels = reinterpret_cast<const uint32_t*>(s->pixels);
 	for(int n = 0; n < s->w*s->h - 1; n += 2) {
-		def.mapping.insert(std::pair<uint32_t,uint32_t>(pixels[0], pixels[1]));
+		if(!def.mapping.find(pixels[0])) {
+			def.mapping.insert(colorshift_hash_table::pixel_pair(pixels[0], pixels[1]));
+		}
 		pixels += 2;
 	}
 
@@ -88,19 +91,7 @@ surface map_palette(surface s, int palette)
 	uint32_t* dst = reinterpret_cast<uint32_t*>(result->pixels);
 	const uint32_t* src = reinterpret_cast<const uint32_t*>(s->pixels);
 
-	const std::map<uint32_t,uint32_t>& mapping = palettes[palette].mapping;
-
-	for(int n = 0; n != s->w*s->h; ++n) {
-		std::map<uint32_t,uint32_t>::const_iterator i = mapping.find(*src);
-		if(i != mapping.end()) {
-			*dst = i->second;
-		} else {
-			*dst = *src;
-		}
-
-		++src;
-		++dst;
-	}
+	palettes[palette].mapping.map_pixels(src, dst, s->w*s->h);
 	return result;
 }
 
@@ -110,10 +101,9 @@ color map_palette(const color& c, int palette)
 		return c;
 	}
 
-	const std::map<uint32_t,uint32_t>& mapping = palettes[palette].mapping;
-	std::map<uint32_t,uint32_t>::const_iterator i = mapping.find(c.value());
-	if(i != mapping.end()) {
-		return color(color::convert_pixel_byte_order(i->second));
+	uint32_t result;
+	if(palettes[palette].mapping.find(c.value(), &result)) {
+		return color(color::convert_pixel_byte_order(result));
 	} else {
 		return c;
 	}
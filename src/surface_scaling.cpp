@@ -12,6 +12,13 @@
 #include "unit_test.hpp"
 #include "variant.hpp"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SURFACE_SCALING_SSE2 1
+#else
+#define SURFACE_SCALING_SSE2 0
+#endif
+
 namespace graphics {
 
 uint32_t interpolate_pixels (uint32_t sourcePixelOne, uint32_t sourcePixelTwo){
@@ -349,7 +356,197 @@ x >= 2 && y < input->h-2 ? in[(y+2)*input->w + x-2] : 0, x >= 1 && y < input->h-
 
 
 
-surface scale_surface(surface input) {
+namespace {
+
+//applies the 2xSaI smoothing for the input pixel at (x,y) on top of the
+//nearest neighbor output already written to 'out'. The pixel must be at
+//least one pixel from the top/left edges and two pixels from the
+//bottom/right edges.
+void scale_pixel_2xsai(const uint32_t* in, int in_w, int in_h, uint32_t* out, int out_w, int x, int y)
+{
+	//do additional 2xSaI interpolation
+
+	//  2xSai works on a square group of sixteen pixels, rather than the square group of nine that Eagle works on.  In Eagle, the current pixel being upsized is the one in the middle of this square of nine; in 2xSai, the current pixel is the one in the upper-left of the middle four.  The other pixels in this group are all input pixels that are being examined to determine if we have an edge to smooth out.
+
+	//  X X X X  |  0  1  2  3
+	//  X * X X  |  4  5  6  7
+	//  X X X X  |  8  9  10 11
+	//  X X X X  |  12 13 14 15
+	const int px[4][4] = {{	//[x][y]
+		y*in_w + x - in_w - 1,
+		y*in_w + x - in_w,
+		y*in_w + x - in_w + 1,
+		y*in_w + x - in_w + 2},
+		{y*in_w + x - 1,
+		y*in_w + x,
+		y*in_w + x + 1,
+		y*in_w + x + 2},
+		{y*in_w + x + in_w - 1,
+		y*in_w + x + in_w,
+		y*in_w + x + in_w + 1,
+		y*in_w + x + in_w + 2},
+		{y*in_w + x + 2*in_w - 1,
+		y*in_w + x + 2*in_w,
+		y*in_w + x + 2*in_w + 1,
+		y*in_w + x + 2*in_w + 2}};
+
+	//these are the four output pixels corresponding to the one input pixel
+	const int upper_left = (y*2)*out_w + x*2;
+	const int upper_right = (y*2)*out_w + x*2 + 1;
+	const int lower_left = (y*2 + 1)*out_w + x*2;
+	const int lower_right = (y*2 + 1)*out_w + x*2 + 1;
+
+	//make sure we're not going out-of-bounds
+	const int max_index = in_w*in_h;
+	assert(px[0][2] < max_index);
+	assert(px[0][3] < max_index);
+	assert(px[1][2] < max_index);
+	assert(px[1][3] < max_index);
+	assert(px[2][0] < max_index);
+	assert(px[2][1] < max_index);
+	assert(px[2][2] < max_index);
+	assert(px[2][3] < max_index);
+	assert(px[3][0] < max_index);
+	assert(px[3][1] < max_index);
+	assert(px[3][2] < max_index);
+	assert(px[3][3] < max_index);
+
+
+
+	// The following blocks are a visual representation of the conditional right above them.  When I have multiple instances of the same number, such as two 1s, then those places are equal.  When I have two different numbers in the same block, then they *must* be inequal - e.g. the value at 2 does not equal the value at 1, and also does not equal the value at 3. When I have a number, and an alphanumeric character in a block, the character does not need to be different from the number, but must equal itself.
+			//  X X X X
+			//  X X X X
+			//  X X X X
+			//  X X X X
+
+	if ( (in[px[1][1]] == in[px[2][2]]) && (in[px[1][2]] != in[px[2][1]]) ) {
+			//  X X X X
+			//  X 1 2 X
+			//  X 3 1 X
+			//  X X X X
+		if ( ((in[px[1][1]] == in[px[0][1]]) && (in[px[1][2]] == in[px[2][3]])) || ((in[px[1][1]] == in[px[2][1]]) && (in[px[1][1]] == in[px[0][2]]) && (in[px[1][2]] != in[px[0][1]]) && (in[px[1][2]] == in[px[0][3]]))){
+			   //  X 1 X X         X 2 1 1
+			   //  X 1 A X         X 1 1 X
+			   //  X X X A   or    X X X X
+			   //  X X X X         X X X X
+			out[upper_right] = in[px[1][1]];
+		}else{
+			if( ! ((in[px[1][1]] == in[px[0][1]])) ){
+				//  X 2 X X
+				//  X 1 X X
+				//  X X X X
+				//  X X X X
+				out[upper_right] = interpolate_pixels(in[px[1][1]],in[px[1][2]]);
+			}
+		}
+
+		if ( ((in[px[1][1]] == in[px[1][0]]) && (in[px[2][1]] == in[px[3][2]])) || ((in[px[1][1]] == in[px[1][2]]) && (in[px[1][1]] == in[px[2][0]]) && (in[px[1][0]] != in[px[2][1]]) && (in[px[2][1]] == in[px[3][0]]))){
+			//  X X X X           X X X X
+			//  1 1 X X           2 A A X
+			//  X A X X    or     A 3 X X
+			//  X X A X           X 3 X X
+			out[lower_left] = in[px[1][1]];
+		}else{
+			if( ! ((in[px[1][1]] == in[px[1][0]])) ){
+					//  X 2 X X
+					//  X 1 X X
+					//  X X X X
+					//  X X X X
+				out[lower_left] = interpolate_pixels(in[px[1][1]],in[px[2][1]]);
+			}
+		}
+		out[lower_right] = in[px[1][1]];
+
+
+
+
+	} else if ( (in[px[1][2]] == in[px[2][1]]) && (in[px[1][1]] != in[px[2][2]]) ) {
+			//  X X X X
+			//  X 2 1 X
+			//  X 1 3 X
+			//  X X X X
+
+		if ( ((in[px[1][2]] == in[px[0][2]]) && (in[px[1][1]] == in[px[2][0]])) || ((in[px[1][2]] == in[px[0][1]]) && (in[px[1][2]] == in[px[2][2]]) && (in[px[1][2]] != in[px[0][2]]) && (in[px[1][1]] == in[px[0][0]]))){
+			//  X X 1 X           2 1 1 X
+			//  X A 1 X           X 2 1 X
+			//  A X X X    or     X X 1 X
+			//  X X X X           X X X X
+			out[upper_right] = in[px[1][2]];
+		}else{
+			out[upper_right] = interpolate_pixels(in[px[1][1]],in[px[1][2]]);
+		}
+
+		if ( ((in[px[2][1]] == in[px[2][0]]) && (in[px[1][1]] == in[px[0][2]])) || ((in[px[2][1]] == in[px[1][0]]) && (in[px[2][1]] == in[px[2][2]]) && (in[px[1][1]] != in[px[2][0]]) && (in[px[1][1]] == in[px[0][0]]))){
+			//  X X A X           X 2 X X
+			//  X A X X           A 2 X X
+			//  1 1 X X    or     3 A A X
+			//  X X X X           X X X X
+			out[lower_left] = in[px[2][1]];
+		}else{
+			out[lower_left] = interpolate_pixels(in[px[1][1]],in[px[2][1]]);
+		}
+		out[lower_right] = in[px[1][2]];
+
+	}else if ( (in[px[1][1]] == in[px[2][2]]) && (in[px[1][2]] == in[px[2][1]]) ) {/*
+
+		// these are two crossed diagonal pairs of pixels in the inner, center set of four.
+		// If they're the same, then they're just a solid square.
+		// but if they're not the same, then we weigh them against a surrounding ring of pixels, and see which
+		// pair is more different from the ring.
+
+		// The pair that is more different will end up being visually subdued - the result will be only 1/4 that pair, and 3/4 the other.
+
+		//The ring is this asterisked set of pixels:
+		//  X * * X
+		//  * X X *
+		//  * X X *
+		//  X * * X
+		if (in[px[1][1]] == in[px[1][2]]){  //First, check if they're the same.  If so, it's just a solid square.
+				out[lower_right] = out[upper_right] = out[upper_left] = out[lower_left] = in[px[1][1]];
+
+		} else {
+
+			int difference_direction = 0;
+			//These following lines compare the corners in this order, to the center pixels A and B.
+
+			//  X 1 * X          X * 2 X          X * * X             X * * X
+			//  1 A B *          * A B 2          * A B *             * A B *
+			//  * B A *    then: * B A *    then: * B A 3      then:  4 B A *
+			//  X * * X          X * * X          X * 3 X             X 4 * X
+
+		   	// These get summed up.  If the final sum is positive, then A is the non-matching color and gets subdued.
+			// if the final sum is negative, then B is the non-matching color and gets subdued.
+			difference_direction += calculate_difference(in[px[1][2]],in[px[1][1]],in[px[0][1]],in[px[1][0]]);
+			difference_direction += calculate_difference(in[px[1][2]],in[px[1][1]],in[px[1][3]],in[px[0][2]]);
+			difference_direction += calculate_difference(in[px[1][2]],in[px[1][1]],in[px[3][2]],in[px[2][3]]);
+			difference_direction += calculate_difference(in[px[1][2]],in[px[1][1]],in[px[2][0]],in[px[3][1]]);
+
+			if (difference_direction > 0){
+				out[lower_right] = out[upper_right] = out[upper_left] = out[lower_left] = interpolate_pixels(in[px[1][1]],in[px[1][2]],in[px[1][2]],in[px[1][2]]);
+			}else if(difference_direction < 0){
+				out[lower_right] = out[upper_right] = out[upper_left] = out[lower_left] = interpolate_pixels(in[px[1][1]],in[px[1][1]],in[px[1][1]],in[px[1][2]]);
+	   								}else{
+				out[lower_right] = out[upper_right] = out[upper_left] = out[lower_left] = interpolate_pixels(in[px[1][1]],in[px[1][2]],in[px[2][1]],in[px[2][2]]);
+			}
+
+		}
+	*/}
+}
+
+//the 2xSaI kernel only writes to its output when exactly one of the two
+//diagonal pairs in the center four pixels match. Everywhere else the
+//output is plain nearest neighbor scaling.
+inline bool needs_2xsai(const uint32_t* in, int in_w, int x, int y)
+{
+	const uint32_t* p = in + y*in_w + x;
+	return (p[0] == p[in_w + 1]) != (p[1] == p[in_w]);
+}
+
+}
+
+//reference implementation of scale_surface(). The SIMD version must
+//produce bit-identical output to this.
+surface scale_surface_reference(surface input) {
 	surface result(surface::create(input->w*2, input->h*2));
 
 	const uint32_t* in = reinterpret_cast<const uint32_t*>(input->pixels);
@@ -363,176 +560,7 @@ surface scale_surface(surface input) {
 			out[(y*2)*result->w + x*2 + 1] = in[y*input->w + x];
 			
 			if ((y > 0) && (y < input->h - 2) && (x > 0) && (x < input->w - 2)){
-				
-				
-			//do additional 2xSaI interpolation
-				
-			//  2xSai works on a square group of sixteen pixels, rather than the square group of nine that Eagle works on.  In Eagle, the current pixel being upsized is the one in the middle of this square of nine; in 2xSai, the current pixel is the one in the upper-left of the middle four.  The other pixels in this group are all input pixels that are being examined to determine if we have an edge to smooth out.
-			
-			//  X X X X  |  0  1  2  3
-			//  X * X X  |  4  5  6  7
-			//  X X X X  |  8  9  10 11
-			//  X X X X  |  12 13 14 15
-						const int px[4][4] = {{	//[x][y]
-							y*input->w + x - input->w - 1,
-							y*input->w + x - input->w,
-							y*input->w + x - input->w + 1,
-							y*input->w + x - input->w + 2},
-							{y*input->w + x - 1,
-							y*input->w + x,
-							y*input->w + x + 1,
-							y*input->w + x + 2},
-							{y*input->w + x + input->w - 1,
-							y*input->w + x + input->w,
-							y*input->w + x + input->w + 1,
-							y*input->w + x + input->w + 2},
-							{y*input->w + x + 2*input->w - 1,
-							y*input->w + x + 2*input->w,
-							y*input->w + x + 2*input->w + 1,
-							y*input->w + x + 2*input->w + 2}};
-						
-						//these are the four output pixels corresponding to the one input pixel
-						const int upper_left = (y*2)*result->w + x*2;
-						const int upper_right = (y*2)*result->w + x*2 + 1;
-						const int lower_left = (y*2 + 1)*result->w + x*2;
-						const int lower_right = (y*2 + 1)*result->w + x*2 + 1;
-
-						//make sure we're not going out-of-bounds
-						const int max_index = input->w*input->h;
-						assert(px[0][2] < max_index);
-						assert(px[0][3] < max_index);
-						assert(px[1][2] < max_index);
-						assert(px[1][3] < max_index);
-						assert(px[2][0] < max_index);
-						assert(px[2][1] < max_index);
-						assert(px[2][2] < max_index);
-						assert(px[2][3] < max_index);
-						assert(px[3][0] < max_index);
-						assert(px[3][1] < max_index);
-						assert(px[3][2] < max_index);
-						assert(px[3][3] < max_index);
-						
-						
-						
-						// The following blocks are a visual representation of the conditional right above them.  When I have multiple instances of the same number, such as two 1s, then those places are equal.  When I have two different numbers in the same block, then they *must* be inequal - e.g. the value at 2 does not equal the value at 1, and also does not equal the value at 3. When I have a number, and an alphanumeric character in a block, the character does not need to be different from the number, but must equal itself.
-								//  X X X X 
-								//  X X X X 
-								//  X X X X 
-								//  X X X X 
-
-						if ( (in[px[1][1]] == in[px[2][2]]) && (in[px[1][2]] != in[px[2][1]]) ) {
-								//  X X X X    
-								//  X 1 2 X    
-								//  X 3 1 X    
-								//  X X X X    
-							if ( ((in[px[1][1]] == in[px[0][1]]) && (in[px[1][2]] == in[px[2][3]])) || ((in[px[1][1]] == in[px[2][1]]) && (in[px[1][1]] == in[px[0][2]]) && (in[px[1][2]] != in[px[0][1]]) && (in[px[1][2]] == in[px[0][3]]))){
-								   //  X 1 X X         X 2 1 1
-								   //  X 1 A X         X 1 1 X
-								   //  X X X A   or    X X X X
-								   //  X X X X         X X X X
-								out[upper_right] = in[px[1][1]];    
-							}else{
-								if( ! ((in[px[1][1]] == in[px[0][1]])) ){
-									//  X 2 X X 
-									//  X 1 X X 
-									//  X X X X 
-									//  X X X X 
-									out[upper_right] = interpolate_pixels(in[px[1][1]],in[px[1][2]]);
-								}
-							}
-							
-							if ( ((in[px[1][1]] == in[px[1][0]]) && (in[px[2][1]] == in[px[3][2]])) || ((in[px[1][1]] == in[px[1][2]]) && (in[px[1][1]] == in[px[2][0]]) && (in[px[1][0]] != in[px[2][1]]) && (in[px[2][1]] == in[px[3][0]]))){
-								//  X X X X           X X X X 
-								//  1 1 X X           2 A A X 
-								//  X A X X    or     A 3 X X 
-								//  X X A X           X 3 X X 
-								out[lower_left] = in[px[1][1]];
-							}else{
-								if( ! ((in[px[1][1]] == in[px[1][0]])) ){
-										//  X 2 X X 
-										//  X 1 X X 
-										//  X X X X 
-										//  X X X X 
-									out[lower_left] = interpolate_pixels(in[px[1][1]],in[px[2][1]]);
-								}
-							}
-							out[lower_right] = in[px[1][1]];
-							
-							
-							
-							
-						} else if ( (in[px[1][2]] == in[px[2][1]]) && (in[px[1][1]] != in[px[2][2]]) ) {       
-								//  X X X X   
-								//  X 2 1 X   
-								//  X 1 3 X   
-								//  X X X X   
-							
-							if ( ((in[px[1][2]] == in[px[0][2]]) && (in[px[1][1]] == in[px[2][0]])) || ((in[px[1][2]] == in[px[0][1]]) && (in[px[1][2]] == in[px[2][2]]) && (in[px[1][2]] != in[px[0][2]]) && (in[px[1][1]] == in[px[0][0]]))){
-								//  X X 1 X           2 1 1 X 
-								//  X A 1 X           X 2 1 X 
-								//  A X X X    or     X X 1 X 
-								//  X X X X           X X X X 
-								out[upper_right] = in[px[1][2]];
-							}else{
-								out[upper_right] = interpolate_pixels(in[px[1][1]],in[px[1][2]]);
-							}
-							
-							if ( ((in[px[2][1]] == in[px[2][0]]) && (in[px[1][1]] == in[px[0][2]])) || ((in[px[2][1]] == in[px[1][0]]) && (in[px[2][1]] == in[px[2][2]]) && (in[px[1][1]] != in[px[2][0]]) && (in[px[1][1]] == in[px[0][0]]))){
-								//  X X A X           X 2 X X 
-								//  X A X X           A 2 X X 
-								//  1 1 X X    or     3 A A X 
-								//  X X X X           X X X X 
-								out[lower_left] = in[px[2][1]];
-							}else{
-								out[lower_left] = interpolate_pixels(in[px[1][1]],in[px[2][1]]);
-							}
-							out[lower_right] = in[px[1][2]];
-							
-						}else if ( (in[px[1][1]] == in[px[2][2]]) && (in[px[1][2]] == in[px[2][1]]) ) {/*
-						 
-							// these are two crossed diagonal pairs of pixels in the inner, center set of four.
-							// If they're the same, then they're just a solid square.
-							// but if they're not the same, then we weigh them against a surrounding ring of pixels, and see which
-							// pair is more different from the ring.
-							
-							// The pair that is more different will end up being visually subdued - the result will be only 1/4 that pair, and 3/4 the other.
-							
-							//The ring is this asterisked set of pixels:
-							//  X * * X
-							//  * X X *
-							//  * X X *
-							//  X * * X
-							if (in[px[1][1]] == in[px[1][2]]){  //First, check if they're the same.  If so, it's just a solid square.
-									out[lower_right] = out[upper_right] = out[upper_left] = out[lower_left] = in[px[1][1]];
-
-							} else {
-								
-								int difference_direction = 0;
-								//These following lines compare the corners in this order, to the center pixels A and B.
-								
-								//  X 1 * X          X * 2 X          X * * X             X * * X
-								//  1 A B *          * A B 2          * A B *             * A B *
-								//  * B A *    then: * B A *    then: * B A 3      then:  4 B A *
-								//  X * * X          X * * X          X * 3 X             X 4 * X     
-								
-							   	// These get summed up.  If the final sum is positive, then A is the non-matching color and gets subdued.
-								// if the final sum is negative, then B is the non-matching color and gets subdued.
-								difference_direction += calculate_difference(in[px[1][2]],in[px[1][1]],in[px[0][1]],in[px[1][0]]);
-								difference_direction += calculate_difference(in[px[1][2]],in[px[1][1]],in[px[1][3]],in[px[0][2]]);
-								difference_direction += calculate_difference(in[px[1][2]],in[px[1][1]],in[px[3][2]],in[px[2][3]]);
-								difference_direction += calculate_difference(in[px[1][2]],in[px[1][1]],in[px[2][0]],in[px[3][1]]);
-								
-								if (difference_direction > 0){
-									out[lower_right] = out[upper_right] = out[upper_left] = out[lower_left] = interpolate_pixels(in[px[1][1]],in[px[1][2]],in[px[1][2]],in[px[1][2]]);
-								}else if(difference_direction < 0){
-									out[lower_right] = out[upper_right] = out[upper_left] = out[lower_left] = interpolate_pixels(in[px[1][1]],in[px[1][1]],in[px[1][1]],in[px[1][2]]);
-   								}else{
-									out[lower_right] = out[upper_right] = out[upper_left] = out[lower_left] = interpolate_pixels(in[px[1][1]],in[px[1][2]],in[px[2][1]],in[px[2][2]]);
-								}								
-								
-							}
-						*/}
-							
+				scale_pixel_2xsai(in, input->w, input->h, out, result->w, x, y);
 			}
 		}
 	}
@@ -540,7 +568,83 @@ surface scale_surface(surface input) {
 	return result;
 }
 
-BENCHMARK(surface_scaling)
+#if SURFACE_SCALING_SSE2
+
+//SSE2 version of scale_surface(). Nearest neighbor doubling is done four
+//source pixels at a time, and the 2xSaI kernel is only run for pixels where
+//a vector comparison of the center four pixels shows it would change the
+//output. Sprite sheets are mostly flat areas so this skips nearly all of
+//the kernel invocations.
+surface scale_surface_sse2(surface input) {
+	surface result(surface::create(input->w*2, input->h*2));
+
+	const int in_w = input->w;
+	const int in_h = input->h;
+	const int out_w = result->w;
+	const uint32_t* in = reinterpret_cast<const uint32_t*>(input->pixels);
+	uint32_t* out = reinterpret_cast<uint32_t*>(result->pixels);
+
+	for(int y = 0; y != in_h; ++y) {
+		const uint32_t* src = in + y*in_w;
+		uint32_t* dst0 = out + (y*2)*out_w;
+		uint32_t* dst1 = dst0 + out_w;
+
+		int x = 0;
+		for(; x + 4 <= in_w; x += 4) {
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+			const __m128i lo = _mm_unpacklo_epi32(v, v);
+			const __m128i hi = _mm_unpackhi_epi32(v, v);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst0 + x*2), lo);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst0 + x*2 + 4), hi);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst1 + x*2), lo);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst1 + x*2 + 4), hi);
+		}
+
+		for(; x < in_w; ++x) {
+			dst0[x*2] = dst0[x*2 + 1] = dst1[x*2] = dst1[x*2 + 1] = src[x];
+		}
+	}
+
+	for(int y = 1; y < in_h - 2; ++y) {
+		const uint32_t* row0 = in + y*in_w;
+		const uint32_t* row1 = row0 + in_w;
+
+		int x = 1;
+		for(; x + 4 <= in_w - 2; x += 4) {
+			const __m128i p11 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x));
+			const __m128i p12 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x + 1));
+			const __m128i p21 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x));
+			const __m128i p22 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x + 1));
+			const __m128i diff = _mm_xor_si128(_mm_cmpeq_epi32(p11, p22), _mm_cmpeq_epi32(p12, p21));
+			int mask = _mm_movemask_ps(_mm_castsi128_ps(diff));
+			for(int n = 0; mask; ++n, mask >>= 1) {
+				if(mask&1) {
+					scale_pixel_2xsai(in, in_w, in_h, out, out_w, x + n, y);
+				}
+			}
+		}
+
+		for(; x < in_w - 2; ++x) {
+			if(needs_2xsai(in, in_w, x, y)) {
+				scale_pixel_2xsai(in, in_w, in_h, out, out_w, x, y);
+			}
+		}
+	}
+
+	return result;
+}
+
+#endif
+
+surface scale_surface(surface input) {
+#if SURFACE_SCALING_SSE2
+	return scale_surface_sse2(input);
+#else
+	return scale_surface_reference(input);
+#endif
+}
+
+BENCHMARK_TAGGED(surface_scaling, "render")
 {
 	surface s(graphics::surface_cache::get("characters/frogatto-spritesheet1.png"));
 	assert(s.get());
@@ -552,6 +656,43 @@ BENCHMARK(surface_scaling)
 	}
 }
 
+BENCHMARK_TAGGED(surface_scaling_reference, "render")
+{
+	surface s(graphics::surface_cache::get("characters/frogatto-spritesheet1.png"));
+	assert(s.get());
+
+	surface target(SDL_CreateRGBSurface(SDL_SWSURFACE,s->w,s->h,32,SURFACE_MASK));
+	SDL_BlitSurface(s.get(), NULL, target.get(), NULL);
+	BENCHMARK_LOOP {
+		scale_surface_reference(target);
+	}
+}
+
+UNIT_TEST(surface_scaling_matches_reference)
+{
+	//use a small palette so that the 2xSaI patterns actually occur, and odd
+	//dimensions so the SIMD tail handling is exercised.
+	const uint32_t palette[] = { 0x00000000, 0xFF0000FF, 0xFF00FF00, 0x80FF0000, 0xFFFFFFFF };
+	const int npalette = sizeof(palette)/sizeof(*palette);
+
+	surface input(surface::create(37, 23));
+	uint32_t* pixels = reinterpret_cast<uint32_t*>(input->pixels);
+	for(int n = 0; n != input->w*input->h; ++n) {
+		pixels[n] = palette[(n*7 + (n/5)*3 + (n*n)%11)%npalette];
+	}
+
+	surface expected = scale_surface_reference(input);
+	surface actual = scale_surface(input);
+	CHECK_EQ(expected->w, actual->w);
+	CHECK_EQ(expected->h, actual->h);
+
+	const uint32_t* a = reinterpret_cast<const uint32_t*>(expected->pixels);
+	const uint32_t* b = reinterpret_cast<const uint32_t*>(actual->pixels);
+	for(int n = 0; n != expected->w*expected->h; ++n) {
+		CHECK_EQ(a[n], b[n]);
+	}
+}
+
 namespace {
 	typedef boost::array<char, 4> OutputPixels;
 	typedef boost::array<char, 25> InputMatrix;
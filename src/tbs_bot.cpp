@@ -1,15 +1,34 @@
+#include <algorithm>
 #include <boost/bind.hpp>
 
+#if !defined(_WINDOWS)
+#include <sys/time.h>
+#endif
+
 #include "asserts.hpp"
+#include "foreach.hpp"
 #include "formula.hpp"
+#include "json_parser.hpp"
 #include "tbs_bot.hpp"
 #include "tbs_web_server.hpp"
+#include "unit_test.hpp"
+#include "utils.hpp"
+
+namespace {
+boost::int64_t get_microseconds()
+{
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return boost::int64_t(tv.tv_sec)*1000000 + tv.tv_usec;
+}
+}
 
 namespace tbs
 {
 
 bot::bot(boost::asio::io_service& service, const std::string& host, const std::string& port, variant v)
-  : service_(service), timer_(service), host_(host), port_(port), script_(v["script"].as_list())
+  : service_(service), timer_(service), host_(host), port_(port), script_(v["script"].as_list()),
+    id_(0), latencies_(NULL), request_start_(0), failed_(false)
 {
 	std::cerr << "CREATE BOT\n";
 	timer_.expires_from_now(boost::posix_time::milliseconds(100));
@@ -21,8 +40,18 @@ bot::~bot()
 	timer_.cancel();
 }
 
+void bot::set_load_test(int id, std::vector<int>* latencies_us)
+{
+	id_ = id;
+	latencies_ = latencies_us;
+}
+
 void bot::process()
 {
+	if(latencies_ && finished()) {
+		return;
+	}
+
 	if(!client_ && response_.size() < script_.size()) {
 		variant script = script_[response_.size()];
 		variant send = script["send"];
@@ -32,14 +61,22 @@ void bot::process()
 
 		int session_id = -1;
 		if(script.has_key("session_id")) {
-			session_id = script["session_id"].as_int();
+			variant session = script["session_id"];
+			if(session.is_string()) {
+				session = game_logic::formula(session).execute(*this);
+			}
+
+			session_id = session.as_int();
 		}
 
-		std::cerr << "BOT SEND REQUEST\n";
+		if(!latencies_) {
+			std::cerr << "BOT SEND REQUEST\n";
+		}
 
 		ASSERT_LOG(send.is_map(), "NO REQUEST TO SEND: " << send.write_json() << " IN " << script.write_json());
 		client_.reset(new client(host_, port_, session_id, &service_));
 		game_logic::map_formula_callable_ptr callable(new game_logic::map_formula_callable(this));
+		request_start_ = get_microseconds();
 		client_->send_request(send.write_json(), callable, boost::bind(&bot::handle_response, this, _1, callable));
 	}
 
@@ -49,6 +86,15 @@ void bot::process()
 
 void bot::handle_response(const std::string& type, game_logic::formula_callable_ptr callable)
 {
+	if(latencies_) {
+		latencies_->push_back(int(get_microseconds() - request_start_));
+		if(type != "message_received") {
+			failed_ = true;
+			client_.reset();
+			return;
+		}
+	}
+
 	ASSERT_LOG(type != "connection_error", "GOT ERROR BACK WHEN SENDING REQUEST: " << callable->query_value("message").write_json());
 
 	ASSERT_LOG(type == "message_received", "UNRECOGNIZED RESPONSE: " << type);
@@ -74,12 +120,20 @@ void bot::handle_response(const std::string& type, game_logic::formula_callable_
 	response_.push_back(variant(&m));
 	client_.reset();
 
+	if(latencies_) {
+		return;
+	}
+
 	tbs::web_server::set_debug_state(generate_report());
 	std::cerr << "SET STATE: " << generate_report().write_json() << "\n";
 }
 
 variant bot::get_value(const std::string& key) const
 {
+	if(key == "bot_id") {
+		return variant(id_);
+	}
+
 	return variant();
 }
 
@@ -92,3 +146,106 @@ variant bot::generate_report() const
 }
 
 }
+
+namespace {
+//the latency which 'percent' percent of the samples are at or below.
+int latency_percentile(const std::vector<int>& sorted, int percent)
+{
+	if(sorted.empty()) {
+		return 0;
+	}
+
+	const size_t index = (sorted.size()*percent + 99)/100;
+	return sorted[index == 0 ? 0 : index - 1];
+}
+
+void stop_load_test(boost::asio::io_service* io_service, const boost::system::error_code& e)
+{
+	if(e != boost::asio::error::operation_aborted) {
+		std::cerr << "tbs_load_test(): Timed out waiting for bots to finish.\n";
+		io_service->stop();
+	}
+}
+}
+
+//Runs many bots against a tbs server at once, each running the same script,
+//and reports how long the server took to respond to them.
+COMMAND_LINE_UTILITY(tbs_load_test) {
+	std::string host = "localhost", port = "23456", script_file;
+	int nclients = 10, timeout = 60;
+
+	std::vector<std::string>::const_iterator it = args.begin();
+	while(it != args.end()) {
+		const std::string arg = *it++;
+		ASSERT_LOG(arg.size() > 2 && arg[0] == '-' && arg[1] == '-' && it != args.end(), "tbs_load_test(): Unrecognized argument: " << arg);
+
+		const std::string value = *it++;
+		if(arg == "--host") {
+			host = value;
+		} else if(arg == "--port") {
+			port = value;
+		} else if(arg == "--clients") {
+			nclients = atoi(value.c_str());
+			ASSERT_LOG(nclients > 0, "tbs_load_test(): Must use at least one client.");
+		} else if(arg == "--script") {
+			script_file = value;
+		} else if(arg == "--timeout") {
+			timeout = atoi(value.c_str());
+		} else {
+			ASSERT_LOG(false, "tbs_load_test(): Unrecognized argument: " << arg);
+		}
+	}
+
+	ASSERT_LOG(script_file.empty() == false, "tbs_load_test(): Must give a bot script with --script");
+	const variant script = json::parse_from_file(script_file);
+
+	boost::asio::io_service io_service;
+
+	std::vector<int> latencies;
+	std::vector<boost::intrusive_ptr<tbs::bot> > bots;
+	for(int n = 0; n != nclients; ++n) {
+		bots.push_back(boost::intrusive_ptr<tbs::bot>(new tbs::bot(io_service, host, port, script)));
+		bots.back()->set_load_test(n, &latencies);
+	}
+
+	boost::asio::deadline_timer timer(io_service);
+	timer.expires_from_now(boost::posix_time::seconds(timeout));
+	timer.async_wait(boost::bind(stop_load_test, &io_service, boost::asio::placeholders::error));
+
+	//run until all the bots are done, or the timer stops the io_service.
+	const boost::int64_t start_time = get_microseconds();
+	while(io_service.run_one()) {
+		bool finished = true;
+		foreach(const boost::intrusive_ptr<tbs::bot>& b, bots) {
+			finished = finished && b->finished();
+		}
+
+		if(finished) {
+			break;
+		}
+	}
+
+	const int elapsed_ms = int((get_microseconds() - start_time)/1000);
+	timer.cancel();
+
+	int nfinished = 0, nfailed = 0;
+	foreach(const boost::intrusive_ptr<tbs::bot>& b, bots) {
+		nfinished += b->finished() && !b->failed();
+		nfailed += b->failed();
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	boost::int64_t total = 0;
+	foreach(int t, latencies) {
+		total += t;
+	}
+
+	fprintf(stderr, "tbs_load_test(): %d clients: %d finished, %d failed, %d unfinished in %dms\n",
+	        nclients, nfinished, nfailed, nclients - nfinished - nfailed, elapsed_ms);
+	fprintf(stderr, "  %d requests (%.1f/s); latency mean %.2fms p50 %.2fms p99 %.2fms max %.2fms\n",
+	        int(latencies.size()), elapsed_ms ? latencies.size()*1000.0/elapsed_ms : 0.0,
+	        latencies.empty() ? 0.0 : total/(latencies.size()*1000.0),
+	        latency_percentile(latencies, 50)/1000.0,
+	        latency_percentile(latencies, 99)/1000.0,
+	        latencies.empty() ? 0.0 : latencies.back()/1000.0);
+}
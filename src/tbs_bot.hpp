@@ -2,6 +2,7 @@
 #define TBS_BOT_HPP_INCLUDED
 
 #include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include <string>
@@ -21,6 +22,15 @@ public:
 
 	void process();
 
+	//Used when running many bots to load test a server. The bot's id is
+	//available to its script as 'bot_id', and the time each request takes
+	//is recorded rather than reported to the debug monitor. The bot stops
+	//once it's finished its script.
+	void set_load_test(int id, std::vector<int>* latencies_us);
+
+	bool finished() const { return failed_ || response_.size() == script_.size(); }
+	bool failed() const { return failed_; }
+
 private:
 	void handle_response(const std::string& type, game_logic::formula_callable_ptr callable);
 	variant get_value(const std::string& key) const;
@@ -34,6 +44,11 @@ private:
 
 	boost::asio::io_service& service_;
 	boost::asio::deadline_timer timer_;
+
+	int id_;
+	std::vector<int>* latencies_;
+	boost::int64_t request_start_;
+	bool failed_;
 };
 
 }
@@ -10,6 +10,7 @@
 #include "filesystem.hpp"
 #include "foreach.hpp"
 #include "formatter.hpp"
+#include "http_server.hpp"
 #include "tbs_server.hpp"
 #include "string_utils.hpp"
 #include "utils.hpp"
@@ -18,6 +19,15 @@
 
 namespace tbs {
 
+namespace {
+//how long a long-poll socket waits for a message before it's sent a
+//heartbeat instead.
+const int HeartbeatSeconds = 10;
+
+//clients further behind than this are sent the whole lobby.
+const size_t MaxLobbyChanges = 256;
+}
+
 server::game_info::game_info(const variant& value)
 {
 	game_state = game::create(value);
@@ -27,7 +37,7 @@ server::client_info::client_info() : nplayer(0), last_contact(0)
 {}
 
 server::server(boost::asio::io_service& io_service)
-  : timer_(io_service), nheartbeat_(0), scheduled_write_(0), status_id_(0)
+  : web_server_(NULL), io_service_(io_service), strand_(io_service), timer_(io_service), nheartbeat_(0), scheduled_write_(0), status_id_(0)
 {
 	heartbeat();
 }
@@ -75,25 +85,18 @@ void server::adopt_ajax_socket(socket_ptr socket, int session_id, const variant&
 			const game_context context(g->game_state.get());
 			g->game_state->setup_game();
 
-			games_.push_back(g);
+			games_[g->game_state->game_id()] = g;
 			send_msg(socket, formatter() << "{ \"type\": \"game_created\", \"game_id\": " << g->game_state->game_id() << " }");
 			
-			status_change();
+			status_change(GAME_ADDED, g);
 			return;
 		} else if(type == "observe_game") {
 			const int id = msg["game_id"].as_int();
 			const std::string user = msg["user"].as_string();
 			const int session_id = msg["session_id"].as_int();
 
-			game_info_ptr g;
-			foreach(const game_info_ptr& gm, games_) {
-				if(gm->game_state->game_id() == id) {
-					g = gm;
-					break;
-				}
-			}
-
-			if(!g) {
+			game_map::const_iterator game_itor = games_.find(id);
+			if(game_itor == games_.end()) {
 				send_msg(socket, "{ \"type\": \"unknown_game\" }");
 				return;
 			}
@@ -103,6 +106,7 @@ void server::adopt_ajax_socket(socket_ptr socket, int session_id, const variant&
 				return;
 			}
 
+			const game_info_ptr& g = game_itor->second;
 			client_info& cli_info = clients_[session_id];
 			cli_info.user = user;
 			cli_info.game = g;
@@ -117,10 +121,19 @@ void server::adopt_ajax_socket(socket_ptr socket, int session_id, const variant&
 			return;
 		} else if(type == "get_status") {
 			const int last_status = msg["last_seen"].as_int();
+
+			//only clients which ask for deltas understand them.
+			const bool deltas = msg["deltas"].as_bool();
 			if(last_status == status_id_) {
-				status_sockets_.push_back(socket);
+				timer_ptr timer(new boost::asio::deadline_timer(io_service_));
+				timer->expires_from_now(boost::posix_time::seconds(HeartbeatSeconds));
+				timer->async_wait(strand_.wrap(boost::bind(&server::handle_status_timeout, this, socket, boost::asio::placeholders::error)));
+				status_sockets_[socket] = timer;
+				if(deltas) {
+					delta_status_sockets_.insert(socket);
+				}
 			} else {
-				send_msg(socket, create_lobby_msg().write_json());
+				send_msg(socket, get_status_msg(deltas ? last_status : -1));
 			}
 			return;
 		} else {
@@ -140,6 +153,7 @@ void server::adopt_ajax_socket(socket_ptr socket, int session_id, const variant&
 
 	socket_info& info = connections_[socket];
 	info.nick = cli_info.user;
+	info.session_id = session_id;
 
 	handle_message_internal(socket, cli_info, msg);
 	close_ajax(socket, cli_info);
@@ -148,6 +162,11 @@ void server::adopt_ajax_socket(socket_ptr socket, int session_id, const variant&
 void server::clear_games()
 {
 	games_.clear();
+
+	//everyone needs to see the whole lobby again.
+	lobby_changes_.clear();
+	++status_id_;
+	wake_status_sockets();
 }
 
 void server::handle_message_internal(socket_ptr socket, client_info& cli_info, const variant& msg)
@@ -170,28 +189,110 @@ void server::handle_message_internal(socket_ptr socket, client_info& cli_info, c
 
 		cli_info.game->game_state->handle_message(cli_info.nplayer, msg);
 		flush_game_messages(*cli_info.game);
+
+		if(cli_info.game->game_state->started() != game_started) {
+			status_change(GAME_CHANGED, cli_info.game);
+		}
 	}
 }
 
 void server::close_ajax(socket_ptr socket, client_info& cli_info)
 {
-	socket_info& info = connections_[socket];
-
 	if(cli_info.msg_queue.empty() == false) {
-
-		for(std::map<socket_ptr,std::string>::iterator s = waiting_connections_.begin();
-		    s != waiting_connections_.end(); ++s) {
-			if(s->second == info.nick && s->first != socket) {
-				send_msg(s->first, "{ \"type\": \"keepalive\" }");
-				break;
-			}
-		}
-
 		send_msg(socket, cli_info.msg_queue.front());
 		cli_info.msg_queue.pop_front();
 	} else {
-		waiting_connections_[socket] = info.nick;
+		wait_for_message(socket, cli_info);
+	}
+}
+
+void server::wait_for_message(socket_ptr socket, client_info& cli_info)
+{
+	if(cli_info.waiting_socket && cli_info.waiting_socket != socket) {
+		//the client has moved on to a new request, so let go of the old one.
+		send_waiting_msg(cli_info, "{ \"type\": \"keepalive\" }");
+	}
+
+	if(!cli_info.waiting_timer) {
+		cli_info.waiting_timer.reset(new boost::asio::deadline_timer(io_service_));
+	}
+
+	cli_info.waiting_socket = socket;
+	cli_info.waiting_timer->expires_from_now(boost::posix_time::seconds(HeartbeatSeconds));
+	cli_info.waiting_timer->async_wait(strand_.wrap(boost::bind(&server::handle_wait_timeout, this, socket, cli_info.session_id, boost::asio::placeholders::error)));
+}
+
+void server::send_waiting_msg(client_info& cli_info, const std::string& msg)
+{
+	const socket_ptr socket = cli_info.waiting_socket;
+	cli_info.waiting_socket.reset();
+	cli_info.waiting_timer->cancel();
+	send_msg(socket, msg);
+}
+
+void server::handle_wait_timeout(socket_ptr socket, int session_id, const boost::system::error_code& e)
+{
+	if(e == boost::asio::error::operation_aborted) {
+		return;
+	}
+
+	std::map<int, client_info>::iterator client_itor = clients_.find(session_id);
+	if(client_itor == clients_.end()) {
+		return;
+	}
+
+	//the timer might have been set again after this wait finished.
+	client_info& cli_info = client_itor->second;
+	if(cli_info.waiting_socket != socket || cli_info.waiting_timer->expires_at() > boost::asio::deadline_timer::traits_type::now()) {
+		return;
+	}
+
+	send_waiting_msg(cli_info, create_heartbeat_msg(cli_info).write_json());
+}
+
+variant server::create_heartbeat_msg(const client_info& cli_info)
+{
+	variant_builder doc;
+	doc.add("type", "heartbeat");
+	if(!cli_info.game) {
+		return doc.build();
+	}
+
+	std::vector<variant> items;
+
+	foreach(int client_session, cli_info.game->clients) {
+		const client_info& info = clients_[client_session];
+		variant_builder value;
+
+		value.add("nick", info.user);
+		value.add("ingame", info.game == cli_info.game);
+		value.add("lag", nheartbeat_ - info.last_contact);
+
+		items.push_back(value.build());
+	}
+
+	foreach(const std::string& ai, cli_info.game->game_state->get_ai_players()) {
+		variant_builder value;
+
+		value.add("nick", ai);
+		value.add("ingame", true);
+		value.add("lag", 0);
+
+		items.push_back(value.build());
 	}
+
+	doc.set("players", variant(&items));
+	return doc.build();
+}
+
+void server::handle_status_timeout(socket_ptr socket, const boost::system::error_code& e)
+{
+	const bool deltas = delta_status_sockets_.erase(socket) != 0;
+	if(e == boost::asio::error::operation_aborted || status_sockets_.erase(socket) == 0) {
+		return;
+	}
+
+	send_msg(socket, get_status_msg(deltas ? status_id_ : -1));
 }
 
 void server::queue_msg(int session_id, const std::string& msg)
@@ -200,7 +301,14 @@ void server::queue_msg(int session_id, const std::string& msg)
 		return;
 	}
 
-	clients_[session_id].msg_queue.push_back(msg);
+	//send the message straight away if the client is waiting for one.
+	client_info& cli_info = clients_[session_id];
+	if(cli_info.waiting_socket && cli_info.msg_queue.empty()) {
+		send_waiting_msg(cli_info, msg);
+		return;
+	}
+
+	cli_info.msg_queue.push_back(msg);
 }
 
 void server::send_msg(socket_ptr socket, const variant& msg)
@@ -215,48 +323,40 @@ void server::send_msg(socket_ptr socket, const char* msg)
 
 void server::send_msg(socket_ptr socket, const std::string& msg)
 {
-	const socket_info& info = connections_[socket];
-	std::stringstream buf;
-	buf <<
-		"HTTP/1.1 200 OK\r\n"
-		"Date: " << get_http_datetime() << "\r\n"
-		"Connection: close\r\n"
-		"Server: Wizard/1.0\r\n"
-		"Accept-Ranges: bytes\r\n"
-		"Access-Control-Allow-Origin: *\r\n"
-		"Content-Type: application/json\r\n"
-		"Content-Length: " << std::dec << (int)msg.size() << "\r\n"
-		"Last-Modified: " << get_http_datetime() << "\r\n\r\n";
-	std::string header = buf.str();
-
-	boost::shared_ptr<std::string> str_buf(new std::string(header.empty() ? msg : (header + msg)));
-	boost::asio::async_write(*socket, boost::asio::buffer(*str_buf),
-			                         boost::bind(&server::handle_send, this, socket, _1, _2, str_buf));
+	ASSERT_LOG(web_server_, "tbs::server HAS NO WEB SERVER TO SEND WITH");
+	web_server_->send_msg(socket, "application/json", msg, "");
 }
 
-void server::handle_send(socket_ptr socket, const boost::system::error_code& e, size_t nbytes, boost::shared_ptr<std::string> buf)
+void server::finished_with_socket(socket_ptr socket)
 {
-	if(e) {
-		std::cerr << "ERROR SENDING DATA\n";
+	std::map<socket_ptr, socket_info>::iterator i = connections_.find(socket);
+	if(i != connections_.end()) {
+		std::map<int, client_info>::iterator client_itor = clients_.find(i->second.session_id);
+		if(client_itor != clients_.end() && client_itor->second.waiting_socket == socket) {
+			client_itor->second.waiting_socket.reset();
+			client_itor->second.waiting_timer->cancel();
+		}
+
+		connections_.erase(i);
 	}
 
-	disconnect(socket);
-}
+	std::map<socket_ptr, timer_ptr>::iterator status = status_sockets_.find(socket);
+	if(status != status_sockets_.end()) {
+		status->second->cancel();
+		status_sockets_.erase(status);
+	}
 
-void server::disconnect(socket_ptr socket)
-{
-	waiting_connections_.erase(socket);
-	connections_.erase(socket);
-	socket->close();
+	delta_status_sockets_.erase(socket);
 }
 
 void server::heartbeat()
 {
 	timer_.expires_from_now(boost::posix_time::milliseconds(100));
-	timer_.async_wait(boost::bind(&server::heartbeat, this));
+	timer_.async_wait(strand_.wrap(boost::bind(&server::heartbeat, this)));
 
-	foreach(game_info_ptr g, games_) {
-		g->game_state->process();
+	for(game_map::iterator i = games_.begin(); i != games_.end(); ++i) {
+		i->second->game_state->process();
+		flush_game_messages(*i->second);
 	}
 
 	nheartbeat_++;
@@ -268,57 +368,6 @@ void server::heartbeat()
 	sys::pump_file_modifications();
 #endif
 
-	const bool send_heartbeat = nheartbeat_%100 == 0;
-
-	for(std::map<socket_ptr, std::string>::iterator i = waiting_connections_.begin(); i != waiting_connections_.end(); ++i) {
-		socket_ptr socket = i->first;
-
-		socket_info& info = connections_[socket];
-		client_info& cli_info = clients_[info.session_id];
-		if(cli_info.msg_queue.empty() == false) {
-			send_msg(socket, cli_info.msg_queue.front());
-			cli_info.msg_queue.pop_front();
-		} else if(send_heartbeat) {
-			if(!cli_info.game) {
-				send_msg(socket, "{ \"type\": \"heartbeat\" }");
-			} else {
-				variant_builder doc;
-				doc.add("type", "heartbeat");
-
-				std::vector<variant> items;
-
-				foreach(int client_session, cli_info.game->clients) {
-					const client_info& info = clients_[client_session];
-					variant_builder value;
-
-					value.add("nick", info.user);
-					value.add("ingame", info.game == cli_info.game);
-					value.add("lag", nheartbeat_ - info.last_contact);
-
-					items.push_back(value.build());
-				}
-
-				foreach(const std::string& ai, cli_info.game->game_state->get_ai_players()) {
-					variant_builder value;
-
-					value.add("nick", ai);
-					value.add("ingame", true);
-					value.add("lag", 0);
-
-					items.push_back(value.build());
-				}
-
-				doc.set("players", variant(&items));
-
-				send_msg(socket, doc.build());
-			}
-		}
-	}
-
-	if(send_heartbeat) {
-		status_change();
-	}
-
 	if(nheartbeat_ >= scheduled_write_) {
 		//write out the game recorded data.
 	}
@@ -366,44 +415,43 @@ void server::flush_game_messages(game_info& info)
 
 void server::quit_games(int session_id)
 {
+	//a client is only ever in the one game it's associated with.
 	client_info& cli_info = clients_[session_id];
-	foreach(game_info_ptr& g, games_) {
-		if(std::count(g->clients.begin(), g->clients.end(), session_id)) {
-			const bool is_first_client = g->clients.front() == session_id;
-			g->clients.erase(std::remove(g->clients.begin(), g->clients.end(), session_id), g->clients.end());
-
-			if(!g->game_state->started()) {
-				g->game_state->remove_player(cli_info.user);
-				if(is_first_client) {
-					g->clients.clear();
-					//TODO: remove joining clients from the game nicely.
-				} else {
-					const std::string msg = create_game_info_msg(g).write_json();
-					foreach(int client, g->clients) {
-						queue_msg(client, msg);
-					}
-				}
-			} else if(g->game_state->get_player_index(cli_info.user) != -1) {
-				std::cerr << "sending quit message...\n";
-				g->game_state->queue_message(formatter() << "<message text=\"" << cli_info.user << " has quit\"/>");
-				flush_game_messages(*g);
-			}
+	game_map::iterator game_itor = cli_info.game ? games_.find(cli_info.game->game_state->game_id()) : games_.end();
+	if(game_itor == games_.end() || game_itor->second != cli_info.game) {
+		cli_info.game.reset();
+		return;
+	}
 
-			if(g->clients.empty()) {
-				//game has no more clients left, so kill it.
-				g.reset();
+	game_info_ptr g = game_itor->second;
+	if(std::count(g->clients.begin(), g->clients.end(), session_id)) {
+		const bool is_first_client = g->clients.front() == session_id;
+		g->clients.erase(std::remove(g->clients.begin(), g->clients.end(), session_id), g->clients.end());
+
+		if(!g->game_state->started()) {
+			g->game_state->remove_player(cli_info.user);
+			if(is_first_client) {
+				g->clients.clear();
+				//TODO: remove joining clients from the game nicely.
+			} else {
+				const std::string msg = create_game_info_msg(g).write_json();
+				foreach(int client, g->clients) {
+					queue_msg(client, msg);
+				}
 			}
+		} else if(g->game_state->get_player_index(cli_info.user) != -1) {
+			std::cerr << "sending quit message...\n";
+			g->game_state->queue_message(formatter() << "<message text=\"" << cli_info.user << " has quit\"/>");
+			flush_game_messages(*g);
 		}
 	}
 
-	int games_size = games_.size();
-
-	games_.erase(std::remove(games_.begin(), games_.end(), game_info_ptr()), games_.end());
-
 	cli_info.game.reset();
 
-	if(games_size != games_.size()) {
-		status_change();
+	if(g->clients.empty()) {
+		//game has no more clients left, so kill it.
+		games_.erase(game_itor);
+		status_change(GAME_REMOVED, g);
 	}
 }
 
@@ -413,9 +461,17 @@ variant server::create_lobby_msg() const
 	value.add("type", "lobby");
 	value.add("status_id", status_id_);
 
+	//list the games in the order they were created.
+	std::vector<int> ids;
+	for(game_map::const_iterator i = games_.begin(); i != games_.end(); ++i) {
+		ids.push_back(i->first);
+	}
+
+	std::sort(ids.begin(), ids.end());
+
 	std::vector<variant> games;
-	foreach(game_info_ptr g, games_) {
-		games.push_back(create_game_info_msg(g));
+	foreach(int id, ids) {
+		games.push_back(create_game_info_msg(games_.find(id)->second));
 	}
 
 	value.set("games", variant(&games));
@@ -423,6 +479,44 @@ variant server::create_lobby_msg() const
 	return value.build();
 }
 
+variant server::create_lobby_delta_msg(int last_seen) const
+{
+	//work out the overall effect of the changes on each game.
+	std::map<int, std::pair<LOBBY_CHANGE, variant> > games;
+	for(std::deque<lobby_change>::const_iterator i = lobby_changes_.end() - (status_id_ - last_seen); i != lobby_changes_.end(); ++i) {
+		std::map<int, std::pair<LOBBY_CHANGE, variant> >::iterator g = games.find(i->game_id);
+		if(g == games.end()) {
+			games[i->game_id] = std::pair<LOBBY_CHANGE, variant>(i->change, i->info);
+		} else if(i->change == GAME_REMOVED && g->second.first == GAME_ADDED) {
+			//the client never saw this game.
+			games.erase(g);
+		} else if(i->change == GAME_REMOVED) {
+			g->second = std::pair<LOBBY_CHANGE, variant>(GAME_REMOVED, variant());
+		} else {
+			g->second.second = i->info;
+		}
+	}
+
+	std::vector<variant> added, changed, removed;
+	for(std::map<int, std::pair<LOBBY_CHANGE, variant> >::const_iterator i = games.begin(); i != games.end(); ++i) {
+		switch(i->second.first) {
+		case GAME_ADDED: added.push_back(i->second.second); break;
+		case GAME_CHANGED: changed.push_back(i->second.second); break;
+		case GAME_REMOVED: removed.push_back(variant(i->first)); break;
+		}
+	}
+
+	variant_builder value;
+	value.add("type", "lobby_delta");
+	value.add("status_id", status_id_);
+	value.add("last_seen", last_seen);
+	value.set("added", variant(&added));
+	value.set("changed", variant(&changed));
+	value.set("removed", variant(&removed));
+
+	return value.build();
+}
+
 variant server::create_game_info_msg(game_info_ptr g) const
 {
 	variant_builder value;
@@ -433,16 +527,52 @@ variant server::create_game_info_msg(game_info_ptr g) const
 	return value.build();
 }
 
-void server::status_change()
+const std::string& server::get_status_msg(int last_seen)
 {
-	++status_id_;
+	if(last_seen > status_id_ || last_seen < status_id_ - int(lobby_changes_.size())) {
+		last_seen = -1;
+	}
+
+	std::map<int, std::string>::iterator i = status_msg_cache_.find(last_seen);
+	if(i != status_msg_cache_.end()) {
+		return i->second;
+	}
+
+	std::string& msg = status_msg_cache_[last_seen];
+	msg = (last_seen == -1 ? create_lobby_msg() : create_lobby_delta_msg(last_seen)).write_json();
+	return msg;
+}
+
+void server::status_change(LOBBY_CHANGE change, game_info_ptr g)
+{
+	lobby_change item;
+	item.status_id = ++status_id_;
+	item.change = change;
+	item.game_id = g->game_state->game_id();
+	if(change != GAME_REMOVED) {
+		item.info = create_game_info_msg(g);
+	}
+
+	lobby_changes_.push_back(item);
+	if(lobby_changes_.size() > MaxLobbyChanges) {
+		lobby_changes_.pop_front();
+	}
+
+	wake_status_sockets();
+}
+
+void server::wake_status_sockets()
+{
+	status_msg_cache_.clear();
 	if(!status_sockets_.empty()) {
-		std::string msg = create_lobby_msg().write_json();
-		foreach(socket_ptr socket, status_sockets_) {
-			send_msg(socket, msg);
+		//the waiting sockets had seen the status before this one.
+		for(std::map<socket_ptr, timer_ptr>::iterator i = status_sockets_.begin(); i != status_sockets_.end(); ++i) {
+			i->second->cancel();
+			send_msg(i->first, get_status_msg(delta_status_sockets_.count(i->first) ? status_id_ - 1 : -1));
 		}
 
 		status_sockets_.clear();
+		delta_status_sockets_.clear();
 	}
 }
 
@@ -6,23 +6,43 @@
 
 #include <deque>
 #include <map>
+#include <set>
 #include <vector>
 
 #include <boost/array.hpp>
 #include <boost/asio.hpp>
+#include <boost/unordered_map.hpp>
+
+namespace http {
+class web_server;
+}
 
 namespace tbs {
 
 typedef boost::shared_ptr<boost::asio::ip::tcp::socket> socket_ptr;
 typedef boost::shared_ptr<boost::array<char, 1024> > buffer_ptr;
 
+//The server's state and all game logic is only used on the server's strand,
+//so the io_service may be run on several threads while the web server's
+//sockets are serviced in parallel. Games can't be run in parallel with each
+//other, since formulas share variants which aren't thread safe.
 class server
 {
 public:
 	explicit server(boost::asio::io_service& io_service);
+
+	//the strand that the web server's handlers must be run on.
+	boost::asio::io_service::strand& strand() { return strand_; }
+
+	//the web server which our sockets come from, used to send responses.
+	void set_web_server(http::web_server* ws) { web_server_ = ws; }
 	 
 	void adopt_ajax_socket(socket_ptr socket, int session_id, const variant& msg);
 
+	//called once a response has been sent on the socket, or the socket
+	//has been closed, so we no longer track it.
+	void finished_with_socket(socket_ptr socket);
+
 	void clear_games();
 private:
 
@@ -33,6 +53,8 @@ private:
 	};
 
 	typedef boost::shared_ptr<game_info> game_info_ptr;
+	typedef boost::shared_ptr<boost::asio::deadline_timer> timer_ptr;
+
 	struct client_info {
 		client_info();
 
@@ -44,21 +66,35 @@ private:
 		int session_id;
 
 		std::deque<std::string> msg_queue;
+
+		//the long-poll socket waiting for this client's next message, if
+		//any, and the timer which sends it a heartbeat if nothing arrives.
+		socket_ptr waiting_socket;
+		timer_ptr waiting_timer;
 	};
 
 	void handle_message_internal(socket_ptr socket, client_info& cli_info, const variant& msg);
 
 	void close_ajax(socket_ptr socket, client_info& cli_info);
 
+	//parks a long-poll socket until there's a message for the client.
+	void wait_for_message(socket_ptr socket, client_info& cli_info);
+	void send_waiting_msg(client_info& cli_info, const std::string& msg);
+	void handle_wait_timeout(socket_ptr socket, int session_id, const boost::system::error_code& e);
+	variant create_heartbeat_msg(const client_info& cli_info);
+
+	void handle_status_timeout(socket_ptr socket, const boost::system::error_code& e);
+
 	void send_msg(socket_ptr socket, const variant& msg);
 	void send_msg(socket_ptr socket, const char* msg);
 	void send_msg(socket_ptr socket, const std::string& msg);
-	void handle_send(socket_ptr socket, const boost::system::error_code& e, size_t nbytes, boost::shared_ptr<std::string> buf);
 
-	void disconnect(socket_ptr socket);
+	http::web_server* web_server_;
 
 	void heartbeat();
 
+	boost::asio::io_service& io_service_;
+	boost::asio::io_service::strand strand_;
 	boost::asio::deadline_timer timer_;
 
 	void quit_games(int session_id);
@@ -74,23 +110,53 @@ private:
 	void queue_msg(int session_id, const std::string& msg);
 
 	variant create_lobby_msg() const;
+	variant create_lobby_delta_msg(int last_seen) const;
 	variant create_game_info_msg(game_info_ptr g) const;
 
-	std::map<socket_ptr, std::string> waiting_connections_;
+	//the message to send a client which last saw the lobby at status
+	//'last_seen'. This is the changes since then if they're still in the
+	//change log, otherwise, or if last_seen is -1, the whole lobby. Each
+	//message is only serialized once for each status.
+	const std::string& get_status_msg(int last_seen);
 
 	std::map<socket_ptr, socket_info> connections_;
 	std::map<int, client_info> clients_;
-	std::vector<game_info_ptr> games_;
 
-	//sockets waiting on status info.
-	std::vector<socket_ptr> status_sockets_;
+	typedef boost::unordered_map<int, game_info_ptr> game_map;
+	game_map games_;
+
+	//sockets waiting on status info, and the timers which send them the
+	//current status if it doesn't change. They've all seen the current
+	//status.
+	std::map<socket_ptr, timer_ptr> status_sockets_;
+
+	//the waiting sockets which asked for deltas, with "deltas": true in
+	//get_status. Others are always sent the whole lobby.
+	std::set<socket_ptr> delta_status_sockets_;
 
 	int nheartbeat_;
 	int scheduled_write_;
 	void schedule_write();
 
-	void status_change();
+	enum LOBBY_CHANGE { GAME_ADDED, GAME_CHANGED, GAME_REMOVED };
+	void status_change(LOBBY_CHANGE change, game_info_ptr g);
+	void wake_status_sockets();
 	int status_id_;
+
+	struct lobby_change {
+		//the status after the change.
+		int status_id;
+		LOBBY_CHANGE change;
+		int game_id;
+		variant info;
+	};
+
+	//the most recent changes to the lobby, each one status after the last.
+	std::deque<lobby_change> lobby_changes_;
+
+	//serialized messages for the current status, keyed by the status the
+	//client last saw, or -1 for the whole lobby.
+	std::map<int, std::string> status_msg_cache_;
 };
 
 }
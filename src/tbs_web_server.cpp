@@ -13,6 +13,7 @@
 #include "tbs_bot.hpp"
 #include "tbs_server.hpp"
 #include "tbs_web_server.hpp"
+#include "thread.hpp"
 #include "unit_test.hpp"
 #include "utils.hpp"
 #include "variant.hpp"
@@ -28,18 +29,31 @@ std::string global_debug_str;
 using boost::asio::ip::tcp;
 
 web_server::web_server(server& serv, boost::asio::io_service& io_service, int port)
-	: http::web_server(io_service, port), server_(serv), timer_(io_service)
+	: http::web_server(io_service, port, &serv.strand()), server_(serv), timer_(io_service)
 {
 	web_server_instance = this;
+	server_.set_web_server(this);
 	timer_.expires_from_now(boost::posix_time::milliseconds(1000));
-	timer_.async_wait(boost::bind(&web_server::heartbeat, this));
+	timer_.async_wait(handler_strand().wrap(boost::bind(&web_server::heartbeat, this)));
 }
 
 web_server::~web_server()
 {
+	server_.set_web_server(NULL);
 	web_server_instance = NULL;
 }
 
+void web_server::handle_response_sent(socket_ptr socket)
+{
+	server_.finished_with_socket(socket);
+}
+
+void web_server::disconnect(socket_ptr socket)
+{
+	server_.finished_with_socket(socket);
+	http::web_server::disconnect(socket);
+}
+
 void web_server::handle_post(socket_ptr socket, variant doc, const http::environment& env)
 {
 	int session_id = -1;
@@ -112,7 +126,7 @@ void web_server::heartbeat()
 	}
 	debug_state_sockets.clear();
 	timer_.expires_from_now(boost::posix_time::milliseconds(1000));
-	timer_.async_wait(boost::bind(&web_server::heartbeat, this));
+	timer_.async_wait(handler_strand().wrap(boost::bind(&web_server::heartbeat, this)));
 }
 
 void web_server::handle_get(socket_ptr socket, 
@@ -156,10 +170,24 @@ void on_code_modified()
 	tbs::game::reload_game_types();
 	throw code_modified_exception();
 }
+
+//runs handlers until the io_service runs out of work.
+void run_tbs_worker(boost::asio::io_service* io_service, tbs::server* s)
+{
+	for(;;) {
+		try {
+			io_service->run();
+			return;
+		} catch(code_modified_exception&) {
+			s->strand().post(boost::bind(&tbs::server::clear_games, s));
+		}
+	}
+}
 }
 
 COMMAND_LINE_UTILITY(tbs_server) {
 	int port = 23456;
+	int nthreads = 1;
 	std::vector<std::string> bot_id;
 	if(args.size() > 0) {
 		std::vector<std::string>::const_iterator it = args.begin();
@@ -171,6 +199,13 @@ COMMAND_LINE_UTILITY(tbs_server) {
 					ASSERT_LOG(port > 0 && port <= 65535, "tbs_server(): Port must lie in the range 1-65535.");
 					++it;
 				}
+			} else if(*it == "--threads") {
+				++it;
+				if(it != args.end()) {
+					nthreads = atoi(it->c_str());
+					ASSERT_LOG(nthreads > 0, "tbs_server(): Must use at least one thread.");
+					++it;
+				}
 			} else if(*it == "--bot") {
 				++it;
 				if(it != args.end()) {
@@ -203,6 +238,22 @@ COMMAND_LINE_UTILITY(tbs_server) {
 	tbs::server s(io_service);
 	tbs::web_server ws(s, io_service, port);
 
+	//bots run formulas outside of the server's strand, so can't be run
+	//alongside other threads.
+	if(nthreads > 1 && !bot_id.empty()) {
+		std::cerr << "tbs_server(): Bots can only be used with a single thread.\n";
+		nthreads = 1;
+	}
+
+	std::vector<boost::shared_ptr<threading::thread> > workers;
+	for(int n = 1; n < nthreads; ++n) {
+#if defined(__ANDROID__) && SDL_VERSION_ATLEAST(1, 3, 0)
+		workers.push_back(boost::shared_ptr<threading::thread>(new threading::thread(formatter() << "tbs-worker-" << n, boost::bind(run_tbs_worker, &io_service, &s))));
+#else
+		workers.push_back(boost::shared_ptr<threading::thread>(new threading::thread(boost::bind(run_tbs_worker, &io_service, &s))));
+#endif
+	}
+
 	std::vector<boost::intrusive_ptr<tbs::bot> > bots;
 	for(;;) {
 		try {
@@ -223,7 +274,7 @@ COMMAND_LINE_UTILITY(tbs_server) {
 		try {
 			io_service.run();
 		} catch(code_modified_exception&) {
-			s.clear_games();
+			s.strand().post(boost::bind(&tbs::server::clear_games, &s));
 		}
 	}
 }
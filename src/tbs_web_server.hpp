@@ -25,6 +25,8 @@ private:
 
 	virtual void handle_post(socket_ptr socket, variant doc, const http::environment& env);
 	virtual void handle_get(socket_ptr socket, const std::string& url, const std::map<std::string, std::string>& args);
+	virtual void handle_response_sent(socket_ptr socket);
+	virtual void disconnect(socket_ptr socket);
 
 	void heartbeat();
 
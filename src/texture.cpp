@@ -34,6 +34,20 @@
 
 #include <SDL_thread.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SSSE3_TARGET
+#else
+#define SSSE3_TARGET __attribute__((target("ssse3")))
+#endif
+#define TEXTURE_SSE2 1
+#else
+#define TEXTURE_SSE2 0
+#endif
+
 namespace graphics
 {
 
@@ -154,6 +168,12 @@ namespace {
 		const char *version = reinterpret_cast<const char *>(glGetString(GL_VERSION));
 		const char *vendor = reinterpret_cast<const char *>(glGetString(GL_VENDOR));
 
+		//without a GL context, as when running headless, there's nothing
+		//to upload textures to, so it doesn't matter.
+		if(!supported || !version || !vendor) {
+			return npot;
+		}
+
 		// OpenGL >= 2.0 drivers must support NPOT textures
 		bool version_2 = (version[0] >= '2');
 		npot = version_2;
@@ -283,6 +303,62 @@ texture::~texture()
 	remove_texture_from_registry(this);
 }
 
+namespace {
+#if TEXTURE_SSE2
+bool cpu_has_ssse3()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 9)) != 0;
+#else
+	return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+//converts a row of 24bpp pixels to 32bpp four pixels at a time. Returns
+//the number of pixels converted; the caller converts the remainder. Each
+//load reads 16 bytes to use 12, so we stop early enough to never read
+//past the end of the row.
+SSSE3_TARGET size_t add_alpha_channel_to_row_ssse3(uint8_t* dst, const uint8_t* src, size_t src_w)
+{
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i alpha = _mm_set1_epi32(0xFF000000);
+
+	size_t x = 0;
+	for(; x*3 + 16 <= src_w*3; x += 4) {
+		const __m128i rgb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x*3));
+		const __m128i rgba = _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x*4), rgba);
+	}
+
+	return x;
+}
+
+//SSE2 version of the transparent color test in
+//set_alpha_for_transparent_colors_in_rgba_surface(). Returns the number of
+//pixels processed.
+int set_alpha_for_transparent_colors_sse2(uint32_t* pixels, int npixels, bool strip_red_rects)
+{
+	//the colors below as little-endian RGBA words with the alpha masked off.
+	const __m128i rgb_mask = _mm_set1_epi32(0x00FFFFFF);
+	const __m128i alpha_color = _mm_set1_epi32(0x00516d6f);
+	const __m128i alpha_color2 = strip_red_rects ? _mm_set1_epi32(0x003d30f9) : _mm_set1_epi32(-1);
+
+	int n = 0;
+	for(; n + 4 <= npixels; n += 4) {
+		__m128i* p = reinterpret_cast<__m128i*>(pixels + n);
+		const __m128i v = _mm_loadu_si128(p);
+		const __m128i rgb = _mm_and_si128(v, rgb_mask);
+		const __m128i transparent = _mm_or_si128(_mm_cmpeq_epi32(rgb, alpha_color), _mm_cmpeq_epi32(rgb, alpha_color2));
+		_mm_storeu_si128(p, _mm_andnot_si128(_mm_andnot_si128(rgb_mask, transparent), v));
+	}
+
+	return n;
+}
+#endif
+}
+
 //this function is designed to convert a 24bpp surface to a 32bpp one, adding
 //an alpha channel. The dest surface may be larger than the source surface,
 //in which case it will put it in the upper-left corner. This is much faster
@@ -291,17 +367,27 @@ void add_alpha_channel_to_surface(uint8_t* dst_ptr, const uint8_t* src_ptr, size
 {
 	ASSERT_GE(dst_w, src_w);
 
+#if TEXTURE_SSE2
+	static const bool use_ssse3 = cpu_has_ssse3();
+#endif
+
 	for(size_t y = 0; y < src_h; ++y) {
 		uint8_t* dst = dst_ptr + y*dst_w*4;
 		const uint8_t* src = src_ptr + y*src_pitch;
-		for(size_t x = 0; x < src_w; ++x) {
+		size_t x = 0;
+#if TEXTURE_SSE2
+		if(use_ssse3) {
+			x = add_alpha_channel_to_row_ssse3(dst, src, src_w);
+			dst += x*4;
+			src += x*3;
+		}
+#endif
+		for(; x < src_w; ++x) {
 			*dst++ = *src++;
 			*dst++ = *src++;
 			*dst++ = *src++;
 			*dst++ = 0xFF;
 		}
-
-		dst += (dst_w - src_w)*4;
 	}
 }
 
@@ -310,7 +396,11 @@ void set_alpha_for_transparent_colors_in_rgba_surface(SDL_Surface* s, int option
 	const bool strip_red_rects = !(options&texture::NO_STRIP_SPRITESHEET_ANNOTATIONS);
 
 	const int npixels = s->w*s->h;
-	for(int n = 0; n != npixels; ++n) {
+	int n = 0;
+#if TEXTURE_SSE2
+	n = set_alpha_for_transparent_colors_sse2(reinterpret_cast<uint32_t*>(s->pixels), npixels, strip_red_rects);
+#endif
+	for(; n != npixels; ++n) {
 		//we use a color in our sprite sheets to indicate transparency, rather than an alpha channel
 		static const unsigned char AlphaPixel[] = {0x6f, 0x6d, 0x51}; //the background color, brown
 		static const unsigned char AlphaPixel2[] = {0xf9, 0x30, 0x3d}; //the border color, red
@@ -928,7 +1018,7 @@ std::vector<boost::shared_ptr<texture::ID> > texture::id_to_build_;
 
 }
 
-BENCHMARK(texture_copy_ctor)
+BENCHMARK_TAGGED(texture_copy_ctor, "render")
 {
 	graphics::texture t(graphics::texture::get("characters/frogatto-spritesheet1.png"));
 	BENCHMARK_LOOP {
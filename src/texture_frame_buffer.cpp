@@ -37,6 +37,7 @@ GLuint framebuffer_id = 0, framebuffer_id_back = 0; //framebuffer object
 GLint video_framebuffer_id = 0; //the original frame buffer object
 int frame_buffer_texture_width = 128;
 int frame_buffer_texture_height = 128;
+int buffer_generation = 0;
 
 void init_internal(int buffer_width, int buffer_height)
 {
@@ -131,6 +132,7 @@ void init(int buffer_width, int buffer_height)
 
 void switch_texture()
 {
+	++buffer_generation;
 	std::swap(texture_id, texture_id_back);
 	std::swap(framebuffer_id, framebuffer_id_back);
 }
@@ -138,6 +140,8 @@ void switch_texture()
 int width() { return frame_buffer_texture_width; }
 int height() { return frame_buffer_texture_height; }
 
+int generation() { return buffer_generation; }
+
 bool unsupported()
 {
 	return !supported;
@@ -145,6 +149,7 @@ bool unsupported()
 
 void set_render_to_texture()
 {
+	++buffer_generation;
 	EXT_CALL(glBindFramebuffer)(EXT_MACRO(GL_FRAMEBUFFER), framebuffer_id);
 	glViewport(0, 0, width(), height());
 }
@@ -14,6 +14,10 @@ int height();
 void set_render_to_texture();
 void set_render_to_screen();
 
+//incremented every time the frame buffer is rendered to or switched, so
+//callers can tell if what they last rendered is still in the buffer.
+int generation();
+
 struct render_scope {
 	render_scope();
 	~render_scope();
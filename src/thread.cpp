@@ -12,8 +12,18 @@
    See the COPYING file for more details.
 */
 
+#ifdef _WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <boost/bind.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 
+#include <algorithm>
 #include <iostream>
 #include <vector>
 
@@ -43,6 +53,71 @@ int call_boost_function(void* arg)
 	return 0;
 }
 
+struct job_queue {
+	job_queue(int njobs, boost::function<void (int)> job) : next(0), njobs(njobs), job(job)
+	{}
+
+	mutex m;
+	int next;
+	const int njobs;
+	boost::function<void (int)> job;
+};
+
+void run_job_queue(job_queue* queue)
+{
+	for(;;) {
+		int n;
+		{
+			lock lck(queue->m);
+			if(queue->next == queue->njobs) {
+				return;
+			}
+
+			n = queue->next++;
+		}
+
+		queue->job(n);
+	}
+}
+
+}
+
+int num_processors()
+{
+#ifdef _WINDOWS
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	const int result = info.dwNumberOfProcessors;
+#else
+	const int result = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return result > 0 ? result : 1;
+}
+
+void run_jobs(int njobs, int nthreads, boost::function<void (int)> job)
+{
+	nthreads = std::min(nthreads, njobs);
+	if(nthreads <= 1) {
+		for(int n = 0; n < njobs; ++n) {
+			job(n);
+		}
+
+		return;
+	}
+
+	job_queue queue(njobs, job);
+
+	std::vector<boost::shared_ptr<thread> > threads;
+	for(int n = 0; n != nthreads; ++n) {
+#if defined(__ANDROID__) && SDL_VERSION_ATLEAST(1, 3, 0)
+		threads.push_back(boost::shared_ptr<thread>(new thread("job", boost::bind(run_job_queue, &queue))));
+#else
+		threads.push_back(boost::shared_ptr<thread>(new thread(boost::bind(run_job_queue, &queue))));
+#endif
+	}
+
+	//the threads are joined as they're destroyed.
+	threads.clear();
 }
 
 #if defined(__ANDROID__) && SDL_VERSION_ATLEAST(1, 3, 0)
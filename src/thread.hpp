@@ -84,6 +84,16 @@ private:
 };
 
 inline Uint32 get_current_thread_id() { return SDL_ThreadID(); }
+
+// The number of processors available, for deciding how many threads to
+// spread work over.
+int num_processors();
+
+// Calls job(0) .. job(njobs-1) on up to nthreads threads, each thread
+// taking the next job when it finishes one, and returns once all the jobs
+// are done. With nthreads <= 1 the jobs are run in order on this thread.
+void run_jobs(int njobs, int nthreads, boost::function<void (int)> job);
+
 // Binary mutexes.
 //
 // Implements an interface to mutexes. This class only defines the
@@ -1,12 +1,29 @@
+#ifdef _WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#elif defined(__APPLE__)
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+
 #include <boost/bind.hpp>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <map>
 #include <set>
+#include <sstream>
+#include <stdio.h>
 
 #include "asserts.hpp"
+#include "filesystem.hpp"
 #include "foreach.hpp"
+#include "json_parser.hpp"
 #include "preferences.hpp"
+#include "string_utils.hpp"
 #include "unit_test.hpp"
+#include "variant.hpp"
 
 #include "graphics.hpp"
 
@@ -27,6 +44,12 @@ BenchmarkMap& get_benchmark_map()
 	return map;
 }
 
+std::map<std::string, std::vector<std::string> >& get_benchmark_tags()
+{
+	static std::map<std::string, std::vector<std::string> > map;
+	return map;
+}
+
 typedef std::map<std::string, CommandLineBenchmarkTest> CommandLineBenchmarkMap;
 CommandLineBenchmarkMap& get_cl_benchmark_map()
 {
@@ -34,6 +57,13 @@ CommandLineBenchmarkMap& get_cl_benchmark_map()
 	return map;
 }
 
+CommandLineBenchmarkTest get_cl_benchmark(const std::string& name)
+{
+	CommandLineBenchmarkMap::const_iterator i = get_cl_benchmark_map().find(name);
+	ASSERT_LOG(i != get_cl_benchmark_map().end(), "UNKNOWN BENCHMARK: " << name);
+	return i->second;
+}
+
 typedef std::map<std::string, UtilityProgram> UtilityMap;
 UtilityMap& get_utility_map()
 {
@@ -108,9 +138,10 @@ bool run_tests(const std::vector<std::string>* tests)
 	}
 }
 
-int register_benchmark(const std::string& name, BenchmarkTest test)
+int register_benchmark(const std::string& name, BenchmarkTest test, const std::string& tags)
 {
 	get_benchmark_map()[name] = test;
+	get_benchmark_tags()[name] = util::split(tags);
 	return 0;
 }
 
@@ -120,71 +151,273 @@ int register_benchmark_cl(const std::string& name, CommandLineBenchmarkTest test
 	return 0;
 }
 
-std::string run_benchmark(const std::string& name, BenchmarkTest fn)
+benchmark_options::benchmark_options() : regression_threshold(10)
+{}
+
+int64_t get_time_ns()
+{
+#ifdef _WINDOWS
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (count.QuadPart/freq.QuadPart)*1000000000LL + ((count.QuadPart%freq.QuadPart)*1000000000LL)/freq.QuadPart;
+#elif defined(__APPLE__)
+	static mach_timebase_info_data_t timebase;
+	if(timebase.denom == 0) {
+		mach_timebase_info(&timebase);
+	}
+
+	return int64_t(mach_absolute_time()*double(timebase.numer)/timebase.denom);
+#else
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return int64_t(ts.tv_sec)*1000000000LL + ts.tv_nsec;
+#endif
+}
+
+namespace {
+int64_t time_iterations(BenchmarkTest fn, int iterations)
+{
+	const int64_t start = get_time_ns();
+	fn(iterations);
+	return get_time_ns() - start;
+}
+
+//how long each sample should take, so the clock's resolution and the
+//cost of calling the benchmark don't matter.
+const int64_t SampleTimeNs = 10000000;
+
+//the benchmark is run for this long before it's timed, to fill caches
+//and let the CPU clock up.
+const int64_t WarmupTimeNs = 200000000;
+
+//samples are taken until we have MaxSamples, or have MinSamples and
+//have spent SamplingTimeNs.
+const int MinSamples = 5;
+const int MaxSamples = 50;
+const int64_t SamplingTimeNs = 1000000000;
+
+std::string format_time(double ns)
+{
+	const char* units[] = {"ns", "us", "ms", "s"};
+	int unit = 0;
+	while(ns >= 10000.0 && unit < 3) {
+		ns /= 1000.0;
+		++unit;
+	}
+
+	char buf[64];
+	sprintf(buf, "%.1f%s", ns, units[unit]);
+	return buf;
+}
+
+std::string format_result(const benchmark_result& result)
+{
+	std::ostringstream s;
+	s << "BENCH " << result.name << ": " << result.nsamples << " samples of " << result.iterations << " iterations; median " << format_time(result.median_ns) << "/iteration, p95 " << format_time(result.p95_ns) << ", mean " << format_time(result.mean_ns) << " +/- " << format_time(result.stddev_ns) << ", min " << format_time(result.min_ns);
+	return s.str();
+}
+
+void write_results(const std::string& fname, const std::vector<benchmark_result>& results)
+{
+	//names of command line benchmarks include their argument, often a
+	//path, so the document is built as a variant to escape them.
+	std::vector<variant> benchmarks;
+	foreach(const benchmark_result& r, results) {
+		std::vector<variant> tags;
+		foreach(const std::string& tag, r.tags) {
+			tags.push_back(variant(tag));
+		}
+
+		std::map<variant, variant> m;
+		m[variant("name")] = variant(r.name);
+		m[variant("tags")] = variant(&tags);
+		m[variant("iterations")] = variant(r.iterations);
+		m[variant("samples")] = variant(r.nsamples);
+		m[variant("median_ns")] = variant(decimal(r.median_ns));
+		m[variant("p95_ns")] = variant(decimal(r.p95_ns));
+		m[variant("mean_ns")] = variant(decimal(r.mean_ns));
+		m[variant("stddev_ns")] = variant(decimal(r.stddev_ns));
+		m[variant("min_ns")] = variant(decimal(r.min_ns));
+		benchmarks.push_back(variant(&m));
+	}
+
+	std::map<variant, variant> doc;
+	doc[variant("benchmarks")] = variant(&benchmarks);
+	sys::write_file(fname, variant(&doc).write_json());
+	std::cerr << "WROTE BENCHMARK RESULTS TO " << fname << "\n";
+}
+
+//compares the median times of the results with those in the baseline,
+//returning false if any are slower by more than the threshold.
+bool compare_with_baseline(const std::string& fname, const std::vector<benchmark_result>& results, int threshold)
+{
+	ASSERT_LOG(sys::file_exists(fname), "COULD NOT FIND BENCHMARK BASELINE " << fname);
+
+	std::map<std::string, double> baseline;
+	const variant doc = json::parse(sys::read_file(fname), json::JSON_NO_PREPROCESSOR);
+	const variant benchmarks = doc["benchmarks"];
+	for(size_t n = 0; n < benchmarks.num_elements(); ++n) {
+		baseline[benchmarks[n]["name"].as_string()] = benchmarks[n]["median_ns"].as_decimal().as_float();
+	}
+
+	int nregressions = 0;
+	foreach(const benchmark_result& r, results) {
+		std::map<std::string, double>::const_iterator i = baseline.find(r.name);
+		if(i == baseline.end() || i->second <= 0.0) {
+			std::cerr << "BENCH " << r.name << ": NOT IN BASELINE\n";
+			continue;
+		}
+
+		const double change = (r.median_ns - i->second)*100.0/i->second;
+		const char* verdict = "";
+		if(change > threshold) {
+			verdict = " REGRESSION";
+			++nregressions;
+		} else if(change < -threshold) {
+			verdict = " IMPROVEMENT";
+		}
+
+		char buf[64];
+		sprintf(buf, "%+.1f%%", change);
+		std::cerr << "BENCH " << r.name << ": " << format_time(i->second) << " -> " << format_time(r.median_ns) << " (" << buf << ")" << verdict << "\n";
+	}
+
+	if(nregressions) {
+		std::cerr << nregressions << " BENCHMARKS REGRESSED BY MORE THAN " << threshold << "% AGAINST " << fname << "\n";
+		return false;
+	}
+
+	std::cerr << "NO BENCHMARKS REGRESSED BY MORE THAN " << threshold << "% AGAINST " << fname << "\n";
+	return true;
+}
+
+bool has_tag(const std::string& name, const std::vector<std::string>& tags)
+{
+	foreach(const std::string& tag, get_benchmark_tags()[name]) {
+		if(std::count(tags.begin(), tags.end(), tag)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+}
+
+benchmark_result measure_benchmark(const std::string& name, BenchmarkTest fn)
 {
 	//run it once without counting it to let any initialization code be run.
 	fn(1);
 
 	std::cerr << "RUNNING BENCHMARK " << name << "...\n";
-	const int MinTicks = 1000;
-	for(int64_t nruns = 10; ; nruns *= 10) {
-		const int start_time = SDL_GetTicks();
-		fn(nruns);
-		const int64_t time_taken_ms = SDL_GetTicks() - start_time;
-		if(time_taken_ms >= MinTicks || nruns > 1000000000) {
-			int64_t time_taken = time_taken_ms*1000000LL;
-			int time_taken_units = 0;
-			int64_t time_taken_per_iter = time_taken/nruns;
-			int time_taken_per_iter_units = 0;
-			while(time_taken > 10000 && time_taken_units < 3) {
-				time_taken /= 1000;
-				time_taken_units++;
-			}
 
-			while(time_taken_per_iter > 10000 && time_taken_per_iter_units < 3) {
-				time_taken_per_iter /= 1000;
-				time_taken_per_iter_units++;
-			}
-
-			const char* units[] = {"ns", "us", "ms", "s"};
-			std::ostringstream s;
-			s << "BENCH " << name << ": " << nruns << " iterations, " << time_taken_per_iter << units[time_taken_per_iter_units] << "/iteration; total, " << time_taken << units[time_taken_units];
-			std::string res = s.str();
-			std::cerr << res << "\n";
-			return res;
+	//find how many iterations make a sample long enough.
+	int iterations = 1;
+	for(;;) {
+		const int64_t t = time_iterations(fn, iterations);
+		if(t >= SampleTimeNs || iterations >= 1000000000) {
+			break;
 		}
+
+		int64_t next = t > SampleTimeNs/100 ? (iterations*SampleTimeNs)/t + 1 : int64_t(iterations)*10;
+		iterations = int(std::min<int64_t>(next, 1000000000));
+	}
+
+	const int64_t warmup_end = get_time_ns() + WarmupTimeNs;
+	while(get_time_ns() < warmup_end) {
+		fn(iterations);
+	}
+
+	std::vector<double> samples;
+	const int64_t sampling_start = get_time_ns();
+	while(int(samples.size()) < MaxSamples && (int(samples.size()) < MinSamples || get_time_ns() - sampling_start < SamplingTimeNs)) {
+		samples.push_back(double(time_iterations(fn, iterations))/iterations);
+	}
+
+	std::sort(samples.begin(), samples.end());
+
+	benchmark_result result;
+	result.name = name;
+	result.tags = get_benchmark_tags()[name];
+	result.iterations = iterations;
+	result.nsamples = samples.size();
+
+	const size_t mid = samples.size()/2;
+	result.median_ns = samples.size()%2 ? samples[mid] : (samples[mid-1] + samples[mid])/2;
+	result.p95_ns = samples[std::min(samples.size() - 1, (samples.size()*95)/100)];
+	result.min_ns = samples.front();
+
+	double sum = 0.0;
+	foreach(double sample, samples) {
+		sum += sample;
 	}
 
-	return "";
+	result.mean_ns = sum/samples.size();
+
+	double variance = 0.0;
+	foreach(double sample, samples) {
+		variance += (sample - result.mean_ns)*(sample - result.mean_ns);
+	}
+
+	result.stddev_ns = samples.size() > 1 ? sqrt(variance/(samples.size() - 1)) : 0.0;
+	return result;
+}
+
+std::string run_benchmark(const std::string& name, BenchmarkTest fn)
+{
+	const std::string res = format_result(measure_benchmark(name, fn));
+	std::cerr << res << "\n";
+	return res;
 }
 
-void run_benchmarks(const std::vector<std::string>* benchmarks)
+bool run_benchmarks(const std::vector<std::string>* benchmarks, const benchmark_options* options)
 {
+	const benchmark_options default_options;
+	if(!options) {
+		options = &default_options;
+	}
+
 	std::vector<std::string> all_benchmarks;
 	if(!benchmarks) {
 		for(BenchmarkMap::const_iterator i = get_benchmark_map().begin(); i != get_benchmark_map().end(); ++i) {
-			all_benchmarks.push_back(i->first);
+			if(options->tags.empty() || has_tag(i->first, options->tags)) {
+				all_benchmarks.push_back(i->first);
+			}
 		}
 
 		benchmarks = &all_benchmarks;
 	}
 
+	std::vector<benchmark_result> results;
 	foreach(const std::string& benchmark, *benchmarks) {
 		std::string::const_iterator colon = std::find(benchmark.begin(), benchmark.end(), ':');
 		if(colon != benchmark.end()) {
 			//this benchmark has a user-supplied argument
 			const std::string bench_name(benchmark.begin(), colon);
 			const std::string arg(colon+1, benchmark.end());
-			run_command_line_benchmark(bench_name, arg);
+			results.push_back(measure_benchmark(benchmark, boost::bind(get_cl_benchmark(bench_name), _1, arg)));
 		} else {
-			run_benchmark(benchmark, get_benchmark_map()[benchmark]);
+			ASSERT_LOG(get_benchmark_map().count(benchmark), "UNKNOWN BENCHMARK: " << benchmark);
+			results.push_back(measure_benchmark(benchmark, get_benchmark_map()[benchmark]));
 		}
+
+		std::cerr << format_result(results.back()) << "\n";
 	}
+
+	if(options->output_file.empty() == false) {
+		write_results(options->output_file, results);
+	}
+
+	if(options->baseline_file.empty() == false) {
+		return compare_with_baseline(options->baseline_file, results, options->regression_threshold);
+	}
+
+	return true;
 }
 
 void run_command_line_benchmark(const std::string& benchmark_name, const std::string& arg)
 {
-	run_benchmark(benchmark_name, boost::bind(get_cl_benchmark_map()[benchmark_name], _1, arg));
+	run_benchmark(benchmark_name, boost::bind(get_cl_benchmark(benchmark_name), _1, arg));
 }
 
 void run_utility(const std::string& utility_name, const std::vector<std::string>& arg)
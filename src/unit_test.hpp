@@ -1,6 +1,7 @@
 #ifndef UNIT_TEST_HPP_INCLUDED
 #define UNIT_TEST_HPP_INCLUDED
 
+#include <boost/cstdint.hpp>
 #include <boost/function.hpp>
 
 #include <iostream>
@@ -18,15 +19,53 @@ typedef boost::function<void (int, const std::string&)> CommandLineBenchmarkTest
 typedef boost::function<void (const std::vector<std::string>&)> UtilityProgram;
 
 int register_test(const std::string& name, UnitTest test);
-int register_benchmark(const std::string& name, BenchmarkTest test);
+
+//tags is a comma separated list, such as "formula" or "render", used to
+//select groups of benchmarks to run.
+int register_benchmark(const std::string& name, BenchmarkTest test, const std::string& tags="");
 int register_benchmark_cl(const std::string& name, CommandLineBenchmarkTest test);
 int register_utility(const std::string& name, UtilityProgram utility, bool needs_video);
 bool utility_needs_video(const std::string& name);
 bool run_tests(const std::vector<std::string>* tests=NULL);
-void run_benchmarks(const std::vector<std::string>* benchmarks=NULL);
+
+struct benchmark_options {
+	benchmark_options();
+
+	//if not empty, only benchmarks with one of these tags are run.
+	std::vector<std::string> tags;
+
+	//where to write the results as JSON, if anywhere.
+	std::string output_file;
+
+	//results written by an earlier run to compare against, and how much
+	//slower, in percent, a benchmark's median time can be before it's
+	//counted as a regression.
+	std::string baseline_file;
+	int regression_threshold;
+};
+
+//returns false if any benchmark regressed against the baseline.
+bool run_benchmarks(const std::vector<std::string>* benchmarks=NULL, const benchmark_options* options=NULL);
 void run_command_line_benchmark(const std::string& benchmark_name, const std::string& arg);
 void run_utility(const std::string& utility_name, const std::vector<std::string>& arg);
 
+//a monotonic clock, in nanoseconds. Unlike SDL_GetTicks it can be used
+//before SDL is initialized.
+int64_t get_time_ns();
+
+struct benchmark_result {
+	std::string name;
+	std::vector<std::string> tags;
+
+	//each sample times this many iterations. Times are per iteration.
+	int iterations;
+	int nsamples;
+	double median_ns, p95_ns, mean_ns, stddev_ns, min_ns;
+};
+
+//warms the benchmark up, then times it repeatedly.
+benchmark_result measure_benchmark(const std::string& name, BenchmarkTest fn);
+
 std::string run_benchmark(const std::string& name, BenchmarkTest fn);
 
 }
@@ -58,6 +97,11 @@ std::string run_benchmark(const std::string& name, BenchmarkTest fn);
 
 #define BENCHMARK_ARG_CALL(name, id, arg)
 
+#define BENCHMARK_TAGGED(name, tags) \
+	void BENCHMARK_##name(int benchmark_iterations)
+
+#define BENCHMARK_ARG_CALL_TAGGED(name, id, tags, arg)
+
 #define BENCHMARK_ARG_CALL_COMMAND_LINE(name)
 
 #define UTILITY(name) void UTILITY_##name(const std::vector<std::string>& args)
@@ -88,6 +132,17 @@ std::string run_benchmark(const std::string& name, BenchmarkTest fn);
 	} \
 	static int BENCHMARK_ARG_VAR_##name_##id = test::register_benchmark(#name " " #id, BENCHMARK_ARG_CALL_##name_##id);
 
+#define BENCHMARK_TAGGED(name, tags) \
+	void BENCHMARK_##name(int benchmark_iterations); \
+	static int BENCHMARK_VAR_##name = test::register_benchmark(#name, BENCHMARK_##name, tags); \
+	void BENCHMARK_##name(int benchmark_iterations)
+
+#define BENCHMARK_ARG_CALL_TAGGED(name, id, tags, arg) \
+	void BENCHMARK_ARG_CALL_##name##_##id(int benchmark_iterations) { \
+		BENCHMARK_ARG_##name(benchmark_iterations, arg); \
+	} \
+	static int BENCHMARK_ARG_VAR_##name##_##id = test::register_benchmark(#name " " #id, BENCHMARK_ARG_CALL_##name##_##id, tags);
+
 #define BENCHMARK_ARG_CALL_COMMAND_LINE(name) \
 	void BENCHMARK_ARG_CALL_##name(int benchmark_iterations, const std::string& arg) { \
 		BENCHMARK_ARG_##name(benchmark_iterations, arg); \
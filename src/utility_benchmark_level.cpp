@@ -0,0 +1,226 @@
+#include <boost/intrusive_ptr.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "allocation_tracker.hpp"
+#include "asserts.hpp"
+#include "controls.hpp"
+#include "custom_object.hpp"
+#include "custom_object_functions.hpp"
+#include "draw_scene.hpp"
+#include "entity.hpp"
+#include "filesystem.hpp"
+#include "foreach.hpp"
+#include "formula_profiler.hpp"
+#include "graphical_font.hpp"
+#include "i18n.hpp"
+#include "json_parser.hpp"
+#include "level.hpp"
+#include "load_level.hpp"
+#include "module.hpp"
+#include "preferences.hpp"
+#include "random.hpp"
+#include "string_utils.hpp"
+#include "texture.hpp"
+#include "tile_map.hpp"
+#include "unit_test.hpp"
+
+namespace {
+const char ControlChars[] = "udlrajt";
+
+//Input files have a line for each change in the controls held down: how
+//many cycles they're held for, then the controls, as letters from
+//"udlrajt" (up, down, left, right, attack, jump, tongue), or '-' for none.
+//Lines beginning with '#' are ignored.
+std::vector<unsigned char> read_input_file(const std::string& fname)
+{
+	ASSERT_LOG(sys::file_exists(fname), "COULD NOT FIND INPUT FILE " << fname);
+
+	std::vector<unsigned char> result;
+	foreach(const std::string& line, util::split(sys::read_file(fname), '\n')) {
+		if(line.empty() || line[0] == '#') {
+			continue;
+		}
+
+		std::vector<std::string> items = util::split(line, ' ');
+		ASSERT_LOG(items.size() == 2, "BAD LINE IN INPUT FILE " << fname << ": " << line);
+
+		const int ncycles = atoi(items[0].c_str());
+		unsigned char state = 0;
+		foreach(char c, items[1]) {
+			if(c == '-') {
+				continue;
+			}
+
+			const char* p = strchr(ControlChars, c);
+			ASSERT_LOG(p != NULL, "BAD CONTROL IN INPUT FILE " << fname << ": " << line);
+			state |= 1 << (p - ControlChars);
+		}
+
+		result.insert(result.end(), ncycles, state);
+	}
+
+	return result;
+}
+
+//without an input file, the player runs back and forth and jumps about,
+//changing what they do every half second.
+std::vector<unsigned char> scripted_input(int ncycles)
+{
+	std::vector<unsigned char> result;
+	unsigned int seed = 1;
+	while(int(result.size()) < ncycles) {
+		seed = seed*1103515245 + 12345;
+		unsigned char state = (seed >> 16)%2 ? (1 << controls::CONTROL_RIGHT) : (1 << controls::CONTROL_LEFT);
+		if((seed >> 20)%3 == 0) {
+			state |= 1 << controls::CONTROL_JUMP;
+		}
+
+		result.insert(result.end(), 25, state);
+	}
+
+	return result;
+}
+
+unsigned int hash_int(unsigned int hash, int value)
+{
+	for(int n = 0; n != 4; ++n) {
+		hash = (hash ^ ((value >> (n*8))&0xFF))*16777619;
+	}
+
+	return hash;
+}
+
+//a hash of the state of everything in the level, which should come out the
+//same every time the same level is run with the same input.
+unsigned int level_checksum(const level& lvl)
+{
+	unsigned int hash = 2166136261u;
+	hash = hash_int(hash, lvl.cycle());
+	hash = hash_int(hash, lvl.get_chars().size());
+	foreach(const entity_ptr& e, lvl.get_chars()) {
+		hash = hash_int(hash, e->centi_x());
+		hash = hash_int(hash, e->centi_y());
+		hash = hash_int(hash, e->velocity_x());
+		hash = hash_int(hash, e->velocity_y());
+		hash = hash_int(hash, e->face_right());
+		hash = hash_int(hash, e->hitpoints());
+	}
+
+	return hash;
+}
+
+//loads what the game needs to load levels, without a window.
+void init_headless()
+{
+	SDL_Init(SDL_INIT_TIMER);
+	preferences::parse_arg("--no-iphone-controls");
+	i18n::init();
+
+	custom_object::init();
+	init_custom_object_functions(json::parse_from_file(module::map_file("data/functions.cfg")));
+	tile_map::init(json::parse_from_file(module::map_file("data/tiles.cfg")));
+
+	std::string filename = "data/fonts." + i18n::get_locale() + ".cfg";
+	if(!sys::file_exists(filename)) {
+		filename = "data/fonts.cfg";
+	}
+
+	graphical_font::init(json::parse_from_file(module::map_file(filename)));
+}
+}
+
+//Runs a level for a number of cycles without drawing it, feeding it input
+//from a file, or a scripted input if none is given, and reports how fast
+//it went, where the time went, and a checksum of the final state. Since
+//it doesn't need a window, it can be run on a headless machine, with
+//--expect-checksum to catch changes which make the game play differently.
+COMMAND_LINE_UTILITY(benchmark_level)
+{
+	std::string level_cfg, input_file;
+	int ncycles = 1000;
+	bool check_checksum = false;
+	unsigned int expected_checksum = 0;
+
+	for(size_t n = 0; n < args.size(); ++n) {
+		const std::string& arg = args[n];
+		if(arg == "--cycles" && n+1 < args.size()) {
+			ncycles = atoi(args[++n].c_str());
+		} else if(arg == "--input" && n+1 < args.size()) {
+			input_file = args[++n];
+		} else if(arg == "--expect-checksum" && n+1 < args.size()) {
+			check_checksum = true;
+			expected_checksum = strtoul(args[++n].c_str(), NULL, 10);
+		} else if(level_cfg.empty() && arg.empty() == false && arg[0] != '-') {
+			level_cfg = arg;
+		} else {
+			ASSERT_LOG(false, "UNRECOGNIZED ARGUMENT: " << arg << "\nusage: benchmark_level <level> [--cycles N] [--input FILE] [--expect-checksum N]");
+		}
+	}
+
+	ASSERT_LOG(level_cfg.empty() == false, "usage: benchmark_level <level> [--cycles N] [--input FILE] [--expect-checksum N]");
+
+	const graphics::texture::manager texture_manager;
+	const load_level_manager load_manager;
+	init_headless();
+
+	const std::vector<unsigned char> input = input_file.empty() ? scripted_input(ncycles) : read_input_file(input_file);
+	if(int(input.size()) < ncycles) {
+		std::cerr << "INPUT ONLY HAS " << input.size() << " CYCLES. THE LAST CONTROLS WILL BE HELD FOR THE REST\n";
+	}
+
+	const int load_start = SDL_GetTicks();
+	boost::intrusive_ptr<level> lvl(load_level(level_cfg));
+	lvl->finish_loading();
+	lvl->set_as_current_level();
+	const int load_time = SDL_GetTicks() - load_start;
+
+	rng::set_seed(0);
+	last_draw_position() = screen_position();
+
+	const formula_profiler::instrumentation_scope instrumentation;
+	allocation_tracker::end_frame();
+	allocation_tracker::reset();
+
+	const int start_time = SDL_GetTicks();
+	for(int cycle = 0; cycle != ncycles; ++cycle) {
+		unsigned char state = 0;
+		if(input.empty() == false) {
+			state = input[std::min<int>(cycle, input.size() - 1)];
+		}
+
+		const controls::local_controls_lock lock(state);
+		update_camera_position(*lvl, last_draw_position(), NULL, false);
+		lvl->process();
+		allocation_tracker::end_frame();
+	}
+
+	const int total_time = std::max<int>(1, SDL_GetTicks() - start_time);
+	const unsigned int checksum = level_checksum(*lvl);
+
+	printf("LEVEL %s: LOADED IN %dms\n", level_cfg.c_str(), load_time);
+	printf("RAN %d CYCLES IN %dms: %.1f CYCLES/SEC, %d OBJECTS AT THE END\n", ncycles, total_time, (ncycles*1000.0)/total_time, int(lvl->get_chars().size()));
+
+	//FFL and COMMANDS nest inside each other, as events are fired while
+	//executing commands, so the phases add up to more than the total.
+	foreach(const formula_profiler::instrument_total& phase, formula_profiler::get_instrumentation()) {
+		printf("  %-18s %8.1fms %5.1f%% %8.1fus/cycle %9d calls\n", phase.id.c_str(), phase.time_us/1000.0, (phase.time_us*0.1)/total_time, double(phase.time_us)/std::max(ncycles, 1), phase.nsamples);
+	}
+
+	if(allocation_tracker::enabled()) {
+		printf("%s", allocation_tracker::get_summary_text(20).c_str());
+	}
+
+	printf("CHECKSUM: %u\n", checksum);
+
+	if(check_checksum) {
+		ASSERT_LOG(checksum == expected_checksum, "CHECKSUM " << checksum << " DOES NOT MATCH EXPECTED CHECKSUM " << expected_checksum);
+		printf("CHECKSUM MATCHES\n");
+	}
+}
@@ -1,5 +1,6 @@
 #include "graphics.hpp"
 
+#include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include <map>
@@ -18,6 +19,7 @@
 #include "string_utils.hpp"
 #include "surface.hpp"
 #include "surface_cache.hpp"
+#include "thread.hpp"
 #include "unit_test.hpp"
 #include "variant_utils.hpp"
 #include "IMG_savepng.h"
@@ -141,6 +143,16 @@ bool animation_area_has_alpha_channel(animation_area_ptr anim)
 	
 	return false;
 }
+
+void save_compiled_image_job(const std::vector<graphics::surface>* surfaces, int n)
+{
+	std::ostringstream fname;
+	fname << "images/compiled-" << n << ".png";
+
+	graphics::set_alpha_for_transparent_colors_in_rgba_surface((*surfaces)[n].get());
+
+	IMG_SavePNG((module::get_module_path() + fname.str()).c_str(), (*surfaces)[n].get(), -1);
+}
 }
 
 UTILITY(compile_objects)
@@ -153,6 +165,17 @@ UTILITY(compile_objects)
 	return;
 #endif
 
+	int njobs = threading::num_processors();
+	for(size_t n = 0; n < args.size(); ++n) {
+		if(args[n] == "--jobs" && n+1 < args.size()) {
+			njobs = std::max(1, atoi(args[++n].c_str()));
+		} else {
+			ASSERT_LOG(false, "UNRECOGNIZED ARGUMENT: " << args[n] << "\nusage: compile_objects [--jobs N]");
+		}
+	}
+
+	const int start_time = SDL_GetTicks();
+
 	using graphics::surface;
 
 	int num_output_images = 0;
@@ -187,8 +210,9 @@ UTILITY(compile_objects)
 		}
 	}
 
-	std::vector<const_custom_object_type_ptr> types = custom_object_type::get_all();
-	foreach(const_custom_object_type_ptr type, types) {
+	std::vector<const_custom_object_type_ptr> types;
+	std::vector<std::string> paths;
+	foreach(const_custom_object_type_ptr type, custom_object_type::get_all()) {
 		const std::string* path = custom_object_type::get_object_path(type->id() + ".cfg");
 
 		//skip any experimental stuff so it isn't compiled
@@ -197,9 +221,31 @@ UTILITY(compile_objects)
 			continue;
 		}
 
-		std::cerr << "OBJECT: " << type->id() << " -> " << *path << "\n";
-		variant obj_node =  json::parse_from_file(*path);
-		obj_node = custom_object_type::merge_prototype(obj_node);
+		types.push_back(type);
+		paths.push_back(*path);
+	}
+
+	//the object files are parsed on many threads, before the nodes are
+	//processed on one thread.
+	std::vector<int> parse_times;
+	const std::vector<variant> parsed_nodes = json::parse_files_parallel(paths, njobs, &parse_times);
+
+	const int parse_time = SDL_GetTicks() - start_time;
+
+	for(int n = 0; n != types.size(); ++n) {
+		const_custom_object_type_ptr type = types[n];
+		std::cerr << "OBJECT: " << type->id() << " -> " << paths[n] << "\n";
+
+		//a line of JSON for each object, so whatever is running us can
+		//show progress.
+		variant_builder progress;
+		progress.add("object", type->id());
+		progress.add("done", n + 1);
+		progress.add("total", static_cast<int>(types.size()));
+		progress.add("parse_ms", parse_times[n]);
+		std::cout << progress.build().write_json(false) << std::endl;
+
+		variant obj_node = custom_object_type::merge_prototype(parsed_nodes[n]);
 		obj_node.remove_attr(variant("prototype"));
 
 		if(obj_node["editor_info"].is_map() && obj_node["editor_info"]["var"].is_list()) {
@@ -363,14 +409,7 @@ UTILITY(compile_objects)
 		}
 	}
 
-	for(int n = 0; n != num_output_images; ++n) {
-		std::ostringstream fname;
-		fname << "images/compiled-" << n << ".png";
-
-		graphics::set_alpha_for_transparent_colors_in_rgba_surface(surfaces[n].get());
-
-		IMG_SavePNG((module::get_module_path() + fname.str()).c_str(), surfaces[n].get(), -1);
-	}
+	threading::run_jobs(num_output_images, njobs, boost::bind(save_compiled_image_job, &surfaces, _1));
 
 	typedef std::pair<variant, animation_area_ptr> anim_pair;
 	foreach(const anim_pair& a, nodes_to_animation_areas) {
@@ -427,4 +466,12 @@ UTILITY(compile_objects)
 	    i != gui_nodes.end(); ++i) {
 		module::write_file("data/compiled/gui/" + i->first, i->second.write_json());
 	}
+
+	variant_builder summary;
+	summary.add("objects", static_cast<int>(types.size()));
+	summary.add("images", num_output_images);
+	summary.add("jobs", njobs);
+	summary.add("parse_ms", parse_time);
+	summary.add("total_ms", static_cast<int>(SDL_GetTicks() - start_time));
+	std::cout << summary.build().write_json(false) << std::endl;
 }
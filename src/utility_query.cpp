@@ -1,4 +1,9 @@
+#include <boost/bind.hpp>
+
+#include <algorithm>
 #include <iostream>
+#include <set>
+#include <stdlib.h>
 #include <string>
 #include <vector>
 #include <sstream>
@@ -11,6 +16,7 @@
 #include "json_parser.hpp"
 #include "module.hpp"
 #include "string_utils.hpp"
+#include "thread.hpp"
 #include "unit_test.hpp"
 #include "variant_callable.hpp"
 #include "variant_utils.hpp"
@@ -308,86 +314,353 @@ void execute_command(variant cmd, variant obj, const std::string& fname)
 	}
 }
 
-void process_file(const std::string& fname, std::map<std::string,std::string>& file_mappings)
+//what the index knows about a file: the id of the object in it, its
+//prototypes, and every key used in it, including the names of
+//properties. Files whose modification time hasn't changed don't need to be
+//parsed to find out whether they match a query's filters.
+struct index_entry {
+	index_entry() : mod_time(0)
+	{}
+
+	int64_t mod_time;
+	std::string id;
+	std::vector<std::string> prototypes;
+	std::set<std::string> keys;
+};
+
+void add_keys(const variant& v, std::set<std::string>& keys)
 {
-	static const std::string Postfix = ".cfg";
-	if(fname.size() <= Postfix.size() || std::string(fname.end()-Postfix.size(),fname.end()) != Postfix) {
-		return;
+	if(v.is_map()) {
+		foreach(const variant_pair& p, v.as_map()) {
+			if(p.first.is_string()) {
+				keys.insert(p.first.as_string());
+			}
+
+			add_keys(p.second, keys);
+		}
+	} else if(v.is_list()) {
+		foreach(const variant& item, v.as_list()) {
+			add_keys(item, keys);
+		}
+	}
+}
+
+index_entry make_index_entry(const variant& doc, int64_t mod_time)
+{
+	index_entry result;
+	result.mod_time = mod_time;
+	if(doc.is_map()) {
+		if(doc["id"].is_string()) {
+			result.id = doc["id"].as_string();
+		}
+
+		if(doc["prototype"].is_list()) {
+			foreach(const variant& proto, doc["prototype"].as_list()) {
+				if(proto.is_string()) {
+					result.prototypes.push_back(proto.as_string());
+				}
+			}
+		}
+	}
+
+	add_keys(doc, result.keys);
+	return result;
+}
+
+variant write_index_entry(const index_entry& entry)
+{
+	variant_builder result;
+	result.add("mod_time", static_cast<int>(entry.mod_time));
+	result.add("id", entry.id);
+
+	std::vector<variant> prototypes, keys;
+	foreach(const std::string& proto, entry.prototypes) {
+		prototypes.push_back(variant(proto));
+	}
+
+	foreach(const std::string& key, entry.keys) {
+		keys.push_back(variant(key));
+	}
+
+	result.add("prototype", variant(&prototypes));
+	result.add("keys", variant(&keys));
+	return result.build();
+}
+
+index_entry read_index_entry(variant node)
+{
+	index_entry result;
+	result.mod_time = node["mod_time"].as_int();
+	result.id = node["id"].as_string();
+	foreach(const variant& proto, node["prototype"].as_list()) {
+		result.prototypes.push_back(proto.as_string());
+	}
+
+	foreach(const variant& key, node["keys"].as_list()) {
+		result.keys.insert(key.as_string());
+	}
+
+	return result;
+}
+
+struct query_filter {
+	std::string path, key, id, prototype;
+
+	bool needs_index() const {
+		return !key.empty() || !id.empty() || !prototype.empty();
+	}
+
+	bool matches_path(const std::string& fname) const {
+		return path.empty() || fname.find(path) != std::string::npos;
+	}
+
+	bool matches(const index_entry& entry) const {
+		return (key.empty() || entry.keys.count(key)) &&
+		       (id.empty() || entry.id == id) &&
+		       (prototype.empty() || std::find(entry.prototypes.begin(), entry.prototypes.end(), prototype) != entry.prototypes.end());
+	}
+};
+
+//a file being queried. The files are read and parsed on many threads, but
+//FFL can only be run on one, so the query itself is run afterwards.
+struct query_file {
+	query_file() : mod_time(0), parse_time(0), parsed(false)
+	{}
+
+	std::string fname, contents;
+	int64_t mod_time;
+	variant doc;
+	index_entry entry;
+	int parse_time;
+	bool parsed;
+	std::string error;
+};
+
+void parse_file_job(std::vector<query_file>* files, int n)
+{
+	query_file& file = (*files)[n];
+	const int start = SDL_GetTicks();
+	try {
+		file.contents = sys::read_file(module::map_file(file.fname));
+		file.doc = json::parse(file.contents, JSON_NO_PREPROCESSOR);
+		file.entry = make_index_entry(file.doc, file.mod_time);
+		file.parsed = true;
+	} catch(json::parse_error& e) {
+		file.error = e.error_message();
+	} catch(validation_failure_exception& e) {
+		file.error = e.msg;
 	}
 
-	variant original = json::parse(sys::read_file(module::map_file(fname)), JSON_NO_PREPROCESSOR);
+	file.parse_time = SDL_GetTicks() - start;
+}
+
+void process_file(query_file& file, std::map<std::string,std::string>& file_mappings)
+{
+	variant original = file.doc;
 	variant v = original;
 
 	variant obj = variant_callable::create(&v);
 
 	boost::intrusive_ptr<map_formula_callable> map_callable(new map_formula_callable(obj.try_convert<formula_callable>()));
 	map_callable->add("doc", v);
-	map_callable->add("filename", variant(fname));
+	map_callable->add("filename", variant(file.fname));
 
 	variant result = formula_->execute(*map_callable);
-	execute_command(result, obj, fname);
+	execute_command(result, obj, file.fname);
 	if(result.as_bool()) {
 		//std::cout << fname << ": " << result.write_json() << "\n";
 	}
 
 	if(original != v) {
-		std::string contents = sys::read_file(module::map_file(fname));
-		std::string new_contents = modify_variant_text(contents, original, v, 1, 1, "");
+		std::string new_contents = modify_variant_text(file.contents, original, v, 1, 1, "");
 		try {
 			json::parse(new_contents, JSON_NO_PREPROCESSOR);
 		} catch(json::parse_error& e) {
-			ASSERT_LOG(false, "ERROR: MODIFIED DOCUMENT " << fname << " COULD NOT BE PARSED. FILE NOT WRITTEN: " << e.error_message() << "\n" << new_contents);
+			ASSERT_LOG(false, "ERROR: MODIFIED DOCUMENT " << file.fname << " COULD NOT BE PARSED. FILE NOT WRITTEN: " << e.error_message() << "\n" << new_contents);
 		}
 
-		file_mappings[fname] = new_contents;
-		std::cerr << "file " << fname << " has changes\n";
+		file_mappings[file.fname] = new_contents;
+		std::cerr << "file " << file.fname << " has changes\n";
 	}
 }
 
-void process_dir(const std::string& dir, std::map<std::string, std::string>& file_mappings, std::vector<std::string>& error_files)
+bool is_cfg_file(const std::string& fname)
+{
+	static const std::string Postfix = ".cfg";
+	return fname.size() > Postfix.size() && std::string(fname.end()-Postfix.size(),fname.end()) == Postfix;
+}
+
+void find_files(const std::string& dir, std::vector<std::string>& result)
 {
 	std::vector<std::string> subdirs, files;
 	module::get_files_in_dir(dir, &files, &subdirs, sys::ENTIRE_FILE_PATH);
 	foreach(const std::string& d, subdirs) {
-		process_dir(d, file_mappings, error_files);
+		find_files(d, result);
 	}
 
 	foreach(const std::string& fname, files) {
-		try {
-			process_file(fname, file_mappings);
-		} catch(json::parse_error& e) {
-			std::cerr << "FAILED TO PARSE " << fname << "\n";
-		} catch(type_error& e) {
-			std::cerr << "TYPE ERROR PARSING " << fname << "\n";
-			error_files.push_back(fname);
-		} catch(validation_failure_exception& e) {
-			std::cerr << "ERROR PARSING " << fname << ": " << e.msg << "\n";
-			error_files.push_back(fname);
+		if(is_cfg_file(fname)) {
+			result.push_back(fname);
 		}
 	}
 }
 
+const char* QueryUsage =
+  "USAGE: query <dir or file> <formula> [options]\n"
+  "  --jobs N          parse files on N threads\n"
+  "  --index FILE      keep an index of the ids, prototypes and keys in each\n"
+  "                    file in FILE, so files not matching --key, --id or\n"
+  "                    --prototype don't need parsing\n"
+  "  --path STR        only query files with STR in their path\n"
+  "  --key NAME        only query files which use the key NAME\n"
+  "  --id ID           only query the object with the id ID\n"
+  "  --prototype NAME  only query objects with the prototype NAME\n"
+  "  --dry-run         report which files match and would be changed, and\n"
+  "                    how long it took, without changing anything\n";
+
 }
 
 COMMAND_LINE_UTILITY(query)
 {
-	if(args.size() != 2) {
-		std::cerr << "USAGE: <dir> <formula>\n";
+	std::vector<std::string> positional_args;
+	std::string index_file;
+	query_filter filter;
+	int njobs = threading::num_processors();
+	bool dry_run = false;
+
+	for(size_t n = 0; n < args.size(); ++n) {
+		const std::string& arg = args[n];
+		if(arg == "--jobs" && n+1 < args.size()) {
+			njobs = std::max(1, atoi(args[++n].c_str()));
+		} else if(arg == "--index" && n+1 < args.size()) {
+			index_file = args[++n];
+		} else if(arg == "--path" && n+1 < args.size()) {
+			filter.path = args[++n];
+		} else if(arg == "--key" && n+1 < args.size()) {
+			filter.key = args[++n];
+		} else if(arg == "--id" && n+1 < args.size()) {
+			filter.id = args[++n];
+		} else if(arg == "--prototype" && n+1 < args.size()) {
+			filter.prototype = args[++n];
+		} else if(arg == "--dry-run") {
+			dry_run = true;
+		} else if(arg.empty() == false && arg[0] == '-' && arg.size() > 1 && arg[1] == '-') {
+			std::cerr << "UNRECOGNIZED ARGUMENT: " << arg << "\n" << QueryUsage;
+			return;
+		} else {
+			positional_args.push_back(arg);
+		}
+	}
+
+	if(positional_args.size() != 2) {
+		std::cerr << QueryUsage;
 		return;
 	}
 
+	SDL_Init(SDL_INIT_TIMER);
+	const int start_time = SDL_GetTicks();
+
 	std::vector<std::string> error_files;
 	std::map<std::string, std::string> file_mappings;
 
-	formula_.reset(new formula(variant(args[1])));
-	if(args[0].size() > 4 && std::string(args[0].end()-4,args[0].end()) == ".cfg") {
-		process_file(args[0], file_mappings);
+	formula_.reset(new formula(variant(positional_args[1])));
+
+	std::vector<std::string> fnames;
+	if(is_cfg_file(positional_args[0])) {
+		fnames.push_back(positional_args[0]);
 	} else {
-		const assert_recover_scope scope;
-		process_dir(args[0], file_mappings, error_files);
+		find_files(positional_args[0], fnames);
+	}
+
+	std::map<std::string, index_entry> index;
+	if(!index_file.empty() && sys::file_exists(index_file)) {
+		variant index_node = json::parse(sys::read_file(index_file), JSON_NO_PREPROCESSOR);
+		foreach(const variant_pair& p, index_node.as_map()) {
+			index[p.first.as_string()] = read_index_entry(p.second);
+		}
+	}
+
+	//work out which files need to be parsed: those whose path matches, and
+	//which the index can't rule out.
+	int nskipped = 0;
+	std::vector<query_file> files;
+	foreach(const std::string& fname, fnames) {
+		if(!filter.matches_path(fname)) {
+			++nskipped;
+			continue;
+		}
+
+		const int64_t mod_time = index_file.empty() ? 0 : sys::file_mod_time(module::map_file(fname));
+		std::map<std::string, index_entry>::const_iterator itor = index.find(fname);
+		if(itor != index.end() && itor->second.mod_time == mod_time && !filter.matches(itor->second)) {
+			++nskipped;
+			continue;
+		}
+
+		files.push_back(query_file());
+		files.back().fname = fname;
+		files.back().mod_time = mod_time;
+	}
+
+	const assert_recover_scope scope;
+
+	const int parse_start = SDL_GetTicks();
+	threading::run_jobs(files.size(), njobs, boost::bind(parse_file_job, &files, _1));
+	const int parse_time = SDL_GetTicks() - parse_start;
+
+	const int query_start = SDL_GetTicks();
+	int nqueried = 0;
+	foreach(query_file& file, files) {
+		if(!file.parsed) {
+			std::cerr << "FAILED TO PARSE " << file.fname << ": " << file.error << "\n";
+			continue;
+		}
+
+		index[file.fname] = file.entry;
+
+		if(!filter.matches(file.entry)) {
+			++nskipped;
+			continue;
+		}
+
+		++nqueried;
+
+		const int file_start = SDL_GetTicks();
+		try {
+			process_file(file, file_mappings);
+		} catch(type_error& e) {
+			std::cerr << "TYPE ERROR PARSING " << file.fname << "\n";
+			error_files.push_back(file.fname);
+		} catch(validation_failure_exception& e) {
+			std::cerr << "ERROR PARSING " << file.fname << ": " << e.msg << "\n";
+			error_files.push_back(file.fname);
+		}
+
+		if(dry_run && file_mappings.count(file.fname)) {
+			std::cerr << "MATCH " << file.fname << ": PARSED IN " << file.parse_time << "ms, QUERIED IN " << (SDL_GetTicks() - file_start) << "ms\n";
+		}
+
+		//the file is no longer needed, so don't keep it in memory.
+		file.contents.clear();
+		file.doc = variant();
 	}
 
-	if(error_files.empty()) {
+	const int query_time = SDL_GetTicks() - query_start;
+
+	if(!index_file.empty()) {
+		std::map<variant, variant> index_node;
+		for(std::map<std::string, index_entry>::const_iterator i = index.begin(); i != index.end(); ++i) {
+			index_node[variant(i->first)] = write_index_entry(i->second);
+		}
+
+		sys::write_file(index_file, variant(&index_node).write_json(false));
+	}
+
+	std::cerr << fnames.size() << " FILES: " << nskipped << " SKIPPED, " << files.size() << " PARSED IN " << parse_time << "ms ON " << njobs << " THREADS, " << nqueried << " QUERIED IN " << query_time << "ms, " << file_mappings.size() << " MATCHED. TOTAL " << (SDL_GetTicks() - start_time) << "ms\n";
+
+	if(dry_run) {
+		std::cerr << "DRY RUN. NO CHANGES MADE\n";
+	} else if(error_files.empty()) {
 		std::cerr << "ALL FILES PROCESSED OKAY. APPLYING MODIFICATIONS TO " << file_mappings.size() << " FILES\n";
 		for(std::map<std::string, std::string>::const_iterator i = file_mappings.begin(); i != file_mappings.end(); ++i) {
 			sys::write_file(i->first, i->second);
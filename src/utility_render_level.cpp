@@ -1,27 +1,78 @@
 #include <boost/intrusive_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 
+#include <algorithm>
+#include <deque>
+#include <stdlib.h>
 #include <string>
 #include <vector>
 
 #include "foreach.hpp"
 #include "IMG_savepng.h"
 #include "level.hpp"
+#include "load_level.hpp"
 #include "string_utils.hpp"
 #include "texture_frame_buffer.hpp"
+#include "thread.hpp"
 #include "unit_test.hpp"
+#include "variant_utils.hpp"
+
+namespace {
+//saves a rendered level on another thread, while the next level is drawn.
+//It uses the surface without taking a reference, since surfaces aren't
+//reference counted safely between threads; the surface is kept alive by
+//the pending_save until the thread is done.
+class png_saver {
+	SDL_Surface* surf_;
+	std::string fname_;
+	int* save_time_;
+public:
+	png_saver(SDL_Surface* surf, const std::string& fname, int* save_time)
+	  : surf_(surf), fname_(fname), save_time_(save_time)
+	{}
+
+	void operator()() const {
+		const int start = SDL_GetTicks();
+		IMG_SavePNG(fname_.c_str(), surf_);
+		*save_time_ = SDL_GetTicks() - start;
+	}
+};
+
+struct pending_save {
+	variant_builder info;
+	graphics::surface surf;
+	boost::shared_ptr<int> save_time;
+
+	//declared last so the thread is joined before the surface is freed.
+	boost::shared_ptr<threading::thread> thread;
+};
+}
 
+//Renders each level to an image, drawing it a screen sized segment at a
+//time into one offscreen frame buffer. The levels are parsed on --jobs
+//threads first, and each image is saved on a thread while the next level
+//is drawn. A JSON array is written, with an entry for each level once its
+//image is saved, giving its dimensions and how long it took. Build with
+//USE_OSMESA and run with --software-gl on machines without a GPU.
 UTILITY(render_level)
 {
-	if(args.size() != 2) {
-		std::cerr << "render_level usage: <level> <output_file>\n";
-		return;
+	std::vector<std::string> positional_args;
+	int njobs = threading::num_processors();
+	for(size_t n = 0; n < args.size(); ++n) {
+		if(args[n] == "--jobs" && n+1 < args.size()) {
+			njobs = std::max(1, atoi(args[++n].c_str()));
+		} else {
+			positional_args.push_back(args[n]);
+		}
 	}
 
-	std::string file = args[0];
-	std::string output = args[1];
+	if(positional_args.size() != 2) {
+		std::cerr << "render_level usage: <level> <output_file> [--jobs N]\n";
+		return;
+	}
 
-	std::vector<std::string> files = util::split(args[0]);
-	std::vector<std::string> outputs = util::split(args[1]);
+	std::vector<std::string> files = util::split(positional_args[0]);
+	std::vector<std::string> outputs = util::split(positional_args[1]);
 
 	foreach(const std::string& f, files) {
 		std::cerr << "FILENAME (" << f << ")\n";
@@ -29,15 +80,43 @@ UTILITY(render_level)
 	
 	if(files.size() != outputs.size()) {
 		std::cerr << "ERROR: " << files.size() << " FILES " << outputs.size() << "outputs\n";
+		return;
 	}
 
+	std::vector<int> parse_times;
+	const std::vector<variant> nodes = load_level_wml_parallel(files, njobs, &parse_times);
+
+	const int seg_width = graphics::screen_width();
+	const int seg_height = graphics::screen_height();
+
+	texture_frame_buffer::init(seg_width, seg_height);
+
+	std::deque<pending_save> saves;
+	int nsaved = 0;
+
 	std::cout << "[";
 
-	for(int n = 0; n != files.size(); ++n) {
+	for(int n = 0; n <= files.size(); ++n) {
+		//finish the oldest saves, keeping at most njobs going, and all of
+		//them once there are no more levels to draw.
+		while(saves.empty() == false && (int(saves.size()) >= njobs || n == files.size())) {
+			saves.front().thread->join();
+			saves.front().info.add("save_ms", *saves.front().save_time);
+			saves.front().info.add("done", ++nsaved);
+			saves.front().info.add("total", static_cast<int>(files.size()));
+			std::cout << (nsaved > 1 ? "," : "") << "\n  " << saves.front().info.build().write_json(false) << std::flush;
+			saves.pop_front();
+		}
+
+		if(n == files.size()) {
+			break;
+		}
+
 		const std::string file = files[n];
 		const std::string output = outputs[n];
-		
-		boost::intrusive_ptr<level> lvl(new level(file));
+
+		const int load_start = SDL_GetTicks();
+		boost::intrusive_ptr<level> lvl(new level(file, nodes[n]));
 		lvl->set_editor();
 		lvl->finish_loading();
 		lvl->set_as_current_level();
@@ -45,20 +124,22 @@ UTILITY(render_level)
 		const int lvl_width = lvl->boundaries().w();
 		const int lvl_height = lvl->boundaries().h();
 
-		if(n != 0) {
-			std::cout << ",";
-		}
+		pending_save save;
+		save.info.add("name", lvl->id());
 
-		std::cout << "\n  {\n  \"name\": \"" << lvl->id() << "\","
-		             << "\n  \"dimensions\": [" << lvl->boundaries().x() << "," << lvl->boundaries().y() << "," << lvl->boundaries().w() << "," << lvl->boundaries().h() << "]\n  }";
+		std::vector<variant> dimensions;
+		dimensions.push_back(variant(lvl->boundaries().x()));
+		dimensions.push_back(variant(lvl->boundaries().y()));
+		dimensions.push_back(variant(lvl_width));
+		dimensions.push_back(variant(lvl_height));
+		save.info.add("dimensions", variant(&dimensions));
+		save.info.add("parse_ms", parse_times[n]);
+		save.info.add("load_ms", static_cast<int>(SDL_GetTicks() - load_start));
 
-		const int seg_width = graphics::screen_width();
-		const int seg_height = graphics::screen_height();
+		const int render_start = SDL_GetTicks();
 
 		graphics::surface level_surface(SDL_CreateRGBSurface(SDL_SWSURFACE, lvl_width, lvl_height, 24, SURFACE_MASK_RGB));
 
-		texture_frame_buffer::init(seg_width, seg_height);
-
 		for(int y = lvl->boundaries().y(); y < lvl->boundaries().y2(); y += seg_height) {
 			for(int x = lvl->boundaries().x(); x < lvl->boundaries().x2(); x += seg_width) {
 				texture_frame_buffer::render_scope scope;
@@ -95,8 +176,19 @@ UTILITY(render_level)
 			}
 		}
 
-		IMG_SavePNG(output.c_str(), level_surface.get());
+		save.info.add("render_ms", static_cast<int>(SDL_GetTicks() - render_start));
+
+		save.surf = level_surface;
+		save.save_time.reset(new int(0));
+		saves.push_back(save);
+
+		png_saver saver(level_surface.get(), output, saves.back().save_time.get());
+#if defined(__ANDROID__) && SDL_VERSION_ATLEAST(1, 3, 0)
+		saves.back().thread.reset(new threading::thread("save-" + output, saver));
+#else
+		saves.back().thread.reset(new threading::thread(saver));
+#endif
 	}
 
-	std::cout << "]";
+	std::cout << "\n]\n";
 }
@@ -100,6 +100,21 @@ const std::vector<const game_logic::formula_expression*>& get_expression_call_st
 	return call_stack;
 }
 
+namespace {
+//counted for each thread, since variants are also made on loading
+//threads, and callers want the count for their own thread.
+#if defined(_MSC_VER)
+__declspec(thread) int nallocations = 0;
+#else
+__thread int nallocations = 0;
+#endif
+}
+
+int get_variant_allocations()
+{
+	return nallocations;
+}
+
 std::string get_full_call_stack()
 {
 	std::string res;
@@ -350,6 +365,7 @@ variant variant::create_delayed(game_logic::const_formula_ptr f, game_logic::con
 	variant v;
 	v.type_ = VARIANT_TYPE_DELAYED;
 	v.delayed_ = new variant_delayed;
+	++nallocations;
 	v.delayed_->fn = f;
 	v.delayed_->callable = callable;
 
@@ -385,6 +401,7 @@ variant::variant(std::vector<variant>* array)
 {
 	assert(array);
 	list_ = new variant_list;
+	++nallocations;
 	list_->elements.swap(*array);
 	list_->begin = list_->elements.begin();
 	list_->end = list_->elements.end();
@@ -399,6 +416,7 @@ variant::variant(const char* s)
 		return;
 	}
 	string_ = new variant_string;
+	++nallocations;
 	string_->str = std::string(s);
 	increment_refcount();
 }
@@ -407,6 +425,7 @@ variant::variant(const std::string& str)
 	: type_(VARIANT_TYPE_STRING)
 {
 	string_ = new variant_string;
+	++nallocations;
 	string_->str = str;
 	increment_refcount();
 }
@@ -435,6 +454,7 @@ variant::variant(std::map<variant,variant>* map)
 
 	assert(map);
 	map_ = new variant_map;
+	++nallocations;
 	map_->elements.swap(*map);
 	increment_refcount();
 }
@@ -443,6 +463,7 @@ variant::variant(game_logic::const_formula_ptr fml, const std::vector<std::strin
   : type_(VARIANT_TYPE_FUNCTION)
 {
 	fn_ = new variant_fn;
+	++nallocations;
 	if(args.empty()) {
 		fn_->begin_args = fn_->end_args = NULL;
 	} else {
@@ -779,6 +800,7 @@ variant variant::add_attr(variant key, variant value)
 		if(map_->refcount > 1) {
 			map_->refcount--;
 			map_ = new variant_map(*map_);
+			++nallocations;
 			map_->refcount = 1;
 		}
 
@@ -798,6 +820,7 @@ variant variant::remove_attr(variant key)
 		if(map_->refcount > 1) {
 			map_->refcount--;
 			map_ = new variant_map(*map_);
+			++nallocations;
 			map_->refcount = 1;
 		}
 
@@ -855,6 +878,7 @@ variant variant::bind_closure(const game_logic::formula_callable* callable)
 	variant result;
 	result.type_ = VARIANT_TYPE_FUNCTION;
 	result.fn_ = new variant_fn(*fn_);
+	++nallocations;
 	result.fn_->refcount = 1;
 	result.fn_->callable.reset(callable);
 	return result;
@@ -1395,6 +1419,7 @@ void variant::make_unique()
 	case VARIANT_TYPE_LIST: {
 		list_->refcount--;
 		list_ = new variant_list(*list_);
+		++nallocations;
 		foreach(variant& v, list_->elements) {
 			v.make_unique();
 		}
@@ -1403,6 +1428,7 @@ void variant::make_unique()
 	case VARIANT_TYPE_STRING:
 		string_->refcount--;
 		string_ = new variant_string(*string_);
+		++nallocations;
 		string_->refcount = 1;
 		break;
 	case VARIANT_TYPE_MAP: {
@@ -1418,6 +1444,7 @@ void variant::make_unique()
 		map_->refcount--;
 
 		variant_map* vm = new variant_map;
+		++nallocations;
 		vm->info = map_->info;
 		vm->refcount = 1;
 		vm->elements.swap(m);
@@ -1833,7 +1860,7 @@ UNIT_TEST(variant_decimal)
 	CHECK_EQ((d + d2).as_decimal().value(), 9880000);
 }
 
-BENCHMARK(variant_assign)
+BENCHMARK_TAGGED(variant_assign, "formula")
 {
 	variant v(4);
 	std::vector<variant> vec(1000);
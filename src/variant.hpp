@@ -28,6 +28,10 @@ std::string get_full_call_stack();
 
 const std::vector<const game_logic::formula_expression*>& get_expression_call_stack();
 
+//how many lists, maps, strings and functions have been allocated for
+//variants on this thread, so the profiler can tell what FFL allocates.
+int get_variant_allocations();
+
 struct call_stack_manager {
 	explicit call_stack_manager(const game_logic::formula_expression* str) {
 		push_call_stack(str);
@@ -0,0 +1,119 @@
+#include <stdio.h>
+
+#include "unit_test.hpp"
+#include "xxhash64.hpp"
+
+namespace xxhash64 {
+
+namespace {
+const uint64_t Prime1 = 11400714785074694791ULL;
+const uint64_t Prime2 = 14029467366897019727ULL;
+const uint64_t Prime3 = 1609587929392839161ULL;
+const uint64_t Prime4 = 9650029242287828579ULL;
+const uint64_t Prime5 = 2870177450012600261ULL;
+
+inline uint64_t rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+//input is read as little endian whatever the machine is. On little endian
+//machines the compiler turns these into single loads.
+inline uint64_t read64(const unsigned char* p)
+{
+	return uint64_t(p[0]) | (uint64_t(p[1]) << 8) | (uint64_t(p[2]) << 16) | (uint64_t(p[3]) << 24) |
+	       (uint64_t(p[4]) << 32) | (uint64_t(p[5]) << 40) | (uint64_t(p[6]) << 48) | (uint64_t(p[7]) << 56);
+}
+
+inline uint64_t read32(const unsigned char* p)
+{
+	return uint64_t(p[0]) | (uint64_t(p[1]) << 8) | (uint64_t(p[2]) << 16) | (uint64_t(p[3]) << 24);
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input)
+{
+	acc += input*Prime2;
+	acc = rotl(acc, 31);
+	return acc*Prime1;
+}
+
+inline uint64_t merge_round(uint64_t acc, uint64_t value)
+{
+	acc ^= round(0, value);
+	return acc*Prime1 + Prime4;
+}
+}
+
+uint64_t hash(const char* data, size_t len, uint64_t seed)
+{
+	const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+	const unsigned char* end = p + len;
+
+	uint64_t h;
+	if(len >= 32) {
+		uint64_t v1 = seed + Prime1 + Prime2;
+		uint64_t v2 = seed + Prime2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - Prime1;
+
+		const unsigned char* limit = end - 32;
+		do {
+			v1 = round(v1, read64(p));
+			v2 = round(v2, read64(p + 8));
+			v3 = round(v3, read64(p + 16));
+			v4 = round(v4, read64(p + 24));
+			p += 32;
+		} while(p <= limit);
+
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = merge_round(h, v1);
+		h = merge_round(h, v2);
+		h = merge_round(h, v3);
+		h = merge_round(h, v4);
+	} else {
+		h = seed + Prime5;
+	}
+
+	h += len;
+
+	while(p + 8 <= end) {
+		h ^= round(0, read64(p));
+		h = rotl(h, 27)*Prime1 + Prime4;
+		p += 8;
+	}
+
+	if(p + 4 <= end) {
+		h ^= read32(p)*Prime1;
+		h = rotl(h, 23)*Prime2 + Prime3;
+		p += 4;
+	}
+
+	while(p < end) {
+		h ^= (*p)*Prime5;
+		h = rotl(h, 11)*Prime1;
+		++p;
+	}
+
+	h ^= h >> 33;
+	h *= Prime2;
+	h ^= h >> 29;
+	h *= Prime3;
+	h ^= h >> 32;
+	return h;
+}
+
+std::string sum(const std::string& data)
+{
+	const uint64_t h = hash(data.data(), data.size());
+	char buf[32];
+	sprintf(buf, "%08x%08x", static_cast<unsigned int>(h >> 32), static_cast<unsigned int>(h & 0xFFFFFFFF));
+	return buf;
+}
+
+}
+
+UNIT_TEST(xxhash64) {
+	CHECK_EQ(xxhash64::sum(""), "ef46db3751d8e999");
+	CHECK_EQ(xxhash64::sum("abc"), "44bc2cf5ad770999");
+	CHECK_EQ(xxhash64::sum("Nobody inspects the spammish repetition"), "fbcea83c8a378bf1");
+}
@@ -0,0 +1,19 @@
+#ifndef XXHASH64_HPP_INCLUDED
+#define XXHASH64_HPP_INCLUDED
+
+#include <boost/cstdint.hpp>
+
+#include <string>
+
+//The 64 bit xxHash, a non-cryptographic hash several times faster than
+//md5, for checking that files haven't changed.
+namespace xxhash64 {
+
+uint64_t hash(const char* data, size_t len, uint64_t seed=0);
+
+//the hash of data as 16 hex digits.
+std::string sum(const std::string& data);
+
+}
+
+#endif